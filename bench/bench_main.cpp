@@ -0,0 +1,358 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "game_state.hpp"
+#include "level_geometry.hpp"
+#include "logger.hpp"
+#include "ppm_writer.hpp"
+#include "software_renderer.hpp"
+#include "wad.hpp"
+#include "wad_generator.hpp"
+
+// Benchmarks of the paths that load and use the WADs: opening them, looking lumps up, parsing every kind
+// of level lump, decoding sprites, palette conversion and PPM export, BSP, blockmap and sight queries and
+// software rendered frames. Every WAD given with --wad (doom1.wad by default) gets its own set, e.g., the
+// shipped shareware IWAD and large generated PWADs, the queries and frames use its first level. Every
+// --synthetic PRESET (small, lines, sectors, sprites or textures) generates synthetic_PRESET.wad first and
+// adds it to them, to see how things scale up to the limits of the format.
+//
+// doomfs_bench [--wad FILE]... [--synthetic PRESET]... [--filter TEXT] [--min_time SECONDS] [--json FILE]
+
+// Points spread over the bounds of the level, always the same ones so runs can be compared
+std::vector<std::pair<double, double>> level_points(const WADLevel & crLevel, size_t count)
+{
+	double min_x_ = 0.0, max_x_ = 0.0, min_y_ = 0.0, max_y_ = 0.0;
+
+	for (size_t i = 0; i < crLevel.vertices.size(); ++i)
+	{
+		const WADLevelVertex & crVertex = crLevel.vertices[i];
+		min_x_ = (i == 0) ? crVertex.x : std::min<double>(min_x_, crVertex.x);
+		max_x_ = (i == 0) ? crVertex.x : std::max<double>(max_x_, crVertex.x);
+		min_y_ = (i == 0) ? crVertex.y : std::min<double>(min_y_, crVertex.y);
+		max_y_ = (i == 0) ? crVertex.y : std::max<double>(max_y_, crVertex.y);
+	}
+
+	std::mt19937 random_(1993);
+	std::uniform_real_distribution<double> x_(min_x_, max_x_);
+	std::uniform_real_distribution<double> y_(min_y_, max_y_);
+
+	std::vector<std::pair<double, double>> points_(count);
+	for (auto & rPoint : points_)
+		rPoint = { x_(random_), y_(random_) };
+
+	return points_;
+}
+
+// Everything the benchmarks of one WAD share, only loaded when one of them runs
+struct WADFixture
+{
+	std::string m_filename;
+	std::unique_ptr<WAD> m_wad;
+	WADLevel m_level;
+
+	WAD & wad()
+	{
+		if (!m_wad)
+		{
+			m_wad = std::make_unique<WAD>(m_filename, false);
+
+			if (m_wad->level_names().empty())
+				throw std::runtime_error("Failed to benchmark " + m_filename + ", it has no levels!");
+
+			m_level = m_wad->level(m_wad->level_names().front());
+		}
+
+		return *m_wad;
+	}
+
+	const WADLevel & level()
+	{
+		wad();
+		return m_level;
+	}
+};
+
+void add_wad_benchmarks(BenchmarkRunner & rRunner, const std::string & crFilename)
+{
+	auto fixture_ = std::make_shared<WADFixture>();
+	fixture_->m_filename = crFilename;
+
+	std::string suffix_ = "/" + crFilename.substr(crFilename.find_last_of('/') + 1);
+
+	rRunner.add("wad_open" + suffix_, [crFilename](BenchmarkState & rState) {
+		std::ifstream file_(crFilename, std::ios::binary | std::ios::ate);
+		uint64_t size_ = file_ ? (uint64_t)file_.tellg() : 0;
+
+		while (rState.keep_running())
+			WAD wad_(crFilename, false);
+
+		rState.set_bytes_processed(size_ * rState.iterations());
+	});
+
+	rRunner.add("lump_lookup" + suffix_, [fixture_](BenchmarkState & rState) {
+		const WAD & crWad = fixture_->wad();
+
+		while (rState.keep_running())
+			for (const WADEntry & crEntry : crWad.directory())
+				do_not_optimize(crWad.find_lump(crEntry.name));
+
+		rState.set_items_processed(crWad.directory().size() * rState.iterations());
+		rState.set_label(std::to_string(crWad.directory().size()) + " lumps");
+	});
+
+	// Each kind of level lump over all the levels, in MB/s of lump data
+	for (const char * pLump : { "THINGS", "LINEDEFS", "SIDEDEFS", "VERTEXES", "SEGS", "SSECTORS", "NODES", "SECTORS", "REJECT", "BLOCKMAP" })
+	{
+		std::string lump_ = pLump;
+
+		rRunner.add("level_parse/" + lump_ + suffix_, [fixture_, lump_](BenchmarkState & rState) {
+			WAD & rWad = fixture_->wad();
+			std::vector<WADEntry> lumps_;
+
+			// REJECT is sized by the sectors of its level, they are read once up front and lent to every parse
+			std::vector<std::vector<WADLevelSector>> sectors_;
+
+			for (const std::string & crLevel : rWad.level_names())
+			{
+				std::vector<WADEntry> level_lumps_ = rWad.level_lumps(crLevel);
+
+				for (const WADEntry & crEntry : level_lumps_)
+				{
+					if (crEntry.name != lump_)
+						continue;
+
+					lumps_.push_back(crEntry);
+					sectors_.emplace_back();
+
+					if (lump_ != "REJECT")
+						continue;
+
+					WADLevel level_;
+
+					for (const WADEntry & crSectors : level_lumps_)
+						if (crSectors.name == "SECTORS")
+							rWad.read_level_lump(level_, crSectors);
+
+					sectors_.back() = std::move(level_.sectors);
+				}
+			}
+
+			uint64_t bytes_ = 0;
+
+			while (rState.keep_running())
+			{
+				for (size_t i = 0; i < lumps_.size(); ++i)
+				{
+					WADLevel level_;
+					level_.sectors.swap(sectors_[i]);
+					rWad.read_level_lump(level_, lumps_[i]);
+					do_not_optimize(level_);
+					level_.sectors.swap(sectors_[i]);
+					bytes_ += lumps_[i].size;
+				}
+			}
+
+			rState.set_bytes_processed(bytes_);
+			rState.set_items_processed(lumps_.size() * rState.iterations());
+		});
+	}
+
+	rRunner.add("sprite_decode" + suffix_, [fixture_](BenchmarkState & rState) {
+		WAD & rWad = fixture_->wad();
+		std::vector<WADEntry> lumps_;
+
+		for (const auto & crSprite : rWad.sprites())
+			lumps_.push_back(*rWad.find_lump(crSprite.first));
+
+		uint64_t bytes_ = 0;
+
+		while (rState.keep_running())
+		{
+			for (const WADEntry & crEntry : lumps_)
+			{
+				do_not_optimize(rWad.decode_picture(crEntry).posts.size());
+				bytes_ += crEntry.size;
+			}
+		}
+
+		rState.set_bytes_processed(bytes_);
+		rState.set_items_processed(lumps_.size() * rState.iterations());
+	});
+
+	// A few thousand random points, the BSP walk finds their subsectors and the blockmap whether the
+	// player fits there
+	rRunner.add("bsp_point_in_subsector" + suffix_, [fixture_](BenchmarkState & rState) {
+		const WADLevel & crLevel = fixture_->level();
+		std::vector<std::pair<double, double>> points_ = level_points(crLevel, 4096);
+
+		while (rState.keep_running())
+			for (const auto & crPoint : points_)
+				do_not_optimize(point_in_subsector(crLevel, crPoint.first, crPoint.second));
+
+		rState.set_items_processed(points_.size() * rState.iterations());
+		rState.set_label(crLevel.name);
+	});
+
+	rRunner.add("blockmap_check_position" + suffix_, [fixture_](BenchmarkState & rState) {
+		const WADLevel & crLevel = fixture_->level();
+		std::vector<std::pair<double, double>> points_ = level_points(crLevel, 4096);
+
+		GameState state_;
+		start_level(state_, crLevel);
+
+		if (!state_.m_mobjs.alive(state_.m_player_mobj))
+			throw std::runtime_error("Failed to benchmark the blockmap, " + crLevel.name + " has no player start!");
+
+		while (rState.keep_running())
+			for (const auto & crPoint : points_)
+				do_not_optimize(state_.m_collision.check_position(state_.m_mobjs, state_.m_player_mobj, Fixed::from_float(crPoint.first), Fixed::from_float(crPoint.second)));
+
+		rState.set_items_processed(points_.size() * rState.iterations());
+		rState.set_label(crLevel.name);
+	});
+
+	// Every monster of the level checks whether it sees the player, and the player shoots all around
+	rRunner.add("sight_monsters_see_player" + suffix_, [fixture_](BenchmarkState & rState) {
+		const WADLevel & crLevel = fixture_->level();
+
+		GameState state_;
+		start_level(state_, crLevel);
+
+		std::vector<Handle> monsters_;
+		std::vector<uint8_t> visible_;
+
+		while (rState.keep_running())
+			monsters_see_player(state_, monsters_, visible_);
+
+		rState.set_items_processed(monsters_.size() * rState.iterations());
+		rState.set_label(crLevel.name + " " + std::to_string(monsters_.size()) + " monsters");
+	});
+
+	rRunner.add("hitscan_trace_line" + suffix_, [fixture_](BenchmarkState & rState) {
+		const WADLevel & crLevel = fixture_->level();
+
+		GameState state_;
+		start_level(state_, crLevel);
+
+		if (!state_.m_mobjs.alive(state_.m_player_mobj))
+			throw std::runtime_error("Failed to benchmark hitscans, " + crLevel.name + " has no player start!");
+
+		while (rState.keep_running())
+			for (unsigned int a = 0; a < 256; ++a)
+				do_not_optimize(state_.m_sight.trace_line(state_.m_collision, state_.m_mobjs, state_.m_player_mobj, BAM::from_raw(a << 24), kMissileRange, Fixed()));
+
+		rState.set_items_processed(256 * rState.iterations());
+		rState.set_label(crLevel.name);
+	});
+
+	// Frames turning around at the player start, with one thread per hardware thread
+	for (const auto & crSize : std::vector<std::pair<unsigned int, unsigned int>> { { 320, 200 }, { 1280, 800 } })
+	{
+		std::string size_ = std::to_string(crSize.first) + "x" + std::to_string(crSize.second);
+
+		rRunner.add("software_frame/" + size_ + suffix_, [fixture_, crSize](BenchmarkState & rState) {
+			const WADLevel & crLevel = fixture_->level();
+			SoftwareRenderer renderer_(fixture_->wad(), crLevel, std::max(std::thread::hardware_concurrency(), 1u));
+			SoftwareFramebuffer framebuffer_(crSize.first, crSize.second);
+			RenderView view_ = renderer_.start_view();
+			unsigned int frame_ = 0;
+
+			while (rState.keep_running())
+			{
+				view_.m_angle = (frame_++ % 64) * kPi / 32.0f;
+				renderer_.render(view_, framebuffer_);
+			}
+
+			rState.set_items_processed(rState.iterations());
+			rState.set_label(crLevel.name + " " + std::to_string(renderer_.threads()) + " threads " + column_kernel_name(renderer_.column_kernel()));
+		});
+	}
+}
+
+// Conversions that do not depend on the contents of the WAD, with the palette of the first one
+void add_image_benchmarks(BenchmarkRunner & rRunner, const std::string & crFilename)
+{
+	auto palette_ = std::make_shared<std::vector<WADPaletteColor>>();
+
+	auto framebuffer_ = [palette_, crFilename](unsigned int width, unsigned int height) {
+		if (palette_->empty())
+			*palette_ = WAD(crFilename, false).palettes()[0];
+
+		SoftwareFramebuffer framebuffer_(width, height);
+		for (size_t i = 0; i < framebuffer_.m_pixels.size(); ++i)
+			framebuffer_.m_pixels[i] = (uint8_t)(i * 7);
+
+		return framebuffer_;
+	};
+
+	rRunner.add("palette_to_rgb/320x200", [palette_, framebuffer_](BenchmarkState & rState) {
+		SoftwareFramebuffer indexed_ = framebuffer_(320, 200);
+
+		while (rState.keep_running())
+			do_not_optimize(indexed_.to_rgb(*palette_).data());
+
+		rState.set_items_processed(indexed_.m_pixels.size() * rState.iterations());
+		rState.set_bytes_processed(indexed_.m_pixels.size() * 3 * rState.iterations());
+	});
+
+	rRunner.add("ppm_export/320x200", [palette_, framebuffer_](BenchmarkState & rState) {
+		std::vector<WADPaletteColor> rgb_ = framebuffer_(320, 200).to_rgb(*palette_);
+		PPMWriter writer_;
+
+		while (rState.keep_running())
+			writer_.write<WADPaletteColor>(rgb_, 200, 320, "doomfs_bench.ppm", true);
+
+		std::remove("doomfs_bench.ppm");
+		rState.set_bytes_processed(rgb_.size() * 3 * rState.iterations());
+	});
+}
+
+int main(int argc, char** argv)
+{
+	// The loaders log every lump they read, which would flood the results and time the sink thread too
+	Logger::instance().set_level(LogLevel::Warning);
+
+	BenchmarkRunner runner_;
+	std::vector<std::string> wad_filenames_;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg_ = argv[i];
+
+		if (runner_.parse_argument(argc, argv, i))
+			continue;
+		else if (arg_ == "--wad" && i + 1 < argc)
+			wad_filenames_.push_back(argv[++i]);
+		else if (arg_ == "--synthetic" && i + 1 < argc)
+		{
+			std::string preset_ = argv[++i];
+			wad_filenames_.push_back("synthetic_" + preset_ + ".wad");
+			generate_wad(synthetic_preset(preset_), wad_filenames_.back());
+		}
+		else
+			std::cerr << "WARNING: Ignoring unknown argument " << arg_ << "\n";
+	}
+
+	if (wad_filenames_.empty())
+		wad_filenames_.push_back("doom1.wad");
+
+	std::string wads_;
+	for (const std::string & crFilename : wad_filenames_)
+	{
+		add_wad_benchmarks(runner_, crFilename);
+		wads_ += (wads_.empty() ? "" : " ") + crFilename;
+	}
+
+	add_image_benchmarks(runner_, wad_filenames_.front());
+	runner_.add_context("wads", wads_);
+
+	runner_.run();
+
+	return 0;
+}
@@ -0,0 +1,421 @@
+#ifndef BENCHMARK_HPP_
+#define BENCHMARK_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+// A small harness in the spirit of Google Benchmark, without the dependency. Every benchmark is a function
+// that loops while keep_running() says so, the harness grows the number of iterations until a run lasts
+// at least the minimum time and reports the time per iteration of that last run, plus the throughput when
+// the benchmark says how many bytes or items it processed. Results go to the console and, for comparing
+// runs, to a JSON file in the same layout Google Benchmark writes (so its compare tools read it too).
+
+// Keeps the compiler from optimizing away a result nothing else reads
+template <typename T>
+inline void do_not_optimize(const T & crValue)
+{
+  asm volatile("" : : "r,m"(crValue) : "memory");
+}
+
+class BenchmarkState
+{
+  public:
+
+    BenchmarkState(uint64_t iterations)
+      : m_iterations(iterations), m_remaining(iterations)
+    {
+
+    }
+
+    bool keep_running()
+    {
+      if (!m_started)
+      {
+        m_started = true;
+        resume_timing();
+      }
+
+      if (m_remaining == 0)
+      {
+        pause_timing();
+        return false;
+      }
+
+      --m_remaining;
+      return true;
+    }
+
+    // Setup inside the loop that should not count
+    void pause_timing()
+    {
+      m_real_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_real_start).count();
+      m_cpu_seconds += cpu_seconds() - m_cpu_start;
+    }
+
+    void resume_timing()
+    {
+      m_real_start = std::chrono::steady_clock::now();
+      m_cpu_start = cpu_seconds();
+    }
+
+    // Totals for all the iterations
+    void set_bytes_processed(uint64_t bytes)
+    {
+      m_bytes = bytes;
+    }
+
+    void set_items_processed(uint64_t items)
+    {
+      m_items = items;
+    }
+
+    void set_label(const std::string & crLabel)
+    {
+      m_label = crLabel;
+    }
+
+    uint64_t iterations() const
+    {
+      return m_iterations;
+    }
+
+    double real_seconds() const
+    {
+      return m_real_seconds;
+    }
+
+    double cpu_seconds_used() const
+    {
+      return m_cpu_seconds;
+    }
+
+    uint64_t bytes() const
+    {
+      return m_bytes;
+    }
+
+    uint64_t items() const
+    {
+      return m_items;
+    }
+
+    const std::string & label() const
+    {
+      return m_label;
+    }
+
+  private:
+
+    // CPU time of the whole process, benchmarks with worker threads (e.g., the renderer) add theirs
+    static double cpu_seconds()
+    {
+      timespec time_;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_);
+      return time_.tv_sec + time_.tv_nsec * 1e-9;
+    }
+
+    uint64_t m_iterations;
+    uint64_t m_remaining;
+    bool m_started = false;
+
+    std::chrono::steady_clock::time_point m_real_start;
+    double m_real_seconds = 0.0;
+    double m_cpu_start = 0.0;
+    double m_cpu_seconds = 0.0;
+
+    uint64_t m_bytes = 0;
+    uint64_t m_items = 0;
+    std::string m_label;
+};
+
+struct BenchmarkResult
+{
+  std::string m_name;
+  uint64_t m_iterations;
+
+  // Nanoseconds per iteration
+  double m_real_time;
+  double m_cpu_time;
+
+  // Per second of real time, 0 when not given
+  double m_bytes_per_second;
+  double m_items_per_second;
+  std::string m_label;
+};
+
+class BenchmarkRunner
+{
+  public:
+
+    typedef std::function<void(BenchmarkState &)> Function;
+
+    // Benchmarks run in the order they are added
+    void add(const std::string & crName, Function function)
+    {
+      m_benchmarks.push_back({ crName, function });
+    }
+
+    // Extra key and value for the context of the JSON results, e.g., the WADs used
+    void add_context(const std::string & crKey, const std::string & crValue)
+    {
+      m_context.push_back({ crKey, crValue });
+    }
+
+    // --filter TEXT only runs the benchmarks whose names contain it, --min_time SECONDS sets how long
+    // each one runs at least (0.5 by default) and --json FILE writes the results there
+    bool parse_argument(int argc, char ** argv, int & rIndex)
+    {
+      std::string arg_ = argv[rIndex];
+
+      if (arg_ == "--filter" && rIndex + 1 < argc)
+        m_filter = argv[++rIndex];
+      else if (arg_ == "--min_time" && rIndex + 1 < argc)
+        m_min_time = std::stod(argv[++rIndex]);
+      else if (arg_ == "--json" && rIndex + 1 < argc)
+        m_json_filename = argv[++rIndex];
+      else
+        return false;
+
+      return true;
+    }
+
+    void run()
+    {
+      std::cout << std::left << std::setw(48) << "Benchmark" << std::right
+                << std::setw(14) << "Time" << std::setw(14) << "CPU" << std::setw(12) << "Iterations" << "\n";
+      std::cout << std::string(108, '-') << "\n";
+
+      for (const Benchmark & crBenchmark : m_benchmarks)
+      {
+        if (crBenchmark.m_name.find(m_filter) == std::string::npos)
+          continue;
+
+        try
+        {
+          BenchmarkResult result_ = measure(crBenchmark);
+          print(result_);
+          m_results.push_back(result_);
+        }
+        catch (const std::exception & crError)
+        {
+          std::cerr << "ERROR: " << crBenchmark.m_name << ": " << crError.what() << "\n";
+        }
+      }
+
+      if (!m_json_filename.empty())
+        write_json();
+    }
+
+  private:
+
+    struct Benchmark
+    {
+      std::string m_name;
+      Function m_function;
+    };
+
+    struct SilencedOutput
+    {
+      SilencedOutput()
+        : m_output(std::cout.rdbuf(nullptr))
+      {
+
+      }
+
+      ~SilencedOutput()
+      {
+        std::cout.rdbuf(m_output);
+      }
+
+      std::streambuf * m_output;
+    };
+
+    // Same growth as Google Benchmark, aim a bit above the minimum time from the last run, at most 10x more
+    BenchmarkResult measure(const Benchmark & crBenchmark)
+    {
+      uint64_t iterations_ = 1;
+
+      while (true)
+      {
+        BenchmarkState state_(iterations_);
+
+        // The code measured reports its progress on std::cout, it is silenced while it runs
+        {
+          SilencedOutput silenced_;
+          crBenchmark.m_function(state_);
+        }
+
+        double seconds_ = state_.real_seconds();
+
+        if (seconds_ >= m_min_time || iterations_ >= kMaxIterations)
+        {
+          BenchmarkResult result_;
+          result_.m_name = crBenchmark.m_name;
+          result_.m_iterations = iterations_;
+          result_.m_real_time = seconds_ * 1e9 / iterations_;
+          result_.m_cpu_time = state_.cpu_seconds_used() * 1e9 / iterations_;
+          result_.m_bytes_per_second = (seconds_ > 0.0) ? state_.bytes() / seconds_ : 0.0;
+          result_.m_items_per_second = (seconds_ > 0.0) ? state_.items() / seconds_ : 0.0;
+          result_.m_label = state_.label();
+          return result_;
+        }
+
+        double multiplier_ = (seconds_ > 0.0) ? std::min(10.0, m_min_time * 1.4 / seconds_) : 10.0;
+        iterations_ = std::min<uint64_t>(kMaxIterations, std::max<uint64_t>(iterations_ + 1, iterations_ * multiplier_));
+      }
+    }
+
+    static std::string format_time(double nanoseconds)
+    {
+      std::ostringstream text_;
+      text_ << std::fixed << std::setprecision(nanoseconds < 10000.0 ? 1 : 0);
+
+      if (nanoseconds < 1e4)
+        text_ << nanoseconds << " ns";
+      else if (nanoseconds < 1e7)
+        text_ << nanoseconds / 1e3 << " us";
+      else
+        text_ << nanoseconds / 1e6 << " ms";
+
+      return text_.str();
+    }
+
+    // With the k, M or G prefix that keeps it below the base
+    static std::string format_rate(double rate, double base)
+    {
+      const char * kPrefixes[] = { "", "k", "M", "G", "T" };
+      unsigned int prefix_ = 0;
+
+      while (rate >= base && prefix_ < 4)
+      {
+        rate /= base;
+        ++prefix_;
+      }
+
+      std::ostringstream text_;
+      text_ << std::fixed << std::setprecision(1) << rate << (base == 1024.0 ? " " : "") << kPrefixes[prefix_];
+      return text_.str();
+    }
+
+    void print(const BenchmarkResult & crResult)
+    {
+      std::cout << std::left << std::setw(48) << crResult.m_name << std::right
+                << std::setw(14) << format_time(crResult.m_real_time)
+                << std::setw(14) << format_time(crResult.m_cpu_time)
+                << std::setw(12) << crResult.m_iterations;
+
+      // Rates and labels go after the columns, like Google Benchmark's user counters
+
+      if (crResult.m_bytes_per_second > 0.0)
+        std::cout << " " << format_rate(crResult.m_bytes_per_second, 1024.0) << "B/s";
+
+      if (crResult.m_items_per_second > 0.0)
+        std::cout << " " << format_rate(crResult.m_items_per_second, 1000.0) << " items/s";
+
+      if (!crResult.m_label.empty())
+        std::cout << " " << crResult.m_label;
+
+      std::cout << std::defaultfloat << "\n";
+    }
+
+    static std::string quote(const std::string & crText)
+    {
+      std::string quoted_ = "\"";
+
+      for (char c : crText)
+      {
+        if (c == '"' || c == '\\')
+          quoted_ += '\\';
+        quoted_ += c;
+      }
+
+      return quoted_ + "\"";
+    }
+
+    void write_json()
+    {
+      std::ofstream file_(m_json_filename);
+
+      if (!file_)
+        throw std::runtime_error("Failed to write benchmark results to " + m_json_filename + "!");
+
+      char date_[64];
+      time_t now_ = time(nullptr);
+      strftime(date_, sizeof(date_), "%Y-%m-%dT%H:%M:%S%z", localtime(&now_));
+
+      char host_[256] = {};
+      gethostname(host_, sizeof(host_) - 1);
+
+      file_ << std::setprecision(10);
+      file_ << "{\n  \"context\": {\n"
+            << "    \"date\": " << quote(date_) << ",\n"
+            << "    \"host_name\": " << quote(host_) << ",\n"
+            << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+#ifdef NDEBUG
+            << "    \"library_build_type\": \"release\",\n"
+#else
+            << "    \"library_build_type\": \"debug\",\n"
+#endif
+            << "    \"min_time\": " << m_min_time;
+
+      for (const auto & crContext : m_context)
+        file_ << ",\n    " << quote(crContext.first) << ": " << quote(crContext.second);
+
+      file_ << "\n  },\n  \"benchmarks\": [";
+
+      for (size_t i = 0; i < m_results.size(); ++i)
+      {
+        const BenchmarkResult & crResult = m_results[i];
+
+        file_ << ((i == 0) ? "\n" : ",\n")
+              << "    {\n"
+              << "      \"name\": " << quote(crResult.m_name) << ",\n"
+              << "      \"run_name\": " << quote(crResult.m_name) << ",\n"
+              << "      \"run_type\": \"iteration\",\n"
+              << "      \"iterations\": " << crResult.m_iterations << ",\n"
+              << "      \"real_time\": " << crResult.m_real_time << ",\n"
+              << "      \"cpu_time\": " << crResult.m_cpu_time << ",\n"
+              << "      \"time_unit\": \"ns\"";
+
+        if (crResult.m_bytes_per_second > 0.0)
+          file_ << ",\n      \"bytes_per_second\": " << crResult.m_bytes_per_second;
+
+        if (crResult.m_items_per_second > 0.0)
+          file_ << ",\n      \"items_per_second\": " << crResult.m_items_per_second;
+
+        if (!crResult.m_label.empty())
+          file_ << ",\n      \"label\": " << quote(crResult.m_label);
+
+        file_ << "\n    }";
+      }
+
+      file_ << "\n  ]\n}\n";
+
+      std::cout << "Wrote " << m_results.size() << " results to " << m_json_filename << "\n";
+    }
+
+    static constexpr uint64_t kMaxIterations = 1000000000;
+
+    std::vector<Benchmark> m_benchmarks;
+    std::vector<std::pair<std::string, std::string>> m_context;
+    std::vector<BenchmarkResult> m_results;
+
+    std::string m_filter;
+    double m_min_time = 0.5;
+    std::string m_json_filename;
+};
+
+#endif
@@ -1,17 +1,80 @@
 #ifndef APPLICATION_HPP_
 #define APPLICATION_HPP_
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <string.h>
+#include <thread>
 #include <vector>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "demo.hpp"
+#include "game_loop.hpp"
+#include "level_cache.hpp"
+#include "level_mesh.hpp"
+#include "logger.hpp"
+#include "mus.hpp"
+#include "ppm_writer.hpp"
+#include "profiler.hpp"
+#include "software_renderer.hpp"
 #include "vertex.hpp"
 #include "vulkan_application.hpp"
+#include "wad.hpp"
+
+struct ApplicationOptions
+{
+  unsigned int m_width = 800;
+  unsigned int m_height = 600;
+
+  // Headless mode renders a fixed number of frames offscreen, without any window
+  bool m_headless = false;
+  unsigned int m_frames = 600;
+  unsigned int m_capture_interval = 0;
+  std::string m_capture_prefix = "frame";
+
+  // When a level is given it is rendered instead of the test quad. The PWADs are mounted over the IWAD
+  // in order, each overriding the lumps and levels of the ones before
+  std::string m_wad_filename = "doom1.wad";
+  std::vector<std::string> m_pwad_filenames;
+
+  // Parsed levels are kept in this directory and loaded from there the next time, empty disables it
+  std::string m_level_cache_directory;
+  std::string m_level_name;
+
+  // Converts the music of the WADs to MIDI files in this directory instead of running, empty disables it
+  std::string m_music_directory;
+
+  // The software renderer draws the level on the CPU, it always runs headless. Threads split the screen
+  // in vertical strips, 0 uses one per hardware thread
+  bool m_software = false;
+  unsigned int m_software_threads = 0;
+
+  // The game runs at 35 tics per second while frames are drawn as fast as possible, optionally with the
+  // tics simulated in their own thread. Timedemo runs one tic per frame flat out instead of following the
+  // clock.
+  bool m_simulation_thread = false;
+  bool m_timedemo = false;
+
+  // Demo to play, a DEMO lump of the WADs or an .lmp file, on its own level unless one is given. Without
+  // rendering the software loop only simulates, e.g., to time the simulation alone. The results are also
+  // written as JSON to the benchmark file for tools that track them across builds.
+  std::string m_demo;
+  bool m_render = true;
+  std::string m_benchmark_filename;
+
+  // Chrome trace of the profiler zones, written at exit with a summary per frame. Only builds with
+  // DOOMFS_PROFILE record zones.
+  std::string m_profile_filename;
+
+  // JSON lines of the log events (e.g., every lump read with its count and duration) as load-time telemetry
+  std::string m_log_filename;
+};
 
 class Application
 {
@@ -22,50 +85,389 @@ class Application
       
     }
 
+    Application(const ApplicationOptions & crOptions)
+    {
+      m_options = crOptions;
+    }
+
     void run()
     {
+      if (!m_options.m_log_filename.empty())
+        Logger::instance().set_telemetry_file(m_options.m_log_filename);
+
+      if (!m_options.m_music_directory.empty())
+      {
+        export_music(WAD(wad_filenames()), m_options.m_music_directory);
+        return;
+      }
+
+      PROFILE_THREAD("main");
+
       init();
       loop();
+      write_profile();
       cleanup();
     }
 
   private:
 
+    // The IWAD and then the PWADs
+    std::vector<std::string> wad_filenames() const
+    {
+      std::vector<std::string> filenames_ { m_options.m_wad_filename };
+      filenames_.insert(filenames_.end(), m_options.m_pwad_filenames.begin(), m_options.m_pwad_filenames.end());
+      return filenames_;
+    }
+
+    void load_level()
+    {
+      PROFILE_ZONE("Application::load_level");
+
+      m_wad = std::make_unique<WAD>(wad_filenames());
+
+      if (!m_options.m_demo.empty())
+      {
+        m_demo = std::make_unique<Demo>(*m_wad, m_options.m_demo);
+
+        if (m_options.m_level_name.empty())
+          m_options.m_level_name = m_demo->level_name(*m_wad);
+
+        LOG_INFO("Playing demo", { { "demo", m_demo->name() }, { "tics", m_demo->tics() }, { "skill", m_demo->skill() },
+                                   { "level", m_options.m_level_name } });
+      }
+
+      if (m_options.m_level_cache_directory.empty())
+        m_level_data = m_wad->level(m_options.m_level_name);
+      else
+        m_level_data = LevelCache(m_options.m_level_cache_directory).level(*m_wad, m_options.m_level_name);
+
+      // The loaders log asynchronously, let them finish before the rest prints to the console
+      Logger::instance().flush();
+    }
+
     void init()
     {
       std::cout << "Application initialization...\n";
 
-      const int kWidth = 800;
-      const int kHeight = 600;
+      if (m_options.m_software)
+      {
+        if (m_options.m_level_name.empty() && m_options.m_demo.empty())
+          throw std::runtime_error("Failed to start the software renderer, no level given!");
+
+        unsigned int threads_ = m_options.m_software_threads;
+        if (threads_ == 0)
+          threads_ = std::max(std::thread::hardware_concurrency(), 1u);
+
+        load_level();
+
+        if (!m_options.m_render)
+          return;
+
+        m_software = std::make_unique<SoftwareRenderer>(*m_wad, m_level_data, threads_);
+        std::cout << "Software rendering with " << m_software->threads() << " threads and "
+                  << column_kernel_name(m_software->column_kernel()) << " column drawers\n";
+        return;
+      }
+
+      // Only the software loop runs the game, Vulkan draws the level without simulating it
+      if (!m_options.m_demo.empty() || !m_options.m_render || !m_options.m_benchmark_filename.empty() ||
+          m_options.m_simulation_thread || m_options.m_timedemo)
+        throw std::runtime_error("Failed to start the Vulkan renderer, -playdemo, -norender, -benchmark, -simthread and -timedemo need -software!");
+
+      if (!m_options.m_level_name.empty())
+      {
+        load_level();
+        m_level = std::make_shared<LevelMesh>(*m_wad, m_level_data);
+      }
+
+      if (m_options.m_headless)
+      {
+        m_vulkan = std::make_unique<VulkanApplication>(m_options.m_width,
+                                                       m_options.m_height,
+                                                       m_options.m_capture_interval,
+                                                       m_options.m_capture_prefix,
+                                                       m_level);
+        return;
+      }
 
       glfwInit();
       glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
       glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-      m_window = std::make_shared<GLFWwindow*>(glfwCreateWindow(800, 600, "Vulkan", nullptr, nullptr));
+      m_window = std::make_shared<GLFWwindow*>(glfwCreateWindow(m_options.m_width, m_options.m_height, "Vulkan", nullptr, nullptr));
 
-      m_vulkan = std::make_unique<VulkanApplication>(m_window);
+      m_vulkan = std::make_unique<VulkanApplication>(m_window, m_level);
     }
 
     void loop()
     {
       std::cout << "Application loop...\n";
 
+        if (m_options.m_software)
+        {
+            software_loop();
+            return;
+        }
+
+        if (m_options.m_headless)
+        {
+            headless_loop();
+            return;
+        }
+
         while (!glfwWindowShouldClose(*m_window))
         {
             glfwPollEvents();
             m_vulkan->draw_frame();
+            PROFILE_FRAME();
         }
 
         m_vulkan->wait_device();
     }
 
+    void headless_loop()
+    {
+        std::vector<double> frame_times_;
+        frame_times_.reserve(m_options.m_frames);
+
+        auto start_ = std::chrono::steady_clock::now();
+
+        for (unsigned int i = 0; i < m_options.m_frames; ++i)
+        {
+            auto frame_start_ = std::chrono::steady_clock::now();
+            m_vulkan->draw_frame();
+            PROFILE_FRAME();
+            frame_times_.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start_).count());
+        }
+
+        m_vulkan->wait_device();
+
+        double total_ms_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+        print_frame_stats(frame_times_, total_ms_);
+    }
+
+    void software_loop()
+    {
+        SoftwareFramebuffer framebuffer_(m_options.m_width, m_options.m_height);
+        PPMWriter writer_;
+
+        GameState initial_;
+        start_level(initial_, m_level_data, m_demo ? m_demo->skill() : kDefaultSkill);
+
+        // A demo plays its commands, otherwise spin in place at the player start, 30 degrees per second
+        GameLoop::CommandSource source_ = [](uint32_t) { return TicCmd{ 0, 0, 156, 0 }; };
+
+        if (m_demo)
+        {
+            const Demo & crDemo = *m_demo;
+            source_ = [&crDemo](uint32_t tic) { return crDemo.command(tic); };
+        }
+
+        GameLoop game_(initial_, source_, m_options.m_simulation_thread);
+
+        // A demo runs until its last tic, otherwise for the frames asked for
+        auto finished_ = [&](unsigned int frame) {
+            return m_demo ? game_.tic() >= m_demo->tics() : frame >= m_options.m_frames;
+        };
+
+        std::vector<double> frame_times_;
+        frame_times_.reserve(m_demo ? m_demo->tics() : m_options.m_frames);
+
+        SubsystemTimes subsystems_;
+        auto start_ = std::chrono::steady_clock::now();
+
+        for (unsigned int i = 0; !finished_(i); ++i)
+        {
+            auto frame_start_ = std::chrono::steady_clock::now();
+
+            // The frame shows the last tic interpolated towards the clock, or every tic as it is in a timedemo
+            uint32_t tic_ = game_.tic() + 1;
+            float alpha_ = 1.0f;
+
+            if (!m_options.m_timedemo)
+            {
+                double tics_ = std::chrono::duration<double>(frame_start_ - start_).count() * kTicRate;
+                tic_ = (uint32_t)tics_;
+                alpha_ = (float)(tics_ - tic_);
+            }
+
+            if (m_demo)
+                tic_ = std::min(tic_, m_demo->tics());
+
+            game_.begin_tics(tic_);
+
+            if (m_software)
+            {
+                auto render_start_ = std::chrono::steady_clock::now();
+
+                PlayerState player_ = game_.interpolated_player(alpha_);
+                RenderView view_ = { player_.m_x.to_float(), player_.m_y.to_float(), player_.m_z.to_float(), player_.m_angle.to_radians() };
+                m_software->render(view_, framebuffer_);
+
+                subsystems_.m_render_ms += elapsed_ms(render_start_);
+            }
+
+            auto wait_start_ = std::chrono::steady_clock::now();
+            game_.end_tics();
+            subsystems_.m_wait_ms += elapsed_ms(wait_start_);
+
+            frame_times_.push_back(elapsed_ms(frame_start_));
+            PROFILE_FRAME();
+
+            if (m_software && m_options.m_capture_interval != 0 && i % m_options.m_capture_interval == 0)
+            {
+                auto capture_start_ = std::chrono::steady_clock::now();
+                writer_.write<WADPaletteColor>(framebuffer_.to_rgb(m_wad->palettes()[0]),
+                                               framebuffer_.m_height,
+                                               framebuffer_.m_width,
+                                               m_options.m_capture_prefix + "_" + std::to_string(i) + ".ppm",
+                                               true);
+                subsystems_.m_capture_ms += elapsed_ms(capture_start_);
+            }
+        }
+
+        double total_ms_ = elapsed_ms(start_);
+        subsystems_.m_simulation_ms = game_.simulation_ms();
+
+        std::cout << "Simulated " << game_.tic() << " tics (" << game_.tic() * 1000.0 / total_ms_ << " tics/s)\n";
+        print_frame_stats(frame_times_, total_ms_);
+        std::cout << "Time in simulation/render/capture/waiting for tics: "
+                  << subsystems_.m_simulation_ms << " / "
+                  << subsystems_.m_render_ms << " / "
+                  << subsystems_.m_capture_ms << " / "
+                  << subsystems_.m_wait_ms << " ms\n";
+
+        if (!m_options.m_benchmark_filename.empty())
+            write_benchmark(frame_times_, total_ms_, game_.tic(), subsystems_);
+    }
+
+    // Where the time of the software loop goes. Simulation overlaps with rendering when it runs in its own
+    // thread, waiting is what the frames spent blocked on it.
+    struct SubsystemTimes
+    {
+        double m_simulation_ms = 0.0;
+        double m_render_ms = 0.0;
+        double m_capture_ms = 0.0;
+        double m_wait_ms = 0.0;
+    };
+
+    static double elapsed_ms(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Frame time below which the given percentage of the (sorted) frames are
+    static double percentile(const std::vector<double> & crSortedTimes, unsigned int percent)
+    {
+        return crSortedTimes[std::min(crSortedTimes.size() * percent / 100, crSortedTimes.size() - 1)];
+    }
+
+    void print_frame_stats(std::vector<double> & rFrameTimes, double totalMs)
+    {
+        if (rFrameTimes.empty())
+            return;
+
+        std::sort(rFrameTimes.begin(), rFrameTimes.end());
+
+        std::cout << "Rendered " << rFrameTimes.size() << " frames in " << totalMs << " ms ("
+                  << rFrameTimes.size() * 1000.0 / totalMs << " FPS)\n";
+        std::cout << "Frame time min/median/p90/p99/max: "
+                  << rFrameTimes.front() << " / "
+                  << percentile(rFrameTimes, 50) << " / "
+                  << percentile(rFrameTimes, 90) << " / "
+                  << percentile(rFrameTimes, 99) << " / "
+                  << rFrameTimes.back() << " ms\n";
+    }
+
+    // One JSON object per run with the setup and the results, frame times sorted
+    void write_benchmark(const std::vector<double> & crSortedTimes, double totalMs, uint32_t tics, const SubsystemTimes & crSubsystems)
+    {
+        std::ofstream file_(m_options.m_benchmark_filename);
+
+        if (!file_)
+            throw std::runtime_error("Failed to write benchmark results to " + m_options.m_benchmark_filename + "!");
+
+        auto quote_ = [](const std::string & crText) {
+            std::string quoted_ = "\"";
+            for (char c : crText)
+            {
+                if (c == '"' || c == '\\')
+                    quoted_ += '\\';
+                quoted_ += c;
+            }
+            return quoted_ + "\"";
+        };
+
+        double mean_ = 0.0;
+        for (double time_ : crSortedTimes)
+            mean_ += time_;
+        mean_ /= std::max<size_t>(crSortedTimes.size(), 1);
+
+        file_ << "{\n"
+              << "  \"demo\": " << quote_(m_demo ? m_demo->name() : "") << ",\n"
+              << "  \"level\": " << quote_(m_options.m_level_name) << ",\n"
+              << "  \"width\": " << m_options.m_width << ",\n"
+              << "  \"height\": " << m_options.m_height << ",\n"
+              << "  \"render\": " << (m_software ? "true" : "false") << ",\n"
+              << "  \"threads\": " << (m_software ? m_software->threads() : 0) << ",\n"
+              << "  \"column_kernel\": " << quote_(m_software ? column_kernel_name(m_software->column_kernel()) : "") << ",\n"
+              << "  \"simulation_thread\": " << (m_options.m_simulation_thread ? "true" : "false") << ",\n"
+              << "  \"timedemo\": " << (m_options.m_timedemo ? "true" : "false") << ",\n"
+              << "  \"tics\": " << tics << ",\n"
+              << "  \"frames\": " << crSortedTimes.size() << ",\n"
+              << "  \"total_ms\": " << totalMs << ",\n"
+              << "  \"tics_per_second\": " << tics * 1000.0 / totalMs << ",\n"
+              << "  \"frames_per_second\": " << crSortedTimes.size() * 1000.0 / totalMs << ",\n";
+
+        if (!crSortedTimes.empty())
+        {
+            file_ << "  \"frame_ms\": { "
+                  << "\"min\": " << crSortedTimes.front() << ", "
+                  << "\"mean\": " << mean_ << ", "
+                  << "\"p50\": " << percentile(crSortedTimes, 50) << ", "
+                  << "\"p90\": " << percentile(crSortedTimes, 90) << ", "
+                  << "\"p99\": " << percentile(crSortedTimes, 99) << ", "
+                  << "\"max\": " << crSortedTimes.back() << " },\n";
+        }
+
+        file_ << "  \"subsystem_ms\": { "
+              << "\"simulation\": " << crSubsystems.m_simulation_ms << ", "
+              << "\"render\": " << crSubsystems.m_render_ms << ", "
+              << "\"capture\": " << crSubsystems.m_capture_ms << ", "
+              << "\"wait\": " << crSubsystems.m_wait_ms << " }\n"
+              << "}\n";
+
+        std::cout << "Wrote benchmark results to " << m_options.m_benchmark_filename << "\n";
+    }
+
+    void write_profile()
+    {
+      if (m_options.m_profile_filename.empty())
+        return;
+
+#ifdef DOOMFS_PROFILE
+      Profiler::instance().print_frame_summary(std::cout);
+      Profiler::instance().write_chrome_trace(m_options.m_profile_filename);
+#else
+      std::cerr << "ERROR: Failed to write profile " << m_options.m_profile_filename << ", built without DOOMFS_PROFILE\n";
+#endif
+    }
+
     void cleanup()
     {
       std::cout << "Application cleanup...\n";
 
+      if (m_options.m_software)
+      {
+        m_software.reset();
+        return;
+      }
+
       m_vulkan.reset();
       std::cout << "Cleaned Vulkan application...\n";
 
+      if (m_options.m_headless)
+        return;
+
       std::cout << "Destroying GLFW Window Context" << std::endl;
       glfwDestroyWindow(*m_window);
 
@@ -74,9 +476,15 @@ class Application
       std::cout << "Cleaned GLFW window...\n";
     }
 
+    ApplicationOptions m_options;
     std::shared_ptr<GLFWwindow*> m_window;
     std::unique_ptr<VulkanApplication> m_vulkan;
+    std::unique_ptr<WAD> m_wad;
+    WADLevel m_level_data;
+    std::unique_ptr<Demo> m_demo;
+    std::shared_ptr<const LevelMesh> m_level;
+    std::unique_ptr<SoftwareRenderer> m_software;
 };
 
 
-#endif
\ No newline at end of file
+#endif
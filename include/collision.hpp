@@ -0,0 +1,704 @@
+#ifndef COLLISION_HPP_
+#define COLLISION_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "fixed.hpp"
+#include "level_geometry.hpp"
+#include "map_objects.hpp"
+#include "wad.hpp"
+
+// Movement clipping against the level and other things, like p_map.c. A move is checked against the
+// lines of the blockmap cells the moving box overlaps and against the things linked in the cells around
+// it, so its cost depends on how crowded the destination is and not on the size of the level.
+//
+// Blocklists are flattened into a single array and the lines keep the fixed point data the checks need
+// next to each other, lines shared by several cells are only checked once per move thanks to a stamp
+// (DOOM's validcount). Things are linked in the cell their center is in (blocklinks), through arrays
+// indexed by their pool slot which never changes while they live.
+
+#define LEVEL_LINEDEF_FLAG_BLOCK_MONSTERS 0x0002
+
+// Blockmap cells are 128 units wide
+const int kMapBlockShift = kFracBits + 7;
+
+// Biggest radius of a thing, things are linked by their center so the cells around a move are checked
+// this much farther out
+const Fixed kMaxRadius = Fixed::from_int(32);
+
+// Highest step a thing climbs
+const Fixed kMaxStepHeight = Fixed::from_int(24);
+
+const uint32_t kNoThing = 0xFFFFFFFF;
+
+enum class SlopeType
+{
+  kHorizontal,
+  kVertical,
+  kPositive,
+  kNegative
+};
+
+struct CollisionLine
+{
+  Fixed m_x;
+  Fixed m_y;
+  Fixed m_dx;
+  Fixed m_dy;
+
+  Fixed m_left;
+  Fixed m_right;
+  Fixed m_bottom;
+  Fixed m_top;
+
+  SlopeType m_slope;
+  unsigned short m_flags;
+  unsigned short m_special;
+
+  // Sectors at each side, -1 when the line is one-sided
+  int m_front;
+  int m_back;
+};
+
+class LevelCollision
+{
+  public:
+
+    LevelCollision()
+    {
+
+    }
+
+    LevelCollision(const WADLevel & crLevel)
+      : m_level(&crLevel)
+    {
+      build_lines();
+      build_blocks();
+
+      for (const WADLevelSector & crSector : crLevel.sectors)
+      {
+        m_floor.push_back(Fixed::from_int((short)crSector.floor_height));
+        m_ceiling.push_back(Fixed::from_int((short)crSector.ceiling_height));
+      }
+    }
+
+    const WADLevel * level() const
+    {
+      return m_level;
+    }
+
+    unsigned short sector_at(Fixed x, Fixed y) const
+    {
+      return m_level->ssectors.empty() ? 0 : point_in_sector(*m_level, x, y);
+    }
+
+    Fixed floor_height(unsigned short sector) const
+    {
+      return m_floor[sector];
+    }
+
+    Fixed ceiling_height(unsigned short sector) const
+    {
+      return m_ceiling[sector];
+    }
+
+    // P_SetThingPosition
+    void link(MapObjects & rMobjs, Handle handle)
+    {
+      MapObject & rMobj = *rMobjs.get(handle);
+
+      rMobj.m_sector = sector_at(rMobj.m_x, rMobj.m_y);
+
+      if (handle.m_slot >= m_links.size())
+        m_links.resize(handle.m_slot + 1, { kNoThing, kNoThing, -1, 0 });
+
+      ThingLink & rLink = m_links[handle.m_slot];
+      rLink.m_generation = handle.m_generation;
+      rLink.m_block = block_of(rMobj.m_x, rMobj.m_y);
+
+      if (rLink.m_block < 0)
+        return;
+
+      rLink.m_prev = kNoThing;
+      rLink.m_next = m_block_things[rLink.m_block];
+
+      if (rLink.m_next != kNoThing)
+        m_links[rLink.m_next].m_prev = handle.m_slot;
+
+      m_block_things[rLink.m_block] = handle.m_slot;
+    }
+
+    // P_UnsetThingPosition
+    void unlink(Handle handle)
+    {
+      if (handle.m_slot >= m_links.size())
+        return;
+
+      ThingLink & rLink = m_links[handle.m_slot];
+
+      if (rLink.m_block < 0)
+        return;
+
+      if (rLink.m_next != kNoThing)
+        m_links[rLink.m_next].m_prev = rLink.m_prev;
+
+      if (rLink.m_prev != kNoThing)
+        m_links[rLink.m_prev].m_next = rLink.m_next;
+      else
+        m_block_things[rLink.m_block] = rLink.m_next;
+
+      rLink.m_block = -1;
+    }
+
+    // P_CheckPosition, whether the thing fits at (x, y). Leaves the floor, ceiling and dropoff heights
+    // of the spot and what blocked the move (if anything) in the check results.
+    bool check_position(MapObjects & rMobjs, Handle handle, Fixed x, Fixed y)
+    {
+      const MapObject & crMobj = *rMobjs.get(handle);
+
+      m_check_handle = handle;
+      m_check_x = x;
+      m_check_y = y;
+      m_check_left = x - crMobj.m_radius;
+      m_check_right = x + crMobj.m_radius;
+      m_check_bottom = y - crMobj.m_radius;
+      m_check_top = y + crMobj.m_radius;
+
+      unsigned short sector_ = sector_at(x, y);
+      m_floor_z = m_floor[sector_];
+      m_dropoff_z = m_floor[sector_];
+      m_ceiling_z = m_ceiling[sector_];
+      m_block_line = -1;
+      m_block_thing = Handle();
+
+      if (crMobj.m_flags & MOBJ_FLAG_NOCLIP)
+        return true;
+
+      if (++m_validcount == 0)
+      {
+        std::fill(m_line_stamps.begin(), m_line_stamps.end(), 0);
+        m_validcount = 1;
+      }
+
+      int xl_, xh_, yl_, yh_;
+
+      blocks_of(m_check_left - kMaxRadius, m_check_right + kMaxRadius, m_check_bottom - kMaxRadius, m_check_top + kMaxRadius, xl_, xh_, yl_, yh_);
+
+      for (int by = yl_; by <= yh_; ++by)
+        for (int bx = xl_; bx <= xh_; ++bx)
+          if (!check_block_things(rMobjs, crMobj, by * m_columns + bx))
+            return false;
+
+      blocks_of(m_check_left, m_check_right, m_check_bottom, m_check_top, xl_, xh_, yl_, yh_);
+
+      for (int by = yl_; by <= yh_; ++by)
+        for (int bx = xl_; bx <= xh_; ++bx)
+          if (!check_block_lines(crMobj, by * m_columns + bx))
+            return false;
+
+      return true;
+    }
+
+    // P_TryMove, moves the thing to (x, y) if it fits there and can step or drop to it
+    bool try_move(MapObjects & rMobjs, Handle handle, Fixed x, Fixed y)
+    {
+      if (!check_position(rMobjs, handle, x, y))
+        return false;
+
+      MapObject & rMobj = *rMobjs.get(handle);
+
+      if (!(rMobj.m_flags & MOBJ_FLAG_NOCLIP))
+      {
+        if (m_ceiling_z - m_floor_z < rMobj.m_height)
+          return false;
+
+        if (m_ceiling_z - rMobj.m_z < rMobj.m_height)
+          return false;
+
+        if (m_floor_z - rMobj.m_z > kMaxStepHeight)
+          return false;
+
+        if (!(rMobj.m_flags & (MOBJ_FLAG_DROPOFF | MOBJ_FLAG_FLOAT)) && m_floor_z - m_dropoff_z > kMaxStepHeight)
+          return false;
+      }
+
+      unlink(handle);
+      rMobj.m_x = x;
+      rMobj.m_y = y;
+      rMobj.m_floor_z = m_floor_z;
+      rMobj.m_ceiling_z = m_ceiling_z;
+      link(rMobjs, handle);
+
+      return true;
+    }
+
+    // P_XYMovement. Moves faster than half the biggest move are split so things do not skip through
+    // thin walls. Returns false when a missile hit something and has to explode.
+    bool xy_movement(MapObjects & rMobjs, Handle handle)
+    {
+      MapObject * pMobj = rMobjs.get(handle);
+
+      pMobj->m_momentum_x = clamp_move(pMobj->m_momentum_x);
+      pMobj->m_momentum_y = clamp_move(pMobj->m_momentum_y);
+
+      Fixed x_move_ = pMobj->m_momentum_x;
+      Fixed y_move_ = pMobj->m_momentum_y;
+      Fixed half_ = kMaxMove / 2;
+
+      do
+      {
+        Fixed try_x_, try_y_;
+
+        // Vanilla only splits positive moves, kept for the same movement
+        if (x_move_ > half_ || y_move_ > half_)
+        {
+          try_x_ = pMobj->m_x + x_move_ / 2;
+          try_y_ = pMobj->m_y + y_move_ / 2;
+          x_move_ = Fixed::from_raw(x_move_.raw() >> 1);
+          y_move_ = Fixed::from_raw(y_move_.raw() >> 1);
+        }
+        else
+        {
+          try_x_ = pMobj->m_x + x_move_;
+          try_y_ = pMobj->m_y + y_move_;
+          x_move_ = Fixed();
+          y_move_ = Fixed();
+        }
+
+        if (!try_move(rMobjs, handle, try_x_, try_y_))
+        {
+          if (pMobj->m_flags & MOBJ_FLAG_MISSILE)
+            return false;
+
+          if (mobj_is_player(*pMobj))
+          {
+            slide_move(rMobjs, handle);
+          }
+          else
+          {
+            pMobj->m_momentum_x = Fixed();
+            pMobj->m_momentum_y = Fixed();
+          }
+        }
+      } while (x_move_ != Fixed() || y_move_ != Fixed());
+
+      return true;
+    }
+
+    Fixed floor_z() const { return m_floor_z; }
+    Fixed ceiling_z() const { return m_ceiling_z; }
+    Fixed dropoff_z() const { return m_dropoff_z; }
+
+    // The line that blocked the last check (-1 if none) and the thing that did (a stale handle if none)
+    int block_line() const { return m_block_line; }
+    Handle block_thing() const { return m_block_thing; }
+
+    const std::vector<CollisionLine> & lines() const
+    {
+      return m_lines;
+    }
+
+    // Blockmap grid
+    Fixed origin_x() const { return m_origin_x; }
+    Fixed origin_y() const { return m_origin_y; }
+    int columns() const { return m_columns; }
+    int rows() const { return m_rows; }
+
+    const uint16_t * block_lines_begin(int block) const
+    {
+      return m_block_lines.data() + m_block_offsets[block];
+    }
+
+    const uint16_t * block_lines_end(int block) const
+    {
+      return m_block_lines.data() + m_block_offsets[block + 1];
+    }
+
+    // Pool slot of the first thing linked in a block, kNoThing when there is none
+    uint32_t block_first_thing(int block) const
+    {
+      return m_block_things[block];
+    }
+
+    uint32_t next_thing(uint32_t slot) const
+    {
+      return m_links[slot].m_next;
+    }
+
+    Handle thing_handle(uint32_t slot) const
+    {
+      return { slot, m_links[slot].m_generation };
+    }
+
+    // -1 outside the blockmap
+    int block_of(Fixed x, Fixed y) const
+    {
+      int bx_ = (x - m_origin_x).raw() >> kMapBlockShift;
+      int by_ = (y - m_origin_y).raw() >> kMapBlockShift;
+
+      if (bx_ < 0 || by_ < 0 || bx_ >= m_columns || by_ >= m_rows)
+        return -1;
+
+      return by_ * m_columns + bx_;
+    }
+
+    // P_PointOnLineSide, 0 is the front (right) side
+    static int point_on_line_side(Fixed x, Fixed y, const CollisionLine & crLine)
+    {
+      if (crLine.m_dx == Fixed())
+      {
+        if (x <= crLine.m_x)
+          return crLine.m_dy > Fixed();
+
+        return crLine.m_dy < Fixed();
+      }
+
+      if (crLine.m_dy == Fixed())
+      {
+        if (y <= crLine.m_y)
+          return crLine.m_dx < Fixed();
+
+        return crLine.m_dx > Fixed();
+      }
+
+      Fixed left_ = Fixed::from_raw(crLine.m_dy.raw() >> kFracBits) * (x - crLine.m_x);
+      Fixed right_ = (y - crLine.m_y) * Fixed::from_raw(crLine.m_dx.raw() >> kFracBits);
+
+      return (right_ < left_) ? 0 : 1;
+    }
+
+    // P_BoxOnLineSide, -1 when the box crosses the line
+    static int box_on_line_side(Fixed left, Fixed right, Fixed bottom, Fixed top, const CollisionLine & crLine)
+    {
+      int p1_ = 0, p2_ = 0;
+
+      switch (crLine.m_slope)
+      {
+        case SlopeType::kHorizontal:
+          p1_ = top > crLine.m_y;
+          p2_ = bottom > crLine.m_y;
+          if (crLine.m_dx < Fixed())
+          {
+            p1_ ^= 1;
+            p2_ ^= 1;
+          }
+          break;
+        case SlopeType::kVertical:
+          p1_ = right < crLine.m_x;
+          p2_ = left < crLine.m_x;
+          if (crLine.m_dy < Fixed())
+          {
+            p1_ ^= 1;
+            p2_ ^= 1;
+          }
+          break;
+        case SlopeType::kPositive:
+          p1_ = point_on_line_side(left, top, crLine);
+          p2_ = point_on_line_side(right, bottom, crLine);
+          break;
+        case SlopeType::kNegative:
+          p1_ = point_on_line_side(right, top, crLine);
+          p2_ = point_on_line_side(left, bottom, crLine);
+          break;
+      }
+
+      return (p1_ == p2_) ? p1_ : -1;
+    }
+
+    // P_LineOpening, the gap between the floors and ceilings at both sides of a two-sided line
+    void line_opening(const CollisionLine & crLine, Fixed & rTop, Fixed & rBottom, Fixed & rLowFloor) const
+    {
+      rTop = std::min(m_ceiling[crLine.m_front], m_ceiling[crLine.m_back]);
+      rBottom = std::max(m_floor[crLine.m_front], m_floor[crLine.m_back]);
+      rLowFloor = std::min(m_floor[crLine.m_front], m_floor[crLine.m_back]);
+    }
+
+  private:
+
+    struct ThingLink
+    {
+      uint32_t m_next;
+      uint32_t m_prev;
+      int m_block;
+      uint32_t m_generation;
+    };
+
+    void build_lines()
+    {
+      for (const WADLevelLinedef & crLinedef : m_level->linedefs)
+      {
+        const WADLevelVertex & crFrom = m_level->vertices[crLinedef.from];
+        const WADLevelVertex & crTo = m_level->vertices[crLinedef.to];
+
+        CollisionLine line_;
+        line_.m_x = Fixed::from_int(crFrom.x);
+        line_.m_y = Fixed::from_int(crFrom.y);
+        line_.m_dx = Fixed::from_int(crTo.x - crFrom.x);
+        line_.m_dy = Fixed::from_int(crTo.y - crFrom.y);
+        line_.m_left = Fixed::from_int(std::min(crFrom.x, crTo.x));
+        line_.m_right = Fixed::from_int(std::max(crFrom.x, crTo.x));
+        line_.m_bottom = Fixed::from_int(std::min(crFrom.y, crTo.y));
+        line_.m_top = Fixed::from_int(std::max(crFrom.y, crTo.y));
+
+        if (line_.m_dx == Fixed())
+          line_.m_slope = SlopeType::kVertical;
+        else if (line_.m_dy == Fixed())
+          line_.m_slope = SlopeType::kHorizontal;
+        else if ((line_.m_dy / line_.m_dx) > Fixed())
+          line_.m_slope = SlopeType::kPositive;
+        else
+          line_.m_slope = SlopeType::kNegative;
+
+        line_.m_flags = crLinedef.flags;
+        line_.m_special = crLinedef.types;
+        line_.m_front = (crLinedef.right_sidedef != LEVEL_NO_SIDEDEF) ? m_level->sidedefs[crLinedef.right_sidedef].sector : -1;
+        line_.m_back = (crLinedef.left_sidedef != LEVEL_NO_SIDEDEF) ? m_level->sidedefs[crLinedef.left_sidedef].sector : -1;
+
+        m_lines.push_back(line_);
+      }
+
+      m_line_stamps.assign(m_lines.size(), 0);
+    }
+
+    void build_blocks()
+    {
+      const WADLevelBlockmap & crBlockmap = m_level->blockmap;
+
+      m_origin_x = Fixed::from_int(crBlockmap.x);
+      m_origin_y = Fixed::from_int(crBlockmap.y);
+      m_columns = crBlockmap.num_cols;
+      m_rows = crBlockmap.num_rows;
+
+      // The level keeps the blocklists flattened already, only a broken lump with lines past LINEDEFS needs
+      // them filtered
+      m_block_offsets = crBlockmap.offsets;
+      m_block_lines = crBlockmap.lines;
+
+      if (std::any_of(m_block_lines.begin(), m_block_lines.end(), [this](uint16_t line) { return line >= m_lines.size(); }))
+      {
+        size_t kept_ = 0;
+
+        for (size_t b = 0; b + 1 < m_block_offsets.size(); ++b)
+        {
+          size_t first_ = m_block_offsets[b];
+          m_block_offsets[b] = kept_;
+
+          for (size_t i = first_; i < m_block_offsets[b + 1]; ++i)
+            if (m_block_lines[i] < m_lines.size())
+              m_block_lines[kept_++] = m_block_lines[i];
+        }
+
+        m_block_offsets.back() = kept_;
+        m_block_lines.resize(kept_);
+      }
+
+      // A short lump leaves the last blocks empty
+      if (m_block_offsets.empty())
+        m_block_offsets.push_back(0);
+
+      m_block_offsets.resize(m_columns * m_rows + 1, m_block_lines.size());
+      m_block_things.assign(m_columns * m_rows, kNoThing);
+    }
+
+    // Blocks overlapped by a box, clamped to the blockmap (empty when the box is outside)
+    void blocks_of(Fixed left, Fixed right, Fixed bottom, Fixed top, int & rXl, int & rXh, int & rYl, int & rYh) const
+    {
+      rXl = std::max((left - m_origin_x).raw() >> kMapBlockShift, 0);
+      rXh = std::min((right - m_origin_x).raw() >> kMapBlockShift, m_columns - 1);
+      rYl = std::max((bottom - m_origin_y).raw() >> kMapBlockShift, 0);
+      rYh = std::min((top - m_origin_y).raw() >> kMapBlockShift, m_rows - 1);
+    }
+
+    // PIT_CheckThing over the things of a block
+    bool check_block_things(MapObjects & rMobjs, const MapObject & crMobj, int block)
+    {
+      for (uint32_t slot = m_block_things[block]; slot != kNoThing; slot = m_links[slot].m_next)
+      {
+        Handle handle_ = thing_handle(slot);
+
+        if (handle_ == m_check_handle)
+          continue;
+
+        const MapObject * pThing = rMobjs.get(handle_);
+
+        if (pThing == nullptr || !(pThing->m_flags & (MOBJ_FLAG_SOLID | MOBJ_FLAG_SPECIAL | MOBJ_FLAG_SHOOTABLE)))
+          continue;
+
+        Fixed block_distance_ = pThing->m_radius + crMobj.m_radius;
+
+        if (abs(pThing->m_x - m_check_x) >= block_distance_ || abs(pThing->m_y - m_check_y) >= block_distance_)
+          continue;
+
+        if (crMobj.m_flags & MOBJ_FLAG_MISSILE)
+        {
+          // Over or under it
+          if (crMobj.m_z > pThing->m_z + pThing->m_height || crMobj.m_z + crMobj.m_height < pThing->m_z)
+            continue;
+
+          // Missiles do not hit whoever shot them
+          if (handle_ == crMobj.m_target)
+            continue;
+
+          // Pickups let them through, anything shootable or solid is hit
+          if (!(pThing->m_flags & (MOBJ_FLAG_SHOOTABLE | MOBJ_FLAG_SOLID)))
+            continue;
+
+          m_block_thing = handle_;
+          return false;
+        }
+
+        if (pThing->m_flags & MOBJ_FLAG_SOLID)
+        {
+          m_block_thing = handle_;
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    // PIT_CheckLine over the lines of a block
+    bool check_block_lines(const MapObject & crMobj, int block)
+    {
+      for (const uint16_t * pLine = block_lines_begin(block); pLine != block_lines_end(block); ++pLine)
+      {
+        if (m_line_stamps[*pLine] == m_validcount)
+          continue;
+
+        m_line_stamps[*pLine] = m_validcount;
+        const CollisionLine & crLine = m_lines[*pLine];
+
+        if (m_check_right <= crLine.m_left || m_check_left >= crLine.m_right ||
+            m_check_top <= crLine.m_bottom || m_check_bottom >= crLine.m_top)
+          continue;
+
+        if (box_on_line_side(m_check_left, m_check_right, m_check_bottom, m_check_top, crLine) != -1)
+          continue;
+
+        // One-sided lines block everything, blocking lines everything but missiles
+        if (crLine.m_back < 0 || crLine.m_front < 0)
+        {
+          m_block_line = *pLine;
+          return false;
+        }
+
+        if (!(crMobj.m_flags & MOBJ_FLAG_MISSILE))
+        {
+          if ((crLine.m_flags & LEVEL_LINEDEF_FLAG_BLOCKING) ||
+              (!mobj_is_player(crMobj) && (crLine.m_flags & LEVEL_LINEDEF_FLAG_BLOCK_MONSTERS)))
+          {
+            m_block_line = *pLine;
+            return false;
+          }
+        }
+
+        Fixed top_, bottom_, low_floor_;
+        line_opening(crLine, top_, bottom_, low_floor_);
+
+        if (top_ < m_ceiling_z)
+        {
+          m_ceiling_z = top_;
+          m_block_line = *pLine;
+        }
+
+        if (bottom_ > m_floor_z)
+        {
+          m_floor_z = bottom_;
+          m_block_line = *pLine;
+        }
+
+        if (low_floor_ < m_dropoff_z)
+          m_dropoff_z = low_floor_;
+      }
+
+      return true;
+    }
+
+    // P_SlideMove, simplified: the momentum is projected on the line that blocked the move (P_HitSlideLine)
+    // and if that does not fit either the thing stairsteps, trying each axis on its own
+    void slide_move(MapObjects & rMobjs, Handle handle)
+    {
+      MapObject * pMobj = rMobjs.get(handle);
+
+      if (m_block_line >= 0)
+      {
+        const CollisionLine & crLine = m_lines[m_block_line];
+        Fixed x_move_ = pMobj->m_momentum_x;
+        Fixed y_move_ = pMobj->m_momentum_y;
+
+        if (crLine.m_slope == SlopeType::kHorizontal)
+        {
+          y_move_ = Fixed();
+        }
+        else if (crLine.m_slope == SlopeType::kVertical)
+        {
+          x_move_ = Fixed();
+        }
+        else
+        {
+          BAM line_angle_ = point_to_angle(crLine.m_dx, crLine.m_dy);
+          if (point_on_line_side(pMobj->m_x, pMobj->m_y, crLine) == 1)
+            line_angle_ += kAng180;
+
+          BAM delta_ = point_to_angle(x_move_, y_move_) - line_angle_;
+          if (delta_ > kAng180)
+            delta_ += kAng180;
+
+          Fixed length_ = approx_distance(x_move_, y_move_) * cosine(delta_);
+          x_move_ = length_ * cosine(line_angle_);
+          y_move_ = length_ * sine(line_angle_);
+        }
+
+        pMobj->m_momentum_x = x_move_;
+        pMobj->m_momentum_y = y_move_;
+
+        if (try_move(rMobjs, handle, pMobj->m_x + x_move_, pMobj->m_y + y_move_))
+          return;
+      }
+
+      if (!try_move(rMobjs, handle, pMobj->m_x, pMobj->m_y + pMobj->m_momentum_y))
+      {
+        pMobj->m_momentum_y = Fixed();
+
+        if (!try_move(rMobjs, handle, pMobj->m_x + pMobj->m_momentum_x, pMobj->m_y))
+          pMobj->m_momentum_x = Fixed();
+      }
+    }
+
+    const WADLevel * m_level = nullptr;
+
+    std::vector<CollisionLine> m_lines;
+    std::vector<uint32_t> m_line_stamps;
+    uint32_t m_validcount = 0;
+
+    std::vector<Fixed> m_floor;
+    std::vector<Fixed> m_ceiling;
+
+    Fixed m_origin_x;
+    Fixed m_origin_y;
+    int m_columns = 0;
+    int m_rows = 0;
+    std::vector<uint32_t> m_block_offsets;
+    std::vector<uint16_t> m_block_lines;
+
+    std::vector<uint32_t> m_block_things;
+    std::vector<ThingLink> m_links;
+
+    // State of the current check (DOOM's tm* globals)
+    Handle m_check_handle;
+    Fixed m_check_x;
+    Fixed m_check_y;
+    Fixed m_check_left;
+    Fixed m_check_right;
+    Fixed m_check_bottom;
+    Fixed m_check_top;
+    Fixed m_floor_z;
+    Fixed m_ceiling_z;
+    Fixed m_dropoff_z;
+    int m_block_line = -1;
+    Handle m_block_thing;
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef DEMO_HPP_
+#define DEMO_HPP_
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "game_state.hpp"
+#include "wad.hpp"
+
+// Demos are recordings of the commands of every player for every tic, which replayed on the same level
+// reproduce the game exactly since the simulation is deterministic. They are the DEMO lumps of the IWAD or
+// .lmp files. Since version 1.4 they start with a 13-byte header:
+//  (1) the version of the game that recorded it (e.g., 109 for 1.9)
+//  (2) the skill (0 to 4), the episode and the map (1 byte each)
+//  (3) the deathmatch, respawn, fast and no monsters flags (1 byte each)
+//  (4) the player whose view was shown (1 byte)
+//  (5) whether each of the 4 players is in the game (1 byte each)
+// while earlier demos only have the skill, episode, map and the 4 players. Then come 4 bytes per player
+// in the game and tic: forward move and side move (signed), the top byte of the turn and the buttons. A
+// 0x80 where the next tic would start ends the demo.
+
+const uint8_t kDemoMarker = 0x80;
+
+class Demo
+{
+  public:
+
+    Demo(const uint8_t * pData, size_t size)
+    {
+      read(pData, size);
+    }
+
+    // A DEMO lump of the mounted WADs if there is one with that name, a file otherwise
+    Demo(const WAD & crWad, const std::string & crName)
+    {
+      std::string lump_name_;
+      for (char c : crName)
+        lump_name_ += toupper(c);
+
+      const WADEntry * pLump = crWad.find_lump(lump_name_);
+
+      if (pLump != nullptr)
+      {
+        m_name = lump_name_;
+        read(crWad.lump_data(*pLump), pLump->size);
+        return;
+      }
+
+      std::ifstream file_(crName, std::ios::binary);
+
+      if (!file_)
+        throw std::runtime_error("Failed to open demo " + crName + "!");
+
+      std::vector<uint8_t> data_((std::istreambuf_iterator<char>(file_)), std::istreambuf_iterator<char>());
+      m_name = crName;
+      read(data_.data(), data_.size());
+    }
+
+    const std::string & name() const
+    {
+      return m_name;
+    }
+
+    unsigned int version() const
+    {
+      return m_version;
+    }
+
+    unsigned int skill() const
+    {
+      return m_skill;
+    }
+
+    // ExMy or MAPxx depending on which kind of levels the WAD has
+    std::string level_name(const WAD & crWad) const
+    {
+      char name_[16];
+      bool commercial_ = !crWad.level_names().empty() && crWad.level_names().front().compare(0, 3, "MAP") == 0;
+
+      if (commercial_)
+        snprintf(name_, sizeof(name_), "MAP%02u", m_map);
+      else
+        snprintf(name_, sizeof(name_), "E%uM%u", m_episode, m_map);
+
+      return name_;
+    }
+
+    unsigned int players() const
+    {
+      return m_players;
+    }
+
+    uint32_t tics() const
+    {
+      return m_commands.size() / m_players;
+    }
+
+    // Command of the first player in the game, the one simulated, nothing once the demo is over
+    TicCmd command(uint32_t tic) const
+    {
+      if (tic >= tics())
+        return TicCmd{ 0, 0, 0, 0 };
+
+      return m_commands[tic * m_players];
+    }
+
+  private:
+
+    void read(const uint8_t * pData, size_t size)
+    {
+      const uint8_t * pEnd = pData + size;
+
+      if (size < 7)
+        throw std::runtime_error("Failed to read demo " + m_name + ", it is too short!");
+
+      bool players_[4];
+
+      // Demos before 1.4 start straight with the skill, later versions are always above it
+      if (pData[0] <= 4)
+      {
+        m_version = 0;
+        m_skill = pData[0];
+        m_episode = pData[1];
+        m_map = pData[2];
+        for (unsigned int p = 0; p < 4; ++p)
+          players_[p] = pData[3 + p] != 0;
+        pData += 7;
+      }
+      else
+      {
+        if (size < 13)
+          throw std::runtime_error("Failed to read demo " + m_name + ", it is too short!");
+
+        if (pData[0] < 104 || pData[0] > 109)
+          throw std::runtime_error("Failed to read demo " + m_name + ", unsupported version " + std::to_string(pData[0]) + "!");
+
+        m_version = pData[0];
+        m_skill = pData[1];
+        m_episode = pData[2];
+        m_map = pData[3];
+        for (unsigned int p = 0; p < 4; ++p)
+          players_[p] = pData[9 + p] != 0;
+        pData += 13;
+      }
+
+      m_players = 0;
+      for (unsigned int p = 0; p < 4; ++p)
+        m_players += players_[p];
+
+      if (m_players == 0)
+        throw std::runtime_error("Failed to read demo " + m_name + ", it has no players!");
+
+      m_commands.reserve((pEnd - pData) / 4);
+
+      // Whole tics only, a demo cut short by a crash just ends at the last complete one
+      while (pData + m_players * 4 <= pEnd && *pData != kDemoMarker)
+      {
+        for (unsigned int p = 0; p < m_players; ++p, pData += 4)
+          m_commands.push_back({ (signed char)pData[0], (signed char)pData[1], (short)(pData[2] << 8), pData[3] });
+      }
+    }
+
+    std::string m_name;
+    unsigned int m_version;
+    unsigned int m_skill;
+    unsigned int m_episode;
+    unsigned int m_map;
+    unsigned int m_players;
+
+    // Tic after tic, the commands of the players in the game in player order
+    std::vector<TicCmd> m_commands;
+};
+
+#endif
@@ -0,0 +1,440 @@
+#ifndef FIXED_HPP_
+#define FIXED_HPP_
+
+#include <climits>
+#include <cstdint>
+
+// Fixed point numbers and binary angles like the ones DOOM uses for everything. Fixed is DOOM's fixed_t,
+// a 32 bit integer with 16 fractional bits, and BAM (binary angle measurement) maps a full turn to the
+// whole 32 bit range so angles wrap around for free. Both are plain integers underneath: arithmetic is
+// the same on every machine and compiler, which is what keeps demos in sync, and converting to pixels
+// or texels is a shift instead of a float to int conversion.
+//
+// The sine, tangent and arctangent tables are generated at compile time from the formulas behind the
+// ones in tables.c. They are not a copy of vanilla's tables: finetangent, for one, differs from the shipped
+// table in the low bits (e.g., entry 0 is -170891310 here and -170910304 in tables.c), so the math follows
+// DOOM's closely but is not bit for bit the same, and demos that depend on those bits can desync.
+
+const int kFracBits = 16;
+const int32_t kFracUnit = 1 << kFracBits;
+
+// Fine angles index the trigonometric tables, a BAM is turned into one dropping its low bits
+const int kFineAngles = 8192;
+const int kFineMask = kFineAngles - 1;
+const int kAngleToFineShift = 19;
+
+// The arctangent table covers slopes [0, 1] in kSlopeRange steps
+const int kSlopeRange = 2048;
+const int kSlopeBits = 11;
+
+class Fixed
+{
+  public:
+
+    constexpr Fixed()
+      : m_raw(0)
+    {
+
+    }
+
+    static constexpr Fixed from_raw(int32_t raw)
+    {
+      Fixed fixed_;
+      fixed_.m_raw = raw;
+      return fixed_;
+    }
+
+    static constexpr Fixed from_int(int value)
+    {
+      return from_raw((int32_t)((uint32_t)value << kFracBits));
+    }
+
+    static constexpr Fixed from_float(float value)
+    {
+      return from_raw((int32_t)(value * kFracUnit));
+    }
+
+    constexpr int32_t raw() const
+    {
+      return m_raw;
+    }
+
+    // Rounds towards minus infinity, like the shifts DOOM uses
+    constexpr int to_int() const
+    {
+      return m_raw >> kFracBits;
+    }
+
+    constexpr float to_float() const
+    {
+      return (float)m_raw / kFracUnit;
+    }
+
+    // Additions wrap around like the 32 bit integers they are
+    constexpr Fixed operator+(Fixed other) const
+    {
+      return from_raw((int32_t)((uint32_t)m_raw + (uint32_t)other.m_raw));
+    }
+
+    constexpr Fixed operator-(Fixed other) const
+    {
+      return from_raw((int32_t)((uint32_t)m_raw - (uint32_t)other.m_raw));
+    }
+
+    constexpr Fixed operator-() const
+    {
+      return from_raw((int32_t)(0u - (uint32_t)m_raw));
+    }
+
+    // FixedMul
+    constexpr Fixed operator*(Fixed other) const
+    {
+      return from_raw((int32_t)(((int64_t)m_raw * other.m_raw) >> kFracBits));
+    }
+
+    constexpr Fixed operator*(int value) const
+    {
+      return from_raw((int32_t)((uint32_t)m_raw * (uint32_t)value));
+    }
+
+    // FixedDiv, quotients that do not fit saturate instead of trapping
+    constexpr Fixed operator/(Fixed other) const
+    {
+      if ((magnitude(m_raw) >> 14) >= magnitude(other.m_raw))
+        return from_raw(((m_raw ^ other.m_raw) < 0) ? INT_MIN : INT_MAX);
+
+      return from_raw((int32_t)(((int64_t)m_raw * kFracUnit) / other.m_raw));
+    }
+
+    constexpr Fixed operator/(int value) const
+    {
+      return from_raw(m_raw / value);
+    }
+
+    Fixed & operator+=(Fixed other)
+    {
+      return *this = *this + other;
+    }
+
+    Fixed & operator-=(Fixed other)
+    {
+      return *this = *this - other;
+    }
+
+    Fixed & operator*=(Fixed other)
+    {
+      return *this = *this * other;
+    }
+
+    Fixed & operator/=(Fixed other)
+    {
+      return *this = *this / other;
+    }
+
+    constexpr bool operator==(Fixed other) const { return m_raw == other.m_raw; }
+    constexpr bool operator!=(Fixed other) const { return m_raw != other.m_raw; }
+    constexpr bool operator<(Fixed other) const { return m_raw < other.m_raw; }
+    constexpr bool operator<=(Fixed other) const { return m_raw <= other.m_raw; }
+    constexpr bool operator>(Fixed other) const { return m_raw > other.m_raw; }
+    constexpr bool operator>=(Fixed other) const { return m_raw >= other.m_raw; }
+
+  private:
+
+    static constexpr uint32_t magnitude(int32_t raw)
+    {
+      return (raw < 0) ? 0u - (uint32_t)raw : (uint32_t)raw;
+    }
+
+    int32_t m_raw;
+};
+
+class BAM
+{
+  public:
+
+    constexpr BAM()
+      : m_raw(0)
+    {
+
+    }
+
+    static constexpr BAM from_raw(uint32_t raw)
+    {
+      BAM angle_;
+      angle_.m_raw = raw;
+      return angle_;
+    }
+
+    // WAD lumps (e.g., segs) store angles as the top 16 bits of a BAM
+    static constexpr BAM from_short(unsigned short value)
+    {
+      return from_raw((uint32_t)value << 16);
+    }
+
+    static constexpr BAM from_degrees(double degrees)
+    {
+      return from_raw((uint32_t)(int64_t)(degrees / 360.0 * 4294967296.0));
+    }
+
+    constexpr uint32_t raw() const
+    {
+      return m_raw;
+    }
+
+    constexpr double to_degrees() const
+    {
+      return m_raw * (360.0 / 4294967296.0);
+    }
+
+    constexpr float to_radians() const
+    {
+      return (float)(m_raw * (6.283185307179586 / 4294967296.0));
+    }
+
+    // Index in the fine tables
+    constexpr int fine() const
+    {
+      return m_raw >> kAngleToFineShift;
+    }
+
+    constexpr BAM operator+(BAM other) const
+    {
+      return from_raw(m_raw + other.m_raw);
+    }
+
+    constexpr BAM operator-(BAM other) const
+    {
+      return from_raw(m_raw - other.m_raw);
+    }
+
+    constexpr BAM operator-() const
+    {
+      return from_raw(0u - m_raw);
+    }
+
+    constexpr BAM operator*(uint32_t value) const
+    {
+      return from_raw(m_raw * value);
+    }
+
+    constexpr BAM operator/(uint32_t value) const
+    {
+      return from_raw(m_raw / value);
+    }
+
+    constexpr BAM operator>>(int shift) const
+    {
+      return from_raw(m_raw >> shift);
+    }
+
+    BAM & operator+=(BAM other)
+    {
+      return *this = *this + other;
+    }
+
+    BAM & operator-=(BAM other)
+    {
+      return *this = *this - other;
+    }
+
+    constexpr bool operator==(BAM other) const { return m_raw == other.m_raw; }
+    constexpr bool operator!=(BAM other) const { return m_raw != other.m_raw; }
+    constexpr bool operator<(BAM other) const { return m_raw < other.m_raw; }
+    constexpr bool operator<=(BAM other) const { return m_raw <= other.m_raw; }
+    constexpr bool operator>(BAM other) const { return m_raw > other.m_raw; }
+    constexpr bool operator>=(BAM other) const { return m_raw >= other.m_raw; }
+
+  private:
+
+    uint32_t m_raw;
+};
+
+constexpr BAM kAng45 = BAM::from_raw(0x20000000u);
+constexpr BAM kAng90 = BAM::from_raw(0x40000000u);
+constexpr BAM kAng180 = BAM::from_raw(0x80000000u);
+constexpr BAM kAng270 = BAM::from_raw(0xC0000000u);
+
+namespace fixed_detail
+{
+  constexpr double kPi = 3.141592653589793;
+
+  // Taylor series after reducing the argument to [-pi, pi], good to the last bit of a double for the
+  // arguments the tables need
+  constexpr double sine(double x)
+  {
+    double turns_ = x / (2.0 * kPi);
+    x -= (double)(int64_t)(turns_ + (turns_ < 0.0 ? -0.5 : 0.5)) * 2.0 * kPi;
+
+    double term_ = x;
+    double sum_ = x;
+
+    for (int n = 1; n < 20; ++n)
+    {
+      term_ *= -x * x / ((2 * n) * (2 * n + 1));
+      sum_ += term_;
+    }
+
+    return sum_;
+  }
+
+  constexpr double cosine(double x)
+  {
+    return sine(x + kPi / 2.0);
+  }
+
+  // atan(x) = pi/4 + atan((x - 1) / (x + 1)) keeps the series argument under 0.42 for x in [0, 1]
+  constexpr double arctangent(double x)
+  {
+    double base_ = 0.0;
+
+    if (x > 0.41421356)
+    {
+      base_ = kPi / 4.0;
+      x = (x - 1.0) / (x + 1.0);
+    }
+
+    double power_ = x;
+    double sum_ = x;
+
+    for (int n = 1; n < 25; ++n)
+    {
+      power_ *= -x * x;
+      sum_ += power_ / (2 * n + 1);
+    }
+
+    return base_ + sum_;
+  }
+
+  struct FineTables
+  {
+    // finesine has a quarter turn more so finecosine can start a quarter turn in
+    int32_t m_sine[5 * kFineAngles / 4];
+    int32_t m_tangent[kFineAngles / 2];
+    uint32_t m_tan_to_angle[kSlopeRange + 1];
+  };
+
+  constexpr FineTables make_fine_tables()
+  {
+    FineTables tables_ = {};
+
+    for (int i = 0; i < 5 * kFineAngles / 4; ++i)
+      tables_.m_sine[i] = (int32_t)(kFracUnit * sine((i + 0.5) * 2.0 * kPi / kFineAngles));
+
+    // Tangents from -90 to 90 degrees, sampled half a step off so neither end is infinite
+    for (int i = 0; i < kFineAngles / 2; ++i)
+    {
+      double a_ = (i - kFineAngles / 4 + 0.5) * kPi / (kFineAngles / 2);
+      tables_.m_tangent[i] = (int32_t)(kFracUnit * sine(a_) / cosine(a_));
+    }
+
+    for (int i = 0; i <= kSlopeRange; ++i)
+      tables_.m_tan_to_angle[i] = (uint32_t)(arctangent((double)i / kSlopeRange) / (2.0 * kPi) * 4294967296.0);
+
+    return tables_;
+  }
+
+  inline constexpr FineTables kTables = make_fine_tables();
+}
+
+constexpr Fixed abs(Fixed value)
+{
+  return (value < Fixed()) ? -value : value;
+}
+
+// P_AproxDistance, the length of (dx, dy) within about 10% without a square root
+constexpr Fixed approx_distance(Fixed dx, Fixed dy)
+{
+  dx = abs(dx);
+  dy = abs(dy);
+
+  return dx + dy - Fixed::from_raw(((dx < dy) ? dx : dy).raw() >> 1);
+}
+
+// finesine, finecosine and finetangent
+constexpr Fixed fine_sine(int fine)
+{
+  return Fixed::from_raw(fixed_detail::kTables.m_sine[fine]);
+}
+
+constexpr Fixed fine_cosine(int fine)
+{
+  return Fixed::from_raw(fixed_detail::kTables.m_sine[fine + kFineAngles / 4]);
+}
+
+constexpr Fixed fine_tangent(int fine)
+{
+  return Fixed::from_raw(fixed_detail::kTables.m_tangent[fine]);
+}
+
+constexpr Fixed sine(BAM angle)
+{
+  return fine_sine(angle.fine());
+}
+
+constexpr Fixed cosine(BAM angle)
+{
+  return fine_cosine(angle.fine());
+}
+
+// tantoangle, the angle of slopes from 0 to 1 in kSlopeRange steps
+constexpr BAM tan_to_angle(unsigned int slope)
+{
+  return BAM::from_raw(fixed_detail::kTables.m_tan_to_angle[slope]);
+}
+
+// SlopeDiv, the index in the arctangent table of num / den when num <= den
+constexpr unsigned int slope_div(uint32_t num, uint32_t den)
+{
+  if (den < 512)
+    return kSlopeRange;
+
+  unsigned int slope_ = (num << 3) / (den >> 8);
+  return (slope_ <= kSlopeRange) ? slope_ : kSlopeRange;
+}
+
+// Angle of the vector (x, y), i.e., atan2(y, x) as a BAM, worked out one octant at a time with the
+// arctangent table like R_PointToAngle. Same algorithm as vanilla, the results only match it as far as
+// the generated arctangent table matches tantoangle.
+constexpr BAM point_to_angle(Fixed x, Fixed y)
+{
+  if (x.raw() == 0 && y.raw() == 0)
+    return BAM();
+
+  uint32_t ax_ = (x.raw() < 0) ? 0u - (uint32_t)x.raw() : (uint32_t)x.raw();
+  uint32_t ay_ = (y.raw() < 0) ? 0u - (uint32_t)y.raw() : (uint32_t)y.raw();
+
+  if (x.raw() >= 0)
+  {
+    if (y.raw() >= 0)
+    {
+      if (ax_ > ay_)
+        return tan_to_angle(slope_div(ay_, ax_));
+
+      return kAng90 - BAM::from_raw(1) - tan_to_angle(slope_div(ax_, ay_));
+    }
+
+    if (ax_ > ay_)
+      return -tan_to_angle(slope_div(ay_, ax_));
+
+    return kAng270 + tan_to_angle(slope_div(ax_, ay_));
+  }
+
+  if (y.raw() >= 0)
+  {
+    if (ax_ > ay_)
+      return kAng180 - BAM::from_raw(1) - tan_to_angle(slope_div(ay_, ax_));
+
+    return kAng90 + tan_to_angle(slope_div(ax_, ay_));
+  }
+
+  if (ax_ > ay_)
+    return kAng180 + tan_to_angle(slope_div(ay_, ax_));
+
+  return kAng270 - BAM::from_raw(1) - tan_to_angle(slope_div(ax_, ay_));
+}
+
+static_assert(sizeof(Fixed) == sizeof(int32_t), "Fixed must be a plain 32 bit integer");
+static_assert(sizeof(BAM) == sizeof(uint32_t), "BAM must be a plain 32 bit integer");
+static_assert(tan_to_angle(kSlopeRange) == kAng45, "The arctangent table must end at 45 degrees");
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef GAME_LOOP_HPP_
+#define GAME_LOOP_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "fixed.hpp"
+#include "game_state.hpp"
+#include "profiler.hpp"
+
+// The game simulation runs in tics of 1/35 s like DOOM, always the same fixed step no matter how fast
+// frames are drawn. Frames interpolate between the last two simulated states, so rendering can go
+// uncapped (or at the display rate) and still move smoothly.
+
+const unsigned int kTicRate = 35;
+
+// Runs the simulation up to the tics asked for, in a worker thread when threaded so the next tics are
+// simulated while the frame of the previous ones is drawn. Frames only ever see the published players,
+// the ones of the last two tics of the last batch that finished, so the worker never races with the
+// renderer. The whole state is only copied at construction, a tic just keeps the player it started from.
+class GameLoop
+{
+  public:
+
+    // Gives the command of every tic, e.g., from the input devices or a demo
+    using CommandSource = std::function<TicCmd(uint32_t)>;
+
+    GameLoop(const GameState & crInitial, CommandSource source, bool threaded)
+      : m_source(source), m_working(crInitial)
+    {
+      m_working_previous = crInitial.m_player;
+      m_previous = crInitial.m_player;
+      m_current = crInitial.m_player;
+      m_current_tic = crInitial.m_tic;
+      m_target = crInitial.m_tic;
+      m_running = false;
+      m_stop = false;
+
+      if (threaded)
+        m_worker = std::thread(&GameLoop::worker, this);
+    }
+
+    ~GameLoop()
+    {
+      if (!m_worker.joinable())
+        return;
+
+      {
+        std::lock_guard<std::mutex> lock_(m_mutex);
+        m_stop = true;
+      }
+
+      m_start_condition.notify_all();
+      m_worker.join();
+    }
+
+    GameLoop(const GameLoop &) = delete;
+    GameLoop & operator=(const GameLoop &) = delete;
+
+    // Starts simulating up to the given tic. Without a worker the tics run right away and are published
+    // at once.
+    void begin_tics(uint32_t tic)
+    {
+      if (!m_worker.joinable())
+      {
+        run_to(tic);
+        publish();
+        return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock_(m_mutex);
+        m_target = tic;
+        m_running = true;
+      }
+
+      m_start_condition.notify_one();
+    }
+
+    // Waits for the tics started by begin_tics and publishes the states they produced
+    void end_tics()
+    {
+      if (!m_worker.joinable())
+        return;
+
+      std::unique_lock<std::mutex> lock_(m_mutex);
+      m_done_condition.wait(lock_, [this] { return !m_running; });
+      publish();
+    }
+
+    // Last published tic
+    uint32_t tic() const
+    {
+      return m_current_tic;
+    }
+
+    // The state being simulated, only safe to look at between end_tics and the next begin_tics
+    const GameState & state() const
+    {
+      return m_working;
+    }
+
+    // Time spent simulating tics so far, like state() only safe to look at between end_tics and the next
+    // begin_tics
+    double simulation_ms() const
+    {
+      return m_simulation_ms;
+    }
+
+    // Player between the last two published tics, alpha going from 0 (the previous one) to 1
+    PlayerState interpolated_player(float alpha) const
+    {
+      const PlayerState & crFrom = m_previous;
+      const PlayerState & crTo = m_current;
+      Fixed alpha_ = Fixed::from_float(alpha);
+
+      PlayerState player_ = crTo;
+      player_.m_x = crFrom.m_x + (crTo.m_x - crFrom.m_x) * alpha_;
+      player_.m_y = crFrom.m_y + (crTo.m_y - crFrom.m_y) * alpha_;
+      player_.m_z = crFrom.m_z + (crTo.m_z - crFrom.m_z) * alpha_;
+
+      // Turn the short way around
+      Fixed turn_ = Fixed::from_raw((int32_t)(crTo.m_angle - crFrom.m_angle).raw());
+      player_.m_angle = crFrom.m_angle + BAM::from_raw((uint32_t)(turn_ * alpha_).raw());
+
+      return player_;
+    }
+
+  private:
+
+    void worker()
+    {
+      PROFILE_THREAD("simulation");
+
+      while (true)
+      {
+        uint32_t target_;
+
+        {
+          std::unique_lock<std::mutex> lock_(m_mutex);
+          m_start_condition.wait(lock_, [this] { return m_stop || m_running; });
+
+          if (m_stop)
+            return;
+
+          target_ = m_target;
+        }
+
+        run_to(target_);
+
+        {
+          std::lock_guard<std::mutex> lock_(m_mutex);
+          m_running = false;
+        }
+
+        m_done_condition.notify_one();
+      }
+    }
+
+    void run_to(uint32_t tic)
+    {
+      auto start_ = std::chrono::steady_clock::now();
+
+      while (m_working.m_tic < tic)
+      {
+        m_working_previous = m_working.m_player;
+        run_tic(m_working, m_source(m_working.m_tic));
+      }
+
+      m_simulation_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+    void publish()
+    {
+      m_previous = m_working_previous;
+      m_current = m_working.m_player;
+      m_current_tic = m_working.m_tic;
+    }
+
+    CommandSource m_source;
+
+    // Only touched by whoever runs the tics
+    GameState m_working;
+    PlayerState m_working_previous;
+    double m_simulation_ms = 0.0;
+
+    // Only touched by the frame loop
+    PlayerState m_previous;
+    PlayerState m_current;
+    uint32_t m_current_tic;
+
+    std::thread m_worker;
+    std::mutex m_mutex;
+    std::condition_variable m_start_condition;
+    std::condition_variable m_done_condition;
+    uint32_t m_target;
+    bool m_running;
+    bool m_stop;
+};
+
+#endif
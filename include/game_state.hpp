@@ -0,0 +1,271 @@
+#ifndef GAME_STATE_HPP_
+#define GAME_STATE_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include "collision.hpp"
+#include "fixed.hpp"
+#include "level_geometry.hpp"
+#include "map_objects.hpp"
+#include "profiler.hpp"
+#include "sight.hpp"
+#include "wad.hpp"
+
+// Everything the game simulation works on and how it advances one tic. Only fixed point math is used so
+// a given sequence of commands always produces the same states.
+
+// Eyes above the feet of the player
+const Fixed kViewHeight = Fixed::from_int(41);
+
+// Skills go from 0 (I'm too young to die) to 4 (nightmare), levels are played in ultra-violence unless a
+// demo says otherwise. Things are skipped unless single player on the skill level played.
+const unsigned int kDefaultSkill = 3;
+const unsigned short kThingMultiplayer = 0x0010;
+
+// The two easiest skills share the first flag and nightmare has the things of ultra-violence
+inline unsigned short thing_skill_mask(unsigned int skill)
+{
+  return (skill <= 1) ? 0x0001 : (skill == 2) ? 0x0002 : 0x0004;
+}
+
+// Player input for one tic, like DOOM's ticcmd_t
+struct TicCmd
+{
+  signed char m_forward_move;
+  signed char m_side_move;
+
+  // Top 16 bits of a BAM
+  short m_angle_turn;
+
+  // Fire, use and weapon change, not simulated yet but kept as demos record them
+  unsigned char m_buttons;
+};
+
+// Where the player looks from, taken at the end of every tic for the frames to draw
+struct PlayerState
+{
+  Fixed m_x;
+  Fixed m_y;
+  Fixed m_z;
+  BAM m_angle;
+};
+
+struct GameState
+{
+  uint32_t m_tic = 0;
+  PlayerState m_player = {};
+  Handle m_player_mobj;
+  MapObjects m_mobjs;
+  LevelCollision m_collision;
+  LevelSight m_sight;
+};
+
+// P_SpawnMobj, places a new object in the level standing on the floor (or at z if that is higher)
+inline Handle spawn_mobj(GameState & rState, unsigned short type, Fixed x, Fixed y, Fixed z)
+{
+  Handle handle_ = rState.m_mobjs.spawn(make_mobj(type, x, y));
+  rState.m_collision.link(rState.m_mobjs, handle_);
+
+  MapObject & rMobj = *rState.m_mobjs.get(handle_);
+  rMobj.m_floor_z = rState.m_collision.floor_height(rMobj.m_sector);
+  rMobj.m_ceiling_z = rState.m_collision.ceiling_height(rMobj.m_sector);
+  rMobj.m_z = (z < rMobj.m_floor_z) ? rMobj.m_floor_z : z;
+
+  return handle_;
+}
+
+// P_RemoveMobj
+inline void remove_mobj(GameState & rState, Handle handle)
+{
+  rState.m_collision.unlink(handle);
+  rState.m_mobjs.remove(handle);
+}
+
+inline void update_player_view(GameState & rState)
+{
+  const MapObject * pPlayer = rState.m_mobjs.get(rState.m_player_mobj);
+
+  if (pPlayer == nullptr)
+    return;
+
+  rState.m_player.m_x = pPlayer->m_x;
+  rState.m_player.m_y = pPlayer->m_y;
+  rState.m_player.m_z = pPlayer->m_z + kViewHeight;
+  rState.m_player.m_angle = pPlayer->m_angle;
+}
+
+// Spawns the player at the player 1 start and the things of the level that appear in single player at
+// the given skill
+inline void start_level(GameState & rState, const WADLevel & crLevel, unsigned int skill = kDefaultSkill)
+{
+  unsigned short skill_mask_ = thing_skill_mask(skill);
+
+  rState.m_tic = 0;
+  rState.m_mobjs.clear();
+  rState.m_collision = LevelCollision(crLevel);
+  rState.m_sight = LevelSight(crLevel);
+  rState.m_mobjs.reserve(crLevel.things.size());
+  rState.m_player_mobj = Handle();
+
+  for (const WADLevelThing & crThing : crLevel.things)
+  {
+    // Only the first player is played, other starts are left out
+    if (crThing.type >= 2 && crThing.type <= 4)
+      continue;
+
+    if (crThing.type != 1 && ((crThing.options & kThingMultiplayer) || !(crThing.options & skill_mask_)))
+      continue;
+
+    if (crThing.type == 1 && rState.m_mobjs.alive(rState.m_player_mobj))
+      continue;
+
+    Handle handle_ = spawn_mobj(rState, crThing.type, Fixed::from_int(crThing.x), Fixed::from_int(crThing.y), Fixed());
+    rState.m_mobjs.get(handle_)->m_angle = thing_angle(crThing);
+
+    if (crThing.type == 1)
+      rState.m_player_mobj = handle_;
+  }
+
+  update_player_view(rState);
+}
+
+// Which monsters see the player, the handles of the ones checked go to rMonsters and whether each sees
+// the player to rVisible, all in one pass over the objects
+inline void monsters_see_player(GameState & rState, std::vector<Handle> & rMonsters, std::vector<uint8_t> & rVisible)
+{
+  rMonsters.clear();
+
+  for (size_t i = 0; i < rState.m_mobjs.size(); ++i)
+  {
+    if ((rState.m_mobjs[i].m_flags & MOBJ_FLAG_COUNTKILL) && !rState.m_mobjs.removed(i))
+      rMonsters.push_back(rState.m_mobjs.handle(i));
+  }
+
+  rState.m_sight.check_sight(rState.m_collision, rState.m_mobjs, rMonsters, rState.m_player_mobj, rVisible);
+}
+
+inline void thrust(MapObject & rMobj, BAM angle, Fixed move)
+{
+  rMobj.m_momentum_x += move * cosine(angle);
+  rMobj.m_momentum_y += move * sine(angle);
+}
+
+// P_ZMovement, falls with gravity and stays between the floor and the ceiling. Returns false when a
+// missile hit either and has to explode.
+inline bool z_movement(MapObject & rMobj)
+{
+  rMobj.m_z += rMobj.m_momentum_z;
+
+  if (rMobj.m_z <= rMobj.m_floor_z)
+  {
+    rMobj.m_z = rMobj.m_floor_z;
+
+    if (rMobj.m_momentum_z < Fixed())
+      rMobj.m_momentum_z = Fixed();
+
+    if (rMobj.m_flags & MOBJ_FLAG_MISSILE)
+      return false;
+  }
+  else if (!(rMobj.m_flags & MOBJ_FLAG_NOGRAVITY))
+  {
+    rMobj.m_momentum_z -= kGravity;
+  }
+
+  if (rMobj.m_z + rMobj.m_height > rMobj.m_ceiling_z)
+  {
+    rMobj.m_z = rMobj.m_ceiling_z - rMobj.m_height;
+
+    if (rMobj.m_momentum_z > Fixed())
+      rMobj.m_momentum_z = Fixed();
+
+    if (rMobj.m_flags & MOBJ_FLAG_MISSILE)
+      return false;
+  }
+
+  return true;
+}
+
+// One tic of a map object (P_MobjThinker without states): movement clipped against the level, friction
+// on the floor, gravity and lifetime
+inline void mobj_thinker(GameState & rState, size_t index)
+{
+  MapObjects & rMobjs = rState.m_mobjs;
+  Handle handle_ = rMobjs.handle(index);
+
+  if (rMobjs[index].m_momentum_x != Fixed() || rMobjs[index].m_momentum_y != Fixed())
+  {
+    if (!rState.m_collision.xy_movement(rMobjs, handle_))
+    {
+      remove_mobj(rState, handle_);
+      return;
+    }
+  }
+
+  MapObject & rMobj = rMobjs[index];
+
+  // Things on the floor slow down, flying ones and missiles keep their speed
+  if (!(rMobj.m_flags & MOBJ_FLAG_MISSILE) && rMobj.m_z <= rMobj.m_floor_z)
+  {
+    if (abs(rMobj.m_momentum_x) < kStopSpeed && abs(rMobj.m_momentum_y) < kStopSpeed)
+    {
+      rMobj.m_momentum_x = Fixed();
+      rMobj.m_momentum_y = Fixed();
+    }
+    else
+    {
+      rMobj.m_momentum_x *= kFriction;
+      rMobj.m_momentum_y *= kFriction;
+    }
+  }
+
+  if ((rMobj.m_z != rMobj.m_floor_z || rMobj.m_momentum_z != Fixed()) && !z_movement(rMobj))
+  {
+    remove_mobj(rState, handle_);
+    return;
+  }
+
+  if (rMobj.m_tics > 0 && --rMobj.m_tics == 0)
+    remove_mobj(rState, handle_);
+}
+
+// P_RunThinkers. Objects spawned during the tic are run in it too, objects removed during it are skipped
+// and only really go away at the end.
+inline void run_mobjs(GameState & rState)
+{
+  for (size_t i = 0; i < rState.m_mobjs.size(); ++i)
+  {
+    if (!rState.m_mobjs.removed(i))
+      mobj_thinker(rState, i);
+  }
+
+  rState.m_mobjs.flush();
+}
+
+// Advances the state by one tic
+inline void run_tic(GameState & rState, const TicCmd & crCmd)
+{
+  PROFILE_ZONE("run_tic");
+
+  MapObject * pPlayer = rState.m_mobjs.get(rState.m_player_mobj);
+
+  if (pPlayer != nullptr)
+  {
+    pPlayer->m_angle += BAM::from_raw((uint32_t)(uint16_t)crCmd.m_angle_turn << 16);
+
+    // Moves are in units of 2048/65536 map units per tic and only push while on the ground, like
+    // P_MovePlayer
+    if (pPlayer->m_z <= pPlayer->m_floor_z)
+    {
+      thrust(*pPlayer, pPlayer->m_angle, Fixed::from_raw(crCmd.m_forward_move * 2048));
+      thrust(*pPlayer, pPlayer->m_angle - kAng90, Fixed::from_raw(crCmd.m_side_move * 2048));
+    }
+  }
+
+  run_mobjs(rState);
+  update_player_view(rState);
+
+  ++rState.m_tic;
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef HASH_HPP_
+#define HASH_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// 64-bit content hash of a block of bytes, XXH64. The input is consumed in 32-byte stripes by four
+// independent lanes, there are no dependencies between them so the compiler keeps them in flight at
+// once (and vectorizes them where 64-bit multiplies are available), hashing runs at memory speed.
+// Identical bytes always give the same hash on every machine, so hashes can be stored on disk.
+
+namespace hash_detail
+{
+  const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+  const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+  const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+  const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+  const uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+  inline uint64_t rotate_left(uint64_t value, int bits)
+  {
+    return (value << bits) | (value >> (64 - bits));
+  }
+
+  // Little-endian loads, like the WAD data itself
+  inline uint64_t read64(const uint8_t * pData)
+  {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t value_;
+    memcpy(&value_, pData, sizeof(value_));
+    return value_;
+#else
+    uint64_t value_ = 0;
+
+    for (int i = 7; i >= 0; --i)
+      value_ = (value_ << 8) | pData[i];
+
+    return value_;
+#endif
+  }
+
+  inline uint32_t read32(const uint8_t * pData)
+  {
+    return (uint32_t)pData[0] | ((uint32_t)pData[1] << 8) | ((uint32_t)pData[2] << 16) | ((uint32_t)pData[3] << 24);
+  }
+
+  inline uint64_t round(uint64_t accumulator, uint64_t input)
+  {
+    accumulator += input * kPrime2;
+    accumulator = rotate_left(accumulator, 31);
+    return accumulator * kPrime1;
+  }
+
+  inline uint64_t merge_round(uint64_t accumulator, uint64_t lane)
+  {
+    accumulator ^= round(0, lane);
+    return accumulator * kPrime1 + kPrime4;
+  }
+}
+
+inline uint64_t hash64(const uint8_t * pData, size_t size, uint64_t seed = 0)
+{
+  using namespace hash_detail;
+
+  const uint8_t * pEnd = pData + size;
+  uint64_t hash_;
+
+  if (size >= 32)
+  {
+    uint64_t lanes_[4] = { seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1 };
+
+    for (; pData + 32 <= pEnd; pData += 32)
+    {
+      for (int l = 0; l < 4; ++l)
+        lanes_[l] = round(lanes_[l], read64(pData + l * 8));
+    }
+
+    hash_ = rotate_left(lanes_[0], 1) + rotate_left(lanes_[1], 7) + rotate_left(lanes_[2], 12) + rotate_left(lanes_[3], 18);
+
+    for (int l = 0; l < 4; ++l)
+      hash_ = merge_round(hash_, lanes_[l]);
+  }
+  else
+  {
+    hash_ = seed + kPrime5;
+  }
+
+  hash_ += size;
+
+  for (; pData + 8 <= pEnd; pData += 8)
+    hash_ = rotate_left(hash_ ^ round(0, read64(pData)), 27) * kPrime1 + kPrime4;
+
+  if (pData + 4 <= pEnd)
+  {
+    hash_ = rotate_left(hash_ ^ (read32(pData) * kPrime1), 23) * kPrime2 + kPrime3;
+    pData += 4;
+  }
+
+  for (; pData < pEnd; ++pData)
+    hash_ = rotate_left(hash_ ^ (*pData * kPrime5), 11) * kPrime1;
+
+  // Final avalanche so every input bit affects every output bit
+  hash_ ^= hash_ >> 33;
+  hash_ *= kPrime2;
+  hash_ ^= hash_ >> 29;
+  hash_ *= kPrime3;
+  hash_ ^= hash_ >> 32;
+
+  return hash_;
+}
+
+// Folds another hash into a running one, e.g., to hash a level from the hashes of its lumps
+inline uint64_t hash_combine(uint64_t hash, uint64_t other)
+{
+  return hash_detail::merge_round(hash, other);
+}
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef LEVEL_CACHE_HPP_
+#define LEVEL_CACHE_HPP_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "logger.hpp"
+#include "mapped_file.hpp"
+#include "profiler.hpp"
+#include "wad.hpp"
+
+// On-disk cache of parsed levels. Each level is stored in a file of its own named after the level and the
+// hash of its lumps, so editing a map (or mounting a PWAD that replaces it) simply misses the cache. The
+// file is a header followed by flat arrays of fixed size records at 8-byte aligned offsets from the start
+// of the file, it is position independent and is loaded by mapping it and copying the arrays out, there
+// is no field by field parsing. The blockmap is stored flattened and REJECT packed, like the level keeps
+// them, and REJECT (by far the largest section, up to 512 MiB) is not even copied: the level points into
+// the mapping, which stays mapped for as long as the level (or a copy of it) lives.
+//
+// Files are written in the byte order of the machine, a cache is not meant to be shared between machines
+// of different endianness (it would just always miss).
+
+const char kLevelCacheMagic[8] = { 'D', 'F', 'S', 'L', 'E', 'V', 'E', 'L' };
+const uint32_t kLevelCacheVersion = 1;
+const uint32_t kLevelCacheByteOrder = 0x01020304;
+
+enum class LevelCacheSection : uint32_t
+{
+  kThings,
+  kLinedefs,
+  kSidedefs,
+  kVertexes,
+  kSegs,
+  kSubsectors,
+  kNodes,
+  kSectors,
+  kBlockmapOffsets,
+  kBlockmapLines,
+  kReject,
+  kCount
+};
+
+struct LevelCacheSectionEntry
+{
+  uint64_t m_offset;
+  uint32_t m_count;
+  uint32_t m_stride;
+};
+
+struct LevelCacheHeader
+{
+  char m_magic[8];
+  uint32_t m_version;
+  uint32_t m_byte_order;
+  uint64_t m_hash;
+  char m_name[WAD_ENTRY_NAME_LENGTH];
+
+  short m_blockmap_x;
+  short m_blockmap_y;
+  unsigned short m_blockmap_columns;
+  unsigned short m_blockmap_rows;
+  uint32_t m_sectors;
+  uint32_t m_padding;
+
+  LevelCacheSectionEntry m_sections[(size_t)LevelCacheSection::kCount];
+};
+
+// Sidedefs and sectors with their texture names stored like in the lumps, 8 characters padded with zeroes
+struct LevelCacheSidedef
+{
+  short m_x_offset;
+  short m_y_offset;
+  char m_upper_texture[WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH];
+  char m_lower_texture[WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH];
+  char m_middle_texture[WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH];
+  unsigned short m_sector;
+};
+
+struct LevelCacheSector
+{
+  short m_floor_height;
+  short m_ceiling_height;
+  char m_floor_texture[WAD_LEVEL_SECTOR_TEXTURE_NAME_LENGTH];
+  char m_ceiling_texture[WAD_LEVEL_SECTOR_TEXTURE_NAME_LENGTH];
+  unsigned short m_light_level;
+  unsigned short m_special;
+  unsigned short m_tag;
+};
+
+// The records copied straight from the mapping
+static_assert(std::is_trivially_copyable<WADLevelThing>::value, "THINGS are not plain records");
+static_assert(std::is_trivially_copyable<WADLevelLinedef>::value, "LINEDEFS are not plain records");
+static_assert(std::is_trivially_copyable<WADLevelVertex>::value, "VERTEXES are not plain records");
+static_assert(std::is_trivially_copyable<WADLevelSeg>::value, "SEGS are not plain records");
+static_assert(std::is_trivially_copyable<WADLevelSubSector>::value, "SSECTORS are not plain records");
+static_assert(std::is_trivially_copyable<WADLevelNode>::value, "NODES are not plain records");
+
+class LevelCache
+{
+  public:
+
+    LevelCache(const std::string & crDirectory)
+      : m_directory(crDirectory)
+    {
+
+    }
+
+    // Reads the level from the cache, false if it is not there (or the file is stale or broken)
+    bool load(const std::string & crName, uint64_t hash, WADLevel & rLevel) const
+    {
+      std::shared_ptr<MappedFile> pFile = std::make_shared<MappedFile>(path(crName, hash));
+      const MappedFile & file_ = *pFile;
+
+      if (!file_.mapped() || file_.size() < sizeof(LevelCacheHeader))
+        return false;
+
+      const LevelCacheHeader & crHeader = *(const LevelCacheHeader *)file_.data();
+
+      if (memcmp(crHeader.m_magic, kLevelCacheMagic, sizeof(kLevelCacheMagic)) != 0 ||
+          crHeader.m_version != kLevelCacheVersion ||
+          crHeader.m_byte_order != kLevelCacheByteOrder ||
+          crHeader.m_hash != hash ||
+          name_string(crHeader.m_name, WAD_ENTRY_NAME_LENGTH) != crName)
+        return false;
+
+      for (const LevelCacheSectionEntry & crSection : crHeader.m_sections)
+      {
+        if (crSection.m_offset % 8 != 0 || crSection.m_offset + (uint64_t)crSection.m_count * crSection.m_stride > file_.size())
+          return false;
+      }
+
+      WADLevel level_;
+      level_.name = crName;
+
+      if (!read_section(file_, LevelCacheSection::kThings, level_.things) ||
+          !read_section(file_, LevelCacheSection::kLinedefs, level_.linedefs) ||
+          !read_section(file_, LevelCacheSection::kVertexes, level_.vertices) ||
+          !read_section(file_, LevelCacheSection::kSegs, level_.segs) ||
+          !read_section(file_, LevelCacheSection::kSubsectors, level_.ssectors) ||
+          !read_section(file_, LevelCacheSection::kNodes, level_.nodes))
+        return false;
+
+      std::vector<LevelCacheSidedef> sidedefs_;
+      std::vector<LevelCacheSector> sectors_;
+
+      if (!read_section(file_, LevelCacheSection::kSidedefs, sidedefs_) ||
+          !read_section(file_, LevelCacheSection::kSectors, sectors_) ||
+          !read_section(file_, LevelCacheSection::kBlockmapOffsets, level_.blockmap.offsets) ||
+          !read_section(file_, LevelCacheSection::kBlockmapLines, level_.blockmap.lines))
+        return false;
+
+      level_.sidedefs.reserve(sidedefs_.size());
+      for (const LevelCacheSidedef & crSide : sidedefs_)
+      {
+        level_.sidedefs.push_back({ crSide.m_x_offset,
+                                    crSide.m_y_offset,
+                                    name_string(crSide.m_upper_texture, WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH),
+                                    name_string(crSide.m_lower_texture, WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH),
+                                    name_string(crSide.m_middle_texture, WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH),
+                                    crSide.m_sector });
+      }
+
+      level_.sectors.reserve(sectors_.size());
+      for (const LevelCacheSector & crSector : sectors_)
+      {
+        level_.sectors.push_back({ crSector.m_floor_height,
+                                   crSector.m_ceiling_height,
+                                   name_string(crSector.m_floor_texture, WAD_LEVEL_SECTOR_TEXTURE_NAME_LENGTH),
+                                   name_string(crSector.m_ceiling_texture, WAD_LEVEL_SECTOR_TEXTURE_NAME_LENGTH),
+                                   crSector.m_light_level,
+                                   crSector.m_special,
+                                   crSector.m_tag });
+      }
+
+      level_.blockmap.x = crHeader.m_blockmap_x;
+      level_.blockmap.y = crHeader.m_blockmap_y;
+      level_.blockmap.num_cols = crHeader.m_blockmap_columns;
+      level_.blockmap.num_rows = crHeader.m_blockmap_rows;
+
+      const std::vector<uint32_t> & crOffsets = level_.blockmap.offsets;
+
+      for (size_t i = 0; i + 1 < crOffsets.size(); ++i)
+      {
+        if (crOffsets[i] > crOffsets[i + 1] || crOffsets[i + 1] > level_.blockmap.lines.size())
+          return false;
+      }
+
+      // REJECT stays in the mapping, the level shares its ownership. Levels without a REJECT lump have no
+      // table at all.
+      const LevelCacheSectionEntry & crReject = crHeader.m_sections[(size_t)LevelCacheSection::kReject];
+
+      if (crReject.m_stride != sizeof(uint8_t) || crHeader.m_sectors != level_.sectors.size())
+        return false;
+
+      if (crReject.m_count != 0)
+      {
+        level_.reject.bits = std::shared_ptr<const uint8_t>(pFile, file_.data() + crReject.m_offset);
+        level_.reject.size = crReject.m_count;
+        level_.reject.sectors = crHeader.m_sectors;
+      }
+
+      rLevel = std::move(level_);
+
+      LOG_INFO("Loaded level from the cache", { { "level", crName }, { "bytes", file_.size() } });
+      return true;
+    }
+
+    // Writes the level to the cache. The file is written under a temporary name and renamed into place so
+    // other processes sharing the cache never map a half-written file.
+    void store(const WADLevel & crLevel, uint64_t hash) const
+    {
+      mkdir(m_directory.c_str(), 0755);
+
+      LevelCacheHeader header_ = {};
+      memcpy(header_.m_magic, kLevelCacheMagic, sizeof(kLevelCacheMagic));
+      header_.m_version = kLevelCacheVersion;
+      header_.m_byte_order = kLevelCacheByteOrder;
+      header_.m_hash = hash;
+      strncpy(header_.m_name, crLevel.name.c_str(), WAD_ENTRY_NAME_LENGTH);
+      header_.m_blockmap_x = crLevel.blockmap.x;
+      header_.m_blockmap_y = crLevel.blockmap.y;
+      header_.m_blockmap_columns = crLevel.blockmap.num_cols;
+      header_.m_blockmap_rows = crLevel.blockmap.num_rows;
+      header_.m_sectors = crLevel.sectors.size();
+
+      std::vector<LevelCacheSidedef> sidedefs_(crLevel.sidedefs.size());
+      for (size_t i = 0; i < crLevel.sidedefs.size(); ++i)
+      {
+        const WADLevelSidedef & crSide = crLevel.sidedefs[i];
+        sidedefs_[i].m_x_offset = crSide.x_offset;
+        sidedefs_[i].m_y_offset = crSide.y_offset;
+        strncpy(sidedefs_[i].m_upper_texture, crSide.upper_texture.c_str(), WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH);
+        strncpy(sidedefs_[i].m_lower_texture, crSide.lower_texture.c_str(), WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH);
+        strncpy(sidedefs_[i].m_middle_texture, crSide.middle_texture.c_str(), WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH);
+        sidedefs_[i].m_sector = crSide.sector;
+      }
+
+      std::vector<LevelCacheSector> sectors_(crLevel.sectors.size());
+      for (size_t i = 0; i < crLevel.sectors.size(); ++i)
+      {
+        const WADLevelSector & crSector = crLevel.sectors[i];
+        sectors_[i].m_floor_height = crSector.floor_height;
+        sectors_[i].m_ceiling_height = crSector.ceiling_height;
+        strncpy(sectors_[i].m_floor_texture, crSector.floor_texture.c_str(), WAD_LEVEL_SECTOR_TEXTURE_NAME_LENGTH);
+        strncpy(sectors_[i].m_ceiling_texture, crSector.ceiling_texture.c_str(), WAD_LEVEL_SECTOR_TEXTURE_NAME_LENGTH);
+        sectors_[i].m_light_level = crSector.light_level;
+        sectors_[i].m_special = crSector.special;
+        sectors_[i].m_tag = crSector.tag;
+      }
+
+      // A REJECT table of another sector count would be indexed wrong, it is left out
+      const WADLevelReject & crReject = crLevel.reject;
+      size_t reject_size_ = (crReject.sectors == crLevel.sectors.size()) ? crReject.size : 0;
+
+      // Lay the sections out one after the other behind the header
+      std::vector<std::pair<const void *, size_t>> chunks_;
+      uint64_t offset_ = align(sizeof(LevelCacheHeader));
+
+      auto add_ = [&](LevelCacheSection section, const void * pData, uint32_t count, uint32_t stride) {
+        header_.m_sections[(size_t)section] = { offset_, count, stride };
+        chunks_.push_back({ pData, (size_t)count * stride });
+        offset_ = align(offset_ + (uint64_t)count * stride);
+      };
+
+      add_(LevelCacheSection::kThings, crLevel.things.data(), crLevel.things.size(), sizeof(WADLevelThing));
+      add_(LevelCacheSection::kLinedefs, crLevel.linedefs.data(), crLevel.linedefs.size(), sizeof(WADLevelLinedef));
+      add_(LevelCacheSection::kSidedefs, sidedefs_.data(), sidedefs_.size(), sizeof(LevelCacheSidedef));
+      add_(LevelCacheSection::kVertexes, crLevel.vertices.data(), crLevel.vertices.size(), sizeof(WADLevelVertex));
+      add_(LevelCacheSection::kSegs, crLevel.segs.data(), crLevel.segs.size(), sizeof(WADLevelSeg));
+      add_(LevelCacheSection::kSubsectors, crLevel.ssectors.data(), crLevel.ssectors.size(), sizeof(WADLevelSubSector));
+      add_(LevelCacheSection::kNodes, crLevel.nodes.data(), crLevel.nodes.size(), sizeof(WADLevelNode));
+      add_(LevelCacheSection::kSectors, sectors_.data(), sectors_.size(), sizeof(LevelCacheSector));
+      add_(LevelCacheSection::kBlockmapOffsets, crLevel.blockmap.offsets.data(), crLevel.blockmap.offsets.size(), sizeof(uint32_t));
+      add_(LevelCacheSection::kBlockmapLines, crLevel.blockmap.lines.data(), crLevel.blockmap.lines.size(), sizeof(unsigned short));
+      add_(LevelCacheSection::kReject, crReject.bits.get(), reject_size_, sizeof(uint8_t));
+
+      std::string path_ = path(crLevel.name, hash);
+      std::string temporary_path_ = path_ + ".tmp";
+      std::ofstream file_(temporary_path_, std::ios::binary);
+
+      if (!file_)
+      {
+        std::cerr << "ERROR: Could not write the level cache file " << temporary_path_ << "\n";
+        return;
+      }
+
+      const char padding_[8] = {};
+
+      file_.write((const char *)&header_, sizeof(header_));
+      file_.write(padding_, align(sizeof(header_)) - sizeof(header_));
+
+      for (const std::pair<const void *, size_t> & crChunk : chunks_)
+      {
+        file_.write((const char *)crChunk.first, crChunk.second);
+        file_.write(padding_, align(crChunk.second) - crChunk.second);
+      }
+
+      file_.close();
+
+      if (!file_ || std::rename(temporary_path_.c_str(), path_.c_str()) != 0)
+      {
+        std::cerr << "ERROR: Could not write the level cache file " << path_ << "\n";
+        std::remove(temporary_path_.c_str());
+      }
+    }
+
+    // Loads the level from the cache or reads it from the WAD and caches it for the next time
+    WADLevel level(WAD & rWad, const std::string & crName) const
+    {
+      PROFILE_ZONE("LevelCache::level");
+
+      uint64_t hash_ = rWad.level_hash(crName);
+      WADLevel level_;
+
+      if (load(crName, hash_, level_))
+        return level_;
+
+      level_ = rWad.level(crName);
+      store(level_, hash_);
+
+      return level_;
+    }
+
+    std::string path(const std::string & crName, uint64_t hash) const
+    {
+      char hash_[17];
+      snprintf(hash_, sizeof(hash_), "%016llx", (unsigned long long)hash);
+
+      return m_directory + "/" + crName + "-" + hash_ + ".lvl";
+    }
+
+  private:
+
+    static uint64_t align(uint64_t offset)
+    {
+      return (offset + 7) & ~(uint64_t)7;
+    }
+
+    static std::string name_string(const char * pName, size_t length)
+    {
+      return std::string(pName, strnlen(pName, length));
+    }
+
+    template <typename T>
+    static bool read_section(const MappedFile & crFile, LevelCacheSection section, std::vector<T> & rRecords)
+    {
+      const LevelCacheHeader & crHeader = *(const LevelCacheHeader *)crFile.data();
+      const LevelCacheSectionEntry & crSection = crHeader.m_sections[(size_t)section];
+
+      if (crSection.m_stride != sizeof(T))
+        return false;
+
+      const T * pRecords = (const T *)(crFile.data() + crSection.m_offset);
+      rRecords.assign(pRecords, pRecords + crSection.m_count);
+
+      return true;
+    }
+
+    std::string m_directory;
+};
+
+#endif
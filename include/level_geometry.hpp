@@ -0,0 +1,127 @@
+#ifndef LEVEL_GEOMETRY_HPP_
+#define LEVEL_GEOMETRY_HPP_
+
+#include "fixed.hpp"
+#include "wad.hpp"
+
+// Small geometric queries over a parsed level shared by the renderers and the game code
+
+#define LEVEL_LINEDEF_FLAG_BLOCKING 0x0001
+#define LEVEL_LINEDEF_FLAG_TWO_SIDED 0x0004
+#define LEVEL_LINEDEF_FLAG_UPPER_UNPEGGED 0x0008
+#define LEVEL_LINEDEF_FLAG_LOWER_UNPEGGED 0x0010
+#define LEVEL_SUBSECTOR_FLAG 0x8000
+#define LEVEL_NO_SIDEDEF 0xFFFF
+
+const std::string kSkyFlatName = "F_SKY1";
+
+// Side of the directed line (x, y) + t * (dx, dy) a point lies on, positive means the right side,
+// which is the front side of both BSP partition lines and segs
+inline double line_side(double x, double y, double dx, double dy, double px, double py)
+{
+  return (px - x) * dy - (py - y) * dx;
+}
+
+inline bool point_on_node_front(const WADLevelNode & crNode, double x, double y)
+{
+  return line_side(crNode.x_start, crNode.y_start, crNode.dx, crNode.dy, x, y) > 0.0;
+}
+
+// R_PointOnSide, the same test in fixed point so the game code picks exactly the subsectors DOOM picks
+inline bool point_on_node_front(const WADLevelNode & crNode, Fixed x, Fixed y)
+{
+  if (crNode.dx == 0)
+    return (x <= Fixed::from_int(crNode.x_start)) ? crNode.dy < 0 : crNode.dy > 0;
+
+  if (crNode.dy == 0)
+    return (y <= Fixed::from_int(crNode.y_start)) ? crNode.dx > 0 : crNode.dx < 0;
+
+  Fixed dx_ = x - Fixed::from_int(crNode.x_start);
+  Fixed dy_ = y - Fixed::from_int(crNode.y_start);
+
+  // Different signs decide without multiplying
+  if ((crNode.dy ^ crNode.dx ^ dx_.raw() ^ dy_.raw()) & 0x80000000)
+    return !((crNode.dy ^ dx_.raw()) & 0x80000000);
+
+  Fixed left_ = Fixed::from_raw(crNode.dy) * dx_;
+  Fixed right_ = dy_ * Fixed::from_raw(crNode.dx);
+
+  return right_ < left_;
+}
+
+// Segs store their angle as the top 16 bits of a BAM
+inline BAM seg_angle(const WADLevelSeg & crSeg)
+{
+  return BAM::from_short(crSeg.angle);
+}
+
+// Things face one of 8 directions given in degrees, which map exactly to multiples of 45 degrees in BAM
+inline BAM thing_angle(const WADLevelThing & crThing)
+{
+  return kAng45 * (uint32_t)(crThing.angle / 45);
+}
+
+inline unsigned short seg_front_sidedef(const WADLevel & crLevel, const WADLevelSeg & crSeg)
+{
+  const WADLevelLinedef & crLinedef = crLevel.linedefs[crSeg.linedef];
+  return crSeg.direction == 0 ? crLinedef.right_sidedef : crLinedef.left_sidedef;
+}
+
+inline unsigned short seg_back_sidedef(const WADLevel & crLevel, const WADLevelSeg & crSeg)
+{
+  const WADLevelLinedef & crLinedef = crLevel.linedefs[crSeg.linedef];
+  return crSeg.direction == 0 ? crLinedef.left_sidedef : crLinedef.right_sidedef;
+}
+
+inline unsigned short subsector_sector(const WADLevel & crLevel, unsigned int subsector)
+{
+  const WADLevelSeg & crSeg = crLevel.segs[crLevel.ssectors[subsector].start_seg];
+  return crLevel.sidedefs[seg_front_sidedef(crLevel, crSeg)].sector;
+}
+
+// Walks the BSP down to the subsector that contains the point
+inline unsigned int point_in_subsector(const WADLevel & crLevel, double x, double y)
+{
+  // A level with a single subsector has no nodes at all
+  if (crLevel.nodes.empty())
+    return 0;
+
+  unsigned short child_ = crLevel.nodes.size() - 1;
+
+  while (!(child_ & LEVEL_SUBSECTOR_FLAG))
+  {
+    const WADLevelNode & crNode = crLevel.nodes[child_];
+    child_ = point_on_node_front(crNode, x, y) ? crNode.right_child : crNode.left_child;
+  }
+
+  return child_ & ~LEVEL_SUBSECTOR_FLAG;
+}
+
+// R_PointInSubsector, for the game code
+inline unsigned int point_in_subsector(const WADLevel & crLevel, Fixed x, Fixed y)
+{
+  if (crLevel.nodes.empty())
+    return 0;
+
+  unsigned short child_ = crLevel.nodes.size() - 1;
+
+  while (!(child_ & LEVEL_SUBSECTOR_FLAG))
+  {
+    const WADLevelNode & crNode = crLevel.nodes[child_];
+    child_ = point_on_node_front(crNode, x, y) ? crNode.right_child : crNode.left_child;
+  }
+
+  return child_ & ~LEVEL_SUBSECTOR_FLAG;
+}
+
+inline unsigned short point_in_sector(const WADLevel & crLevel, double x, double y)
+{
+  return subsector_sector(crLevel, point_in_subsector(crLevel, x, y));
+}
+
+inline unsigned short point_in_sector(const WADLevel & crLevel, Fixed x, Fixed y)
+{
+  return subsector_sector(crLevel, point_in_subsector(crLevel, x, y));
+}
+
+#endif
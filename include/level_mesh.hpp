@@ -0,0 +1,491 @@
+#ifndef LEVEL_MESH_HPP_
+#define LEVEL_MESH_HPP_
+
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "level_geometry.hpp"
+#include "profiler.hpp"
+#include "wad.hpp"
+
+// Triangle soup of a whole level ready to be uploaded once to the GPU. Geometry is grouped in
+// surfaces (a wall quad or a subsector floor/ceiling polygon) and each surface references a texture
+// in the level texture table, so the renderer can issue one indirect draw per surface without ever
+// rebinding anything.
+
+const float kPlayerViewHeight = 41.0f;
+
+struct LevelVertex
+{
+  float m_x;
+  float m_y;
+  float m_z;
+
+  // Texture coordinates are in texels, the shaders wrap them with the size of the texture
+  float m_u;
+  float m_v;
+
+  float m_light;
+};
+
+struct LevelSurface
+{
+  uint32_t m_first_index;
+  uint32_t m_index_count;
+  uint32_t m_texture;
+};
+
+struct LevelTextureImage
+{
+  std::string m_name;
+  bool m_flat;
+  unsigned int m_width;
+  unsigned int m_height;
+
+  // Row-major RGBA8 texels
+  std::vector<uint8_t> m_rgba;
+};
+
+class LevelMesh
+{
+  public:
+
+    LevelMesh(const WAD & crWad, const WADLevel & crLevel)
+      : m_wad(crWad), m_level(crLevel)
+    {
+      PROFILE_ZONE("LevelMesh::LevelMesh");
+
+      build_walls();
+      build_flats();
+      find_player_start();
+
+      std::cout << "Built level mesh for " << m_level.name << " with " << m_vertices.size() << " vertices, "
+                << m_wall_surfaces.size() << " wall surfaces, " << m_flat_surfaces.size() << " flat surfaces and "
+                << m_textures.size() << " textures...\n";
+    }
+
+    const std::vector<LevelVertex> & vertices() const
+    {
+      return m_vertices;
+    }
+
+    const std::vector<uint32_t> & indices() const
+    {
+      return m_indices;
+    }
+
+    const std::vector<LevelSurface> & wall_surfaces() const
+    {
+      return m_wall_surfaces;
+    }
+
+    const std::vector<LevelSurface> & flat_surfaces() const
+    {
+      return m_flat_surfaces;
+    }
+
+    const std::vector<LevelTextureImage> & textures() const
+    {
+      return m_textures;
+    }
+
+    float start_x() const
+    {
+      return m_start_x;
+    }
+
+    float start_y() const
+    {
+      return m_start_y;
+    }
+
+    float start_z() const
+    {
+      return m_start_z;
+    }
+
+    float start_angle() const
+    {
+      return m_start_angle;
+    }
+
+  private:
+
+    struct Point
+    {
+      double x;
+      double y;
+    };
+
+    // Sutherland-Hodgman against a single line, keeps the front side (or the back side if flip is set)
+    static std::vector<Point> clip(const std::vector<Point> & crPolygon, double x, double y, double dx, double dy, bool flip)
+    {
+      const double kEpsilon = 1e-3;
+      std::vector<Point> out_;
+
+      for (size_t i = 0; i < crPolygon.size(); ++i)
+      {
+        const Point & a_ = crPolygon[i];
+        const Point & b_ = crPolygon[(i + 1) % crPolygon.size()];
+
+        double sa_ = line_side(x, y, dx, dy, a_.x, a_.y) * (flip ? -1.0 : 1.0);
+        double sb_ = line_side(x, y, dx, dy, b_.x, b_.y) * (flip ? -1.0 : 1.0);
+
+        if (sa_ >= -kEpsilon)
+          out_.push_back(a_);
+
+        if ((sa_ > kEpsilon && sb_ < -kEpsilon) || (sa_ < -kEpsilon && sb_ > kEpsilon))
+        {
+          double t_ = sa_ / (sa_ - sb_);
+          out_.push_back({ a_.x + (b_.x - a_.x) * t_, a_.y + (b_.y - a_.y) * t_ });
+        }
+      }
+
+      return out_;
+    }
+
+    uint32_t texture_index(const std::string & crName, bool flat)
+    {
+      std::string key_ = (flat ? "F:" : "T:") + crName;
+      auto it = m_texture_map.find(key_);
+
+      if (it != m_texture_map.end())
+        return it->second;
+
+      // Byte-identical textures (or flats) under different names are converted and uploaded only once
+      uint64_t hash_ = 0;
+
+      if (flat)
+        hash_ = m_wad.flat_hash(crName);
+      else if (m_wad.textures().count(crName) != 0)
+        hash_ = m_wad.textures().at(crName).hash;
+
+      // Missing ones are left apart so each is still reported
+      if (hash_ != 0)
+      {
+        hash_ = hash_combine(hash_, flat);
+        auto same_ = m_texture_hash_map.find(hash_);
+
+        if (same_ != m_texture_hash_map.end())
+        {
+          m_texture_map[key_] = same_->second;
+          return same_->second;
+        }
+      }
+
+      // Convert the indexed texture to RGBA once with the base palette and the brightest colormap, sector
+      // lighting is applied in the shader through the vertex color
+      const std::vector<WADPaletteColor> & palette_ = m_wad.palettes()[0];
+      const std::vector<uint8_t> & colormap_ = m_wad.colormaps()[0];
+
+      LevelTextureImage image_;
+      image_.m_name = crName;
+      image_.m_flat = flat;
+
+      if (flat)
+      {
+        auto flat_ = m_wad.flats().find(crName);
+
+        image_.m_width = WAD_FLAT_SIZE;
+        image_.m_height = WAD_FLAT_SIZE;
+        image_.m_rgba.assign(WAD_FLAT_SIZE * WAD_FLAT_SIZE * 4, 0);
+
+        if (flat_ != m_wad.flats().end())
+        {
+          for (unsigned int i = 0; i < WAD_FLAT_SIZE * WAD_FLAT_SIZE; ++i)
+          {
+            const WADPaletteColor & c_ = palette_[colormap_[flat_->second[i]]];
+            image_.m_rgba[i * 4 + 0] = c_.r;
+            image_.m_rgba[i * 4 + 1] = c_.g;
+            image_.m_rgba[i * 4 + 2] = c_.b;
+            image_.m_rgba[i * 4 + 3] = 255;
+          }
+        }
+        else
+          std::cerr << "ERROR: Missing flat " << crName << "\n";
+      }
+      else
+      {
+        auto texture_ = m_wad.textures().find(crName);
+
+        if (texture_ != m_wad.textures().end())
+        {
+          const WADTexture & crTexture = texture_->second;
+
+          image_.m_width = crTexture.width;
+          image_.m_height = crTexture.height;
+          image_.m_rgba.assign(crTexture.width * crTexture.height * 4, 0);
+
+          for (unsigned int x = 0; x < crTexture.width; ++x)
+          {
+            for (unsigned int y = 0; y < crTexture.height; ++y)
+            {
+              const WADPaletteColor & c_ = palette_[colormap_[crTexture.pixels[x * crTexture.height + y]]];
+              unsigned int idx_ = (y * crTexture.width + x) * 4;
+              image_.m_rgba[idx_ + 0] = c_.r;
+              image_.m_rgba[idx_ + 1] = c_.g;
+              image_.m_rgba[idx_ + 2] = c_.b;
+              image_.m_rgba[idx_ + 3] = 255;
+            }
+          }
+        }
+        else
+        {
+          std::cerr << "ERROR: Missing texture " << crName << "\n";
+
+          image_.m_width = 1;
+          image_.m_height = 1;
+          image_.m_rgba.assign(4, 255);
+        }
+      }
+
+      uint32_t index_ = m_textures.size();
+      m_textures.push_back(image_);
+      m_texture_map[key_] = index_;
+
+      if (hash_ != 0)
+        m_texture_hash_map[hash_] = index_;
+
+      return index_;
+    }
+
+    unsigned int texture_height(uint32_t texture)
+    {
+      return m_textures[texture].m_height;
+    }
+
+    void add_wall(const WADLevelVertex & crV1, const WADLevelVertex & crV2, float bottom, float top,
+                  float u0, float anchor, float yOffset, uint32_t texture, float light)
+    {
+      if (top <= bottom)
+        return;
+
+      float length_ = std::sqrt(float(crV2.x - crV1.x) * (crV2.x - crV1.x) + float(crV2.y - crV1.y) * (crV2.y - crV1.y));
+      float u1_ = u0 + length_;
+
+      // V grows downwards from the texture anchor height
+      float v_top_ = anchor - top + yOffset;
+      float v_bottom_ = anchor - bottom + yOffset;
+
+      uint32_t base_ = m_vertices.size();
+      m_vertices.push_back({ float(crV1.x), float(crV1.y), top, u0, v_top_, light });
+      m_vertices.push_back({ float(crV1.x), float(crV1.y), bottom, u0, v_bottom_, light });
+      m_vertices.push_back({ float(crV2.x), float(crV2.y), bottom, u1_, v_bottom_, light });
+      m_vertices.push_back({ float(crV2.x), float(crV2.y), top, u1_, v_top_, light });
+
+      // Counter-clockwise when looking at the front (right) side of the seg
+      LevelSurface surface_ = { (uint32_t)m_indices.size(), 6, texture };
+      for (uint32_t i : { 0u, 1u, 2u, 2u, 3u, 0u })
+        m_indices.push_back(base_ + i);
+
+      m_wall_surfaces.push_back(surface_);
+    }
+
+    void build_walls()
+    {
+      for (const WADLevelSeg & crSeg : m_level.segs)
+      {
+        const WADLevelLinedef & crLinedef = m_level.linedefs[crSeg.linedef];
+        unsigned short front_side_ = seg_front_sidedef(m_level, crSeg);
+        unsigned short back_side_ = seg_back_sidedef(m_level, crSeg);
+
+        if (front_side_ == LEVEL_NO_SIDEDEF)
+          continue;
+
+        const WADLevelSidedef & crSide = m_level.sidedefs[front_side_];
+        const WADLevelSector & crFront = m_level.sectors[crSide.sector];
+        const WADLevelVertex & crV1 = m_level.vertices[crSeg.start];
+        const WADLevelVertex & crV2 = m_level.vertices[crSeg.end];
+
+        float light_ = crFront.light_level / 255.0f;
+        float u0_ = float(crSeg.offset + crSide.x_offset);
+        float y_offset_ = float(crSide.y_offset);
+
+        bool two_sided_ = (crLinedef.flags & LEVEL_LINEDEF_FLAG_TWO_SIDED) && back_side_ != LEVEL_NO_SIDEDEF;
+
+        if (!two_sided_)
+        {
+          if (crSide.middle_texture == "-")
+            continue;
+
+          uint32_t texture_ = texture_index(crSide.middle_texture, false);
+          float anchor_ = (crLinedef.flags & LEVEL_LINEDEF_FLAG_LOWER_UNPEGGED)
+                            ? float(crFront.floor_height + texture_height(texture_))
+                            : float(crFront.ceiling_height);
+
+          add_wall(crV1, crV2, crFront.floor_height, crFront.ceiling_height, u0_, anchor_, y_offset_, texture_, light_);
+          continue;
+        }
+
+        const WADLevelSector & crBack = m_level.sectors[m_level.sidedefs[back_side_].sector];
+
+        // Sky hack, the upper wall between two sky sectors is not drawn
+        bool sky_ = crFront.ceiling_texture == kSkyFlatName && crBack.ceiling_texture == kSkyFlatName;
+
+        if (crBack.ceiling_height < crFront.ceiling_height && crSide.upper_texture != "-" && !sky_)
+        {
+          uint32_t texture_ = texture_index(crSide.upper_texture, false);
+          float anchor_ = (crLinedef.flags & LEVEL_LINEDEF_FLAG_UPPER_UNPEGGED)
+                            ? float(crFront.ceiling_height)
+                            : float(crBack.ceiling_height + texture_height(texture_));
+
+          add_wall(crV1, crV2, crBack.ceiling_height, crFront.ceiling_height, u0_, anchor_, y_offset_, texture_, light_);
+        }
+
+        if (crBack.floor_height > crFront.floor_height && crSide.lower_texture != "-")
+        {
+          uint32_t texture_ = texture_index(crSide.lower_texture, false);
+          float anchor_ = (crLinedef.flags & LEVEL_LINEDEF_FLAG_LOWER_UNPEGGED)
+                            ? float(crFront.ceiling_height)
+                            : float(crBack.floor_height);
+
+          add_wall(crV1, crV2, crFront.floor_height, crBack.floor_height, u0_, anchor_, y_offset_, texture_, light_);
+        }
+
+        // Masked middle textures on two-sided lines (grates, fences) need alpha testing and are skipped
+      }
+    }
+
+    void add_flat(const std::vector<Point> & crPolygon, float z, const std::string & crFlat, float light)
+    {
+      if (crPolygon.size() < 3 || crFlat == kSkyFlatName)
+        return;
+
+      uint32_t texture_ = texture_index(crFlat, true);
+      uint32_t base_ = m_vertices.size();
+
+      // Flats are aligned to the world grid, 1 texel per map unit
+      for (const Point & crP : crPolygon)
+        m_vertices.push_back({ float(crP.x), float(crP.y), z, float(crP.x), float(-crP.y), light });
+
+      LevelSurface surface_ = { (uint32_t)m_indices.size(), 0, texture_ };
+
+      // Subsectors are convex so a fan is enough
+      for (uint32_t i = 1; i + 1 < crPolygon.size(); ++i)
+      {
+        m_indices.push_back(base_);
+        m_indices.push_back(base_ + i);
+        m_indices.push_back(base_ + i + 1);
+      }
+
+      surface_.m_index_count = m_indices.size() - surface_.m_first_index;
+      m_flat_surfaces.push_back(surface_);
+    }
+
+    void build_subsector(unsigned int subsector, const std::vector<Point> & crPolygon)
+    {
+      const WADLevelSubSector & crSubsector = m_level.ssectors[subsector];
+      std::vector<Point> polygon_ = crPolygon;
+
+      // The BSP splits only bound the subsector loosely, its segs close the actual convex region. Every
+      // subsector lies on the front side of all its segs.
+      for (unsigned int i = 0; i < crSubsector.num_segs; ++i)
+      {
+        const WADLevelSeg & crSeg = m_level.segs[crSubsector.start_seg + i];
+        const WADLevelVertex & crV1 = m_level.vertices[crSeg.start];
+        const WADLevelVertex & crV2 = m_level.vertices[crSeg.end];
+
+        polygon_ = clip(polygon_, crV1.x, crV1.y, crV2.x - crV1.x, crV2.y - crV1.y, false);
+      }
+
+      const WADLevelSector & crSector = m_level.sectors[subsector_sector(m_level, subsector)];
+      float light_ = crSector.light_level / 255.0f;
+
+      add_flat(polygon_, crSector.floor_height, crSector.floor_texture, light_);
+      add_flat(polygon_, crSector.ceiling_height, crSector.ceiling_texture, light_);
+    }
+
+    void build_node(unsigned short child, const std::vector<Point> & crPolygon)
+    {
+      if (crPolygon.size() < 3)
+        return;
+
+      if (child & LEVEL_SUBSECTOR_FLAG)
+      {
+        build_subsector(child & ~LEVEL_SUBSECTOR_FLAG, crPolygon);
+        return;
+      }
+
+      const WADLevelNode & crNode = m_level.nodes[child];
+
+      build_node(crNode.right_child, clip(crPolygon, crNode.x_start, crNode.y_start, crNode.dx, crNode.dy, false));
+      build_node(crNode.left_child, clip(crPolygon, crNode.x_start, crNode.y_start, crNode.dx, crNode.dy, true));
+    }
+
+    void build_flats()
+    {
+      if (m_level.vertices.empty() || m_level.ssectors.empty())
+        return;
+
+      // Start from the level bounding box (plus some slack) and let the BSP carve it into subsectors
+      double min_x_ = m_level.vertices[0].x, max_x_ = min_x_;
+      double min_y_ = m_level.vertices[0].y, max_y_ = min_y_;
+
+      for (const WADLevelVertex & crV : m_level.vertices)
+      {
+        min_x_ = std::min(min_x_, double(crV.x));
+        max_x_ = std::max(max_x_, double(crV.x));
+        min_y_ = std::min(min_y_, double(crV.y));
+        max_y_ = std::max(max_y_, double(crV.y));
+      }
+
+      std::vector<Point> bounds_ {
+        { min_x_ - 64.0, min_y_ - 64.0 },
+        { min_x_ - 64.0, max_y_ + 64.0 },
+        { max_x_ + 64.0, max_y_ + 64.0 },
+        { max_x_ + 64.0, min_y_ - 64.0 }
+      };
+
+      // A level with a single subsector has no nodes at all
+      if (m_level.nodes.empty())
+        build_subsector(0, bounds_);
+      else
+        build_node(m_level.nodes.size() - 1, bounds_);
+    }
+
+    void find_player_start()
+    {
+      m_start_x = 0.0f;
+      m_start_y = 0.0f;
+      m_start_z = kPlayerViewHeight;
+      m_start_angle = 0.0f;
+
+      // Thing type 1 is the player 1 start
+      for (const WADLevelThing & crThing : m_level.things)
+      {
+        if (crThing.type != 1)
+          continue;
+
+        m_start_x = crThing.x;
+        m_start_y = crThing.y;
+        m_start_angle = crThing.angle * 3.14159265f / 180.0f;
+
+        if (!m_level.ssectors.empty())
+          m_start_z = m_level.sectors[point_in_sector(m_level, crThing.x, crThing.y)].floor_height + kPlayerViewHeight;
+
+        break;
+      }
+    }
+
+    const WAD & m_wad;
+    const WADLevel & m_level;
+
+    std::vector<LevelVertex> m_vertices;
+    std::vector<uint32_t> m_indices;
+    std::vector<LevelSurface> m_wall_surfaces;
+    std::vector<LevelSurface> m_flat_surfaces;
+    std::vector<LevelTextureImage> m_textures;
+    std::map<std::string, uint32_t> m_texture_map;
+    std::unordered_map<uint64_t, uint32_t> m_texture_hash_map;
+
+    float m_start_x;
+    float m_start_y;
+    float m_start_z;
+    float m_start_angle;
+};
+
+#endif
@@ -0,0 +1,391 @@
+#ifndef LOGGER_HPP_
+#define LOGGER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+// Leveled logging for the loaders, which report what they read as events with a message and structured
+// fields (e.g., the lump, how many records it had and how long it took):
+//
+//   LOG_INFO("Read level lump", { { "lump", "THINGS" }, { "count", things_ }, { "ms", timer_.ms() } });
+//
+// Messages must be string literals, only their pointers are kept. Producers never lock, events go through a
+// bounded lock-free queue to a sink thread that formats them, to the console as "message key=value..." (with
+// the usual ERROR: and WARNING: prefixes on std::cerr) and, when a telemetry file is set, as JSON lines so
+// the same events can be analyzed as load-time telemetry. A full queue makes the producers yield until the
+// sink catches up, no event is lost.
+//
+// Levels below DOOMFS_LOG_LEVEL (Info by default) are compiled out, the macros leave a constant false
+// condition and their arguments are never evaluated. Above it, Logger::set_level filters at run time.
+
+enum class LogLevel
+{
+  Trace = 0,
+  Debug = 1,
+  Info = 2,
+  Warning = 3,
+  Error = 4,
+  Off = 5
+};
+
+#ifndef DOOMFS_LOG_LEVEL
+#define DOOMFS_LOG_LEVEL 2
+#endif
+
+struct LogField
+{
+  enum Type { kInteger, kReal, kText };
+
+  LogField()
+  {
+
+  }
+
+  template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+  LogField(const char * pKey, T value)
+    : m_key(pKey), m_type(kInteger), m_integer((int64_t)value)
+  {
+
+  }
+
+  LogField(const char * pKey, double value)
+    : m_key(pKey), m_type(kReal), m_real(value)
+  {
+
+  }
+
+  LogField(const char * pKey, const std::string & crText)
+    : m_key(pKey), m_type(kText), m_text(crText)
+  {
+
+  }
+
+  LogField(const char * pKey, const char * pText)
+    : m_key(pKey), m_type(kText), m_text(pText)
+  {
+
+  }
+
+  const char * m_key = nullptr;
+  Type m_type = kInteger;
+  int64_t m_integer = 0;
+  double m_real = 0.0;
+
+  // Lump names fit in the small string buffer, they do not allocate
+  std::string m_text;
+};
+
+struct LogEvent
+{
+  static const unsigned int kMaxFields = 8;
+
+  LogLevel m_level;
+
+  // Seconds since the logger started
+  double m_time;
+  const char * m_message;
+  unsigned int m_field_count;
+  LogField m_fields[kMaxFields];
+};
+
+// Milliseconds since it was created or restarted, for the durations of the events
+class LogTimer
+{
+  public:
+
+    LogTimer()
+      : m_start(std::chrono::steady_clock::now())
+    {
+
+    }
+
+    void restart()
+    {
+      m_start = std::chrono::steady_clock::now();
+    }
+
+    double ms() const
+    {
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+  private:
+
+    std::chrono::steady_clock::time_point m_start;
+};
+
+class Logger
+{
+  public:
+
+    static const size_t kCapacity = 4096;
+
+    static Logger & instance()
+    {
+      static Logger logger_;
+      return logger_;
+    }
+
+    ~Logger()
+    {
+      {
+        std::lock_guard<std::mutex> lock_(m_mutex);
+        m_stop = true;
+      }
+
+      m_wake_condition.notify_one();
+      m_sink.join();
+    }
+
+    Logger(const Logger &) = delete;
+    Logger & operator=(const Logger &) = delete;
+
+    bool enabled(LogLevel level) const
+    {
+      return (int)level >= m_level.load(std::memory_order_relaxed);
+    }
+
+    // Events below this level are dropped before they are queued
+    void set_level(LogLevel level)
+    {
+      m_level.store((int)level, std::memory_order_relaxed);
+    }
+
+    // Also writes every event to this file as a JSON object per line
+    void set_telemetry_file(const std::string & crFilename)
+    {
+      auto file_ = std::make_unique<std::ofstream>(crFilename);
+
+      if (!*file_)
+        throw std::runtime_error("Failed to open log file " + crFilename + "!");
+
+      std::lock_guard<std::mutex> lock_(m_mutex);
+      m_telemetry = std::move(file_);
+    }
+
+    void log(LogLevel level, const char * pMessage, std::initializer_list<LogField> fields = {})
+    {
+      LogEvent event_;
+      event_.m_level = level;
+      event_.m_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+      event_.m_message = pMessage;
+      event_.m_field_count = 0;
+
+      for (const LogField & crField : fields)
+        if (event_.m_field_count < LogEvent::kMaxFields)
+          event_.m_fields[event_.m_field_count++] = crField;
+
+      while (!try_push(event_))
+      {
+        m_wake_condition.notify_one();
+        std::this_thread::yield();
+      }
+    }
+
+    // Waits until the sink has written every event queued so far, e.g., before printing straight to the
+    // console so the output stays in order
+    void flush()
+    {
+      size_t target_ = m_enqueue_position.load(std::memory_order_acquire);
+
+      while (m_written.load(std::memory_order_acquire) < target_)
+      {
+        m_wake_condition.notify_one();
+        std::this_thread::yield();
+      }
+    }
+
+  private:
+
+    // Bounded multi-producer queue in which every slot carries a sequence number: a producer claims the
+    // slot whose sequence matches its position, the sink reads it once the producer has advanced it
+    struct Slot
+    {
+      std::atomic<size_t> m_sequence;
+      LogEvent m_event;
+    };
+
+    Logger()
+      : m_start(std::chrono::steady_clock::now()), m_slots(new Slot[kCapacity])
+    {
+      for (size_t i = 0; i < kCapacity; ++i)
+        m_slots[i].m_sequence.store(i, std::memory_order_relaxed);
+
+      m_sink = std::thread(&Logger::sink, this);
+    }
+
+    bool try_push(LogEvent & rEvent)
+    {
+      size_t position_ = m_enqueue_position.load(std::memory_order_relaxed);
+
+      while (true)
+      {
+        Slot & rSlot = m_slots[position_ & (kCapacity - 1)];
+        size_t sequence_ = rSlot.m_sequence.load(std::memory_order_acquire);
+        intptr_t difference_ = (intptr_t)sequence_ - (intptr_t)position_;
+
+        if (difference_ == 0)
+        {
+          if (m_enqueue_position.compare_exchange_weak(position_, position_ + 1, std::memory_order_relaxed))
+          {
+            rSlot.m_event = std::move(rEvent);
+            rSlot.m_sequence.store(position_ + 1, std::memory_order_release);
+            return true;
+          }
+        }
+        else if (difference_ < 0)
+          return false;
+        else
+          position_ = m_enqueue_position.load(std::memory_order_relaxed);
+      }
+    }
+
+    bool try_pop(LogEvent & rEvent)
+    {
+      Slot & rSlot = m_slots[m_dequeue_position & (kCapacity - 1)];
+
+      if (rSlot.m_sequence.load(std::memory_order_acquire) != m_dequeue_position + 1)
+        return false;
+
+      rEvent = std::move(rSlot.m_event);
+      rSlot.m_sequence.store(m_dequeue_position + kCapacity, std::memory_order_release);
+      ++m_dequeue_position;
+      return true;
+    }
+
+    // Drains the queue, then sleeps a little unless woken up by a full queue, a flush or the destructor
+    void sink()
+    {
+      LogEvent event_;
+
+      while (true)
+      {
+        bool written_ = false;
+
+        while (try_pop(event_))
+        {
+          write(event_);
+          written_ = true;
+        }
+
+        if (written_)
+        {
+          std::cout.flush();
+          m_written.store(m_dequeue_position, std::memory_order_release);
+        }
+
+        std::unique_lock<std::mutex> lock_(m_mutex);
+
+        if (m_stop && m_dequeue_position == m_enqueue_position.load(std::memory_order_acquire))
+          break;
+
+        m_wake_condition.wait_for(lock_, std::chrono::milliseconds(2));
+      }
+
+      if (m_telemetry)
+        m_telemetry->flush();
+    }
+
+    void write(const LogEvent & crEvent)
+    {
+      std::ostream & rOs = (crEvent.m_level >= LogLevel::Warning) ? std::cerr : std::cout;
+      const char * kPrefixes[] = { "TRACE: ", "DEBUG: ", "", "WARNING: ", "ERROR: " };
+
+      rOs << kPrefixes[(int)crEvent.m_level] << crEvent.m_message;
+
+      for (unsigned int i = 0; i < crEvent.m_field_count; ++i)
+      {
+        rOs << " " << crEvent.m_fields[i].m_key << "=";
+        write_value(rOs, crEvent.m_fields[i], false);
+      }
+
+      rOs << "\n";
+
+      std::lock_guard<std::mutex> lock_(m_mutex);
+
+      if (!m_telemetry)
+        return;
+
+      const char * kLevels[] = { "trace", "debug", "info", "warning", "error" };
+
+      *m_telemetry << "{\"time\":" << crEvent.m_time << ",\"level\":\"" << kLevels[(int)crEvent.m_level] << "\",\"message\":";
+      write_quoted(*m_telemetry, crEvent.m_message);
+
+      for (unsigned int i = 0; i < crEvent.m_field_count; ++i)
+      {
+        *m_telemetry << ",";
+        write_quoted(*m_telemetry, crEvent.m_fields[i].m_key);
+        *m_telemetry << ":";
+        write_value(*m_telemetry, crEvent.m_fields[i], true);
+      }
+
+      *m_telemetry << "}\n";
+    }
+
+    static void write_value(std::ostream & rOs, const LogField & crField, bool quoted)
+    {
+      if (crField.m_type == LogField::kInteger)
+        rOs << crField.m_integer;
+      else if (crField.m_type == LogField::kReal)
+        rOs << crField.m_real;
+      else if (quoted)
+        write_quoted(rOs, crField.m_text);
+      else
+        rOs << crField.m_text;
+    }
+
+    static void write_quoted(std::ostream & rOs, const std::string & crText)
+    {
+      rOs << "\"";
+
+      for (char c : crText)
+      {
+        if (c == '"' || c == '\\')
+          rOs << '\\' << c;
+        else if ((unsigned char)c < 0x20)
+          rOs << "\\u00" << "0123456789abcdef"[(c >> 4) & 0xF] << "0123456789abcdef"[c & 0xF];
+        else
+          rOs << c;
+      }
+
+      rOs << "\"";
+    }
+
+    std::chrono::steady_clock::time_point m_start;
+    std::atomic<int> m_level { DOOMFS_LOG_LEVEL };
+
+    std::unique_ptr<Slot[]> m_slots;
+    std::atomic<size_t> m_enqueue_position { 0 };
+    size_t m_dequeue_position = 0;
+    std::atomic<size_t> m_written { 0 };
+
+    // Only the sink and the setup take it, never the producers
+    std::mutex m_mutex;
+    std::condition_variable m_wake_condition;
+    bool m_stop = false;
+    std::unique_ptr<std::ofstream> m_telemetry;
+
+    std::thread m_sink;
+};
+
+#define LOG_AT(level, ...) \
+  do { if ((int)(level) >= DOOMFS_LOG_LEVEL && Logger::instance().enabled(level)) Logger::instance().log(level, __VA_ARGS__); } while (0)
+
+#define LOG_TRACE(...) LOG_AT(LogLevel::Trace, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(LogLevel::Warning, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LogLevel::Error, __VA_ARGS__)
+
+#endif
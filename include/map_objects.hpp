@@ -0,0 +1,142 @@
+#ifndef MAP_OBJECTS_HPP_
+#define MAP_OBJECTS_HPP_
+
+#include <cstdint>
+
+#include "fixed.hpp"
+#include "object_pool.hpp"
+
+// Map objects (mobjs) are everything that lives in a level and thinks every tic: monsters, pickups,
+// decorations, projectiles. They are kept in an ObjectPool so a tic walks them in one contiguous array
+// and spawning a projectile just reuses a slot.
+
+// Subset of DOOM's mobj flags, same values as in info.h
+#define MOBJ_FLAG_SPECIAL 0x00000001
+#define MOBJ_FLAG_SOLID 0x00000002
+#define MOBJ_FLAG_SHOOTABLE 0x00000004
+#define MOBJ_FLAG_NOGRAVITY 0x00000200
+#define MOBJ_FLAG_DROPOFF 0x00000400
+#define MOBJ_FLAG_NOCLIP 0x00001000
+#define MOBJ_FLAG_FLOAT 0x00004000
+#define MOBJ_FLAG_MISSILE 0x00010000
+#define MOBJ_FLAG_COUNTKILL 0x00400000
+
+const Fixed kGravity = Fixed::from_int(1);
+
+// Momentum lost every tic and the speed below which things stop, from p_mobj.c
+const Fixed kFriction = Fixed::from_raw(0xE800);
+const Fixed kStopSpeed = Fixed::from_raw(0x1000);
+const Fixed kMaxMove = Fixed::from_int(30);
+
+struct MobjInfo
+{
+  Fixed m_radius;
+  Fixed m_height;
+  uint32_t m_flags;
+};
+
+// Size and flags of the thing types of the shareware episode worth telling apart, anything else is a
+// small non-blocking item
+inline MobjInfo mobj_info(unsigned short type)
+{
+  const uint32_t monster_ = MOBJ_FLAG_SOLID | MOBJ_FLAG_SHOOTABLE | MOBJ_FLAG_COUNTKILL;
+
+  switch (type)
+  {
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+      return { Fixed::from_int(16), Fixed::from_int(56), MOBJ_FLAG_SOLID | MOBJ_FLAG_SHOOTABLE };
+    case 3004:
+    case 9:
+    case 3001:
+      return { Fixed::from_int(20), Fixed::from_int(56), monster_ };
+    case 3002:
+    case 58:
+      return { Fixed::from_int(30), Fixed::from_int(56), monster_ };
+    case 3003:
+      return { Fixed::from_int(24), Fixed::from_int(64), monster_ };
+    case 3005:
+      return { Fixed::from_int(31), Fixed::from_int(56), monster_ | MOBJ_FLAG_FLOAT | MOBJ_FLAG_NOGRAVITY };
+    case 3006:
+      return { Fixed::from_int(16), Fixed::from_int(56), MOBJ_FLAG_SOLID | MOBJ_FLAG_SHOOTABLE | MOBJ_FLAG_FLOAT | MOBJ_FLAG_NOGRAVITY };
+    case 2035:
+      return { Fixed::from_int(10), Fixed::from_int(42), MOBJ_FLAG_SOLID | MOBJ_FLAG_SHOOTABLE };
+    case 30:
+    case 31:
+    case 32:
+    case 33:
+    case 35:
+    case 44:
+    case 45:
+    case 46:
+    case 47:
+    case 48:
+    case 2028:
+      return { Fixed::from_int(16), Fixed::from_int(16), MOBJ_FLAG_SOLID };
+    default:
+      return { Fixed::from_int(20), Fixed::from_int(16), MOBJ_FLAG_SPECIAL };
+  }
+}
+
+struct MapObject
+{
+  Fixed m_x;
+  Fixed m_y;
+  Fixed m_z;
+  Fixed m_momentum_x;
+  Fixed m_momentum_y;
+  Fixed m_momentum_z;
+  BAM m_angle;
+
+  Fixed m_radius;
+  Fixed m_height;
+  Fixed m_floor_z;
+  Fixed m_ceiling_z;
+
+  uint32_t m_flags;
+  unsigned short m_type;
+
+  // Who shot a missile
+  Handle m_target;
+
+  unsigned short m_sector;
+  int m_health;
+
+  // Tics left before the object goes away, -1 lives forever (DOOM counts down state durations, here
+  // there are no states yet so running out means removal, e.g., for projectiles)
+  int m_tics;
+};
+
+typedef ObjectPool<MapObject> MapObjects;
+
+inline bool mobj_is_player(const MapObject & crMobj)
+{
+  return crMobj.m_type >= 1 && crMobj.m_type <= 4;
+}
+
+inline Fixed clamp_move(Fixed move)
+{
+  return (move > kMaxMove) ? kMaxMove : (move < -kMaxMove) ? -kMaxMove : move;
+}
+
+// A map object of the given type at (x, y), not placed in the level yet
+inline MapObject make_mobj(unsigned short type, Fixed x, Fixed y)
+{
+  MobjInfo info_ = mobj_info(type);
+
+  MapObject mobj_ = {};
+  mobj_.m_x = x;
+  mobj_.m_y = y;
+  mobj_.m_radius = info_.m_radius;
+  mobj_.m_height = info_.m_height;
+  mobj_.m_flags = info_.m_flags;
+  mobj_.m_type = type;
+  mobj_.m_health = 100;
+  mobj_.m_tics = -1;
+
+  return mobj_;
+}
+
+#endif
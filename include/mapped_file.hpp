@@ -0,0 +1,78 @@
+#ifndef MAPPED_FILE_HPP_
+#define MAPPED_FILE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A whole file mapped read-only into memory, the pages are only read from disk (or the page cache) when
+// touched. Opening a file that does not exist is not an error, the mapping is just empty.
+class MappedFile
+{
+  public:
+
+    MappedFile()
+    {
+
+    }
+
+    MappedFile(const std::string & crFilename)
+    {
+      int descriptor_ = open(crFilename.c_str(), O_RDONLY);
+
+      if (descriptor_ < 0)
+        return;
+
+      struct stat stat_;
+
+      if (fstat(descriptor_, &stat_) == 0 && stat_.st_size > 0)
+      {
+        void * pData = mmap(nullptr, stat_.st_size, PROT_READ, MAP_PRIVATE, descriptor_, 0);
+
+        if (pData != MAP_FAILED)
+        {
+          m_data = (const uint8_t *)pData;
+          m_size = stat_.st_size;
+        }
+      }
+
+      // The mapping outlives the descriptor
+      close(descriptor_);
+    }
+
+    ~MappedFile()
+    {
+      if (m_data != nullptr)
+        munmap((void *)m_data, m_size);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    bool mapped() const
+    {
+      return m_data != nullptr;
+    }
+
+    const uint8_t * data() const
+    {
+      return m_data;
+    }
+
+    size_t size() const
+    {
+      return m_size;
+    }
+
+  private:
+
+    const uint8_t * m_data = nullptr;
+    size_t m_size = 0;
+};
+
+#endif
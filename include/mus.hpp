@@ -0,0 +1,440 @@
+#ifndef MUS_HPP_
+#define MUS_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "wad.hpp"
+
+// DOOM music is stored in MUS format, a compact score for the DMX sound library which is MIDI in all but
+// the encoding. A lump starts with a header:
+//  (1) the "MUS" signature followed by 0x1A (4 bytes)
+//  (2) an unsigned short (2 bytes) with the length of the score
+//  (3) an unsigned short (2 bytes) with the offset to the start of the score
+//  (4) three unsigned shorts (6 bytes) with the primary and secondary channels and the instrument count
+//  (5) one more unsigned short (2 bytes) that is not used
+// followed by the list of instruments and then the score. Every event of the score is one byte with the
+// type in bits 4-6 and the channel in bits 0-3, then its data, and when bit 7 is set a delay in tics (at
+// 140 per second) until the next event, as a MIDI-style variable length number.
+//
+// MUS channel 15 is the percussion channel, 9 in MIDI, the rest get MIDI channels as they are first used.
+
+struct MidiEvent
+{
+  // Tics since the start of the score
+  uint32_t time;
+
+  // Status byte with the MIDI channel and one or two data bytes
+  uint8_t status;
+  uint8_t data[2];
+  uint8_t size;
+};
+
+// Walks the score of a MUS lump and yields its events already translated to MIDI, one at a time and
+// without converting the whole lump first, so a player can start right away and only keeps the events
+// of the block it is about to play. The lump must outlive the sequencer.
+class MusSequencer
+{
+  public:
+
+    static const unsigned int kTicsPerSecond = 140;
+
+    MusSequencer(const uint8_t * pData, size_t size)
+    {
+      if (size < 16 || memcmp(pData, "MUS\x1A", 4) != 0)
+        throw std::runtime_error("Failed to read MUS lump, the signature is missing!");
+
+      size_t length_ = pData[4] | (pData[5] << 8);
+      size_t start_ = pData[6] | (pData[7] << 8);
+
+      if (start_ >= size)
+        throw std::runtime_error("Failed to read MUS lump, the score starts past its end!");
+
+      // Some lumps get the length of the score wrong, the end of the lump is the end of the score anyway
+      m_score = pData + start_;
+      m_score_size = std::min(length_, size - start_);
+
+      rewind();
+    }
+
+    // Size of the score in bytes
+    size_t score_size() const
+    {
+      return m_score_size;
+    }
+
+    // Tics since the start up to the event that comes next, or to the end once the score ends
+    uint32_t time() const
+    {
+      return m_time;
+    }
+
+    // Starts over from the beginning, e.g., for looping music
+    void rewind()
+    {
+      m_position = 0;
+      m_time = 0;
+      m_finished = false;
+      m_queued = 0;
+      m_next_channel = 0;
+
+      for (unsigned int c = 0; c < 16; ++c)
+      {
+        m_channels[c] = -1;
+        m_velocities[c] = 127;
+      }
+    }
+
+    // Next event in time order, false once the score ends
+    bool next(MidiEvent & rEvent)
+    {
+      if (m_queued == 0 && !decode())
+        return false;
+
+      rEvent = m_queue[0];
+      m_queue[0] = m_queue[1];
+      m_queued--;
+
+      return true;
+    }
+
+    // Time of the next event without taking it, false once the score ends
+    bool peek(uint32_t & rTime)
+    {
+      if (m_queued == 0 && !decode())
+        return false;
+
+      rTime = m_queue[0].time;
+      return true;
+    }
+
+    // Hands every event up to the given time to the callback, for players that pull the events of each
+    // audio block. Returns false once the score ends.
+    template <typename T>
+    bool events_until(uint32_t time, T callback)
+    {
+      uint32_t next_;
+
+      while (peek(next_))
+      {
+        if (next_ > time)
+          return true;
+
+        MidiEvent event_;
+        next(event_);
+        callback(event_);
+      }
+
+      return false;
+    }
+
+  private:
+
+    // Decodes MUS events until one produces MIDI events, which are queued
+    bool decode()
+    {
+      // Controller numbers of MUS controllers 1 to 9 (0 is the program change) and system events 10 to 14
+      static const uint8_t kControllers[15] = { 0x00, 0x00, 0x01, 0x07, 0x0A, 0x0B, 0x5B, 0x5D, 0x40, 0x43,
+                                                0x78, 0x7B, 0x7E, 0x7F, 0x79 };
+
+      while (!m_finished && m_position < m_score_size)
+      {
+        uint8_t descriptor_ = m_score[m_position++];
+        unsigned int type_ = (descriptor_ >> 4) & 0x07;
+        unsigned int channel_ = descriptor_ & 0x0F;
+
+        MidiEvent event_ { m_time, 0, { 0, 0 }, 3 };
+        bool emit_ = true;
+
+        switch (type_)
+        {
+          case 0:
+            // Release note
+            event_.status = 0x80;
+            event_.data[0] = byte() & 0x7F;
+            break;
+
+          case 1:
+          {
+            // Play note, with a new volume for the channel when the high bit is set
+            uint8_t note_ = byte();
+
+            if (note_ & 0x80)
+              m_velocities[channel_] = byte() & 0x7F;
+
+            event_.status = 0x90;
+            event_.data[0] = note_ & 0x7F;
+            event_.data[1] = m_velocities[channel_];
+            break;
+          }
+
+          case 2:
+          {
+            // Pitch bend, 128 is centered and MIDI takes 14 bits
+            unsigned int bend_ = byte() * 64;
+            event_.status = 0xE0;
+            event_.data[0] = bend_ & 0x7F;
+            event_.data[1] = (bend_ >> 7) & 0x7F;
+            break;
+          }
+
+          case 3:
+          {
+            // System event, a controller without value
+            uint8_t controller_ = byte();
+            emit_ = controller_ >= 10 && controller_ <= 14;
+            event_.status = 0xB0;
+            event_.data[0] = emit_ ? kControllers[controller_] : 0;
+            break;
+          }
+
+          case 4:
+          {
+            uint8_t controller_ = byte();
+            uint8_t value_ = std::min<uint8_t>(byte(), 127);
+
+            if (controller_ == 0)
+            {
+              event_.status = 0xC0;
+              event_.data[0] = value_;
+              event_.size = 2;
+            }
+            else
+            {
+              emit_ = controller_ <= 9;
+              event_.status = 0xB0;
+              event_.data[0] = emit_ ? kControllers[controller_] : 0;
+              event_.data[1] = value_;
+            }
+            break;
+          }
+
+          case 5:
+            // End of measure, nothing to play
+            emit_ = false;
+            break;
+
+          default:
+            // End of the score (type 7 is not used and its length is unknown, it ends it too)
+            m_finished = true;
+            return false;
+        }
+
+        if (emit_)
+        {
+          event_.status |= midi_channel(channel_);
+          m_queue[m_queued++] = event_;
+        }
+
+        if (descriptor_ & 0x80)
+          m_time += delay();
+
+        if (emit_)
+          return true;
+      }
+
+      m_finished = true;
+      return false;
+    }
+
+    uint8_t byte()
+    {
+      return (m_position < m_score_size) ? m_score[m_position++] : 0;
+    }
+
+    uint32_t delay()
+    {
+      uint32_t delay_ = 0;
+
+      while (m_position < m_score_size)
+      {
+        uint8_t byte_ = m_score[m_position++];
+        delay_ = (delay_ << 7) | (byte_ & 0x7F);
+
+        if (!(byte_ & 0x80))
+          break;
+      }
+
+      return delay_;
+    }
+
+    // The first time a channel is used it is silenced with an all notes off, some songs leave notes
+    // playing that MIDI synthesizers would otherwise keep from whatever was played on it before
+    uint8_t midi_channel(unsigned int channel)
+    {
+      if (channel == 15)
+        return 9;
+
+      if (m_channels[channel] < 0)
+      {
+        if (m_next_channel == 9)
+          m_next_channel++;
+
+        m_channels[channel] = m_next_channel++ & 0x0F;
+        m_queue[m_queued++] = { m_time, (uint8_t)(0xB0 | m_channels[channel]), { 0x7B, 0 }, 3 };
+      }
+
+      return m_channels[channel];
+    }
+
+    const uint8_t * m_score;
+    size_t m_score_size;
+    size_t m_position;
+    uint32_t m_time;
+    bool m_finished;
+
+    // At most an all notes off and the event that follows it are waiting to be taken
+    MidiEvent m_queue[2];
+    unsigned int m_queued;
+
+    int m_channels[16];
+    int m_next_channel;
+    uint8_t m_velocities[16];
+};
+
+// Converts a MUS lump into a format 0 MIDI file in a single pass. Every MUS event that produces MIDI takes
+// at least 2 bytes and produces at most 8 (a 5-byte delta and 3 bytes of event), plus an all notes off for
+// each of the 16 channels and the end of the track, so the output buffer is allocated once from the size
+// of the score and trimmed at the end.
+inline std::vector<uint8_t> mus_to_midi(const uint8_t * pData, size_t size)
+{
+  MusSequencer sequencer_(pData, size);
+
+  std::vector<uint8_t> midi_(sequencer_.score_size() * 4 + 16 * 8 + 64);
+  uint8_t * pOut = midi_.data();
+
+  auto write_ = [&pOut](std::initializer_list<uint8_t> bytes) {
+    for (uint8_t byte_ : bytes)
+      *pOut++ = byte_;
+  };
+
+  // Header with one track and 70 ticks per quarter note, at the default 120 beats per minute that is the
+  // 140 tics per second of MUS so times are copied as they are
+  write_({ 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 70 });
+  write_({ 'M', 'T', 'r', 'k', 0, 0, 0, 0 });
+  uint8_t * pTrack = pOut;
+
+  // Set the tempo explicitly anyway, 500000 microseconds per quarter note
+  write_({ 0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20 });
+
+  // Delta times are variable length numbers, 7 bits per byte from the most significant with the high bit
+  // set on all but the last
+  uint32_t time_ = 0;
+
+  auto write_delta_ = [&pOut, &time_](uint32_t time) {
+    uint32_t delta_ = time - time_;
+    uint8_t bytes_[5];
+    int count_ = 0;
+
+    time_ = time;
+
+    do
+    {
+      bytes_[count_++] = delta_ & 0x7F;
+      delta_ >>= 7;
+    } while (delta_ != 0);
+
+    while (count_ > 1)
+      *pOut++ = bytes_[--count_] | 0x80;
+
+    *pOut++ = bytes_[0];
+  };
+
+  MidiEvent event_;
+
+  while (sequencer_.next(event_))
+  {
+    write_delta_(event_.time);
+    *pOut++ = event_.status;
+
+    for (unsigned int i = 1; i < event_.size; ++i)
+      *pOut++ = event_.data[i - 1];
+  }
+
+  // The track ends after the delay of the last event
+  write_delta_(sequencer_.time());
+  write_({ 0xFF, 0x2F, 0x00 });
+
+  size_t track_size_ = pOut - pTrack;
+  pTrack[-4] = (track_size_ >> 24) & 0xFF;
+  pTrack[-3] = (track_size_ >> 16) & 0xFF;
+  pTrack[-2] = (track_size_ >> 8) & 0xFF;
+  pTrack[-1] = track_size_ & 0xFF;
+
+  assert(pOut <= midi_.data() + midi_.size());
+  midi_.resize(pOut - midi_.data());
+
+  return midi_;
+}
+
+// Writes every music lump of the WAD as NAME.mid in the given directory. Lumps are independent so they
+// are converted by as many threads as there are hardware threads.
+inline void export_music(const WAD & crWad, const std::string & crDirectory)
+{
+  mkdir(crDirectory.c_str(), 0755);
+
+  std::vector<const WADEntry *> lumps_;
+  for (const auto & crMusic : crWad.music())
+    lumps_.push_back(&crMusic.second);
+
+  std::vector<std::string> errors_(lumps_.size());
+  std::atomic<size_t> next_ { 0 };
+
+  auto export_ = [&]() {
+    for (size_t i = next_++; i < lumps_.size(); i = next_++)
+    {
+      try
+      {
+        std::vector<uint8_t> midi_ = mus_to_midi(crWad.lump_data(*lumps_[i]), lumps_[i]->size);
+
+        std::string filename_ = crDirectory + "/" + lumps_[i]->name + ".mid";
+        std::ofstream file_(filename_, std::ios::binary);
+        file_.write((const char *)midi_.data(), midi_.size());
+
+        if (!file_)
+          throw std::runtime_error("Failed to write " + filename_ + "!");
+      }
+      catch (const std::runtime_error & crError)
+      {
+        errors_[i] = crError.what();
+      }
+    }
+  };
+
+  unsigned int threads_ = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), lumps_.size());
+  std::vector<std::thread> workers_;
+
+  for (unsigned int t = 1; t < threads_; ++t)
+    workers_.emplace_back(export_);
+
+  export_();
+
+  for (std::thread & rWorker : workers_)
+    rWorker.join();
+
+  unsigned int exported_ = 0;
+
+  for (size_t i = 0; i < lumps_.size(); ++i)
+  {
+    if (errors_[i].empty())
+      exported_++;
+    else
+      std::cerr << "ERROR: " << lumps_[i]->name << ": " << errors_[i] << "\n";
+  }
+
+  std::cout << "Exported " << exported_ << " music lumps to " << crDirectory << "\n";
+}
+
+#endif
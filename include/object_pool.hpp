@@ -0,0 +1,185 @@
+#ifndef OBJECT_POOL_HPP_
+#define OBJECT_POOL_HPP_
+
+#include <cstdint>
+#include <vector>
+
+// Refers to an object of a pool. Handles stay valid while their object lives and become stale (but never
+// dangle) once it is removed, even if its slot is reused by a new object, since every reuse bumps the
+// slot generation.
+struct Handle
+{
+  static const uint32_t kInvalid = 0xFFFFFFFF;
+
+  uint32_t m_slot = kInvalid;
+  uint32_t m_generation = 0;
+
+  bool operator==(const Handle & crOther) const
+  {
+    return m_slot == crOther.m_slot && m_generation == crOther.m_generation;
+  }
+
+  bool operator!=(const Handle & crOther) const
+  {
+    return !(*this == crOther);
+  }
+};
+
+// Objects of one type stored densely, so updating all of them walks a single array instead of chasing a
+// linked list of heap allocations like DOOM's thinkers. Handles go through a slot table that maps them to
+// the current position of their object, removing an object moves the last one into its place.
+//
+// Removals are deferred until flush() so objects can be removed while the pool is being iterated (e.g.,
+// by their own thinker) without moving anything under the loop. Freed slots are reused before new ones
+// are made, so once the pool has grown to its peak population spawning and removing never allocates.
+template <typename T>
+class ObjectPool
+{
+  public:
+
+    ObjectPool(size_t capacity = 0)
+    {
+      reserve(capacity);
+    }
+
+    void reserve(size_t capacity)
+    {
+      m_objects.reserve(capacity);
+      m_owners.reserve(capacity);
+      m_slots.reserve(capacity);
+      m_free.reserve(capacity);
+      m_removed.reserve(capacity);
+    }
+
+    Handle spawn(const T & crObject)
+    {
+      uint32_t slot_;
+
+      if (!m_free.empty())
+      {
+        slot_ = m_free.back();
+        m_free.pop_back();
+      }
+      else
+      {
+        slot_ = m_slots.size();
+        m_slots.push_back({ 0, 0, false });
+      }
+
+      Slot & rSlot = m_slots[slot_];
+      rSlot.m_index = m_objects.size();
+      rSlot.m_removed = false;
+
+      m_objects.push_back(crObject);
+      m_owners.push_back(slot_);
+
+      return { slot_, rSlot.m_generation };
+    }
+
+    // Marks the object for removal, it stays in place (and is still iterated) until the next flush()
+    void remove(Handle handle)
+    {
+      if (!alive(handle))
+        return;
+
+      m_slots[handle.m_slot].m_removed = true;
+      m_removed.push_back(handle.m_slot);
+    }
+
+    void flush()
+    {
+      for (uint32_t slot : m_removed)
+      {
+        Slot & rSlot = m_slots[slot];
+        uint32_t last_ = m_objects.size() - 1;
+
+        if (rSlot.m_index != last_)
+        {
+          m_objects[rSlot.m_index] = m_objects[last_];
+          m_owners[rSlot.m_index] = m_owners[last_];
+          m_slots[m_owners[last_]].m_index = rSlot.m_index;
+        }
+
+        m_objects.pop_back();
+        m_owners.pop_back();
+
+        ++rSlot.m_generation;
+        rSlot.m_removed = false;
+        m_free.push_back(slot);
+      }
+
+      m_removed.clear();
+    }
+
+    void clear()
+    {
+      for (size_t i = 0; i < m_objects.size(); ++i)
+        remove(handle(i));
+
+      flush();
+    }
+
+    bool alive(Handle handle) const
+    {
+      return handle.m_slot < m_slots.size() &&
+             m_slots[handle.m_slot].m_generation == handle.m_generation &&
+             !m_slots[handle.m_slot].m_removed;
+    }
+
+    // Returns nullptr for stale handles
+    T * get(Handle handle)
+    {
+      return alive(handle) ? &m_objects[m_slots[handle.m_slot].m_index] : nullptr;
+    }
+
+    const T * get(Handle handle) const
+    {
+      return alive(handle) ? &m_objects[m_slots[handle.m_slot].m_index] : nullptr;
+    }
+
+    // Dense access, indices change when objects are flushed
+    size_t size() const
+    {
+      return m_objects.size();
+    }
+
+    T & operator[](size_t index)
+    {
+      return m_objects[index];
+    }
+
+    const T & operator[](size_t index) const
+    {
+      return m_objects[index];
+    }
+
+    Handle handle(size_t index) const
+    {
+      return { m_owners[index], m_slots[m_owners[index]].m_generation };
+    }
+
+    bool removed(size_t index) const
+    {
+      return m_slots[m_owners[index]].m_removed;
+    }
+
+  private:
+
+    struct Slot
+    {
+      uint32_t m_index;
+      uint32_t m_generation;
+      bool m_removed;
+    };
+
+    std::vector<T> m_objects;
+
+    // Slot of every object, parallel to m_objects
+    std::vector<uint32_t> m_owners;
+
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_free;
+    std::vector<uint32_t> m_removed;
+};
+
+#endif
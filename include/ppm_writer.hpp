@@ -6,40 +6,62 @@
 #include <string>
 #include <vector>
 
+#include "logger.hpp"
+
 class PPMWriter
 {
   public:
 
 		template <typename T>
-    void write(const std::vector<T> & colors, int rows, int cols, std::string filename)
+    void write(const std::vector<T> & colors, int rows, int cols, std::string filename, bool binary = false)
     {
-      std::ofstream f_(filename);
+      std::ofstream f_(filename, binary ? std::ios::binary : std::ios::out);
 
       if (f_.is_open())
       {
-        f_ << "P3\n" << cols << " " << rows << "\n255\n";
-        
-        for (int j = 0; j < rows; ++j)
+        // Binary PPMs (P6) are written in a single pass over a byte buffer, they are much faster
+        // to produce than the ASCII ones (P3) when dumping whole rendered frames.
+        if (binary)
+        {
+          f_ << "P6\n" << cols << " " << rows << "\n255\n";
+
+          std::vector<char> bytes_(rows * cols * 3);
+
+          for (int i = 0; i < rows * cols; ++i)
+          {
+            bytes_[i * 3 + 0] = colors[i].r;
+            bytes_[i * 3 + 1] = colors[i].g;
+            bytes_[i * 3 + 2] = colors[i].b;
+          }
+
+          f_.write(bytes_.data(), bytes_.size());
+        }
+        else
         {
-          for (int i = 0; i < cols; ++i)
+          f_ << "P3\n" << cols << " " << rows << "\n255\n";
+        
+          for (int j = 0; j < rows; ++j)
           {
-            int idx_ = j * cols + i;
+            for (int i = 0; i < cols; ++i)
+            {
+              int idx_ = j * cols + i;
 
-            int ir_ = colors[idx_].r;
-            int ig_ = colors[idx_].g;
-            int ib_ = colors[idx_].b;
+              int ir_ = colors[idx_].r;
+              int ig_ = colors[idx_].g;
+              int ib_ = colors[idx_].b;
 
-            f_ << ir_ << " " << ig_ << " " << ib_ << "\n";
+              f_ << ir_ << " " << ig_ << " " << ib_ << "\n";
+            }
           }
         }
 
         f_.close();
 
-				std::cout << "Written file " << filename << "\n";
+				LOG_INFO("Wrote PPM", { { "file", filename }, { "rows", rows }, { "cols", cols } });
       }
       else
       {
-        std::cerr << "ERROR: Unable to open file " << filename << "\n";
+        LOG_ERROR("Unable to open file", { { "file", filename } });
       }
     }
 };
@@ -0,0 +1,395 @@
+#ifndef PROFILER_HPP_
+#define PROFILER_HPP_
+
+// Instrumentation of the hot paths with scoped zones. PROFILE_ZONE("name") times the rest of the enclosing
+// scope, zones nest into a hierarchy per thread, PROFILE_FRAME() marks the end of a frame and
+// PROFILE_THREAD("name") names the calling thread in the trace. Names must be string literals, only their
+// pointers are stored.
+//
+// Every thread records into a ring buffer of its own that only it writes, so a zone costs two reads of the
+// time stamp counter and a store, without locks. A full ring overwrites its oldest events instead of
+// waiting. The rings are read when the profile is exported, as a Chrome trace (chrome://tracing or
+// Perfetto) and as a summary of where the time of a frame goes.
+//
+// Zones are only compiled in with DOOMFS_PROFILE defined (cmake -DDOOMFS_PROFILE=ON), otherwise the macros
+// expand to nothing and nothing of this header is built.
+
+#ifdef DOOMFS_PROFILE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Time stamp counter ticks where there is an invariant one, steady clock nanoseconds elsewhere
+inline uint64_t profile_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct ProfileEvent
+{
+  // Null for the frame markers
+  const char * m_name;
+  uint64_t m_start;
+  uint64_t m_end;
+
+  // Ticks spent in the zones nested in this one, the rest is its own
+  uint64_t m_children;
+  uint32_t m_depth;
+};
+
+// Events of a thread, written by that thread and read by the exporter. Reads are meant for when the
+// thread is idle (e.g., between frames or at exit), events overwritten while they are copied are dropped.
+class ProfileRing
+{
+  public:
+
+    static const size_t kCapacity = 1 << 16;
+
+    ProfileRing(uint32_t thread)
+      : m_thread(thread), m_name("thread " + std::to_string(thread)), m_events(kCapacity)
+    {
+
+    }
+
+    void push(const ProfileEvent & crEvent)
+    {
+      uint64_t written_ = m_written.load(std::memory_order_relaxed);
+      m_events[written_ & (kCapacity - 1)] = crEvent;
+      m_written.store(written_ + 1, std::memory_order_release);
+    }
+
+    // The events still in the ring, oldest first
+    std::vector<ProfileEvent> snapshot() const
+    {
+      uint64_t end_ = m_written.load(std::memory_order_acquire);
+      uint64_t begin_ = (end_ > kCapacity) ? end_ - kCapacity : 0;
+
+      std::vector<ProfileEvent> events_;
+      events_.reserve(end_ - begin_);
+
+      for (uint64_t i = begin_; i < end_; ++i)
+        events_.push_back(m_events[i & (kCapacity - 1)]);
+
+      // The writer may already be storing event after_, whose slot is the one of after_ - kCapacity, so
+      // that one is dropped as well
+      uint64_t after_ = m_written.load(std::memory_order_acquire);
+      uint64_t overwritten_ = (after_ + 1 > kCapacity) ? std::min(after_ + 1 - kCapacity, end_) : 0;
+
+      if (overwritten_ > begin_)
+        events_.erase(events_.begin(), events_.begin() + (overwritten_ - begin_));
+
+      return events_;
+    }
+
+    uint32_t thread() const
+    {
+      return m_thread;
+    }
+
+    const std::string & name() const
+    {
+      return m_name;
+    }
+
+    // Under the mutex of the profiler, the exporter reads the name with it held
+    void set_name(const std::string & crName)
+    {
+      m_name = crName;
+    }
+
+  private:
+
+    uint32_t m_thread;
+    std::string m_name;
+    std::vector<ProfileEvent> m_events;
+    std::atomic<uint64_t> m_written { 0 };
+};
+
+// Owns the rings of every thread that recorded something, they outlive their threads so workers that
+// already finished still show up in the profile
+class Profiler
+{
+  public:
+
+    static Profiler & instance()
+    {
+      static Profiler profiler_;
+      return profiler_;
+    }
+
+    ProfileRing & register_thread()
+    {
+      std::lock_guard<std::mutex> lock_(m_mutex);
+      m_rings.push_back(std::make_unique<ProfileRing>(m_rings.size()));
+      return *m_rings.back();
+    }
+
+    void set_thread_name(ProfileRing & rRing, const std::string & crName)
+    {
+      std::lock_guard<std::mutex> lock_(m_mutex);
+      rRing.set_name(crName);
+    }
+
+    // Complete events for the zones and instant events for the frames, in microseconds
+    void write_chrome_trace(const std::string & crFilename)
+    {
+      std::ofstream file_(crFilename);
+
+      if (!file_)
+        throw std::runtime_error("Failed to write profile " + crFilename + "!");
+
+      double us_per_tick_ = 1e6 / ticks_per_second();
+      size_t events_ = 0;
+
+      file_ << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+
+      std::lock_guard<std::mutex> lock_(m_mutex);
+
+      for (const std::unique_ptr<ProfileRing> & crRing : m_rings)
+      {
+        file_ << ((events_++ == 0) ? "\n" : ",\n")
+              << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << crRing->thread()
+              << ",\"args\":{\"name\":\"" << crRing->name() << "\"}}";
+
+        for (const ProfileEvent & crEvent : crRing->snapshot())
+        {
+          file_ << ",\n";
+
+          if (crEvent.m_name == nullptr)
+            file_ << "{\"name\":\"frame\",\"ph\":\"i\",\"s\":\"g\"";
+          else
+            file_ << "{\"name\":\"" << crEvent.m_name << "\",\"ph\":\"X\",\"dur\":" << (crEvent.m_end - crEvent.m_start) * us_per_tick_;
+
+          file_ << ",\"ts\":" << (crEvent.m_start - m_start_ticks) * us_per_tick_ << ",\"pid\":1,\"tid\":" << crRing->thread() << "}";
+          ++events_;
+        }
+      }
+
+      file_ << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+      std::cout << "Wrote " << events_ << " profile events to " << crFilename << "\n";
+    }
+
+    // Time per frame of every zone, of all the threads, between the first and the last frame marker.
+    // Inclusive time counts the nested zones too, self time does not.
+    void print_frame_summary(std::ostream & rOs)
+    {
+      std::vector<ProfileEvent> events_;
+
+      {
+        std::lock_guard<std::mutex> lock_(m_mutex);
+
+        for (const std::unique_ptr<ProfileRing> & crRing : m_rings)
+        {
+          std::vector<ProfileEvent> thread_events_ = crRing->snapshot();
+          events_.insert(events_.end(), thread_events_.begin(), thread_events_.end());
+        }
+      }
+
+      // In the order they ended, so the zones of every thread go through the frames together
+      std::sort(events_.begin(), events_.end(), [](const ProfileEvent & crA, const ProfileEvent & crB) {
+        return crA.m_end < crB.m_end;
+      });
+
+      std::vector<uint64_t> frames_;
+      for (const ProfileEvent & crEvent : events_)
+        if (crEvent.m_name == nullptr)
+          frames_.push_back(crEvent.m_end);
+
+      if (frames_.size() < 2)
+      {
+        rOs << "Profile has no complete frames\n";
+        return;
+      }
+
+      struct ZoneStats
+      {
+        uint64_t m_calls = 0;
+        uint64_t m_inclusive = 0;
+        uint64_t m_self = 0;
+        uint64_t m_max = 0;
+        size_t m_frame = SIZE_MAX;
+        uint64_t m_frame_ticks = 0;
+      };
+
+      // Zones belong to the frame they end in
+      std::map<std::string, ZoneStats> zones_;
+
+      for (const ProfileEvent & crEvent : events_)
+      {
+        if (crEvent.m_name == nullptr || crEvent.m_end <= frames_.front() || crEvent.m_end > frames_.back())
+          continue;
+
+        size_t frame_ = std::lower_bound(frames_.begin(), frames_.end(), crEvent.m_end) - frames_.begin();
+        uint64_t ticks_ = crEvent.m_end - crEvent.m_start;
+
+        ZoneStats & rStats = zones_[crEvent.m_name];
+        rStats.m_calls++;
+        rStats.m_inclusive += ticks_;
+        rStats.m_self += ticks_ - std::min(ticks_, crEvent.m_children);
+
+        if (rStats.m_frame != frame_)
+        {
+          rStats.m_frame = frame_;
+          rStats.m_frame_ticks = 0;
+        }
+
+        rStats.m_frame_ticks += ticks_;
+        rStats.m_max = std::max(rStats.m_max, rStats.m_frame_ticks);
+      }
+
+      std::vector<std::pair<std::string, ZoneStats>> sorted_(zones_.begin(), zones_.end());
+      std::sort(sorted_.begin(), sorted_.end(), [](const std::pair<std::string, ZoneStats> & crA, const std::pair<std::string, ZoneStats> & crB) {
+        return crA.second.m_inclusive > crB.second.m_inclusive;
+      });
+
+      size_t count_ = frames_.size() - 1;
+      double ms_per_tick_ = 1e3 / ticks_per_second();
+
+      rOs << "Profile of " << count_ << " frames (" << (frames_.back() - frames_.front()) * ms_per_tick_ / count_ << " ms per frame)\n";
+      rOs << std::left << std::setw(40) << "Zone" << std::right << std::setw(12) << "Calls" << std::setw(14) << "Inclusive"
+          << std::setw(14) << "Self" << std::setw(14) << "Max" << "\n";
+
+      rOs << std::fixed << std::setprecision(3);
+
+      for (const auto & crZone : sorted_)
+      {
+        const ZoneStats & crStats = crZone.second;
+        rOs << std::left << std::setw(40) << crZone.first << std::right
+            << std::setw(12) << std::setprecision(1) << (double)crStats.m_calls / count_ << std::setprecision(3)
+            << std::setw(11) << crStats.m_inclusive * ms_per_tick_ / count_ << " ms"
+            << std::setw(11) << crStats.m_self * ms_per_tick_ / count_ << " ms"
+            << std::setw(11) << crStats.m_max * ms_per_tick_ << " ms\n";
+      }
+
+      rOs << std::defaultfloat;
+    }
+
+  private:
+
+    Profiler()
+      : m_start_ticks(profile_ticks()), m_start_time(std::chrono::steady_clock::now())
+    {
+
+    }
+
+    // Measured against the steady clock over the whole run, the counter has no fixed rate
+    double ticks_per_second() const
+    {
+      double seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start_time).count();
+      uint64_t ticks_ = profile_ticks() - m_start_ticks;
+
+      return (seconds_ > 0.0 && ticks_ > 0) ? ticks_ / seconds_ : 1e9;
+    }
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<ProfileRing>> m_rings;
+
+    uint64_t m_start_ticks;
+    std::chrono::steady_clock::time_point m_start_time;
+};
+
+// Ring and zone stack of the calling thread, the ring is registered the first time the thread records
+struct ProfileThread
+{
+  static const uint32_t kMaxDepth = 64;
+
+  ProfileRing * m_ring = nullptr;
+  uint32_t m_depth = 0;
+  uint64_t m_children[kMaxDepth];
+
+  static ProfileThread & current()
+  {
+    thread_local ProfileThread thread_;
+
+    if (thread_.m_ring == nullptr)
+      thread_.m_ring = &Profiler::instance().register_thread();
+
+    return thread_;
+  }
+};
+
+class ProfileZone
+{
+  public:
+
+    ProfileZone(const char * pName)
+      : m_name(pName), m_thread(&ProfileThread::current())
+    {
+      m_depth = m_thread->m_depth++;
+
+      if (m_depth < ProfileThread::kMaxDepth)
+        m_thread->m_children[m_depth] = 0;
+
+      m_start = profile_ticks();
+    }
+
+    ~ProfileZone()
+    {
+      uint64_t end_ = profile_ticks();
+      uint64_t children_ = (m_depth < ProfileThread::kMaxDepth) ? m_thread->m_children[m_depth] : 0;
+
+      if (m_depth > 0 && m_depth <= ProfileThread::kMaxDepth)
+        m_thread->m_children[m_depth - 1] += end_ - m_start;
+
+      m_thread->m_depth--;
+      m_thread->m_ring->push({ m_name, m_start, end_, children_, m_depth });
+    }
+
+    ProfileZone(const ProfileZone &) = delete;
+    ProfileZone & operator=(const ProfileZone &) = delete;
+
+  private:
+
+    const char * m_name;
+    ProfileThread * m_thread;
+    uint64_t m_start;
+    uint32_t m_depth;
+};
+
+inline void profile_frame()
+{
+  uint64_t now_ = profile_ticks();
+  ProfileThread::current().m_ring->push({ nullptr, now_, now_, 0, 0 });
+}
+
+inline void profile_thread_name(const std::string & crName)
+{
+  Profiler::instance().set_thread_name(*ProfileThread::current().m_ring, crName);
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_FRAME() profile_frame()
+#define PROFILE_THREAD(name) profile_thread_name(name)
+
+#else
+
+#define PROFILE_ZONE(name)
+#define PROFILE_FRAME()
+#define PROFILE_THREAD(name)
+
+#endif
+
+#endif
@@ -0,0 +1,672 @@
+#ifndef SIGHT_HPP_
+#define SIGHT_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "collision.hpp"
+#include "fixed.hpp"
+#include "level_geometry.hpp"
+#include "map_objects.hpp"
+#include "wad.hpp"
+
+// Line of sight and hitscan traces, like p_sight.c and the path traversal of p_maputl.c.
+//
+// Sight first looks at the REJECT table, one bit per pair of sectors telling that nothing in the first
+// can ever see the second, and only walks the BSP when it does not rule the pair out: the subsectors the
+// line between the two things crosses are visited in order and every two-sided line on the way narrows
+// the window of slopes they can see each other through, until it closes or the target is reached.
+//
+// Hitscans walk the blockmap cells along the shot in order, gathering the lines and things the shot
+// crosses, and return the nearest one that stops it.
+
+#define LEVEL_NODE_NONE 0xFFFF
+
+// How far hitscans reach, like MISSILERANGE
+const Fixed kMissileRange = Fixed::from_int(32 * 64);
+
+enum class TraceHit
+{
+  kNone,
+  kLine,
+  kThing
+};
+
+struct TraceResult
+{
+  TraceHit m_hit;
+  int m_line;
+  Handle m_thing;
+
+  // Where the shot stopped, slightly in front of what it hit
+  Fixed m_x;
+  Fixed m_y;
+  Fixed m_z;
+};
+
+class LevelSight
+{
+  public:
+
+    LevelSight()
+    {
+
+    }
+
+    LevelSight(const WADLevel & crLevel)
+    {
+      // The packed table of the level is used as it is, from the lump or the mapped level cache
+      m_reject = crLevel.reject;
+      build_nodes(crLevel);
+    }
+
+    // Whether the REJECT table says nothing in sector from can see sector to
+    bool rejected(unsigned int from, unsigned int to) const
+    {
+      return m_reject.rejected(from, to);
+    }
+
+    // P_CheckSight, whether the eyes of the looker see any part of the target
+    bool check_sight(const LevelCollision & crCollision, const MapObject & crLooker, const MapObject & crTarget)
+    {
+      if (rejected(crLooker.m_sector, crTarget.m_sector))
+        return false;
+
+      return trace_sight(crCollision, crLooker, crTarget);
+    }
+
+    // Sight from every looker to the same target in one call. Results are 1 for the lookers that see it.
+    // Lookers are grouped by sector, so the REJECT bit of each sector is tested once and a rejected sector
+    // rules out all of its lookers before any BSP walk.
+    void check_sight(const LevelCollision & crCollision,
+                     const MapObjects & crMobjs,
+                     const std::vector<Handle> & crLookers,
+                     Handle target,
+                     std::vector<uint8_t> & rVisible)
+    {
+      rVisible.assign(crLookers.size(), 0);
+
+      const MapObject * pTarget = crMobjs.get(target);
+      if (pTarget == nullptr)
+        return;
+
+      m_grouped_lookers.clear();
+
+      for (size_t i = 0; i < crLookers.size(); ++i)
+      {
+        const MapObject * pLooker = crMobjs.get(crLookers[i]);
+
+        if (pLooker != nullptr && crLookers[i] != target)
+          m_grouped_lookers.push_back({ pLooker->m_sector, (uint32_t)i });
+      }
+
+      std::sort(m_grouped_lookers.begin(), m_grouped_lookers.end());
+
+      for (size_t first_ = 0; first_ < m_grouped_lookers.size(); )
+      {
+        unsigned short sector_ = m_grouped_lookers[first_].first;
+        size_t last_ = first_;
+
+        while (last_ < m_grouped_lookers.size() && m_grouped_lookers[last_].first == sector_)
+          ++last_;
+
+        if (!rejected(sector_, pTarget->m_sector))
+        {
+          for (size_t i = first_; i < last_; ++i)
+          {
+            uint32_t looker_ = m_grouped_lookers[i].second;
+            rVisible[looker_] = trace_sight(crCollision, *crMobjs.get(crLookers[looker_]), *pTarget);
+          }
+        }
+
+        first_ = last_;
+      }
+    }
+
+    // P_LineAttack without the damage: traces a shot from the shooter along angle, going up or down by
+    // slope units per unit, and returns the first wall or shootable thing it hits within distance
+    TraceResult trace_line(const LevelCollision & crCollision,
+                           const MapObjects & crMobjs,
+                           Handle shooter,
+                           BAM angle,
+                           Fixed distance,
+                           Fixed slope)
+    {
+      const MapObject & crShooter = *crMobjs.get(shooter);
+
+      Fixed x2_ = crShooter.m_x + cosine(angle) * distance.to_int();
+      Fixed y2_ = crShooter.m_y + sine(angle) * distance.to_int();
+
+      m_shoot_z = crShooter.m_z + Fixed::from_raw(crShooter.m_height.raw() >> 1) + Fixed::from_int(8);
+      m_attack_range = distance;
+      m_aim_slope = slope;
+
+      gather_intercepts(crCollision, crMobjs, crShooter.m_x, crShooter.m_y, x2_, y2_);
+
+      std::sort(m_intercepts.begin(), m_intercepts.end(), [](const Intercept & crA, const Intercept & crB) {
+        return crA.m_frac < crB.m_frac;
+      });
+
+      TraceResult result_ = { TraceHit::kNone, -1, Handle(), x2_, y2_, m_shoot_z + slope * distance };
+
+      for (const Intercept & crIntercept : m_intercepts)
+      {
+        if (crIntercept.m_frac > Fixed::from_int(1))
+          break;
+
+        if (crIntercept.m_line >= 0)
+        {
+          if (!shot_stops_at_line(crCollision, crCollision.lines()[crIntercept.m_line], crIntercept.m_frac))
+            continue;
+
+          result_.m_hit = TraceHit::kLine;
+          result_.m_line = crIntercept.m_line;
+          set_hit_point(result_, crIntercept.m_frac - Fixed::from_int(4) / m_attack_range);
+          return result_;
+        }
+
+        if (crIntercept.m_thing == shooter)
+          continue;
+
+        const MapObject * pThing = crMobjs.get(crIntercept.m_thing);
+        if (pThing == nullptr || !(pThing->m_flags & MOBJ_FLAG_SHOOTABLE))
+          continue;
+
+        Fixed distance_ = m_attack_range * crIntercept.m_frac;
+
+        // Over or under it
+        if ((pThing->m_z + pThing->m_height - m_shoot_z) / distance_ < m_aim_slope ||
+            (pThing->m_z - m_shoot_z) / distance_ > m_aim_slope)
+          continue;
+
+        result_.m_hit = TraceHit::kThing;
+        result_.m_thing = crIntercept.m_thing;
+        set_hit_point(result_, crIntercept.m_frac - Fixed::from_int(10) / m_attack_range);
+        return result_;
+      }
+
+      return result_;
+    }
+
+  private:
+
+    struct DivLine
+    {
+      Fixed m_x;
+      Fixed m_y;
+      Fixed m_dx;
+      Fixed m_dy;
+    };
+
+    struct SightNode
+    {
+      DivLine m_line;
+
+      // Front (right) and back (left) children
+      unsigned short m_children[2];
+    };
+
+    struct Intercept
+    {
+      Fixed m_frac;
+
+      // A line index, or -1 for a thing
+      int m_line;
+      Handle m_thing;
+    };
+
+    void build_nodes(const WADLevel & crLevel)
+    {
+      for (const WADLevelNode & crNode : crLevel.nodes)
+      {
+        SightNode node_;
+        node_.m_line = { Fixed::from_int(crNode.x_start), Fixed::from_int(crNode.y_start), Fixed::from_int(crNode.dx), Fixed::from_int(crNode.dy) };
+        node_.m_children[0] = crNode.right_child;
+        node_.m_children[1] = crNode.left_child;
+        m_nodes.push_back(node_);
+      }
+
+      // Lines of every subsector, each only once even if several segs of it are there
+      m_subsector_offsets.push_back(0);
+
+      for (const WADLevelSubSector & crSubsector : crLevel.ssectors)
+      {
+        size_t first_ = m_subsector_lines.size();
+
+        for (unsigned int s = crSubsector.start_seg; s < crSubsector.start_seg + crSubsector.num_segs; ++s)
+        {
+          unsigned short line_ = crLevel.segs[s].linedef;
+
+          if (std::find(m_subsector_lines.begin() + first_, m_subsector_lines.end(), line_) == m_subsector_lines.end())
+            m_subsector_lines.push_back(line_);
+        }
+
+        m_subsector_offsets.push_back(m_subsector_lines.size());
+      }
+
+      m_line_stamps.assign(crLevel.linedefs.size(), 0);
+    }
+
+    // The BSP walk of P_CheckSight, once REJECT did not rule the pair out
+    bool trace_sight(const LevelCollision & crCollision, const MapObject & crLooker, const MapObject & crTarget)
+    {
+      new_validcount();
+
+      m_sight_z = crLooker.m_z + crLooker.m_height - Fixed::from_raw(crLooker.m_height.raw() >> 2);
+      m_top_slope = crTarget.m_z + crTarget.m_height - m_sight_z;
+      m_bottom_slope = crTarget.m_z - m_sight_z;
+
+      m_trace = { crLooker.m_x, crLooker.m_y, crTarget.m_x - crLooker.m_x, crTarget.m_y - crLooker.m_y };
+      m_target_x = crTarget.m_x;
+      m_target_y = crTarget.m_y;
+
+      // A level with a single subsector has no nodes at all
+      if (m_nodes.empty())
+        return cross_subsector(crCollision, 0);
+
+      return cross_node(crCollision, m_nodes.size() - 1);
+    }
+
+    void new_validcount()
+    {
+      if (++m_validcount == 0)
+      {
+        std::fill(m_line_stamps.begin(), m_line_stamps.end(), 0);
+        m_validcount = 1;
+      }
+    }
+
+    // P_DivlineSide, 0 front, 1 back and 2 on the line. Uses only the integer parts of the coordinates,
+    // like the original (including testing x against the y of horizontal lines).
+    static int divline_side(Fixed x, Fixed y, const DivLine & crLine)
+    {
+      if (crLine.m_dx == Fixed())
+      {
+        if (x == crLine.m_x)
+          return 2;
+
+        if (x <= crLine.m_x)
+          return crLine.m_dy > Fixed();
+
+        return crLine.m_dy < Fixed();
+      }
+
+      if (crLine.m_dy == Fixed())
+      {
+        if (x == crLine.m_y)
+          return 2;
+
+        if (y <= crLine.m_y)
+          return crLine.m_dx < Fixed();
+
+        return crLine.m_dx > Fixed();
+      }
+
+      int32_t left_ = (crLine.m_dy.raw() >> kFracBits) * ((x - crLine.m_x).raw() >> kFracBits);
+      int32_t right_ = ((y - crLine.m_y).raw() >> kFracBits) * (crLine.m_dx.raw() >> kFracBits);
+
+      if (right_ < left_)
+        return 0;
+
+      return (left_ == right_) ? 2 : 1;
+    }
+
+    // P_PointOnDivlineSide, 0 front and 1 back
+    static int point_on_divline_side(Fixed x, Fixed y, const DivLine & crLine)
+    {
+      if (crLine.m_dx == Fixed())
+      {
+        if (x <= crLine.m_x)
+          return crLine.m_dy > Fixed();
+
+        return crLine.m_dy < Fixed();
+      }
+
+      if (crLine.m_dy == Fixed())
+      {
+        if (y <= crLine.m_y)
+          return crLine.m_dx < Fixed();
+
+        return crLine.m_dx > Fixed();
+      }
+
+      Fixed dx_ = x - crLine.m_x;
+      Fixed dy_ = y - crLine.m_y;
+
+      // Different signs decide without multiplying
+      if ((crLine.m_dy.raw() ^ crLine.m_dx.raw() ^ dx_.raw() ^ dy_.raw()) & 0x80000000)
+        return ((crLine.m_dy.raw() ^ dx_.raw()) & 0x80000000) ? 1 : 0;
+
+      Fixed left_ = Fixed::from_raw(crLine.m_dy.raw() >> 8) * Fixed::from_raw(dx_.raw() >> 8);
+      Fixed right_ = Fixed::from_raw(dy_.raw() >> 8) * Fixed::from_raw(crLine.m_dx.raw() >> 8);
+
+      return (right_ < left_) ? 0 : 1;
+    }
+
+    // P_InterceptVector, the fraction along the trace where it crosses the line
+    static Fixed intercept_vector(const DivLine & crTrace, const DivLine & crLine)
+    {
+      Fixed den_ = Fixed::from_raw(crLine.m_dy.raw() >> 8) * crTrace.m_dx - Fixed::from_raw(crLine.m_dx.raw() >> 8) * crTrace.m_dy;
+
+      if (den_ == Fixed())
+        return Fixed();
+
+      Fixed num_ = Fixed::from_raw((crLine.m_x - crTrace.m_x).raw() >> 8) * crLine.m_dy +
+                   Fixed::from_raw((crTrace.m_y - crLine.m_y).raw() >> 8) * crLine.m_dx;
+
+      return num_ / den_;
+    }
+
+    static DivLine line_divline(const CollisionLine & crLine)
+    {
+      return { crLine.m_x, crLine.m_y, crLine.m_dx, crLine.m_dy };
+    }
+
+    // P_CrossBSPNode, visits the front side of the partition first and the back side only if the sight
+    // line reaches it
+    bool cross_node(const LevelCollision & crCollision, unsigned short node)
+    {
+      if (node & LEVEL_SUBSECTOR_FLAG)
+        return cross_subsector(crCollision, (node == LEVEL_NODE_NONE) ? 0 : (node & ~LEVEL_SUBSECTOR_FLAG));
+
+      const SightNode & crNode = m_nodes[node];
+
+      int side_ = divline_side(m_trace.m_x, m_trace.m_y, crNode.m_line);
+      if (side_ == 2)
+        side_ = 0;
+
+      if (!cross_node(crCollision, crNode.m_children[side_]))
+        return false;
+
+      if (side_ == divline_side(m_target_x, m_target_y, crNode.m_line))
+        return true;
+
+      return cross_node(crCollision, crNode.m_children[side_ ^ 1]);
+    }
+
+    // P_CrossSubsector, narrows the visible slopes through the lines of a subsector the sight line crosses
+    bool cross_subsector(const LevelCollision & crCollision, unsigned int subsector)
+    {
+      if (subsector + 1 >= m_subsector_offsets.size())
+        return true;
+
+      const std::vector<CollisionLine> & crLines = crCollision.lines();
+
+      for (uint32_t i = m_subsector_offsets[subsector]; i < m_subsector_offsets[subsector + 1]; ++i)
+      {
+        uint16_t index_ = m_subsector_lines[i];
+
+        if (m_line_stamps[index_] == m_validcount)
+          continue;
+
+        m_line_stamps[index_] = m_validcount;
+        const CollisionLine & crLine = crLines[index_];
+
+        // The line has to cross the sight line...
+        if (divline_side(crLine.m_x, crLine.m_y, m_trace) == divline_side(crLine.m_x + crLine.m_dx, crLine.m_y + crLine.m_dy, m_trace))
+          continue;
+
+        // ...and the sight line has to cross the line
+        DivLine line_ = line_divline(crLine);
+
+        if (divline_side(m_trace.m_x, m_trace.m_y, line_) == divline_side(m_target_x, m_target_y, line_))
+          continue;
+
+        if (crLine.m_front < 0 || crLine.m_back < 0 || !(crLine.m_flags & LEVEL_LINEDEF_FLAG_TWO_SIDED))
+          return false;
+
+        Fixed front_floor_ = crCollision.floor_height(crLine.m_front);
+        Fixed back_floor_ = crCollision.floor_height(crLine.m_back);
+        Fixed front_ceiling_ = crCollision.ceiling_height(crLine.m_front);
+        Fixed back_ceiling_ = crCollision.ceiling_height(crLine.m_back);
+
+        if (front_floor_ == back_floor_ && front_ceiling_ == back_ceiling_)
+          continue;
+
+        Fixed open_top_, open_bottom_, low_floor_;
+        crCollision.line_opening(crLine, open_top_, open_bottom_, low_floor_);
+
+        if (open_bottom_ >= open_top_)
+          return false;
+
+        Fixed frac_ = intercept_vector(m_trace, line_);
+
+        if (front_floor_ != back_floor_)
+          m_bottom_slope = std::max(m_bottom_slope, (open_bottom_ - m_sight_z) / frac_);
+
+        if (front_ceiling_ != back_ceiling_)
+          m_top_slope = std::min(m_top_slope, (open_top_ - m_sight_z) / frac_);
+
+        if (m_top_slope <= m_bottom_slope)
+          return false;
+      }
+
+      return true;
+    }
+
+    // The cells of P_PathTraverse walked in order from (x1, y1) to (x2, y2), adding the lines and things
+    // the trace crosses in each
+    void gather_intercepts(const LevelCollision & crCollision, const MapObjects & crMobjs, Fixed x1, Fixed y1, Fixed x2, Fixed y2)
+    {
+      m_intercepts.clear();
+      new_validcount();
+
+      const int block_size_ = 1 << kMapBlockShift;
+      const int block_to_frac_ = kMapBlockShift - kFracBits;
+
+      // Starting exactly on a cell edge would go down both sides of it
+      if (((x1 - crCollision.origin_x()).raw() & (block_size_ - 1)) == 0)
+        x1 += Fixed::from_int(1);
+
+      if (((y1 - crCollision.origin_y()).raw() & (block_size_ - 1)) == 0)
+        y1 += Fixed::from_int(1);
+
+      m_trace = { x1, y1, x2 - x1, y2 - y1 };
+
+      int32_t rx1_ = (x1 - crCollision.origin_x()).raw();
+      int32_t ry1_ = (y1 - crCollision.origin_y()).raw();
+      int32_t rx2_ = (x2 - crCollision.origin_x()).raw();
+      int32_t ry2_ = (y2 - crCollision.origin_y()).raw();
+
+      int xt1_ = rx1_ >> kMapBlockShift;
+      int yt1_ = ry1_ >> kMapBlockShift;
+      int xt2_ = rx2_ >> kMapBlockShift;
+      int yt2_ = ry2_ >> kMapBlockShift;
+
+      int map_x_step_, map_y_step_;
+      Fixed partial_, x_step_, y_step_;
+
+      if (xt2_ > xt1_)
+      {
+        map_x_step_ = 1;
+        partial_ = Fixed::from_int(1) - Fixed::from_raw((rx1_ >> block_to_frac_) & (kFracUnit - 1));
+        y_step_ = Fixed::from_raw(ry2_ - ry1_) / abs(Fixed::from_raw(rx2_ - rx1_));
+      }
+      else if (xt2_ < xt1_)
+      {
+        map_x_step_ = -1;
+        partial_ = Fixed::from_raw((rx1_ >> block_to_frac_) & (kFracUnit - 1));
+        y_step_ = Fixed::from_raw(ry2_ - ry1_) / abs(Fixed::from_raw(rx2_ - rx1_));
+      }
+      else
+      {
+        map_x_step_ = 0;
+        partial_ = Fixed::from_int(1);
+        y_step_ = Fixed::from_int(256);
+      }
+
+      Fixed y_intercept_ = Fixed::from_raw(ry1_ >> block_to_frac_) + partial_ * y_step_;
+
+      if (yt2_ > yt1_)
+      {
+        map_y_step_ = 1;
+        partial_ = Fixed::from_int(1) - Fixed::from_raw((ry1_ >> block_to_frac_) & (kFracUnit - 1));
+        x_step_ = Fixed::from_raw(rx2_ - rx1_) / abs(Fixed::from_raw(ry2_ - ry1_));
+      }
+      else if (yt2_ < yt1_)
+      {
+        map_y_step_ = -1;
+        partial_ = Fixed::from_raw((ry1_ >> block_to_frac_) & (kFracUnit - 1));
+        x_step_ = Fixed::from_raw(rx2_ - rx1_) / abs(Fixed::from_raw(ry2_ - ry1_));
+      }
+      else
+      {
+        map_y_step_ = 0;
+        partial_ = Fixed::from_int(1);
+        x_step_ = Fixed::from_int(256);
+      }
+
+      Fixed x_intercept_ = Fixed::from_raw(rx1_ >> block_to_frac_) + partial_ * x_step_;
+
+      int map_x_ = xt1_;
+      int map_y_ = yt1_;
+
+      for (int count = 0; count < 64; ++count)
+      {
+        if (map_x_ >= 0 && map_y_ >= 0 && map_x_ < crCollision.columns() && map_y_ < crCollision.rows())
+        {
+          int block_ = map_y_ * crCollision.columns() + map_x_;
+          add_line_intercepts(crCollision, block_);
+          add_thing_intercepts(crCollision, crMobjs, block_);
+        }
+
+        if (map_x_ == xt2_ && map_y_ == yt2_)
+          break;
+
+        if (y_intercept_.to_int() == map_y_)
+        {
+          y_intercept_ += y_step_;
+          map_x_ += map_x_step_;
+        }
+        else if (x_intercept_.to_int() == map_x_)
+        {
+          x_intercept_ += x_step_;
+          map_y_ += map_y_step_;
+        }
+      }
+    }
+
+    // PIT_AddLineIntercepts
+    void add_line_intercepts(const LevelCollision & crCollision, int block)
+    {
+      const Fixed long_trace_ = Fixed::from_int(16);
+
+      for (const uint16_t * pLine = crCollision.block_lines_begin(block); pLine != crCollision.block_lines_end(block); ++pLine)
+      {
+        if (m_line_stamps[*pLine] == m_validcount)
+          continue;
+
+        m_line_stamps[*pLine] = m_validcount;
+        const CollisionLine & crLine = crCollision.lines()[*pLine];
+
+        int s1_, s2_;
+
+        if (abs(m_trace.m_dx) > long_trace_ || abs(m_trace.m_dy) > long_trace_)
+        {
+          s1_ = point_on_divline_side(crLine.m_x, crLine.m_y, m_trace);
+          s2_ = point_on_divline_side(crLine.m_x + crLine.m_dx, crLine.m_y + crLine.m_dy, m_trace);
+        }
+        else
+        {
+          s1_ = LevelCollision::point_on_line_side(m_trace.m_x, m_trace.m_y, crLine);
+          s2_ = LevelCollision::point_on_line_side(m_trace.m_x + m_trace.m_dx, m_trace.m_y + m_trace.m_dy, crLine);
+        }
+
+        if (s1_ == s2_)
+          continue;
+
+        Fixed frac_ = intercept_vector(m_trace, line_divline(crLine));
+
+        if (frac_ < Fixed())
+          continue;
+
+        m_intercepts.push_back({ frac_, *pLine, Handle() });
+      }
+    }
+
+    // PIT_AddThingIntercepts, things are crossed along the diagonal of their box facing the trace
+    void add_thing_intercepts(const LevelCollision & crCollision, const MapObjects & crMobjs, int block)
+    {
+      bool positive_ = (m_trace.m_dx.raw() ^ m_trace.m_dy.raw()) > 0;
+
+      for (uint32_t slot = crCollision.block_first_thing(block); slot != kNoThing; slot = crCollision.next_thing(slot))
+      {
+        Handle handle_ = crCollision.thing_handle(slot);
+        const MapObject * pThing = crMobjs.get(handle_);
+
+        if (pThing == nullptr)
+          continue;
+
+        Fixed x1_ = pThing->m_x - pThing->m_radius;
+        Fixed x2_ = pThing->m_x + pThing->m_radius;
+        Fixed y1_ = positive_ ? pThing->m_y + pThing->m_radius : pThing->m_y - pThing->m_radius;
+        Fixed y2_ = positive_ ? pThing->m_y - pThing->m_radius : pThing->m_y + pThing->m_radius;
+
+        if (point_on_divline_side(x1_, y1_, m_trace) == point_on_divline_side(x2_, y2_, m_trace))
+          continue;
+
+        Fixed frac_ = intercept_vector(m_trace, { x1_, y1_, x2_ - x1_, y2_ - y1_ });
+
+        if (frac_ < Fixed())
+          continue;
+
+        m_intercepts.push_back({ frac_, -1, handle_ });
+      }
+    }
+
+    // PTR_ShootTraverse for lines, whether the shot hits the line or goes through its opening
+    bool shot_stops_at_line(const LevelCollision & crCollision, const CollisionLine & crLine, Fixed frac)
+    {
+      if (crLine.m_front < 0 || crLine.m_back < 0 || !(crLine.m_flags & LEVEL_LINEDEF_FLAG_TWO_SIDED))
+        return true;
+
+      Fixed open_top_, open_bottom_, low_floor_;
+      crCollision.line_opening(crLine, open_top_, open_bottom_, low_floor_);
+
+      Fixed distance_ = m_attack_range * frac;
+
+      if (crCollision.floor_height(crLine.m_front) != crCollision.floor_height(crLine.m_back) &&
+          (open_bottom_ - m_shoot_z) / distance_ > m_aim_slope)
+        return true;
+
+      if (crCollision.ceiling_height(crLine.m_front) != crCollision.ceiling_height(crLine.m_back) &&
+          (open_top_ - m_shoot_z) / distance_ < m_aim_slope)
+        return true;
+
+      return false;
+    }
+
+    void set_hit_point(TraceResult & rResult, Fixed frac) const
+    {
+      rResult.m_x = m_trace.m_x + m_trace.m_dx * frac;
+      rResult.m_y = m_trace.m_y + m_trace.m_dy * frac;
+      rResult.m_z = m_shoot_z + m_aim_slope * (frac * m_attack_range);
+    }
+
+    WADLevelReject m_reject;
+
+    std::vector<SightNode> m_nodes;
+    std::vector<uint32_t> m_subsector_offsets;
+    std::vector<uint16_t> m_subsector_lines;
+
+    std::vector<uint32_t> m_line_stamps;
+    uint32_t m_validcount = 0;
+
+    // State of the current sight check or trace
+    DivLine m_trace = {};
+    Fixed m_target_x;
+    Fixed m_target_y;
+    Fixed m_sight_z;
+    Fixed m_top_slope;
+    Fixed m_bottom_slope;
+    Fixed m_shoot_z;
+    Fixed m_attack_range;
+    Fixed m_aim_slope;
+    std::vector<Intercept> m_intercepts;
+
+    // Sector and index of the lookers of a batched sight check, sorted by sector
+    std::vector<std::pair<unsigned short, uint32_t>> m_grouped_lookers;
+};
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef SOFTWARE_COLUMNS_HPP_
+#define SOFTWARE_COLUMNS_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SOFTWARE_COLUMNS_X86
+#include <immintrin.h>
+#endif
+
+// Wall column drawing, the innermost loop of the software renderer. Textures are column-major so a
+// column is contiguous, and lighting goes through the colormaps (256-entry lookup tables). Adjacent
+// columns of a wall are drawn together with SSE2 (4 columns) or AVX2 (8 columns) kernels picked at
+// runtime: the rows every column of a group covers are drawn a row of the group at a time, the rest
+// of each column (and every column that cannot be grouped) goes through the scalar reference drawer,
+// so all kernels write exactly the same pixels.
+
+enum class ColumnKernel
+{
+  kScalar,
+  kSSE2,
+  kAVX2
+};
+
+// A column of a wall, offsets are relative to the texture and colormap arenas
+struct WallColumn
+{
+  int m_x;
+  int m_yl;
+  int m_yh;
+  uint32_t m_frac;
+  uint32_t m_step;
+  uint32_t m_source;
+  uint32_t m_colormap;
+};
+
+// Draws count pixels of a texture column downwards. The texture coordinate is 16.16 fixed point and
+// wraps around the column height, like DOOM does for walls.
+inline void draw_column(uint8_t * pDest,
+                        unsigned int pitch,
+                        int count,
+                        uint32_t frac,
+                        uint32_t step,
+                        const uint8_t * pSource,
+                        unsigned int height,
+                        const uint8_t * pColormap)
+{
+  if ((height & (height - 1)) == 0)
+  {
+    uint32_t mask_ = height - 1;
+
+    for (int i = 0; i < count; ++i)
+    {
+      *pDest = pColormap[pSource[(frac >> 16) & mask_]];
+      pDest += pitch;
+      frac += step;
+    }
+
+    return;
+  }
+
+  // Non power of two textures (e.g., 72 or 120 texels high) wrap explicitly instead of showing the
+  // vanilla tutti-frutti garbage
+  uint32_t frac_max_ = height << 16;
+  frac %= frac_max_;
+  step %= frac_max_;
+
+  for (int i = 0; i < count; ++i)
+  {
+    *pDest = pColormap[pSource[frac >> 16]];
+    pDest += pitch;
+    frac += step;
+
+    if (frac >= frac_max_)
+      frac -= frac_max_;
+  }
+}
+
+inline ColumnKernel detect_column_kernel()
+{
+#ifdef SOFTWARE_COLUMNS_X86
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return ColumnKernel::kAVX2;
+
+  if (__builtin_cpu_supports("sse2"))
+    return ColumnKernel::kSSE2;
+#endif
+
+  return ColumnKernel::kScalar;
+}
+
+inline const char * column_kernel_name(ColumnKernel kernel)
+{
+  switch (kernel)
+  {
+    case ColumnKernel::kAVX2:
+      return "AVX2";
+    case ColumnKernel::kSSE2:
+      return "SSE2";
+    default:
+      return "scalar";
+  }
+}
+
+inline void draw_wall_column(uint8_t * pFramebuffer,
+                             unsigned int pitch,
+                             const WallColumn & crColumn,
+                             int yl,
+                             int yh,
+                             const uint8_t * pTexels,
+                             const uint8_t * pColormaps,
+                             unsigned int height)
+{
+  if (yl > yh)
+    return;
+
+  draw_column(pFramebuffer + yl * pitch + crColumn.m_x,
+              pitch,
+              yh - yl + 1,
+              crColumn.m_frac + (uint32_t)(yl - crColumn.m_yl) * crColumn.m_step,
+              crColumn.m_step,
+              pTexels + crColumn.m_source,
+              height,
+              pColormaps + crColumn.m_colormap);
+}
+
+// Draws the rows of a group of columns outside the rows they all share with the scalar drawer, returns
+// the shared rows in rTop and rBottom (empty when rTop > rBottom)
+inline void draw_group_edges(uint8_t * pFramebuffer,
+                             unsigned int pitch,
+                             const WallColumn * pColumns,
+                             int lanes,
+                             const uint8_t * pTexels,
+                             const uint8_t * pColormaps,
+                             unsigned int height,
+                             int & rTop,
+                             int & rBottom)
+{
+  rTop = pColumns[0].m_yl;
+  rBottom = pColumns[0].m_yh;
+
+  for (int l = 1; l < lanes; ++l)
+  {
+    rTop = std::max(rTop, pColumns[l].m_yl);
+    rBottom = std::min(rBottom, pColumns[l].m_yh);
+  }
+
+  for (int l = 0; l < lanes; ++l)
+  {
+    const WallColumn & crColumn = pColumns[l];
+
+    if (rTop > rBottom)
+    {
+      draw_wall_column(pFramebuffer, pitch, crColumn, crColumn.m_yl, crColumn.m_yh, pTexels, pColormaps, height);
+      continue;
+    }
+
+    draw_wall_column(pFramebuffer, pitch, crColumn, crColumn.m_yl, rTop - 1, pTexels, pColormaps, height);
+    draw_wall_column(pFramebuffer, pitch, crColumn, rBottom + 1, crColumn.m_yh, pTexels, pColormaps, height);
+  }
+}
+
+#ifdef SOFTWARE_COLUMNS_X86
+
+// 4 columns per row, texture coordinates are stepped in one register and the texel and colormap fetches
+// stay scalar (SSE2 has no gather)
+__attribute__((target("sse2")))
+inline void draw_wall_columns_sse2(uint8_t * pFramebuffer,
+                                   unsigned int pitch,
+                                   const WallColumn * pColumns,
+                                   const uint8_t * pTexels,
+                                   const uint8_t * pColormaps,
+                                   unsigned int height)
+{
+  int top_, bottom_;
+  draw_group_edges(pFramebuffer, pitch, pColumns, 4, pTexels, pColormaps, height, top_, bottom_);
+
+  if (top_ > bottom_)
+    return;
+
+  uint32_t frac_[4];
+  uint32_t step_[4];
+  const uint8_t * pSource[4];
+  const uint8_t * pColormap[4];
+
+  for (int l = 0; l < 4; ++l)
+  {
+    frac_[l] = pColumns[l].m_frac + (uint32_t)(top_ - pColumns[l].m_yl) * pColumns[l].m_step;
+    step_[l] = pColumns[l].m_step;
+    pSource[l] = pTexels + pColumns[l].m_source;
+    pColormap[l] = pColormaps + pColumns[l].m_colormap;
+  }
+
+  __m128i frac_v_ = _mm_loadu_si128((const __m128i *)frac_);
+  __m128i step_v_ = _mm_loadu_si128((const __m128i *)step_);
+  __m128i mask_v_ = _mm_set1_epi32(height - 1);
+
+  alignas(16) uint32_t texel_[4];
+  uint8_t * pDest = pFramebuffer + top_ * pitch + pColumns[0].m_x;
+
+  for (int y = top_; y <= bottom_; ++y)
+  {
+    _mm_store_si128((__m128i *)texel_, _mm_and_si128(_mm_srli_epi32(frac_v_, 16), mask_v_));
+
+    pDest[0] = pColormap[0][pSource[0][texel_[0]]];
+    pDest[1] = pColormap[1][pSource[1][texel_[1]]];
+    pDest[2] = pColormap[2][pSource[2][texel_[2]]];
+    pDest[3] = pColormap[3][pSource[3][texel_[3]]];
+
+    frac_v_ = _mm_add_epi32(frac_v_, step_v_);
+    pDest += pitch;
+  }
+}
+
+// 8 columns per row. Gathers would fetch the texels and colormap entries in two instructions but they
+// are slower than scalar loads on most cores (much slower with the gather data sampling mitigation), so
+// like the SSE2 kernel only the texture coordinates are vectorized.
+__attribute__((target("avx2")))
+inline void draw_wall_columns_avx2(uint8_t * pFramebuffer,
+                                   unsigned int pitch,
+                                   const WallColumn * pColumns,
+                                   const uint8_t * pTexels,
+                                   const uint8_t * pColormaps,
+                                   unsigned int height)
+{
+  int top_, bottom_;
+  draw_group_edges(pFramebuffer, pitch, pColumns, 8, pTexels, pColormaps, height, top_, bottom_);
+
+  if (top_ > bottom_)
+    return;
+
+  uint32_t frac_[8];
+  uint32_t step_[8];
+  uint32_t source_[8];
+  const uint8_t * pColormap[8];
+
+  for (int l = 0; l < 8; ++l)
+  {
+    frac_[l] = pColumns[l].m_frac + (uint32_t)(top_ - pColumns[l].m_yl) * pColumns[l].m_step;
+    step_[l] = pColumns[l].m_step;
+    source_[l] = pColumns[l].m_source;
+    pColormap[l] = pColormaps + pColumns[l].m_colormap;
+  }
+
+  __m256i frac_v_ = _mm256_loadu_si256((const __m256i *)frac_);
+  __m256i step_v_ = _mm256_loadu_si256((const __m256i *)step_);
+  __m256i source_v_ = _mm256_loadu_si256((const __m256i *)source_);
+  __m256i mask_v_ = _mm256_set1_epi32(height - 1);
+
+  alignas(32) uint32_t texel_[8];
+  uint8_t * pDest = pFramebuffer + top_ * pitch + pColumns[0].m_x;
+
+  for (int y = top_; y <= bottom_; ++y)
+  {
+    _mm256_store_si256((__m256i *)texel_, _mm256_add_epi32(source_v_, _mm256_and_si256(_mm256_srli_epi32(frac_v_, 16), mask_v_)));
+
+    for (int l = 0; l < 8; ++l)
+      pDest[l] = pColormap[l][pTexels[texel_[l]]];
+
+    frac_v_ = _mm256_add_epi32(frac_v_, step_v_);
+    pDest += pitch;
+  }
+}
+
+#endif
+
+// Draws the columns of a wall, all of them from the same texture. Runs of adjacent columns go through
+// the wide kernels when the texture height is a power of two, everything else is drawn one column at a
+// time.
+inline void draw_wall_columns(uint8_t * pFramebuffer,
+                              unsigned int pitch,
+                              const std::vector<WallColumn> & crColumns,
+                              const uint8_t * pTexels,
+                              const uint8_t * pColormaps,
+                              unsigned int height,
+                              ColumnKernel kernel)
+{
+  size_t i = 0;
+
+#ifdef SOFTWARE_COLUMNS_X86
+  bool wrap_mask_ = (height & (height - 1)) == 0;
+
+  while (wrap_mask_ && kernel != ColumnKernel::kScalar && i < crColumns.size())
+  {
+    int lanes_ = (kernel == ColumnKernel::kAVX2) ? 8 : 4;
+
+    if (i + lanes_ <= crColumns.size() && crColumns[i + lanes_ - 1].m_x == crColumns[i].m_x + lanes_ - 1)
+    {
+      if (kernel == ColumnKernel::kAVX2)
+        draw_wall_columns_avx2(pFramebuffer, pitch, &crColumns[i], pTexels, pColormaps, height);
+      else
+        draw_wall_columns_sse2(pFramebuffer, pitch, &crColumns[i], pTexels, pColormaps, height);
+
+      i += lanes_;
+      continue;
+    }
+
+    const WallColumn & crColumn = crColumns[i++];
+    draw_wall_column(pFramebuffer, pitch, crColumn, crColumn.m_yl, crColumn.m_yh, pTexels, pColormaps, height);
+  }
+#endif
+
+  for (; i < crColumns.size(); ++i)
+    draw_wall_column(pFramebuffer, pitch, crColumns[i], crColumns[i].m_yl, crColumns[i].m_yh, pTexels, pColormaps, height);
+}
+
+#endif
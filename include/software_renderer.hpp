@@ -0,0 +1,1555 @@
+#ifndef SOFTWARE_RENDERER_HPP_
+#define SOFTWARE_RENDERER_HPP_
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "level_geometry.hpp"
+#include "profiler.hpp"
+#include "software_columns.hpp"
+#include "software_sprites.hpp"
+#include "software_visplanes.hpp"
+#include "wad.hpp"
+
+// Classic DOOM-style renderer running entirely on the CPU. The level is drawn front to back walking
+// the BSP: walls are drawn as vertical texture columns clipped against a list of solid screen ranges
+// so nothing is overdrawn, floors and ceilings are collected into visplanes and drawn afterwards as
+// horizontal spans, and things are drawn last, back to front, as masked sprites clipped against the
+// walls in front of them. The output is an 8-bit framebuffer of palette indices.
+//
+// The screen is split into vertical strips, one per thread. Every strip walks the BSP on its own with
+// its own clip lists, visplanes and sprites, so the threads share nothing but the read-only level data
+// and write disjoint columns of the framebuffer.
+
+const int kLightLevels = 16;
+const int kMaxLightScale = 48;
+const int kMaxLightZ = 128;
+const int kNumColormaps = 32;
+
+const float kPi = 3.14159265358979f;
+
+// Walls closer than this are clipped, sprites closer than kMinSpriteDistance are not drawn at all
+const float kNearClip = 1.0f;
+const float kMinSpriteDistance = 4.0f;
+
+struct SoftwareFramebuffer
+{
+  SoftwareFramebuffer(unsigned int width, unsigned int height)
+    : m_width(width), m_height(height), m_pixels(width * height, 0)
+  {
+  }
+
+  std::vector<WADPaletteColor> to_rgb(const std::vector<WADPaletteColor> & crPalette) const
+  {
+    std::vector<WADPaletteColor> rgb_(m_pixels.size());
+
+    for (size_t i = 0; i < m_pixels.size(); ++i)
+      rgb_[i] = crPalette[m_pixels[i]];
+
+    return rgb_;
+  }
+
+  unsigned int m_width;
+  unsigned int m_height;
+
+  // Row-major palette indices
+  std::vector<uint8_t> m_pixels;
+};
+
+struct RenderView
+{
+  float m_x;
+  float m_y;
+  float m_z;
+
+  // Radians, counter-clockwise from the positive X axis (east) like thing angles
+  float m_angle;
+};
+
+class SoftwareRenderer
+{
+  public:
+
+    SoftwareRenderer(const WAD & crWad, const WADLevel & crLevel, unsigned int threads = 1)
+      : m_wad(crWad), m_level(crLevel)
+    {
+      m_width = 0;
+      m_height = 0;
+
+      build_light_tables();
+      build_level_tables();
+      build_sprite_tables();
+      build_things();
+
+      m_column_kernel = detect_column_kernel();
+
+      // The calling thread renders the first strip, workers render the rest
+      m_contexts.resize(std::max(threads, 1u));
+      m_frame = 0;
+      m_pending = 0;
+      m_stop = false;
+
+      for (RenderContext & rCtx : m_contexts)
+        rCtx.m_vissprites.resize(m_things.size());
+
+      for (unsigned int i = 1; i < m_contexts.size(); ++i)
+        m_workers.emplace_back(&SoftwareRenderer::worker, this, i);
+    }
+
+    ~SoftwareRenderer()
+    {
+      {
+        std::lock_guard<std::mutex> lock_(m_mutex);
+        m_stop = true;
+      }
+
+      m_start_condition.notify_all();
+
+      for (std::thread & rWorker : m_workers)
+        rWorker.join();
+    }
+
+    SoftwareRenderer(const SoftwareRenderer &) = delete;
+    SoftwareRenderer & operator=(const SoftwareRenderer &) = delete;
+
+    void render(const RenderView & crView, SoftwareFramebuffer & rFramebuffer)
+    {
+      PROFILE_ZONE("SoftwareRenderer::render");
+
+      setup_resolution(rFramebuffer.m_width, rFramebuffer.m_height);
+
+      {
+        std::lock_guard<std::mutex> lock_(m_mutex);
+        m_frame_view = crView;
+        m_frame_framebuffer = &rFramebuffer;
+        m_pending = m_workers.size();
+        ++m_frame;
+      }
+
+      m_start_condition.notify_all();
+
+      render_strip(0);
+
+      // Frame barrier, the framebuffer is complete once every strip is
+      std::unique_lock<std::mutex> lock_(m_mutex);
+      m_done_condition.wait(lock_, [this] { return m_pending == 0; });
+    }
+
+    unsigned int threads() const
+    {
+      return m_contexts.size();
+    }
+
+    ColumnKernel column_kernel() const
+    {
+      return m_column_kernel;
+    }
+
+    // Every kernel draws the same image, forcing one is only useful to compare them
+    void set_column_kernel(ColumnKernel kernel)
+    {
+      m_column_kernel = kernel;
+    }
+
+    // View from the player 1 start, standing on the floor of its sector
+    RenderView start_view() const
+    {
+      RenderView view_ = { 0.0f, 0.0f, 41.0f, 0.0f };
+
+      for (const WADLevelThing & crThing : m_level.things)
+      {
+        if (crThing.type != 1)
+          continue;
+
+        view_.m_x = crThing.x;
+        view_.m_y = crThing.y;
+        view_.m_z = m_level.sectors[point_in_sector(m_level, crThing.x, crThing.y)].floor_height + 41.0f;
+        view_.m_angle = crThing.angle * kPi / 180.0f;
+        break;
+      }
+
+      return view_;
+    }
+
+  private:
+
+    struct ClipRange
+    {
+      int m_first;
+      int m_last;
+    };
+
+    struct DrawSeg
+    {
+      int m_x1;
+      int m_x2;
+      float m_scale1;
+      float m_scale_step;
+      float m_min_scale;
+      float m_max_scale;
+      float m_v1x;
+      float m_v1y;
+      float m_v2x;
+      float m_v2y;
+
+      // Solid walls hide everything behind them, otherwise the clip rows left after the wall was drawn
+      // are kept in the openings pool starting at these offsets
+      bool m_solid;
+      int m_top_clip;
+      int m_bottom_clip;
+    };
+
+    // Wall currently being drawn, in screen space. 1/z and u/z interpolate linearly across the screen.
+    struct WallProjection
+    {
+      unsigned int m_seg;
+      float m_sx1;
+      float m_dsx;
+      float m_invz1;
+      float m_invz2;
+      float m_uz1;
+      float m_uz2;
+    };
+
+    // Everything a frame writes while it is being rendered, the renderer itself stays read-only
+    struct RenderContext
+    {
+      RenderView m_view;
+      float m_cos;
+      float m_sin;
+
+      // View position in fixed point, for the rotations of the sprites
+      Fixed m_view_x;
+      Fixed m_view_y;
+      SoftwareFramebuffer * m_framebuffer;
+
+      // Columns [m_x_start, m_x_end) are rendered
+      int m_x_start;
+      int m_x_end;
+
+      std::vector<ClipRange> m_solid_segs;
+      std::vector<short> m_ceiling_clip;
+      std::vector<short> m_floor_clip;
+
+      VisplaneSet m_planes;
+      int m_floor_plane;
+      int m_ceiling_plane;
+
+      std::vector<DrawSeg> m_drawsegs;
+      std::vector<short> m_openings;
+
+      // Upper, middle and lower columns of the wall being drawn
+      std::vector<WallColumn> m_wall_columns[3];
+
+      // Scale of the solid wall covering each column, 0 while the column is open
+      std::vector<float> m_solid_scale;
+
+      // Pool with room for every thing of the level, a thing is projected at most once per frame
+      std::vector<VisSprite> m_vissprites;
+      size_t m_vissprite_count;
+      std::vector<uint32_t> m_sprite_order;
+      std::vector<uint64_t> m_sprite_keys;
+      std::vector<uint64_t> m_sprite_scratch;
+      std::vector<uint8_t> m_sector_visited;
+      std::vector<short> m_sprite_top_clip;
+      std::vector<short> m_sprite_bottom_clip;
+    };
+
+    struct SoftwareSector
+    {
+      float m_floor;
+      float m_ceiling;
+      int m_floor_flat;
+      int m_ceiling_flat;
+      int m_light;
+    };
+
+    struct SoftwareSide
+    {
+      int m_upper;
+      int m_lower;
+      int m_middle;
+    };
+
+    // Textures used by the level live one after the other, column-major, in the texture arena
+    struct SoftwareTexture
+    {
+      uint32_t m_offset;
+      unsigned int m_width;
+      unsigned int m_height;
+    };
+
+    struct SpriteFrame
+    {
+      bool m_rotate;
+      int m_lumps[8];
+      bool m_flip[8];
+    };
+
+    struct SoftwareThing
+    {
+      float m_x;
+      float m_y;
+
+      // The same position in fixed point, for the rotations
+      Fixed m_fixed_x;
+      Fixed m_fixed_y;
+      BAM m_angle;
+      unsigned short m_sector;
+      int m_frame;
+    };
+
+    // Map thing types to sprite names, only things that are visible in the level are listed
+    struct ThingSprite
+    {
+      unsigned short m_type;
+      const char * m_sprite;
+      char m_frame;
+    };
+
+    void worker(unsigned int strip)
+    {
+      PROFILE_THREAD("software strip " + std::to_string(strip));
+
+      unsigned long long frame_ = 0;
+
+      while (true)
+      {
+        {
+          std::unique_lock<std::mutex> lock_(m_mutex);
+          m_start_condition.wait(lock_, [&] { return m_stop || m_frame != frame_; });
+
+          if (m_stop)
+            return;
+
+          frame_ = m_frame;
+        }
+
+        render_strip(strip);
+
+        std::lock_guard<std::mutex> lock_(m_mutex);
+        if (--m_pending == 0)
+          m_done_condition.notify_one();
+      }
+    }
+
+    void render_strip(unsigned int strip)
+    {
+      RenderContext & rCtx = m_contexts[strip];
+      int x_start_ = m_width * strip / m_contexts.size();
+      int x_end_ = m_width * (strip + 1) / m_contexts.size();
+
+      if (x_start_ >= x_end_)
+        return;
+
+      PROFILE_ZONE("SoftwareRenderer::render_strip");
+
+      begin_frame(rCtx, m_frame_view, *m_frame_framebuffer, x_start_, x_end_);
+
+      // The walk is recursive, it is timed as a whole
+      {
+        PROFILE_ZONE("SoftwareRenderer::render_bsp_node");
+        render_bsp_node(rCtx, m_level.nodes.empty() ? LEVEL_SUBSECTOR_FLAG : (unsigned short)(m_level.nodes.size() - 1));
+      }
+
+      draw_planes(rCtx);
+      draw_sprites(rCtx);
+    }
+
+    void build_light_tables()
+    {
+      const std::vector<std::vector<uint8_t>> & colormaps_ = m_wad.colormaps();
+
+      // All colormaps back to back so the column drawers can address them with offsets from one base
+      m_colormap_arena.assign(colormaps_.size() * 256, 0);
+      for (size_t i = 0; i < colormaps_.size(); ++i)
+        std::copy(colormaps_[i].begin(), colormaps_[i].begin() + 256, m_colormap_arena.begin() + i * 256);
+
+      // Same tables as R_InitLightTables, each sector light level starts at a colormap and walls and
+      // planes fade towards darker colormaps with the distance
+      for (int i = 0; i < kLightLevels; ++i)
+      {
+        int start_map_ = ((kLightLevels - 1 - i) * 2) * kNumColormaps / kLightLevels;
+
+        for (int j = 0; j < kMaxLightZ; ++j)
+        {
+          int scale_ = 160 / (j + 1);
+          int level_ = std::min(std::max(start_map_ - scale_ / 2, 0), kNumColormaps - 1);
+          m_z_light[i][j] = m_colormap_arena.data() + std::min<size_t>(level_, colormaps_.size() - 1) * 256;
+        }
+
+        for (int j = 0; j < kMaxLightScale; ++j)
+        {
+          int level_ = std::min(std::max(start_map_ - j / 2, 0), kNumColormaps - 1);
+          m_scale_light[i][j] = m_colormap_arena.data() + std::min<size_t>(level_, colormaps_.size() - 1) * 256;
+        }
+      }
+    }
+
+    int texture_index(const std::string & crName)
+    {
+      if (crName == "-")
+        return -1;
+
+      auto it = m_texture_map.find(crName);
+      if (it != m_texture_map.end())
+        return it->second;
+
+      auto texture_ = m_wad.textures().find(crName);
+      if (texture_ == m_wad.textures().end())
+      {
+        std::cerr << "ERROR: Missing texture " << crName << "\n";
+        m_texture_map[crName] = -1;
+        return -1;
+      }
+
+      const WADTexture & crTexture = texture_->second;
+
+      // Textures with the same pixels under another name share the copy in the arena
+      auto same_ = m_texture_hash_map.find(crTexture.hash);
+      if (same_ != m_texture_hash_map.end())
+      {
+        m_texture_map[crName] = same_->second;
+        return same_->second;
+      }
+
+      uint32_t offset_ = m_texture_arena.size();
+      m_texture_arena.insert(m_texture_arena.end(), crTexture.pixels.begin(), crTexture.pixels.end());
+
+      int index_ = m_textures.size();
+      m_textures.push_back({ offset_, crTexture.width, crTexture.height });
+      m_texture_map[crName] = index_;
+      m_texture_hash_map[crTexture.hash] = index_;
+
+      return index_;
+    }
+
+    int flat_index(const std::string & crName)
+    {
+      // Sky ceilings are drawn from the sky texture instead
+      if (crName == kSkyFlatName)
+        return -1;
+
+      auto it = m_flat_map.find(crName);
+      if (it != m_flat_map.end())
+        return it->second;
+
+      // Flats used by the level are packed one after the other in a single arena, missing ones stay black.
+      // Identical flats are only packed once.
+      auto flat_ = m_wad.flats().find(crName);
+
+      if (flat_ != m_wad.flats().end())
+      {
+        auto same_ = m_flat_hash_map.find(m_wad.flat_hash(crName));
+        if (same_ != m_flat_hash_map.end())
+        {
+          m_flat_map[crName] = same_->second;
+          return same_->second;
+        }
+      }
+
+      int index_ = m_flat_arena.size() / (WAD_FLAT_SIZE * WAD_FLAT_SIZE);
+      m_flat_arena.resize(m_flat_arena.size() + WAD_FLAT_SIZE * WAD_FLAT_SIZE, 0);
+
+      if (flat_ == m_wad.flats().end())
+        std::cerr << "ERROR: Missing flat " << crName << "\n";
+      else
+      {
+        std::copy(flat_->second.begin(), flat_->second.end(), m_flat_arena.end() - WAD_FLAT_SIZE * WAD_FLAT_SIZE);
+        m_flat_hash_map[m_wad.flat_hash(crName)] = index_;
+      }
+
+      m_flat_map[crName] = index_;
+      return index_;
+    }
+
+    void build_level_tables()
+    {
+      for (const WADLevelSector & crSector : m_level.sectors)
+      {
+        SoftwareSector sector_;
+        sector_.m_floor = crSector.floor_height;
+        sector_.m_ceiling = crSector.ceiling_height;
+        sector_.m_floor_flat = flat_index(crSector.floor_texture);
+        sector_.m_ceiling_flat = flat_index(crSector.ceiling_texture);
+        sector_.m_light = std::min(crSector.light_level >> 4, kLightLevels - 1);
+        m_sectors.push_back(sector_);
+      }
+
+      for (const WADLevelSidedef & crSide : m_level.sidedefs)
+        m_sides.push_back({ texture_index(crSide.upper_texture), texture_index(crSide.lower_texture), texture_index(crSide.middle_texture) });
+
+      auto sky_ = m_wad.textures().find("SKY1");
+      m_sky = (sky_ != m_wad.textures().end()) ? &sky_->second : nullptr;
+    }
+
+    void build_sprite_tables()
+    {
+      // Sprite lumps are named PPPPFR or PPPPFRFR where PPPP is the sprite, F the frame letter and R the
+      // rotation (0 means the same picture is used for every angle). The second frame/rotation pair
+      // uses the same picture mirrored.
+      for (const auto & crEntry : m_wad.sprites())
+      {
+        const std::string & crName = crEntry.first;
+
+        if (crName.size() < 6)
+          continue;
+
+        // Sprite lumps with the same contents share their packed patch
+        auto same_ = m_patch_hash_map.find(crEntry.second->hash);
+        int lump_index_ = (same_ != m_patch_hash_map.end()) ? same_->second : m_patches.add(*crEntry.second);
+        m_patch_hash_map[crEntry.second->hash] = lump_index_;
+
+        install_sprite_frame(crName.substr(0, 4) + crName[4], crName[5] - '0', lump_index_, false);
+
+        if (crName.size() >= 8)
+          install_sprite_frame(crName.substr(0, 4) + crName[6], crName[7] - '0', lump_index_, true);
+      }
+    }
+
+    void install_sprite_frame(const std::string & crKey, int rotation, int lump, bool flip)
+    {
+      if (rotation < 0 || rotation > 8)
+        return;
+
+      auto it = m_sprite_frame_map.find(crKey);
+
+      if (it == m_sprite_frame_map.end())
+      {
+        SpriteFrame frame_ = {};
+        for (int r = 0; r < 8; ++r)
+          frame_.m_lumps[r] = -1;
+
+        it = m_sprite_frame_map.insert(std::make_pair(crKey, (int)m_sprite_frames.size())).first;
+        m_sprite_frames.push_back(frame_);
+      }
+
+      SpriteFrame & rFrame = m_sprite_frames[it->second];
+
+      if (rotation == 0)
+      {
+        rFrame.m_rotate = false;
+
+        for (int r = 0; r < 8; ++r)
+        {
+          rFrame.m_lumps[r] = lump;
+          rFrame.m_flip[r] = flip;
+        }
+      }
+      else
+      {
+        rFrame.m_rotate = true;
+        rFrame.m_lumps[rotation - 1] = lump;
+        rFrame.m_flip[rotation - 1] = flip;
+      }
+    }
+
+    void build_things()
+    {
+      static const ThingSprite kThingSprites[] = {
+        // Monsters
+        { 3004, "POSS", 'A' }, { 9, "SPOS", 'A' }, { 65, "CPOS", 'A' }, { 3001, "TROO", 'A' },
+        { 3002, "SARG", 'A' }, { 58, "SARG", 'A' }, { 3006, "SKUL", 'A' }, { 3005, "HEAD", 'A' },
+        { 3003, "BOSS", 'A' }, { 69, "BOS2", 'A' }, { 68, "BSPI", 'A' }, { 71, "PAIN", 'A' },
+        { 66, "SKEL", 'A' }, { 67, "FATT", 'A' }, { 64, "VILE", 'A' }, { 7, "SPID", 'A' },
+        { 16, "CYBR", 'A' }, { 84, "SSWV", 'A' },
+        // Weapons and ammo
+        { 2001, "SHOT", 'A' }, { 82, "SGN2", 'A' }, { 2002, "MGUN", 'A' }, { 2003, "LAUN", 'A' },
+        { 2004, "PLAS", 'A' }, { 2005, "CSAW", 'A' }, { 2006, "BFUG", 'A' }, { 2007, "CLIP", 'A' },
+        { 2048, "AMMO", 'A' }, { 2008, "SHEL", 'A' }, { 2049, "SBOX", 'A' }, { 2010, "ROCK", 'A' },
+        { 2046, "BROK", 'A' }, { 2047, "CELL", 'A' }, { 17, "CELP", 'A' }, { 8, "BPAK", 'A' },
+        // Health, armor and powerups
+        { 2011, "STIM", 'A' }, { 2012, "MEDI", 'A' }, { 2014, "BON1", 'A' }, { 2015, "BON2", 'A' },
+        { 2018, "ARM1", 'A' }, { 2019, "ARM2", 'A' }, { 2013, "SOUL", 'A' }, { 83, "MEGA", 'A' },
+        { 2022, "PINV", 'A' }, { 2023, "PSTR", 'A' }, { 2024, "PINS", 'A' }, { 2025, "SUIT", 'A' },
+        { 2026, "PMAP", 'A' }, { 2045, "PVIS", 'A' },
+        // Keys
+        { 5, "BKEY", 'A' }, { 6, "YKEY", 'A' }, { 13, "RKEY", 'A' }, { 40, "BSKU", 'A' },
+        { 39, "YSKU", 'A' }, { 38, "RSKU", 'A' },
+        // Obstacles and decorations
+        { 2035, "BAR1", 'A' }, { 48, "ELEC", 'A' }, { 30, "COL1", 'A' }, { 31, "COL2", 'A' },
+        { 32, "COL3", 'A' }, { 33, "COL4", 'A' }, { 36, "COL5", 'A' }, { 37, "COL6", 'A' },
+        { 41, "CEYE", 'A' }, { 42, "FSKU", 'A' }, { 43, "TRE1", 'A' }, { 54, "TRE2", 'A' },
+        { 44, "TBLU", 'A' }, { 45, "TGRN", 'A' }, { 46, "TRED", 'A' }, { 55, "SMBT", 'A' },
+        { 56, "SMGT", 'A' }, { 57, "SMRT", 'A' }, { 47, "SMIT", 'A' }, { 2028, "COLU", 'A' },
+        { 85, "TLMP", 'A' }, { 86, "TLP2", 'A' }, { 34, "CAND", 'A' }, { 35, "CBRA", 'A' },
+        { 70, "FCAN", 'A' },
+        // Hanging things and gore
+        { 49, "GOR1", 'A' }, { 63, "GOR1", 'A' }, { 50, "GOR2", 'A' }, { 59, "GOR2", 'A' },
+        { 51, "GOR3", 'A' }, { 61, "GOR3", 'A' }, { 52, "GOR4", 'A' }, { 60, "GOR4", 'A' },
+        { 53, "GOR5", 'A' }, { 62, "GOR5", 'A' }, { 25, "POL1", 'A' }, { 26, "POL6", 'A' },
+        { 27, "POL4", 'A' }, { 28, "POL2", 'A' }, { 29, "POL3", 'A' }, { 24, "POL5", 'A' },
+        { 10, "PLAY", 'W' }, { 12, "PLAY", 'W' }, { 15, "PLAY", 'N' }, { 18, "POSS", 'L' },
+        { 19, "SPOS", 'L' }, { 20, "TROO", 'M' }, { 21, "SARG", 'N' }, { 22, "HEAD", 'L' },
+        { 23, "SKUL", 'K' }
+      };
+
+      std::map<unsigned short, std::string> sprite_keys_;
+      for (const ThingSprite & crSprite : kThingSprites)
+        sprite_keys_[crSprite.m_type] = std::string(crSprite.m_sprite) + crSprite.m_frame;
+
+      m_sector_things.assign(m_level.sectors.size(), std::vector<int>());
+
+      for (const WADLevelThing & crThing : m_level.things)
+      {
+        // Skip multiplayer-only things and things that are not present in the hardest skills
+        if ((crThing.options & 0x0010) || !(crThing.options & 0x0004))
+          continue;
+
+        auto key_ = sprite_keys_.find(crThing.type);
+        if (key_ == sprite_keys_.end())
+          continue;
+
+        auto frame_ = m_sprite_frame_map.find(key_->second);
+        if (frame_ == m_sprite_frame_map.end())
+          continue;
+
+        SoftwareThing thing_;
+        thing_.m_x = crThing.x;
+        thing_.m_y = crThing.y;
+        thing_.m_fixed_x = Fixed::from_int(crThing.x);
+        thing_.m_fixed_y = Fixed::from_int(crThing.y);
+        thing_.m_angle = thing_angle(crThing);
+        thing_.m_sector = m_level.ssectors.empty() ? 0 : point_in_sector(m_level, crThing.x, crThing.y);
+        thing_.m_frame = frame_->second;
+
+        m_sector_things[thing_.m_sector].push_back(m_things.size());
+        m_things.push_back(thing_);
+      }
+    }
+
+    void setup_resolution(unsigned int width, unsigned int height)
+    {
+      if (width == m_width && height == m_height)
+        return;
+
+      m_width = width;
+      m_height = height;
+
+      // 90 degrees of horizontal field of view, pixels are square
+      m_center_x = width * 0.5f;
+      m_center_y = height * 0.5f;
+      m_projection = width * 0.5f;
+
+      // Light tables were designed for 320 columns
+      m_light_scale_factor = 16.0f * 320.0f / width;
+
+      // Distance to a plane seen through each row, per unit of height between the plane and the eye
+      m_row_slope.resize(height);
+      for (unsigned int y = 0; y < height; ++y)
+        m_row_slope[y] = m_projection / std::fabs(y + 0.5f - m_center_y);
+    }
+
+    void begin_frame(RenderContext & rCtx, const RenderView & crView, SoftwareFramebuffer & rFramebuffer, int xStart, int xEnd)
+    {
+      rCtx.m_view = crView;
+      rCtx.m_cos = std::cos(crView.m_angle);
+      rCtx.m_sin = std::sin(crView.m_angle);
+
+      // Clamped to the 16-bit map coordinates so the conversion stays defined for any view
+      rCtx.m_view_x = Fixed::from_float(std::max(-32768.0f, std::min(crView.m_x, 32767.0f)));
+      rCtx.m_view_y = Fixed::from_float(std::max(-32768.0f, std::min(crView.m_y, 32767.0f)));
+      rCtx.m_framebuffer = &rFramebuffer;
+      rCtx.m_x_start = xStart;
+      rCtx.m_x_end = xEnd;
+
+      // Two sentinels right outside the rendered columns so clipping never runs off the list
+      rCtx.m_solid_segs.clear();
+      rCtx.m_solid_segs.push_back({ INT_MIN / 2, xStart - 1 });
+      rCtx.m_solid_segs.push_back({ xEnd, INT_MAX / 2 });
+
+      rCtx.m_ceiling_clip.assign(m_width, -1);
+      rCtx.m_floor_clip.assign(m_width, (short)m_height);
+
+      rCtx.m_planes.begin_frame(m_width, m_height, xStart, xEnd);
+
+      rCtx.m_drawsegs.clear();
+      rCtx.m_openings.clear();
+
+      rCtx.m_solid_scale.assign(m_width, 0.0f);
+      rCtx.m_vissprite_count = 0;
+      rCtx.m_sector_visited.assign(m_level.sectors.size(), 0);
+      rCtx.m_sprite_top_clip.resize(m_width);
+      rCtx.m_sprite_bottom_clip.resize(m_width);
+    }
+
+    void to_view(const RenderContext & crCtx, float x, float y, float & rForward, float & rSide) const
+    {
+      float dx_ = x - crCtx.m_view.m_x;
+      float dy_ = y - crCtx.m_view.m_y;
+
+      rForward = dx_ * crCtx.m_cos + dy_ * crCtx.m_sin;
+      rSide = dx_ * crCtx.m_sin - dy_ * crCtx.m_cos;
+    }
+
+    bool screen_covered(const RenderContext & crCtx, int first, int last) const
+    {
+      for (const ClipRange & crRange : crCtx.m_solid_segs)
+        if (crRange.m_first <= first && crRange.m_last >= last)
+          return true;
+
+      return false;
+    }
+
+    // Returns whether any part of a node bounding box can be seen, i.e., it is inside the field of view
+    // and not completely hidden behind solid walls already drawn
+    bool check_bbox(const RenderContext & crCtx, float top, float bottom, float left, float right) const
+    {
+      float vx_ = crCtx.m_view.m_x;
+      float vy_ = crCtx.m_view.m_y;
+
+      if (vx_ >= left && vx_ <= right && vy_ >= bottom && vy_ <= top)
+        return true;
+
+      // Angles of the corners relative to the direction of the box center, which keeps the whole box
+      // within (-pi, pi) as seen from outside
+      float center_ = std::atan2((top + bottom) * 0.5f - vy_, (left + right) * 0.5f - vx_);
+      float corners_[4][2] = { { left, bottom }, { left, top }, { right, bottom }, { right, top } };
+      float min_ = 0.0f;
+      float max_ = 0.0f;
+
+      for (int c = 0; c < 4; ++c)
+      {
+        float a_ = std::atan2(corners_[c][1] - vy_, corners_[c][0] - vx_) - center_;
+
+        while (a_ > kPi)
+          a_ -= 2.0f * kPi;
+        while (a_ < -kPi)
+          a_ += 2.0f * kPi;
+
+        min_ = std::min(min_, a_);
+        max_ = std::max(max_, a_);
+      }
+
+      // Relative to the view direction now, with angles growing to the left
+      float rel_ = center_ - crCtx.m_view.m_angle;
+
+      while (rel_ > kPi)
+        rel_ -= 2.0f * kPi;
+      while (rel_ < -kPi)
+        rel_ += 2.0f * kPi;
+
+      float half_fov_ = std::atan(m_center_x / m_projection);
+
+      for (float wrap_ : { 0.0f, -2.0f * kPi, 2.0f * kPi })
+      {
+        float lo_ = std::max(rel_ + min_ + wrap_, -half_fov_);
+        float hi_ = std::min(rel_ + max_ + wrap_, half_fov_);
+
+        if (lo_ > hi_)
+          continue;
+
+        // Leftmost column comes from the highest angle
+        int x1_ = (int)std::floor(m_center_x - std::tan(hi_) * m_projection);
+        int x2_ = (int)std::ceil(m_center_x - std::tan(lo_) * m_projection);
+
+        x1_ = std::max(x1_, crCtx.m_x_start);
+        x2_ = std::min(x2_, crCtx.m_x_end - 1);
+
+        if (x1_ <= x2_ && !screen_covered(crCtx, x1_, x2_))
+          return true;
+      }
+
+      return false;
+    }
+
+    void render_bsp_node(RenderContext & rCtx, unsigned short child)
+    {
+      // Once solid walls cover every column nothing else can be seen
+      if (rCtx.m_solid_segs.size() == 1)
+        return;
+
+      if (child & LEVEL_SUBSECTOR_FLAG)
+      {
+        render_subsector(rCtx, child & ~LEVEL_SUBSECTOR_FLAG);
+        return;
+      }
+
+      const WADLevelNode & crNode = m_level.nodes[child];
+      bool front_ = point_on_node_front(crNode, rCtx.m_view.m_x, rCtx.m_view.m_y);
+
+      // Front to back, the far side is only visited if its bounding box can still be seen
+      render_bsp_node(rCtx, front_ ? crNode.right_child : crNode.left_child);
+
+      if (front_)
+      {
+        if (check_bbox(rCtx, crNode.left_y_upper, crNode.left_y_lower, crNode.left_x_lower, crNode.left_x_upper))
+          render_bsp_node(rCtx, crNode.left_child);
+      }
+      else
+      {
+        if (check_bbox(rCtx, crNode.right_y_upper, crNode.right_y_lower, crNode.right_x_lower, crNode.right_x_upper))
+          render_bsp_node(rCtx, crNode.right_child);
+      }
+    }
+
+    void render_subsector(RenderContext & rCtx, unsigned int subsector)
+    {
+      const WADLevelSubSector & crSubsector = m_level.ssectors[subsector];
+      unsigned short sector_index_ = subsector_sector(m_level, subsector);
+      const SoftwareSector & crSector = m_sectors[sector_index_];
+
+      rCtx.m_floor_plane = crSector.m_floor < rCtx.m_view.m_z
+                             ? find_plane(rCtx, crSector.m_floor, crSector.m_floor_flat, crSector.m_light)
+                             : -1;
+      rCtx.m_ceiling_plane = (crSector.m_ceiling > rCtx.m_view.m_z || crSector.m_ceiling_flat < 0)
+                               ? find_plane(rCtx, crSector.m_ceiling, crSector.m_ceiling_flat, crSector.m_light)
+                               : -1;
+
+      // Things are added once per sector, the first time one of its subsectors is seen
+      if (!rCtx.m_sector_visited[sector_index_])
+      {
+        rCtx.m_sector_visited[sector_index_] = 1;
+
+        for (int t : m_sector_things[sector_index_])
+          project_sprite(rCtx, m_things[t]);
+      }
+
+      for (unsigned int i = 0; i < crSubsector.num_segs; ++i)
+        add_line(rCtx, crSubsector.start_seg + i);
+    }
+
+    void add_line(RenderContext & rCtx, unsigned int segIndex)
+    {
+      const WADLevelSeg & crSeg = m_level.segs[segIndex];
+      const WADLevelVertex & crV1 = m_level.vertices[crSeg.start];
+      const WADLevelVertex & crV2 = m_level.vertices[crSeg.end];
+
+      // Segs are only seen from their front (right) side
+      if (line_side(crV1.x, crV1.y, crV2.x - crV1.x, crV2.y - crV1.y, rCtx.m_view.m_x, rCtx.m_view.m_y) <= 0.0)
+        return;
+
+      float f1_, s1_, f2_, s2_;
+      to_view(rCtx, crV1.x, crV1.y, f1_, s1_);
+      to_view(rCtx, crV2.x, crV2.y, f2_, s2_);
+
+      float u1_ = crSeg.offset;
+      float u2_ = crSeg.offset + std::sqrt(float(crV2.x - crV1.x) * (crV2.x - crV1.x) + float(crV2.y - crV1.y) * (crV2.y - crV1.y));
+
+      if (f1_ < kNearClip && f2_ < kNearClip)
+        return;
+
+      if (f1_ < kNearClip)
+      {
+        float t_ = (kNearClip - f1_) / (f2_ - f1_);
+        s1_ += (s2_ - s1_) * t_;
+        u1_ += (u2_ - u1_) * t_;
+        f1_ = kNearClip;
+      }
+      else if (f2_ < kNearClip)
+      {
+        float t_ = (kNearClip - f2_) / (f1_ - f2_);
+        s2_ += (s1_ - s2_) * t_;
+        u2_ += (u1_ - u2_) * t_;
+        f2_ = kNearClip;
+      }
+
+      WallProjection wall_;
+      wall_.m_seg = segIndex;
+      wall_.m_sx1 = m_center_x + s1_ * m_projection / f1_;
+      float sx2_ = m_center_x + s2_ * m_projection / f2_;
+      wall_.m_dsx = sx2_ - wall_.m_sx1;
+
+      if (wall_.m_dsx <= 0.0f)
+        return;
+
+      wall_.m_invz1 = 1.0f / f1_;
+      wall_.m_invz2 = 1.0f / f2_;
+      wall_.m_uz1 = u1_ / f1_;
+      wall_.m_uz2 = u2_ / f2_;
+
+      // A column is covered when its center is inside the projected wall
+      int x1_ = std::max((int)std::ceil(wall_.m_sx1 - 0.5f), rCtx.m_x_start);
+      int x2_ = std::min((int)std::ceil(sx2_ - 0.5f) - 1, rCtx.m_x_end - 1);
+
+      if (x1_ > x2_)
+        return;
+
+      unsigned short back_side_ = seg_back_sidedef(m_level, crSeg);
+      const WADLevelLinedef & crLinedef = m_level.linedefs[crSeg.linedef];
+
+      if (back_side_ == LEVEL_NO_SIDEDEF || !(crLinedef.flags & LEVEL_LINEDEF_FLAG_TWO_SIDED))
+      {
+        clip_wall_range(rCtx, x1_, x2_, true, wall_);
+        return;
+      }
+
+      const SoftwareSector & crFront = m_sectors[m_level.sidedefs[seg_front_sidedef(m_level, crSeg)].sector];
+      const SoftwareSector & crBack = m_sectors[m_level.sidedefs[back_side_].sector];
+
+      // Closed doors are solid
+      if (crBack.m_ceiling <= crFront.m_floor || crBack.m_floor >= crFront.m_ceiling)
+      {
+        clip_wall_range(rCtx, x1_, x2_, true, wall_);
+        return;
+      }
+
+      // A window, the back sector is seen through it
+      if (crBack.m_ceiling != crFront.m_ceiling || crBack.m_floor != crFront.m_floor)
+      {
+        clip_wall_range(rCtx, x1_, x2_, false, wall_);
+        return;
+      }
+
+      // Same heights on both sides, nothing to draw unless the flats or the light change
+      if (crBack.m_ceiling_flat == crFront.m_ceiling_flat &&
+          crBack.m_floor_flat == crFront.m_floor_flat &&
+          crBack.m_light == crFront.m_light)
+        return;
+
+      clip_wall_range(rCtx, x1_, x2_, false, wall_);
+    }
+
+    // Draws the parts of [first, last] not hidden behind solid walls yet. Solid walls are then added to
+    // the solid segs so later (further) walls are clipped against them.
+    void clip_wall_range(RenderContext & rCtx, int first, int last, bool solid, const WallProjection & crWall)
+    {
+      std::vector<ClipRange> & rSegs = rCtx.m_solid_segs;
+
+      int current_ = first;
+
+      for (size_t i = 0; i < rSegs.size() && current_ <= last; ++i)
+      {
+        if (rSegs[i].m_last < current_)
+          continue;
+
+        if (rSegs[i].m_first > current_)
+          store_wall_range(rCtx, crWall, current_, std::min(last, rSegs[i].m_first - 1), solid);
+
+        current_ = std::max(current_, rSegs[i].m_last + 1);
+      }
+
+      if (!solid)
+        return;
+
+      // Merge every range touching [first, last] into a single one
+      size_t a_ = 0;
+      while (rSegs[a_].m_last < first - 1)
+        ++a_;
+
+      size_t b_ = a_;
+      ClipRange merged_ = { first, last };
+
+      while (b_ < rSegs.size() && rSegs[b_].m_first <= last + 1)
+      {
+        merged_.m_first = std::min(merged_.m_first, rSegs[b_].m_first);
+        merged_.m_last = std::max(merged_.m_last, rSegs[b_].m_last);
+        ++b_;
+      }
+
+      rSegs.erase(rSegs.begin() + a_, rSegs.begin() + b_);
+      rSegs.insert(rSegs.begin() + a_, merged_);
+    }
+
+    int find_plane(RenderContext & rCtx, float height, int flat, int light)
+    {
+      // The sky is a single plane no matter its height or light
+      if (flat < 0)
+      {
+        height = 0.0f;
+        light = 0;
+      }
+
+      return rCtx.m_planes.find(height, flat, light);
+    }
+
+    void store_wall_range(RenderContext & rCtx, const WallProjection & crWall, int start, int stop, bool solid)
+    {
+      const WADLevelSeg & crSeg = m_level.segs[crWall.m_seg];
+      const WADLevelLinedef & crLinedef = m_level.linedefs[crSeg.linedef];
+      const WADLevelSidedef & crSidedef = m_level.sidedefs[seg_front_sidedef(m_level, crSeg)];
+      const SoftwareSide & crSide = m_sides[seg_front_sidedef(m_level, crSeg)];
+      const SoftwareSector & crFront = m_sectors[crSidedef.sector];
+      const WADLevelVertex & crV1 = m_level.vertices[crSeg.start];
+      const WADLevelVertex & crV2 = m_level.vertices[crSeg.end];
+
+      unsigned short back_side_ = seg_back_sidedef(m_level, crSeg);
+      const SoftwareSector * pBack = (back_side_ != LEVEL_NO_SIDEDEF && (crLinedef.flags & LEVEL_LINEDEF_FLAG_TWO_SIDED))
+                                       ? &m_sectors[m_level.sidedefs[back_side_].sector]
+                                       : nullptr;
+
+      float view_z_ = rCtx.m_view.m_z;
+      float world_top_ = crFront.m_ceiling - view_z_;
+      float world_bottom_ = crFront.m_floor - view_z_;
+      float world_high_ = 0.0f;
+      float world_low_ = 0.0f;
+      float y_offset_ = crSidedef.y_offset;
+
+      int mid_texture_ = -1;
+      int top_texture_ = -1;
+      int bottom_texture_ = -1;
+      float mid_texturemid_ = 0.0f;
+      float top_texturemid_ = 0.0f;
+      float bottom_texturemid_ = 0.0f;
+
+      bool mark_floor_ = true;
+      bool mark_ceiling_ = true;
+
+      if (!pBack)
+      {
+        mid_texture_ = crSide.m_middle;
+
+        if (mid_texture_ >= 0)
+          mid_texturemid_ = ((crLinedef.flags & LEVEL_LINEDEF_FLAG_LOWER_UNPEGGED)
+                               ? crFront.m_floor + m_textures[mid_texture_].m_height - view_z_
+                               : world_top_) + y_offset_;
+      }
+      else
+      {
+        world_high_ = pBack->m_ceiling - view_z_;
+        world_low_ = pBack->m_floor - view_z_;
+
+        // Sky hack, the upper wall between two sky sectors is not drawn
+        if (crFront.m_ceiling_flat < 0 && pBack->m_ceiling_flat < 0)
+          world_top_ = world_high_;
+
+        mark_floor_ = world_low_ != world_bottom_ || pBack->m_floor_flat != crFront.m_floor_flat || pBack->m_light != crFront.m_light;
+        mark_ceiling_ = world_high_ != world_top_ || pBack->m_ceiling_flat != crFront.m_ceiling_flat || pBack->m_light != crFront.m_light;
+
+        // Closed doors
+        if (pBack->m_ceiling <= crFront.m_floor || pBack->m_floor >= crFront.m_ceiling)
+          mark_floor_ = mark_ceiling_ = true;
+
+        if (world_high_ < world_top_ && crSide.m_upper >= 0)
+        {
+          top_texture_ = crSide.m_upper;
+          top_texturemid_ = ((crLinedef.flags & LEVEL_LINEDEF_FLAG_UPPER_UNPEGGED)
+                               ? world_top_
+                               : world_high_ + m_textures[top_texture_].m_height) + y_offset_;
+        }
+
+        if (world_low_ > world_bottom_ && crSide.m_lower >= 0)
+        {
+          bottom_texture_ = crSide.m_lower;
+          bottom_texturemid_ = ((crLinedef.flags & LEVEL_LINEDEF_FLAG_LOWER_UNPEGGED)
+                                  ? world_top_
+                                  : world_low_) + y_offset_;
+        }
+      }
+
+      // Planes on the other side of the view height cannot be seen
+      if (crFront.m_floor >= view_z_)
+        mark_floor_ = false;
+
+      if (crFront.m_ceiling <= view_z_ && crFront.m_ceiling_flat >= 0)
+        mark_ceiling_ = false;
+
+      if (mark_floor_ && rCtx.m_floor_plane >= 0)
+        rCtx.m_floor_plane = rCtx.m_planes.check(rCtx.m_floor_plane, start, stop);
+      else
+        mark_floor_ = false;
+
+      if (mark_ceiling_ && rCtx.m_ceiling_plane >= 0)
+        rCtx.m_ceiling_plane = rCtx.m_planes.check(rCtx.m_ceiling_plane, start, stop);
+      else
+        mark_ceiling_ = false;
+
+      // Fake contrast, walls along the axes are a bit darker or brighter
+      int light_ = crFront.m_light;
+      if (crV1.y == crV2.y)
+        light_ = std::max(light_ - 1, 0);
+      else if (crV1.x == crV2.x)
+        light_ = std::min(light_ + 1, kLightLevels - 1);
+
+      DrawSeg drawseg_;
+      drawseg_.m_x1 = start;
+      drawseg_.m_x2 = stop;
+      drawseg_.m_v1x = crV1.x;
+      drawseg_.m_v1y = crV1.y;
+      drawseg_.m_v2x = crV2.x;
+      drawseg_.m_v2y = crV2.y;
+      drawseg_.m_solid = solid;
+      drawseg_.m_top_clip = -1;
+      drawseg_.m_bottom_clip = -1;
+
+      if (!solid)
+      {
+        drawseg_.m_top_clip = rCtx.m_openings.size();
+        drawseg_.m_bottom_clip = drawseg_.m_top_clip + (stop - start + 1);
+        rCtx.m_openings.resize(drawseg_.m_bottom_clip + (stop - start + 1));
+      }
+
+      SoftwareFramebuffer & rFb = *rCtx.m_framebuffer;
+      std::vector<short> & rCeilingClip = rCtx.m_ceiling_clip;
+      std::vector<short> & rFloorClip = rCtx.m_floor_clip;
+      float x_offset_ = crSidedef.x_offset;
+
+      float scale_first_ = 0.0f;
+      float scale_last_ = 0.0f;
+
+      for (int x = start; x <= stop; ++x)
+      {
+        float t_ = (x + 0.5f - crWall.m_sx1) / crWall.m_dsx;
+        float invz_ = crWall.m_invz1 + (crWall.m_invz2 - crWall.m_invz1) * t_;
+        float scale_ = m_projection * invz_;
+        float iscale_ = 1.0f / scale_;
+        float u_ = (crWall.m_uz1 + (crWall.m_uz2 - crWall.m_uz1) * t_) / invz_ + x_offset_;
+
+        if (x == start)
+          scale_first_ = scale_;
+        if (x == stop)
+          scale_last_ = scale_;
+
+        if (solid)
+          rCtx.m_solid_scale[x] = scale_;
+
+        int light_index_ = std::min((int)(scale_ * m_light_scale_factor), kMaxLightScale - 1);
+        const uint8_t * pColormap = m_scale_light[light_][light_index_];
+
+        int ceiling_clip_ = rCeilingClip[x];
+        int floor_clip_ = rFloorClip[x];
+
+        int yl_ = (int)std::ceil(m_center_y - world_top_ * scale_ - 0.5f);
+        if (yl_ < ceiling_clip_ + 1)
+          yl_ = ceiling_clip_ + 1;
+
+        if (mark_ceiling_)
+        {
+          int top_ = ceiling_clip_ + 1;
+          int bottom_ = std::min(yl_ - 1, floor_clip_ - 1);
+
+          if (top_ <= bottom_)
+          {
+            Visplane & rPlane = rCtx.m_planes.plane(rCtx.m_ceiling_plane);
+            rPlane.m_top[x + 1] = top_;
+            rPlane.m_bottom[x + 1] = bottom_;
+          }
+        }
+
+        int yh_ = (int)std::ceil(m_center_y - world_bottom_ * scale_ - 0.5f) - 1;
+        if (yh_ >= floor_clip_)
+          yh_ = floor_clip_ - 1;
+
+        if (mark_floor_)
+        {
+          int top_ = std::max(yh_ + 1, ceiling_clip_ + 1);
+          int bottom_ = floor_clip_ - 1;
+
+          if (top_ <= bottom_)
+          {
+            Visplane & rPlane = rCtx.m_planes.plane(rCtx.m_floor_plane);
+            rPlane.m_top[x + 1] = top_;
+            rPlane.m_bottom[x + 1] = bottom_;
+          }
+        }
+
+        if (!pBack)
+        {
+          if (mid_texture_ >= 0 && yl_ <= yh_)
+            add_wall_column(rCtx.m_wall_columns[1], m_textures[mid_texture_], x, yl_, yh_, u_, mid_texturemid_, iscale_, pColormap);
+
+          rCeilingClip[x] = m_height;
+          rFloorClip[x] = -1;
+          continue;
+        }
+
+        if (top_texture_ >= 0)
+        {
+          int mid_ = std::min((int)std::ceil(m_center_y - world_high_ * scale_ - 0.5f) - 1, floor_clip_ - 1);
+
+          if (mid_ >= yl_)
+          {
+            add_wall_column(rCtx.m_wall_columns[0], m_textures[top_texture_], x, yl_, mid_, u_, top_texturemid_, iscale_, pColormap);
+            rCeilingClip[x] = mid_;
+          }
+          else
+            rCeilingClip[x] = yl_ - 1;
+        }
+        else if (mark_ceiling_)
+          rCeilingClip[x] = yl_ - 1;
+
+        if (bottom_texture_ >= 0)
+        {
+          int mid_ = std::max((int)std::ceil(m_center_y - world_low_ * scale_ - 0.5f), (int)rCeilingClip[x] + 1);
+
+          if (mid_ <= yh_)
+          {
+            add_wall_column(rCtx.m_wall_columns[2], m_textures[bottom_texture_], x, mid_, yh_, u_, bottom_texturemid_, iscale_, pColormap);
+            rFloorClip[x] = mid_;
+          }
+          else
+            rFloorClip[x] = yh_ + 1;
+        }
+        else if (mark_floor_)
+          rFloorClip[x] = yh_ + 1;
+
+        if (!solid)
+        {
+          rCtx.m_openings[drawseg_.m_top_clip + x - start] = rCeilingClip[x];
+          rCtx.m_openings[drawseg_.m_bottom_clip + x - start] = rFloorClip[x];
+        }
+      }
+
+      // The columns of each part of the wall are drawn together so adjacent ones can share the wide kernels
+      int textures_[3] = { top_texture_, mid_texture_, bottom_texture_ };
+
+      for (int k = 0; k < 3; ++k)
+      {
+        if (rCtx.m_wall_columns[k].empty())
+          continue;
+
+        draw_wall_columns(rFb.m_pixels.data(),
+                          rFb.m_width,
+                          rCtx.m_wall_columns[k],
+                          m_texture_arena.data(),
+                          m_colormap_arena.data(),
+                          m_textures[textures_[k]].m_height,
+                          m_column_kernel);
+        rCtx.m_wall_columns[k].clear();
+      }
+
+      drawseg_.m_scale1 = scale_first_;
+      drawseg_.m_scale_step = stop > start ? (scale_last_ - scale_first_) / (stop - start) : 0.0f;
+      drawseg_.m_min_scale = std::min(scale_first_, scale_last_);
+      drawseg_.m_max_scale = std::max(scale_first_, scale_last_);
+      rCtx.m_drawsegs.push_back(drawseg_);
+    }
+
+    void add_wall_column(std::vector<WallColumn> & rColumns,
+                         const SoftwareTexture & crTexture,
+                         int x,
+                         int yl,
+                         int yh,
+                         float u,
+                         float texturemid,
+                         float iscale,
+                         const uint8_t * pColormap)
+    {
+      int texture_column_ = (int)std::floor(u) % (int)crTexture.m_width;
+      if (texture_column_ < 0)
+        texture_column_ += crTexture.m_width;
+
+      // The coordinate of the first row is wrapped into the texture here, from then on the drawers only
+      // look at its low bits (power of two heights) or wrap it themselves
+      float v_ = std::fmod(texturemid + (yl + 0.5f - m_center_y) * iscale, (float)crTexture.m_height);
+      if (v_ < 0.0f)
+        v_ += crTexture.m_height;
+
+      WallColumn column_;
+      column_.m_x = x;
+      column_.m_yl = yl;
+      column_.m_yh = yh;
+      column_.m_frac = (uint32_t)(v_ * 65536.0f);
+      column_.m_step = (uint32_t)(iscale * 65536.0f);
+      column_.m_source = crTexture.m_offset + texture_column_ * crTexture.m_height;
+      column_.m_colormap = pColormap - m_colormap_arena.data();
+      rColumns.push_back(column_);
+    }
+
+    void draw_planes(RenderContext & rCtx)
+    {
+      PROFILE_ZONE("SoftwareRenderer::draw_planes");
+
+      for (int p : rCtx.m_planes.draw_order())
+      {
+        const Visplane & crPlane = rCtx.m_planes.plane(p);
+
+        if (crPlane.m_flat < 0)
+          draw_sky(rCtx, crPlane);
+        else
+          draw_plane_spans(rCtx, crPlane, rCtx.m_planes.make_spans(p));
+      }
+    }
+
+    // Spans come sorted by row, the texture mapping and light of a row are set up once for all its spans
+    void draw_plane_spans(RenderContext & rCtx, const Visplane & crPlane, const std::vector<PlaneSpan> & crSpans)
+    {
+      const uint8_t * pFlat = m_flat_arena.data() + crPlane.m_flat * WAD_FLAT_SIZE * WAD_FLAT_SIZE;
+      const uint8_t * pColormap = nullptr;
+      uint8_t * pPixels = rCtx.m_framebuffer->m_pixels.data();
+      float plane_z_ = std::fabs(crPlane.m_height - rCtx.m_view.m_z);
+
+      int row_ = -1;
+      uint32_t xfrac_ = 0;
+      uint32_t yfrac_ = 0;
+      uint32_t xstep_ = 0;
+      uint32_t ystep_ = 0;
+
+      for (const PlaneSpan & crSpan : crSpans)
+      {
+        if (crSpan.m_y != row_)
+        {
+          row_ = crSpan.m_y;
+
+          float distance_ = plane_z_ * m_row_slope[row_];
+
+          // World position under the first pixel of the row and the step from pixel to pixel along it
+          float t_ = (0.5f - m_center_x) / m_projection;
+          float wx_ = rCtx.m_view.m_x + distance_ * (rCtx.m_cos + t_ * rCtx.m_sin);
+          float wy_ = rCtx.m_view.m_y + distance_ * (rCtx.m_sin - t_ * rCtx.m_cos);
+
+          // Only the low 6 integer bits matter, unsigned arithmetic lets the coordinates wrap safely.
+          // Spans start from the row origin so a pixel gets the same texel no matter where its span (or
+          // strip) starts.
+          xstep_ = (uint32_t)(int32_t)(distance_ / m_projection * rCtx.m_sin * 65536.0f);
+          ystep_ = (uint32_t)(int32_t)(distance_ / m_projection * rCtx.m_cos * 65536.0f);
+          xfrac_ = (uint32_t)(int32_t)(std::fmod(wx_, 64.0f) * 65536.0f);
+          yfrac_ = (uint32_t)(int32_t)(std::fmod(-wy_, 64.0f) * 65536.0f);
+
+          pColormap = m_z_light[crPlane.m_light][std::min((int)(distance_ / 16.0f), kMaxLightZ - 1)];
+        }
+
+        draw_span(pPixels + row_ * m_width + crSpan.m_x1,
+                  crSpan.m_x2 - crSpan.m_x1 + 1,
+                  xfrac_ + xstep_ * crSpan.m_x1,
+                  yfrac_ + ystep_ * crSpan.m_x1,
+                  xstep_,
+                  ystep_,
+                  pFlat,
+                  pColormap);
+      }
+    }
+
+    void draw_sky(RenderContext & rCtx, const Visplane & crPlane)
+    {
+      if (!m_sky)
+        return;
+
+      // The sky wraps around four times a full turn and is drawn unlit, 1 texel per pixel at 320x200
+      const uint8_t * pColormap = m_wad.colormaps()[0].data();
+      float iscale_ = 200.0f / m_height;
+      float texturemid_ = 100.0f;
+
+      for (int x = crPlane.m_minx; x <= crPlane.m_maxx; ++x)
+      {
+        int top_ = crPlane.m_top[x + 1];
+        int bottom_ = crPlane.m_bottom[x + 1];
+
+        if (top_ == kPlaneUnused || top_ > bottom_)
+          continue;
+
+        float angle_ = rCtx.m_view.m_angle + std::atan((m_center_x - x - 0.5f) / m_projection);
+        int column_ = (int)std::floor(angle_ / (2.0f * kPi) * 1024.0f) % (int)m_sky->width;
+        if (column_ < 0)
+          column_ += m_sky->width;
+
+        float v_ = texturemid_ + (top_ + 0.5f - m_center_y) * iscale_;
+
+        draw_column(rCtx.m_framebuffer->m_pixels.data() + top_ * m_width + x,
+                    m_width,
+                    bottom_ - top_ + 1,
+                    (uint32_t)(int32_t)(v_ * 65536.0f),
+                    (uint32_t)(iscale_ * 65536.0f),
+                    m_sky->pixels.data() + column_ * m_sky->height,
+                    m_sky->height,
+                    pColormap);
+      }
+    }
+
+    void project_sprite(RenderContext & rCtx, const SoftwareThing & crThing)
+    {
+      float forward_, side_;
+      to_view(rCtx, crThing.m_x, crThing.m_y, forward_, side_);
+
+      if (forward_ < kMinSpriteDistance)
+        return;
+
+      float xscale_ = m_projection / forward_;
+      const SpriteFrame & crFrame = m_sprite_frames[crThing.m_frame];
+
+      // Pick the rotation facing the viewer, 8 rotations of 45 degrees centered on the thing angle. Done
+      // in BAM like vanilla so things turn at exactly the same view angles. The deltas are taken in fixed
+      // point like R_PointToAngle does, they wrap instead of overflowing across a whole 16-bit map.
+      int rotation_ = 0;
+
+      if (crFrame.m_rotate)
+      {
+        BAM angle_ = point_to_angle(crThing.m_fixed_x - rCtx.m_view_x, crThing.m_fixed_y - rCtx.m_view_y);
+        rotation_ = ((angle_ - crThing.m_angle + (kAng45 / 2) * 9).raw() >> 29) & 7;
+      }
+
+      int lump_index_ = crFrame.m_lumps[rotation_];
+      if (lump_index_ < 0)
+        return;
+
+      const PackedPatch & crPatch = m_patches.patch(lump_index_);
+      bool flip_ = crFrame.m_flip[rotation_];
+
+      float x1_exact_ = m_center_x + (side_ - crPatch.m_left_offset) * xscale_;
+      float x2_exact_ = m_center_x + (side_ - crPatch.m_left_offset + crPatch.m_width) * xscale_;
+
+      int x1_ = std::max((int)std::ceil(x1_exact_ - 0.5f), rCtx.m_x_start);
+      int x2_ = std::min((int)std::ceil(x2_exact_ - 0.5f) - 1, rCtx.m_x_end - 1);
+
+      // Columns already covered by a nearer solid wall can never show the sprite, a sprite completely
+      // behind solid walls is dropped before it costs a clip or a sort
+      while (x1_ <= x2_ && rCtx.m_solid_scale[x1_] > xscale_)
+        ++x1_;
+
+      while (x2_ >= x1_ && rCtx.m_solid_scale[x2_] > xscale_)
+        --x2_;
+
+      if (x1_ > x2_)
+        return;
+
+      const SoftwareSector & crSector = m_sectors[crThing.m_sector];
+
+      VisSprite & rSprite = rCtx.m_vissprites[rCtx.m_vissprite_count++];
+      rSprite.m_x1 = x1_;
+      rSprite.m_x2 = x2_;
+      rSprite.m_x1_exact = x1_exact_;
+      rSprite.m_gx = crThing.m_x;
+      rSprite.m_gy = crThing.m_y;
+      rSprite.m_scale = xscale_;
+      rSprite.m_xiscale = flip_ ? -1.0f / xscale_ : 1.0f / xscale_;
+      rSprite.m_startfrac = flip_ ? crPatch.m_width - 0.001f : 0.0f;
+      rSprite.m_texturemid = crSector.m_floor + crPatch.m_top_offset - rCtx.m_view.m_z;
+      rSprite.m_patch = lump_index_;
+      rSprite.m_colormap = m_scale_light[crSector.m_light][std::min((int)(xscale_ * m_light_scale_factor), kMaxLightScale - 1)];
+    }
+
+    void draw_sprites(RenderContext & rCtx)
+    {
+      PROFILE_ZONE("SoftwareRenderer::draw_sprites");
+
+      sort_vissprites(rCtx.m_vissprites, rCtx.m_vissprite_count, rCtx.m_sprite_order, rCtx.m_sprite_keys, rCtx.m_sprite_scratch);
+
+      for (uint32_t i : rCtx.m_sprite_order)
+        draw_sprite(rCtx, rCtx.m_vissprites[i]);
+    }
+
+    void draw_sprite(RenderContext & rCtx, const VisSprite & crSprite)
+    {
+      std::vector<short> & rTop = rCtx.m_sprite_top_clip;
+      std::vector<short> & rBottom = rCtx.m_sprite_bottom_clip;
+
+      for (int x = crSprite.m_x1; x <= crSprite.m_x2; ++x)
+      {
+        rTop[x] = -2;
+        rBottom[x] = -2;
+      }
+
+      // Walk the drawn walls from the nearest, the first wall in front of the sprite decides the clip
+      for (size_t i = rCtx.m_drawsegs.size(); i-- > 0; )
+      {
+        const DrawSeg & crSeg = rCtx.m_drawsegs[i];
+
+        if (crSeg.m_x1 > crSprite.m_x2 || crSeg.m_x2 < crSprite.m_x1)
+          continue;
+
+        // The wall is behind the sprite
+        if (crSeg.m_max_scale < crSprite.m_scale ||
+            (crSeg.m_min_scale < crSprite.m_scale &&
+             line_side(crSeg.m_v1x, crSeg.m_v1y, crSeg.m_v2x - crSeg.m_v1x, crSeg.m_v2y - crSeg.m_v1y, crSprite.m_gx, crSprite.m_gy) > 0.0))
+          continue;
+
+        int r1_ = std::max(crSeg.m_x1, crSprite.m_x1);
+        int r2_ = std::min(crSeg.m_x2, crSprite.m_x2);
+
+        for (int x = r1_; x <= r2_; ++x)
+        {
+          if (crSeg.m_solid)
+          {
+            if (rTop[x] == -2)
+              rTop[x] = m_height;
+            if (rBottom[x] == -2)
+              rBottom[x] = -1;
+          }
+          else
+          {
+            if (rTop[x] == -2)
+              rTop[x] = rCtx.m_openings[crSeg.m_top_clip + x - crSeg.m_x1];
+            if (rBottom[x] == -2)
+              rBottom[x] = rCtx.m_openings[crSeg.m_bottom_clip + x - crSeg.m_x1];
+          }
+        }
+      }
+
+      const PackedPatch & crPatch = m_patches.patch(crSprite.m_patch);
+      float iscale_ = 1.0f / crSprite.m_scale;
+      uint32_t step_ = (uint32_t)(iscale_ * 65536.0f);
+      float sprite_top_ = m_center_y - crSprite.m_texturemid * crSprite.m_scale;
+      uint8_t * pPixels = rCtx.m_framebuffer->m_pixels.data();
+
+      for (int x = crSprite.m_x1; x <= crSprite.m_x2; ++x)
+      {
+        int clip_top_ = rTop[x] == -2 ? -1 : rTop[x];
+        int clip_bottom_ = rBottom[x] == -2 ? (int)m_height : rBottom[x];
+
+        int column_ = (int)(crSprite.m_startfrac + (x + 0.5f - crSprite.m_x1_exact) * crSprite.m_xiscale);
+        column_ = std::min(std::max(column_, 0), (int)crPatch.m_width - 1);
+
+        for (const uint8_t * pPost = m_patches.column(crPatch, column_); *pPost != kPatchColumnEnd; pPost += pPost[1] + 2)
+        {
+          int size_ = pPost[1];
+          const uint8_t * pSource = pPost + 2;
+
+          float top_ = sprite_top_ + pPost[0] * crSprite.m_scale;
+          float bottom_ = top_ + size_ * crSprite.m_scale;
+
+          int yl_ = std::max((int)std::ceil(top_ - 0.5f), clip_top_ + 1);
+          int yh_ = std::min((int)std::ceil(bottom_ - 0.5f) - 1, clip_bottom_ - 1);
+
+          if (yl_ > yh_)
+            continue;
+
+          uint32_t frac_ = (uint32_t)std::max((yl_ + 0.5f - top_) * iscale_ * 65536.0f, 0.0f);
+          uint8_t * pDest = pPixels + yl_ * m_width + x;
+
+          for (int y = yl_; y <= yh_; ++y)
+          {
+            *pDest = crSprite.m_colormap[pSource[std::min((int)(frac_ >> 16), size_ - 1)]];
+            pDest += m_width;
+            frac_ += step_;
+          }
+        }
+      }
+    }
+
+    const WAD & m_wad;
+    const WADLevel & m_level;
+
+    unsigned int m_width;
+    unsigned int m_height;
+    float m_center_x;
+    float m_center_y;
+    float m_projection;
+    float m_light_scale_factor;
+    std::vector<float> m_row_slope;
+
+    const uint8_t * m_scale_light[kLightLevels][kMaxLightScale];
+    const uint8_t * m_z_light[kLightLevels][kMaxLightZ];
+
+    std::vector<SoftwareSector> m_sectors;
+    std::vector<SoftwareSide> m_sides;
+    std::vector<uint8_t> m_colormap_arena;
+    std::vector<SoftwareTexture> m_textures;
+    std::vector<uint8_t> m_texture_arena;
+    std::map<std::string, int> m_texture_map;
+    std::unordered_map<uint64_t, int> m_texture_hash_map;
+    std::vector<uint8_t> m_flat_arena;
+    std::map<std::string, int> m_flat_map;
+    std::unordered_map<uint64_t, int> m_flat_hash_map;
+    const WADTexture * m_sky;
+
+    SpritePatches m_patches;
+    std::unordered_map<uint64_t, int> m_patch_hash_map;
+    std::vector<SpriteFrame> m_sprite_frames;
+    std::map<std::string, int> m_sprite_frame_map;
+    std::vector<SoftwareThing> m_things;
+    std::vector<std::vector<int>> m_sector_things;
+
+    ColumnKernel m_column_kernel;
+
+    std::vector<RenderContext> m_contexts;
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_start_condition;
+    std::condition_variable m_done_condition;
+    unsigned long long m_frame;
+    unsigned int m_pending;
+    bool m_stop;
+    RenderView m_frame_view;
+    SoftwareFramebuffer * m_frame_framebuffer;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef SOFTWARE_SPRITES_HPP_
+#define SOFTWARE_SPRITES_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "wad.hpp"
+
+// Sprites of the software renderer: the pictures packed for drawing and the things projected on screen
+// during a frame (vissprites).
+
+// Ends the posts of a packed column
+const uint8_t kPatchColumnEnd = 0xFF;
+
+struct PackedPatch
+{
+  unsigned int m_width;
+  unsigned int m_height;
+  int m_left_offset;
+  int m_top_offset;
+
+  // First entry of the column offsets of this patch
+  uint32_t m_columns;
+};
+
+// Sprite pictures in the same layout as DOOM patch lumps: every column is a run of posts, each one a row
+// byte, a size byte and size palette indices, ended by kPatchColumnEnd. Every picture lives in one shared
+// buffer instead of a vector per post, so drawing a column walks contiguous memory.
+class SpritePatches
+{
+  public:
+
+    int add(const WADSprite & crSprite)
+    {
+      PackedPatch patch_;
+      patch_.m_width = crSprite.width;
+      patch_.m_height = crSprite.height;
+      patch_.m_left_offset = (short)crSprite.left_offset;
+      patch_.m_top_offset = (short)crSprite.top_offset;
+      patch_.m_columns = m_column_offsets.size();
+
+      // Posts are stored in column order already
+      size_t post_ = 0;
+
+      for (unsigned int c = 0; c < crSprite.width; ++c)
+      {
+        m_column_offsets.push_back(m_posts.size());
+
+        for (; post_ < crSprite.posts.size() && crSprite.posts[post_].col == c; ++post_)
+        {
+          const WADSpritePost & crPost = crSprite.posts[post_];
+
+          m_posts.push_back(crPost.row);
+          m_posts.push_back(crPost.size);
+          m_posts.insert(m_posts.end(), crPost.pixels.begin(), crPost.pixels.begin() + crPost.size);
+        }
+
+        m_posts.push_back(kPatchColumnEnd);
+      }
+
+      m_patches.push_back(patch_);
+      return m_patches.size() - 1;
+    }
+
+    const PackedPatch & patch(int index) const
+    {
+      return m_patches[index];
+    }
+
+    const uint8_t * column(const PackedPatch & crPatch, unsigned int column) const
+    {
+      return m_posts.data() + m_column_offsets[crPatch.m_columns + column];
+    }
+
+  private:
+
+    std::vector<PackedPatch> m_patches;
+    std::vector<uint32_t> m_column_offsets;
+    std::vector<uint8_t> m_posts;
+};
+
+struct VisSprite
+{
+  int m_x1;
+  int m_x2;
+  float m_x1_exact;
+  float m_gx;
+  float m_gy;
+  float m_scale;
+  float m_xiscale;
+  float m_startfrac;
+  float m_texturemid;
+  int m_patch;
+  const uint8_t * m_colormap;
+};
+
+// Sorts count vissprites back to front (smallest scale first) into rOrder. Scales are positive floats so
+// their bit patterns sort like the values and a stable LSD radix sort on them, 8 bits per pass, is linear
+// in the number of sprites. Passes where every key has the same byte are skipped.
+inline void sort_vissprites(const std::vector<VisSprite> & crSprites,
+                            size_t count,
+                            std::vector<uint32_t> & rOrder,
+                            std::vector<uint64_t> & rKeys,
+                            std::vector<uint64_t> & rScratch)
+{
+  rOrder.resize(count);
+  rKeys.resize(count);
+  rScratch.resize(count);
+
+  if (count == 0)
+    return;
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    uint32_t bits_;
+    std::memcpy(&bits_, &crSprites[i].m_scale, sizeof(bits_));
+    rKeys[i] = ((uint64_t)bits_ << 32) | i;
+  }
+
+  for (unsigned int shift = 32; shift < 64; shift += 8)
+  {
+    size_t histogram_[257] = {};
+
+    for (size_t i = 0; i < count; ++i)
+      histogram_[((rKeys[i] >> shift) & 0xFF) + 1]++;
+
+    if (histogram_[((rKeys[0] >> shift) & 0xFF) + 1] == count)
+      continue;
+
+    for (unsigned int b = 0; b < 256; ++b)
+      histogram_[b + 1] += histogram_[b];
+
+    for (size_t i = 0; i < count; ++i)
+      rScratch[histogram_[(rKeys[i] >> shift) & 0xFF]++] = rKeys[i];
+
+    rKeys.swap(rScratch);
+  }
+
+  for (size_t i = 0; i < count; ++i)
+    rOrder[i] = (uint32_t)rKeys[i];
+}
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef SOFTWARE_VISPLANES_HPP_
+#define SOFTWARE_VISPLANES_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Floors and ceilings seen during a frame. Every visible range of columns of a sector floor or ceiling is
+// marked in a visplane (a plane with a given height, flat and light) while the walls are drawn, and once
+// the BSP walk is done the planes are turned into horizontal spans and drawn. Vanilla DOOM kept 128 of
+// them in a static array and bombed out when a level needed more, here storage grows as needed and is
+// kept from frame to frame, so there is no limit and no allocation once the first frames warmed it up.
+
+const unsigned int kVisplaneHashSize = 256;
+
+// Unused visplane columns have their top set to this value
+const unsigned short kPlaneUnused = 0xFFFF;
+
+struct Visplane
+{
+  float m_height;
+  int m_flat;
+  int m_light;
+  int m_minx;
+  int m_maxx;
+
+  // Next plane in the same hash bucket
+  int m_next;
+
+  // Indexed by column + 1 so the spans code can look at the columns right outside [minx, maxx]
+  std::vector<unsigned short> m_top;
+  std::vector<unsigned short> m_bottom;
+};
+
+struct PlaneSpan
+{
+  unsigned short m_y;
+  unsigned short m_x1;
+  unsigned short m_x2;
+};
+
+class VisplaneSet
+{
+  public:
+
+    // Starts a new frame rendering columns [xStart, xEnd) of a width x height screen
+    void begin_frame(unsigned int width, unsigned int height, int xStart, int xEnd)
+    {
+      m_width = width;
+      m_x_start = xStart;
+      m_x_end = xEnd;
+      m_count = 0;
+
+      m_hash.assign(kVisplaneHashSize, -1);
+      m_span_start.resize(height);
+    }
+
+    // Returns a plane with the given properties, creating it if there is none yet
+    int find(float height, int flat, int light)
+    {
+      int bucket_ = hash(height, flat, light);
+
+      for (int i = m_hash[bucket_]; i >= 0; i = m_planes[i].m_next)
+      {
+        const Visplane & crPlane = m_planes[i];
+
+        if (crPlane.m_height == height && crPlane.m_flat == flat && crPlane.m_light == light)
+          return i;
+      }
+
+      return create(height, flat, light);
+    }
+
+    // Returns a plane with the same properties as the given one that can take columns [start, stop], which
+    // is the same plane unless some of those columns are already in use
+    int check(int plane, int start, int stop)
+    {
+      Visplane & rPlane = m_planes[plane];
+
+      int intersect_first_ = std::max(start, rPlane.m_minx);
+      int intersect_last_ = std::min(stop, rPlane.m_maxx);
+
+      for (int x = intersect_first_; x <= intersect_last_; ++x)
+      {
+        if (rPlane.m_top[x + 1] != kPlaneUnused)
+        {
+          int new_ = create(rPlane.m_height, rPlane.m_flat, rPlane.m_light);
+          Visplane & rNew = m_planes[new_];
+          rNew.m_minx = start;
+          rNew.m_maxx = stop;
+          return new_;
+        }
+      }
+
+      rPlane.m_minx = std::min(rPlane.m_minx, start);
+      rPlane.m_maxx = std::max(rPlane.m_maxx, stop);
+      return plane;
+    }
+
+    Visplane & plane(int index)
+    {
+      return m_planes[index];
+    }
+
+    // Planes with any column marked, the ones sharing a flat and light next to each other so each flat
+    // stays in cache while its planes are drawn
+    const std::vector<int> & draw_order()
+    {
+      m_order.clear();
+
+      for (size_t i = 0; i < m_count; ++i)
+        if (m_planes[i].m_minx <= m_planes[i].m_maxx)
+          m_order.push_back(i);
+
+      std::sort(m_order.begin(), m_order.end(), [this](int a, int b) {
+        const Visplane & crA = m_planes[a];
+        const Visplane & crB = m_planes[b];
+        return crA.m_flat != crB.m_flat ? crA.m_flat < crB.m_flat : crA.m_light < crB.m_light;
+      });
+
+      return m_order;
+    }
+
+    // Turns the marked columns of a plane into horizontal spans, like R_MakeSpans. Spans come out sorted by
+    // row so the per-row texture mapping and light only have to be set up once for all the spans of a row.
+    const std::vector<PlaneSpan> & make_spans(int plane)
+    {
+      Visplane & rPlane = m_planes[plane];
+      m_spans.clear();
+
+      // Sentinels right outside the plane close every open span
+      rPlane.m_top[rPlane.m_minx] = kPlaneUnused;
+      rPlane.m_top[rPlane.m_maxx + 2] = kPlaneUnused;
+
+      for (int x = rPlane.m_minx; x <= rPlane.m_maxx + 1; ++x)
+      {
+        int t1_ = rPlane.m_top[x];
+        int b1_ = rPlane.m_bottom[x];
+        int t2_ = rPlane.m_top[x + 1];
+        int b2_ = rPlane.m_bottom[x + 1];
+
+        // Close the spans of the previous column that do not continue in this one...
+        while (t1_ < t2_ && t1_ <= b1_)
+        {
+          m_spans.push_back({ (unsigned short)t1_, (unsigned short)m_span_start[t1_], (unsigned short)(x - 1) });
+          ++t1_;
+        }
+
+        while (b1_ > b2_ && b1_ >= t1_)
+        {
+          m_spans.push_back({ (unsigned short)b1_, (unsigned short)m_span_start[b1_], (unsigned short)(x - 1) });
+          --b1_;
+        }
+
+        // ...and open the spans that start in this one
+        while (t2_ < t1_ && t2_ <= b2_)
+        {
+          m_span_start[t2_] = x;
+          ++t2_;
+        }
+
+        while (b2_ > b1_ && b2_ >= t2_)
+        {
+          m_span_start[b2_] = x;
+          --b2_;
+        }
+      }
+
+      std::sort(m_spans.begin(), m_spans.end(), [](const PlaneSpan & crA, const PlaneSpan & crB) {
+        return crA.m_y != crB.m_y ? crA.m_y < crB.m_y : crA.m_x1 < crB.m_x1;
+      });
+
+      return m_spans;
+    }
+
+  private:
+
+    static int hash(float height, int flat, int light)
+    {
+      uint32_t h_ = (uint32_t)(int32_t)height * 73856093u ^ (uint32_t)flat * 19349663u ^ (uint32_t)light * 83492791u;
+      return (h_ ^ (h_ >> 16)) & (kVisplaneHashSize - 1);
+    }
+
+    int create(float height, int flat, int light)
+    {
+      if (m_count == m_planes.size())
+        m_planes.emplace_back();
+
+      Visplane & rPlane = m_planes[m_count];
+      rPlane.m_height = height;
+      rPlane.m_flat = flat;
+      rPlane.m_light = light;
+      rPlane.m_minx = m_x_end;
+      rPlane.m_maxx = m_x_start - 1;
+      rPlane.m_top.resize(m_width + 2);
+      rPlane.m_bottom.resize(m_width + 2);
+
+      // Only the columns being rendered (and the one at each side) are ever looked at
+      std::fill(rPlane.m_top.begin() + m_x_start, rPlane.m_top.begin() + m_x_end + 2, kPlaneUnused);
+      std::fill(rPlane.m_bottom.begin() + m_x_start, rPlane.m_bottom.begin() + m_x_end + 2, 0);
+
+      int bucket_ = hash(height, flat, light);
+      rPlane.m_next = m_hash[bucket_];
+      m_hash[bucket_] = m_count;
+
+      return m_count++;
+    }
+
+    unsigned int m_width = 0;
+    int m_x_start = 0;
+    int m_x_end = 0;
+
+    std::vector<Visplane> m_planes;
+    size_t m_count = 0;
+    std::vector<int> m_hash;
+
+    std::vector<int> m_span_start;
+    std::vector<PlaneSpan> m_spans;
+    std::vector<int> m_order;
+};
+
+// Draws count pixels of a row of a 64x64 flat. Texture coordinates are 16.16 fixed point and wrap around
+// the flat, only the low 6 integer bits of each one are used.
+inline void draw_span(uint8_t * pDest,
+                      int count,
+                      uint32_t xfrac,
+                      uint32_t yfrac,
+                      uint32_t xstep,
+                      uint32_t ystep,
+                      const uint8_t * pFlat,
+                      const uint8_t * pColormap)
+{
+  int i = 0;
+
+#ifdef __SSE2__
+  // Texel offsets of 4 pixels at a time, fetching the texels and their colormap entries stays scalar
+  if (count >= 4)
+  {
+    __m128i xfrac_ = _mm_setr_epi32((int)xfrac, (int)(xfrac + xstep), (int)(xfrac + 2 * xstep), (int)(xfrac + 3 * xstep));
+    __m128i yfrac_ = _mm_setr_epi32((int)yfrac, (int)(yfrac + ystep), (int)(yfrac + 2 * ystep), (int)(yfrac + 3 * ystep));
+    __m128i xstep_ = _mm_set1_epi32((int)(4 * xstep));
+    __m128i ystep_ = _mm_set1_epi32((int)(4 * ystep));
+    __m128i xmask_ = _mm_set1_epi32(63);
+    __m128i ymask_ = _mm_set1_epi32(63 * 64);
+
+    alignas(16) uint32_t offsets_[4];
+
+    for (; i + 4 <= count; i += 4)
+    {
+      __m128i offset_ = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(yfrac_, 10), ymask_),
+                                     _mm_and_si128(_mm_srli_epi32(xfrac_, 16), xmask_));
+      _mm_store_si128((__m128i *)offsets_, offset_);
+
+      pDest[i + 0] = pColormap[pFlat[offsets_[0]]];
+      pDest[i + 1] = pColormap[pFlat[offsets_[1]]];
+      pDest[i + 2] = pColormap[pFlat[offsets_[2]]];
+      pDest[i + 3] = pColormap[pFlat[offsets_[3]]];
+
+      xfrac_ = _mm_add_epi32(xfrac_, xstep_);
+      yfrac_ = _mm_add_epi32(yfrac_, ystep_);
+    }
+
+    xfrac += (uint32_t)i * xstep;
+    yfrac += (uint32_t)i * ystep;
+  }
+#endif
+
+  for (; i < count; ++i)
+  {
+    pDest[i] = pColormap[pFlat[((yfrac >> 10) & (63 * 64)) | ((xfrac >> 16) & 63)]];
+    xfrac += xstep;
+    yfrac += ystep;
+  }
+}
+
+#endif
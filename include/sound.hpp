@@ -0,0 +1,465 @@
+#ifndef SOUND_HPP_
+#define SOUND_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "wad.hpp"
+
+// Sound effects from the DMX lumps to the speakers. Sounds are resampled once to the output rate as float
+// PCM, the mixer adds every playing channel with its own volume and stereo separation and hands blocks of
+// 16-bit stereo frames to whoever plays them through a lock-free ring buffer: an audio thread, or a WAV
+// file to listen to (and compare) the output without any audio device.
+
+// Linear resampler. Positions in the source are 16.16 fixed point, the fraction picks one of kPhases
+// precomputed weights and the 8-bit samples go through a precomputed table to float.
+class SoundResampler
+{
+  public:
+
+    static const unsigned int kPhaseBits = 8;
+    static const unsigned int kPhases = 1 << kPhaseBits;
+
+    SoundResampler()
+    {
+      for (unsigned int p = 0; p < kPhases; ++p)
+        m_weights[p] = (float)p / kPhases;
+
+      for (unsigned int s = 0; s < 256; ++s)
+        m_levels[s] = ((float)s - 128.0f) / 128.0f;
+    }
+
+    std::vector<float> resample(const WADSound & crSound, unsigned int targetRate) const
+    {
+      const std::vector<uint8_t> & crSamples = crSound.samples;
+
+      if (crSamples.empty() || crSound.sample_rate == 0 || targetRate == 0)
+        return {};
+
+      uint64_t step_ = ((uint64_t)crSound.sample_rate << 16) / targetRate;
+      size_t frames_ = (size_t)(((uint64_t)crSamples.size() << 16) / step_);
+      size_t last_ = crSamples.size() - 1;
+
+      std::vector<float> pcm_(frames_);
+      uint64_t position_ = 0;
+
+      for (size_t i = 0; i < frames_; ++i, position_ += step_)
+      {
+        size_t index_ = position_ >> 16;
+        float a_ = m_levels[crSamples[index_]];
+        float b_ = m_levels[crSamples[std::min(index_ + 1, last_)]];
+
+        pcm_[i] = a_ + (b_ - a_) * m_weights[(position_ >> (16 - kPhaseBits)) & (kPhases - 1)];
+      }
+
+      return pcm_;
+    }
+
+  private:
+
+    float m_weights[kPhases];
+    float m_levels[256];
+};
+
+inline std::vector<int16_t> pcm_to_int16(const std::vector<float> & crPcm)
+{
+  std::vector<int16_t> samples_(crPcm.size());
+
+  for (size_t i = 0; i < crPcm.size(); ++i)
+    samples_[i] = (int16_t)std::min(std::max(std::lrint(crPcm[i] * 32767.0f), -32768l), 32767l);
+
+  return samples_;
+}
+
+// Sounds resampled to the output rate, each one the first time it is played. Byte-identical lumps share
+// the same decoded samples.
+class SoundCache
+{
+  public:
+
+    typedef std::shared_ptr<const std::vector<float>> Samples;
+
+    SoundCache(unsigned int rate)
+      : m_rate(rate)
+    {
+
+    }
+
+    // Null if the WAD has no such sound
+    Samples get(const WAD & crWad, const std::string & crName)
+    {
+      auto named_ = m_named.find(crName);
+      if (named_ != m_named.end())
+        return named_->second;
+
+      auto sound_ = crWad.sounds().find(crName);
+      if (sound_ == crWad.sounds().end())
+        return nullptr;
+
+      Samples & rSamples = m_decoded[sound_->second.hash];
+
+      if (!rSamples)
+        rSamples = std::make_shared<const std::vector<float>>(m_resampler.resample(sound_->second, m_rate));
+
+      return m_named[crName] = rSamples;
+    }
+
+    size_t decoded() const
+    {
+      return m_decoded.size();
+    }
+
+  private:
+
+    unsigned int m_rate;
+    SoundResampler m_resampler;
+    std::unordered_map<std::string, Samples> m_named;
+    std::unordered_map<uint64_t, Samples> m_decoded;
+};
+
+// Single producer, single consumer queue of interleaved 16-bit stereo frames. The mixer writes and the
+// audio thread (or a file sink) reads, neither ever waits for the other: each side only moves its own
+// position and reads the other one.
+class AudioRingBuffer
+{
+  public:
+
+    AudioRingBuffer(size_t frames)
+    {
+      size_t capacity_ = 1;
+      while (capacity_ < frames)
+        capacity_ <<= 1;
+
+      m_samples.resize(capacity_ * 2);
+      m_mask = capacity_ - 1;
+    }
+
+    AudioRingBuffer(const AudioRingBuffer &) = delete;
+    AudioRingBuffer & operator=(const AudioRingBuffer &) = delete;
+
+    size_t capacity() const
+    {
+      return m_mask + 1;
+    }
+
+    // Frames the consumer can read
+    size_t available() const
+    {
+      return m_write.load(std::memory_order_acquire) - m_read.load(std::memory_order_relaxed);
+    }
+
+    // Frames the producer can write
+    size_t space() const
+    {
+      return capacity() - (m_write.load(std::memory_order_relaxed) - m_read.load(std::memory_order_acquire));
+    }
+
+    size_t write(const int16_t * pFrames, size_t frames)
+    {
+      size_t write_ = m_write.load(std::memory_order_relaxed);
+      frames = std::min(frames, space());
+
+      for (size_t i = 0; i < frames; ++i)
+      {
+        size_t slot_ = ((write_ + i) & m_mask) * 2;
+        m_samples[slot_] = pFrames[i * 2];
+        m_samples[slot_ + 1] = pFrames[i * 2 + 1];
+      }
+
+      m_write.store(write_ + frames, std::memory_order_release);
+      return frames;
+    }
+
+    size_t read(int16_t * pFrames, size_t frames)
+    {
+      size_t read_ = m_read.load(std::memory_order_relaxed);
+      frames = std::min(frames, available());
+
+      for (size_t i = 0; i < frames; ++i)
+      {
+        size_t slot_ = ((read_ + i) & m_mask) * 2;
+        pFrames[i * 2] = m_samples[slot_];
+        pFrames[i * 2 + 1] = m_samples[slot_ + 1];
+      }
+
+      m_read.store(read_ + frames, std::memory_order_release);
+      return frames;
+    }
+
+  private:
+
+    std::vector<int16_t> m_samples;
+    size_t m_mask;
+
+    // Each position on a cache line of its own, they are written by different threads
+    alignas(64) std::atomic<size_t> m_write { 0 };
+    alignas(64) std::atomic<size_t> m_read { 0 };
+};
+
+// Mixes a fixed number of channels like DOOM's (8 by default). Starting a sound takes a free channel or
+// the one that has been playing the longest.
+class SoundMixer
+{
+  public:
+
+    SoundMixer(unsigned int rate, unsigned int channels = 8)
+      : m_rate(rate), m_channels(channels)
+    {
+
+    }
+
+    unsigned int rate() const
+    {
+      return m_rate;
+    }
+
+    // Volume goes from 0 to 127 and separation from 0 (left) to 255 (right), 128 is centered. Returns
+    // the channel or -1 if there is nothing to play.
+    int play(SoundCache::Samples samples, int volume, int separation)
+    {
+      if (!samples || samples->empty())
+        return -1;
+
+      unsigned int channel_ = 0;
+
+      for (unsigned int c = 0; c < m_channels.size(); ++c)
+      {
+        if (!m_channels[c].m_samples)
+        {
+          channel_ = c;
+          break;
+        }
+
+        if (m_channels[c].m_start < m_channels[channel_].m_start)
+          channel_ = c;
+      }
+
+      Channel & rChannel = m_channels[channel_];
+      rChannel.m_samples = samples;
+      rChannel.m_position = 0;
+      rChannel.m_start = m_started++;
+      update(channel_, volume, separation);
+
+      return channel_;
+    }
+
+    // Like I_UpdateSoundParams, the volume of each side falls with the square of the separation
+    void update(int channel, int volume, int separation)
+    {
+      int separation_ = std::min(std::max(separation, 0), 255) + 1;
+      int volume_ = std::min(std::max(volume, 0), 127);
+
+      int left_ = volume_ - ((volume_ * separation_ * separation_) >> 16);
+      separation_ -= 257;
+      int right_ = volume_ - ((volume_ * separation_ * separation_) >> 16);
+
+      m_channels[channel].m_left = left_ / 127.0f;
+      m_channels[channel].m_right = right_ / 127.0f;
+    }
+
+    void stop(int channel)
+    {
+      m_channels[channel].m_samples.reset();
+    }
+
+    bool playing(int channel) const
+    {
+      return (bool)m_channels[channel].m_samples;
+    }
+
+    // Mixes the next frames of every playing channel into interleaved 16-bit stereo
+    void mix(int16_t * pFrames, size_t frames)
+    {
+      m_left.assign(frames, 0.0f);
+      m_right.assign(frames, 0.0f);
+
+      for (Channel & rChannel : m_channels)
+      {
+        if (!rChannel.m_samples)
+          continue;
+
+        size_t count_ = std::min(frames, rChannel.m_samples->size() - rChannel.m_position);
+        mix_channel(rChannel.m_samples->data() + rChannel.m_position, count_, rChannel.m_left, rChannel.m_right);
+
+        rChannel.m_position += count_;
+
+        if (rChannel.m_position == rChannel.m_samples->size())
+          rChannel.m_samples.reset();
+      }
+
+      convert(pFrames, frames);
+    }
+
+    // Mixes as many frames as fit in the ring buffer, up to maxFrames, and returns how many
+    size_t mix(AudioRingBuffer & rRing, size_t maxFrames)
+    {
+      size_t frames_ = std::min(rRing.space(), maxFrames);
+
+      m_frames.resize(frames_ * 2);
+      mix(m_frames.data(), frames_);
+
+      return rRing.write(m_frames.data(), frames_);
+    }
+
+  private:
+
+    struct Channel
+    {
+      SoundCache::Samples m_samples;
+      size_t m_position = 0;
+      uint64_t m_start = 0;
+      float m_left = 0.0f;
+      float m_right = 0.0f;
+    };
+
+    void mix_channel(const float * pSamples, size_t count, float left, float right)
+    {
+      float * pLeft = m_left.data();
+      float * pRight = m_right.data();
+      size_t i = 0;
+
+#ifdef __SSE2__
+      __m128 left_ = _mm_set1_ps(left);
+      __m128 right_ = _mm_set1_ps(right);
+
+      for (; i + 4 <= count; i += 4)
+      {
+        __m128 samples_ = _mm_loadu_ps(pSamples + i);
+        _mm_storeu_ps(pLeft + i, _mm_add_ps(_mm_loadu_ps(pLeft + i), _mm_mul_ps(samples_, left_)));
+        _mm_storeu_ps(pRight + i, _mm_add_ps(_mm_loadu_ps(pRight + i), _mm_mul_ps(samples_, right_)));
+      }
+#endif
+
+      for (; i < count; ++i)
+      {
+        pLeft[i] += pSamples[i] * left;
+        pRight[i] += pSamples[i] * right;
+      }
+    }
+
+    // Scales to 16 bits rounding to nearest and saturating, the SSE2 path packs and interleaves 4 frames
+    // at a time and gives the same results as the scalar one
+    void convert(int16_t * pFrames, size_t frames)
+    {
+      size_t i = 0;
+
+#ifdef __SSE2__
+      __m128 scale_ = _mm_set1_ps(32767.0f);
+
+      for (; i + 4 <= frames; i += 4)
+      {
+        __m128i left_ = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(m_left.data() + i), scale_));
+        __m128i right_ = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(m_right.data() + i), scale_));
+        __m128i packed_ = _mm_packs_epi32(left_, right_);
+        _mm_storeu_si128((__m128i *)(pFrames + i * 2), _mm_unpacklo_epi16(packed_, _mm_srli_si128(packed_, 8)));
+      }
+#endif
+
+      for (; i < frames; ++i)
+      {
+        pFrames[i * 2] = (int16_t)std::min(std::max(std::lrint(m_left[i] * 32767.0f), -32768l), 32767l);
+        pFrames[i * 2 + 1] = (int16_t)std::min(std::max(std::lrint(m_right[i] * 32767.0f), -32768l), 32767l);
+      }
+    }
+
+    unsigned int m_rate;
+    std::vector<Channel> m_channels;
+    uint64_t m_started = 0;
+
+    std::vector<float> m_left;
+    std::vector<float> m_right;
+    std::vector<int16_t> m_frames;
+};
+
+// Writes what the mixer produces to a 16-bit stereo WAV file, the consumer side of the ring buffer when
+// there is no audio device
+class WAVFileSink
+{
+  public:
+
+    WAVFileSink(const std::string & crFilename, unsigned int rate)
+      : m_file(crFilename, std::ios::binary), m_rate(rate)
+    {
+      if (!m_file)
+        throw std::runtime_error("Failed to create WAV file " + crFilename + "!");
+
+      // The sizes in the header are filled in when closing
+      write_header(0);
+    }
+
+    ~WAVFileSink()
+    {
+      close();
+    }
+
+    // Takes every frame waiting in the ring buffer
+    size_t consume(AudioRingBuffer & rRing)
+    {
+      int16_t frames_[512 * 2];
+      size_t total_ = 0;
+
+      while (size_t read_ = rRing.read(frames_, 512))
+      {
+        write(frames_, read_);
+        total_ += read_;
+      }
+
+      return total_;
+    }
+
+    void write(const int16_t * pFrames, size_t frames)
+    {
+      // WAV samples are little-endian like the host the mixer runs on
+      m_file.write((const char *)pFrames, frames * 4);
+      m_frames += frames;
+    }
+
+    void close()
+    {
+      if (!m_file.is_open())
+        return;
+
+      m_file.seekp(0);
+      write_header(m_frames * 4);
+      m_file.close();
+    }
+
+  private:
+
+    void write_header(uint32_t dataSize)
+    {
+      auto write32_ = [this](uint32_t value) { m_file.write((const char *)&value, 4); };
+      auto write16_ = [this](uint16_t value) { m_file.write((const char *)&value, 2); };
+
+      m_file.write("RIFF", 4);
+      write32_(36 + dataSize);
+      m_file.write("WAVEfmt ", 8);
+      write32_(16);
+      write16_(1);
+      write16_(2);
+      write32_(m_rate);
+      write32_(m_rate * 4);
+      write16_(4);
+      write16_(16);
+      m_file.write("data", 4);
+      write32_(dataSize);
+    }
+
+    std::ofstream m_file;
+    unsigned int m_rate;
+    uint64_t m_frames = 0;
+};
+
+#endif
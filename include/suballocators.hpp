@@ -0,0 +1,209 @@
+#ifndef SUBALLOCATORS_HPP_
+#define SUBALLOCATORS_HPP_
+
+#include <cassert>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+// Offset-only allocators used to carve big memory blocks into smaller ranges. They never touch the
+// memory they manage, they just hand out offsets, so the same code works for GPU memory blocks or
+// any other arena.
+
+inline bool is_power_of_two(uint64_t value)
+{
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+inline uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+inline unsigned int log2_ceil(uint64_t value)
+{
+  unsigned int order_ = 0;
+
+  while ((uint64_t(1) << order_) < value)
+    ++order_;
+
+  return order_;
+}
+
+// Buddy allocator for long-lived resources. The managed range is a power of two which is recursively
+// split in halves (buddies) until the requested size fits. Since every block of order k starts at a
+// multiple of 2^k, alignment comes for free by rounding the request up to max(size, alignment). On
+// free, a block is merged back with its buddy as long as the buddy is free too, so the arena does not
+// fragment permanently after load/unload cycles.
+class BuddyAllocator
+{
+  public:
+
+    BuddyAllocator(uint64_t size, uint64_t minBlockSize)
+    {
+      assert(is_power_of_two(size));
+      assert(is_power_of_two(minBlockSize));
+      assert(minBlockSize <= size);
+
+      m_size = size;
+      m_min_order = log2_ceil(minBlockSize);
+      m_max_order = log2_ceil(size);
+      m_used = 0;
+
+      m_free_lists.resize(m_max_order - m_min_order + 1);
+      m_free_lists.back().insert(0);
+    }
+
+    bool allocate(uint64_t size, uint64_t alignment, uint64_t & rOffset, uint64_t & rAllocatedSize)
+    {
+      uint64_t request_ = size > alignment ? size : alignment;
+      unsigned int order_ = log2_ceil(request_);
+
+      if (order_ < m_min_order)
+        order_ = m_min_order;
+
+      if (order_ > m_max_order)
+        return false;
+
+      // Find the smallest free block that can hold the request
+      unsigned int k = order_;
+      while (k <= m_max_order && m_free_lists[k - m_min_order].empty())
+        ++k;
+
+      if (k > m_max_order)
+        return false;
+
+      // Always take the lowest offset, it keeps allocations packed at the start of the arena
+      std::set<uint64_t> & list_ = m_free_lists[k - m_min_order];
+      uint64_t offset_ = *list_.begin();
+      list_.erase(list_.begin());
+
+      // Split it until it has the requested order, the upper halves go back to the free lists
+      while (k > order_)
+      {
+        --k;
+        m_free_lists[k - m_min_order].insert(offset_ + (uint64_t(1) << k));
+      }
+
+      rOffset = offset_;
+      rAllocatedSize = uint64_t(1) << order_;
+      m_used += rAllocatedSize;
+
+      return true;
+    }
+
+    void free(uint64_t offset, uint64_t allocatedSize)
+    {
+      assert(is_power_of_two(allocatedSize));
+
+      unsigned int k = log2_ceil(allocatedSize);
+      m_used -= allocatedSize;
+
+      while (k < m_max_order)
+      {
+        uint64_t buddy_ = offset ^ (uint64_t(1) << k);
+        std::set<uint64_t> & list_ = m_free_lists[k - m_min_order];
+        auto it = list_.find(buddy_);
+
+        if (it == list_.end())
+          break;
+
+        list_.erase(it);
+        offset = offset < buddy_ ? offset : buddy_;
+        ++k;
+      }
+
+      m_free_lists[k - m_min_order].insert(offset);
+    }
+
+    uint64_t size() const
+    {
+      return m_size;
+    }
+
+    uint64_t used() const
+    {
+      return m_used;
+    }
+
+    uint64_t largest_free() const
+    {
+      for (unsigned int k = m_max_order + 1; k-- > m_min_order; )
+        if (!m_free_lists[k - m_min_order].empty())
+          return uint64_t(1) << k;
+
+      return 0;
+    }
+
+    bool empty() const
+    {
+      return m_used == 0;
+    }
+
+  private:
+
+    uint64_t m_size;
+    uint64_t m_used;
+    unsigned int m_min_order;
+    unsigned int m_max_order;
+    std::vector<std::set<uint64_t>> m_free_lists;
+};
+
+// Linear (bump) allocator for per-frame data. The arena is split in one region per frame in flight.
+// Allocations just bump the region head and the whole region is released at once when its frame
+// comes around again, i.e., once the fence guarding that frame has been waited on.
+class LinearAllocator
+{
+  public:
+
+    LinearAllocator(uint64_t size, unsigned int frameCount)
+    {
+      assert(frameCount != 0);
+
+      m_region_size = size / frameCount;
+      m_heads.assign(frameCount, 0);
+    }
+
+    bool allocate(unsigned int frame, uint64_t size, uint64_t alignment, uint64_t & rOffset)
+    {
+      assert(frame < m_heads.size());
+
+      uint64_t offset_ = align_up(m_heads[frame], alignment);
+
+      if (offset_ + size > m_region_size)
+        return false;
+
+      m_heads[frame] = offset_ + size;
+      rOffset = frame * m_region_size + offset_;
+
+      return true;
+    }
+
+    void reset(unsigned int frame)
+    {
+      assert(frame < m_heads.size());
+      m_heads[frame] = 0;
+    }
+
+    uint64_t used() const
+    {
+      uint64_t used_ = 0;
+
+      for (uint64_t h : m_heads)
+        used_ += h;
+
+      return used_;
+    }
+
+    uint64_t size() const
+    {
+      return m_region_size * m_heads.size();
+    }
+
+  private:
+
+    uint64_t m_region_size;
+    std::vector<uint64_t> m_heads;
+};
+
+#endif
@@ -1,10 +1,17 @@
 #ifndef VULKAN_APPLICATION_HPP_
 #define VULKAN_APPLICATION_HPP_
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <experimental/optional>
 #include <fstream>
+#include <iomanip>
+#include <map>
 #include <set>
+#include <sstream>
+#include <string>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -19,6 +26,11 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#include "level_mesh.hpp"
+#include "ppm_writer.hpp"
+#include "profiler.hpp"
+#include "vulkan_memory_allocator.hpp"
+
 struct UniformBufferObject
 {
     alignas(16) glm::mat4 m_model;
@@ -51,6 +63,45 @@ void destroy_debug_utils_messengerext(
         function_(instance, callback, pAllocator);
 }
 
+// Our own header prepended to the driver's pipeline cache blob. The driver blob already starts with a
+// VkPipelineCacheHeaderVersionOne, but we also need to key the file by driver version (which the
+// Vulkan header does not carry) and remember how long a cold pipeline build took so we can report
+// the startup time saved when the cache is warm.
+struct PipelineCacheFileHeader
+{
+    uint32_t m_magic;
+    uint32_t m_version;
+    uint32_t m_vendor_id;
+    uint32_t m_device_id;
+    uint32_t m_driver_version;
+    uint8_t m_uuid[VK_UUID_SIZE];
+    uint64_t m_cold_build_us;
+    uint64_t m_data_size;
+};
+
+// Level textures are grouped into array images by size class, draws of the same array are contiguous
+// so each range is drawn with the descriptor set of its array
+struct LevelTextureArray
+{
+  uint32_t m_width;
+  uint32_t m_height;
+  std::vector<uint32_t> m_textures;
+};
+
+struct LevelDrawRange
+{
+  uint32_t m_array;
+  uint32_t m_first;
+  uint32_t m_count;
+};
+
+struct ReadbackColor
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+};
+
 struct QueueFamilyIndices
 {
     std::experimental::optional<uint32_t> m_graphics_family;
@@ -79,6 +130,9 @@ class VulkanApplication
 
   const int kMaxFramesInFlight = 2;
 
+  const uint32_t kPipelineCacheMagic = 0x43504644; // "DFPC"
+  const uint32_t kPipelineCacheVersion = 1;
+
   const std::vector<const char*> kValidationLayers = {
     "VK_LAYER_LUNARG_standard_validation"
   };
@@ -87,6 +141,14 @@ class VulkanApplication
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
   };
 
+  // Headless rendering has no surface so it does not need any device extension at all
+  const std::vector<const char*> kHeadlessDeviceExtensions = {};
+
+  const VkFormat kOffscreenFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+  // Animation step used in headless mode so captured frames do not depend on wall-clock time
+  const float kHeadlessFrameTime = 1.0f / 60.0f;
+
   const std::vector<Vertex> kVertices =
   {
     {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
@@ -107,13 +169,16 @@ class VulkanApplication
 
   public:
 
-    VulkanApplication(std::shared_ptr<GLFWwindow*> pWindow)
+    VulkanApplication(std::shared_ptr<GLFWwindow*> pWindow, std::shared_ptr<const LevelMesh> pLevel = nullptr)
     {
         m_window = pWindow;
+        m_level = pLevel;
         glfwSetWindowUserPointer(*m_window, this);
         glfwSetFramebufferSizeCallback(*m_window, framebuffer_resize_callback);
 
+        m_headless = false;
         m_current_frame = 0;
+        m_frame_number = 0;
         m_framebuffer_resized = false;
 
         init_vulkan();
@@ -121,36 +186,65 @@ class VulkanApplication
         create_surface();
         pick_physical_device();
         create_logical_device();
+        create_allocator();
+        create_pipeline_cache();
         create_swap_chain();
         create_image_views();
-        create_render_pass();
-        create_descriptorset_layout();
-        create_graphics_pipeline();
-        create_framebuffers();
-        create_commandpool();
-        create_depth_resources();
-        create_textureimage();
-        create_textureimageview();
-        create_texturesampler();
-        create_vertexbuffer();
-        create_indexbuffer();
-        create_uniformbuffers();
-        create_descriptorpool();
-        create_descriptorsets();
-        create_commandbuffers();
-        create_semaphores();
-        create_fences();
+        create_resources();
+    }
+
+    // Headless mode renders into offscreen images instead of a swap chain, so it needs neither a
+    // window nor a surface and runs on display-less hosts (e.g., with the lavapipe CPU driver). Every
+    // captureInterval frames the rendered image is read back and written as a PPM file.
+    VulkanApplication(uint32_t width,
+                      uint32_t height,
+                      unsigned int captureInterval,
+                      const std::string & crCapturePrefix,
+                      std::shared_ptr<const LevelMesh> pLevel = nullptr)
+    {
+        m_level = pLevel;
+        m_headless = true;
+        m_current_frame = 0;
+        m_frame_number = 0;
+        m_framebuffer_resized = false;
+        m_surface = VK_NULL_HANDLE;
+        m_swap_chain = VK_NULL_HANDLE;
+        m_capture_interval = captureInterval;
+        m_capture_prefix = crCapturePrefix;
+
+        m_swap_chain_extent = {width, height};
+        m_swap_chain_format = kOffscreenFormat;
+
+        init_vulkan();
+        setup_debug_callback();
+        pick_physical_device();
+        create_logical_device();
+        create_allocator();
+        create_pipeline_cache();
+        create_offscreen_images();
+        create_image_views();
+        create_resources();
     }
 
     ~VulkanApplication()
     {
         cleanup_swapchain();
 
+        destroy_graphics_pipelines();
+        vkDestroyPipelineLayout(m_device, m_pipeline_layout, nullptr);
+        vkDestroyRenderPass(m_device, m_render_pass, nullptr);
+
+        save_pipeline_cache();
+        vkDestroyPipelineCache(m_device, m_pipeline_cache, nullptr);
+
         vkDestroySampler(m_device, m_texture_sampler, nullptr);
-        vkDestroyImageView(m_device, m_texture_image_view, nullptr);
 
-        vkDestroyImage(m_device, m_texture_image, nullptr);
-        vkFreeMemory(m_device, m_texture_image_memory, nullptr);
+        for (size_t a = 0; a < m_texture_images.size(); ++a)
+        {
+            vkDestroyImageView(m_device, m_texture_image_views[a], nullptr);
+            vkDestroyImage(m_device, m_texture_images[a], nullptr);
+            m_allocator->free(m_texture_image_allocations[a]);
+        }
 
         vkDestroyDescriptorPool(m_device, m_descriptorpool, nullptr);
 
@@ -159,14 +253,26 @@ class VulkanApplication
         for (size_t i = 0; i < m_swap_chain_images.size(); ++i)
         {
             vkDestroyBuffer(m_device, m_uniform_buffers[i], nullptr);
-            vkFreeMemory(m_device, m_uniformbuffers_memory[i], nullptr);
+            m_allocator->free(m_uniformbuffers_allocation[i]);
         }
 
         vkDestroyBuffer(m_device, m_indexbuffer, nullptr);
-        vkFreeMemory(m_device, m_indexbuffer_memory, nullptr);
+        m_allocator->free(m_indexbuffer_allocation);
 
         vkDestroyBuffer(m_device, m_vertexbuffer, nullptr);
-        vkFreeMemory(m_device, m_vertexbuffer_memory, nullptr);
+        m_allocator->free(m_vertexbuffer_allocation);
+
+        if (m_level)
+        {
+            vkDestroyBuffer(m_device, m_indirect_buffer, nullptr);
+            m_allocator->free(m_indirect_buffer_allocation);
+
+            vkDestroyBuffer(m_device, m_surface_buffer, nullptr);
+            m_allocator->free(m_surface_buffer_allocation);
+
+            vkDestroyBuffer(m_device, m_texture_info_buffer, nullptr);
+            m_allocator->free(m_texture_info_buffer_allocation);
+        }
 
         for (size_t i = 0; i < kMaxFramesInFlight; ++i)
             vkDestroyFence(m_device, m_inflight_fences[i], nullptr);
@@ -178,28 +284,52 @@ class VulkanApplication
         }
 
         vkDestroyCommandPool(m_device, m_commandpool, nullptr);
-        
+
+        std::cout << m_allocator->stats();
+        m_allocator.reset();
+
         vkDestroyDevice(m_device, nullptr);
 
         if (kEnableValidationLayers)
             destroy_debug_utils_messengerext(m_vk_instance, m_callback, nullptr);
 
-        vkDestroySurfaceKHR(m_vk_instance, m_surface, nullptr);
+        if (!m_headless)
+            vkDestroySurfaceKHR(m_vk_instance, m_surface, nullptr);
+
         vkDestroyInstance(m_vk_instance, nullptr);
     }
 
     void draw_frame()
     {
+        PROFILE_ZONE("VulkanApplication::draw_frame");
+
+        if (m_headless)
+        {
+            draw_offscreen_frame();
+            return;
+        }
+
         uint32_t image_index_;
 
-        vkWaitForFences(m_device, 1, &m_inflight_fences[m_current_frame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+        {
+            PROFILE_ZONE("vkWaitForFences");
+            vkWaitForFences(m_device, 1, &m_inflight_fences[m_current_frame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+        }
 
-        VkResult result_ = vkAcquireNextImageKHR(m_device,
-                                                 m_swap_chain,
-                                                 std::numeric_limits<uint64_t>::max(),
-                                                 m_image_available_semaphores[m_current_frame],
-                                                 VK_NULL_HANDLE,
-                                                 &image_index_);
+        // The GPU is done with this frame slot so its per-frame memory can be recycled
+        m_allocator->begin_frame(m_current_frame);
+
+        VkResult result_;
+
+        {
+            PROFILE_ZONE("vkAcquireNextImageKHR");
+            result_ = vkAcquireNextImageKHR(m_device,
+                                            m_swap_chain,
+                                            std::numeric_limits<uint64_t>::max(),
+                                            m_image_available_semaphores[m_current_frame],
+                                            VK_NULL_HANDLE,
+                                            &image_index_);
+        }
 
         if (result_ == VK_ERROR_OUT_OF_DATE_KHR)
         {
@@ -231,8 +361,11 @@ class VulkanApplication
 
         vkResetFences(m_device, 1, &m_inflight_fences[m_current_frame]);
 
-        if (vkQueueSubmit(m_graphics_queue, 1, &submit_info_, m_inflight_fences[m_current_frame]) != VK_SUCCESS)
-            throw std::runtime_error("Failed to submit draw command buffer!");
+        {
+            PROFILE_ZONE("vkQueueSubmit");
+            if (vkQueueSubmit(m_graphics_queue, 1, &submit_info_, m_inflight_fences[m_current_frame]) != VK_SUCCESS)
+                throw std::runtime_error("Failed to submit draw command buffer!");
+        }
 
         VkPresentInfoKHR present_info_ = {};
         present_info_.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -246,7 +379,10 @@ class VulkanApplication
 
         present_info_.pResults = nullptr;
 
-        result_ = vkQueuePresentKHR(m_present_queue, &present_info_);
+        {
+            PROFILE_ZONE("vkQueuePresentKHR");
+            result_ = vkQueuePresentKHR(m_present_queue, &present_info_);
+        }
 
         if (result_ == VK_ERROR_OUT_OF_DATE_KHR || result_ == VK_SUBOPTIMAL_KHR || m_framebuffer_resized)
         {
@@ -256,7 +392,10 @@ class VulkanApplication
         else if (result_ != VK_SUCCESS)
             throw std::runtime_error("Failed to present swap chain image!");
 
-        vkQueueWaitIdle(m_present_queue);
+        {
+            PROFILE_ZONE("vkQueueWaitIdle");
+            vkQueueWaitIdle(m_present_queue);
+        }
 
         m_current_frame = (m_current_frame + 1) % kMaxFramesInFlight;
     }
@@ -264,10 +403,164 @@ class VulkanApplication
     void wait_device()
     {
         vkDeviceWaitIdle(m_device);
+
+        // Frames still sitting in the readback buffers are written out now that the GPU is idle
+        if (m_headless)
+            for (unsigned int i = 0; i < m_swap_chain_images.size(); ++i)
+                collect_readback(i);
+    }
+
+    VulkanMemoryStats memory_stats() const
+    {
+        return m_allocator->stats();
     }
 
   private:
 
+    // Everything that does not depend on whether we render to a swap chain or to offscreen images
+    void create_resources()
+    {
+        create_render_pass();
+        create_descriptorset_layout();
+        create_pipeline_layout();
+        create_graphics_pipelines();
+        create_commandpool();
+        create_depth_resources();
+        create_framebuffers();
+        create_textureimage();
+        create_textureimageview();
+        create_texturesampler();
+        create_vertexbuffer();
+        create_indexbuffer();
+
+        if (m_level)
+          create_level_draw_buffers();
+
+        create_uniformbuffers();
+        create_descriptorpool();
+        create_descriptorsets();
+        create_commandbuffers();
+        create_semaphores();
+        create_fences();
+    }
+
+    void draw_offscreen_frame()
+    {
+        // Offscreen images are bound to frame slots, so the fence of the slot also guards its image
+        {
+            PROFILE_ZONE("vkWaitForFences");
+            vkWaitForFences(m_device, 1, &m_inflight_fences[m_current_frame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+        }
+
+        m_allocator->begin_frame(m_current_frame);
+
+        // The frame previously rendered in this slot has been copied into its readback buffer by now,
+        // so reading it back here never stalls the GPU while it works on the other slot.
+        collect_readback(m_current_frame);
+
+        uint32_t image_index_ = static_cast<uint32_t>(m_current_frame);
+
+        update_uniformbuffer(image_index_);
+
+        VkSubmitInfo submit_info_ = {};
+        submit_info_.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info_.waitSemaphoreCount = 0;
+        submit_info_.commandBufferCount = 1;
+        submit_info_.pCommandBuffers = &m_commandbuffers[image_index_];
+        submit_info_.signalSemaphoreCount = 0;
+
+        vkResetFences(m_device, 1, &m_inflight_fences[m_current_frame]);
+
+        {
+            PROFILE_ZONE("vkQueueSubmit");
+            if (vkQueueSubmit(m_graphics_queue, 1, &submit_info_, m_inflight_fences[m_current_frame]) != VK_SUCCESS)
+                throw std::runtime_error("Failed to submit draw command buffer!");
+        }
+
+        m_readback_frames[image_index_] = m_frame_number;
+        m_readback_pending[image_index_] = true;
+
+        m_frame_number++;
+        m_current_frame = (m_current_frame + 1) % kMaxFramesInFlight;
+    }
+
+    void collect_readback(unsigned int slot)
+    {
+        PROFILE_ZONE("VulkanApplication::collect_readback");
+
+        if (!m_readback_pending[slot])
+            return;
+
+        m_readback_pending[slot] = false;
+
+        uint64_t frame_ = m_readback_frames[slot];
+
+        if (m_capture_interval == 0 || frame_ % m_capture_interval != 0)
+            return;
+
+        const uint8_t* pixels_ = static_cast<const uint8_t*>(m_readback_allocations[slot].m_mapped);
+        const uint32_t width_ = m_swap_chain_extent.width;
+        const uint32_t height_ = m_swap_chain_extent.height;
+
+        std::vector<ReadbackColor> image_(width_ * height_);
+
+        for (uint32_t i = 0; i < width_ * height_; ++i)
+        {
+            image_[i].r = pixels_[i * 4 + 0];
+            image_[i].g = pixels_[i * 4 + 1];
+            image_[i].b = pixels_[i * 4 + 2];
+        }
+
+        std::ostringstream filename_;
+        filename_ << m_capture_prefix << std::setw(6) << std::setfill('0') << frame_ << ".ppm";
+
+        PPMWriter writer_;
+        writer_.write<ReadbackColor>(image_, height_, width_, filename_.str(), true);
+    }
+
+    void create_offscreen_images()
+    {
+        m_swap_chain_images.resize(kMaxFramesInFlight);
+        m_offscreen_allocations.resize(kMaxFramesInFlight);
+        m_readback_buffers.resize(kMaxFramesInFlight);
+        m_readback_allocations.resize(kMaxFramesInFlight);
+        m_readback_frames.assign(kMaxFramesInFlight, 0);
+        m_readback_pending.assign(kMaxFramesInFlight, false);
+
+        VkDeviceSize readback_size_ = (VkDeviceSize)m_swap_chain_extent.width * m_swap_chain_extent.height * 4;
+
+        for (unsigned int i = 0; i < kMaxFramesInFlight; ++i)
+        {
+            create_image(m_swap_chain_extent.width,
+                         m_swap_chain_extent.height,
+                         kOffscreenFormat,
+                         VK_IMAGE_TILING_OPTIMAL,
+                         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                         m_swap_chain_images[i],
+                         m_offscreen_allocations[i]);
+
+            // Cached memory makes the CPU reads of the readback much faster, but it is optional
+            try
+            {
+                create_buffer(readback_size_,
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+                              m_readback_buffers[i],
+                              m_readback_allocations[i]);
+            }
+            catch (const std::runtime_error &)
+            {
+                vkDestroyBuffer(m_device, m_readback_buffers[i], nullptr);
+                create_buffer(readback_size_,
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                              m_readback_buffers[i],
+                              m_readback_allocations[i]);
+            }
+        }
+    }
+
     static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(
         VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
         VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -308,12 +601,18 @@ class VulkanApplication
 
     std::vector<const char *> get_required_extensions(bool enableValidation)
     {
-      uint32_t glfw_extension_count_ = 0;
-      const char** glfw_extensions_;
+      std::vector<const char*> extensions_;
 
-      glfw_extensions_ = glfwGetRequiredInstanceExtensions(&glfw_extension_count_);
+      // GLFW is not even initialized in headless mode and no surface extension is needed
+      if (!m_headless)
+      {
+        uint32_t glfw_extension_count_ = 0;
+        const char** glfw_extensions_;
 
-      std::vector<const char*> extensions_(glfw_extensions_, glfw_extensions_ + glfw_extension_count_);
+        glfw_extensions_ = glfwGetRequiredInstanceExtensions(&glfw_extension_count_);
+
+        extensions_.assign(glfw_extensions_, glfw_extensions_ + glfw_extension_count_);
+      }
 
       if (kEnableValidationLayers)
         extensions_.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -394,6 +693,19 @@ class VulkanApplication
         if (qf.queueCount > 0 && qf.queueFlags & VK_QUEUE_GRAPHICS_BIT)
           qf_indices_.m_graphics_family = i;
 
+        // Without a surface there is nothing to present to, the graphics queue does all the work
+        if (m_headless)
+        {
+          if (qf_indices_.m_graphics_family)
+            qf_indices_.m_present_family = qf_indices_.m_graphics_family.value();
+
+          if (qf_indices_.is_complete())
+            break;
+
+          ++i;
+          continue;
+        }
+
         VkBool32 present_support_ = false;
         vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_surface, &present_support_);
 
@@ -416,7 +728,8 @@ class VulkanApplication
       std::vector<VkExtensionProperties> available_extensions_(extension_count_);
       vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count_, available_extensions_.data());
 
-      std::set<std::string> required_extensions_(kDeviceExtensions.begin(), kDeviceExtensions.end());
+      const std::vector<const char*> & device_extensions_ = m_headless ? kHeadlessDeviceExtensions : kDeviceExtensions;
+      std::set<std::string> required_extensions_(device_extensions_.begin(), device_extensions_.end());
 
       for (const auto& extension : available_extensions_)
         required_extensions_.erase(extension.extensionName);
@@ -440,7 +753,9 @@ class VulkanApplication
       // Verify that swap chain support is adequate
       bool swap_chain_adequate_ = false;
 
-      if (extensions_supported_)
+      if (m_headless)
+        swap_chain_adequate_ = true;
+      else if (extensions_supported_)
       {
         SwapChainSupportDetails swap_chain_support_ = query_swap_chain_support(device);
         swap_chain_adequate_ = !swap_chain_support_.m_formats.empty() && !swap_chain_support_.m_present_modes.empty();
@@ -449,6 +764,10 @@ class VulkanApplication
       // Query queue families
       QueueFamilyIndices qf_indices_ = find_queue_families(device);
 
+      // In headless mode any device will do, software implementations such as lavapipe included.
+      if (m_headless)
+        return qf_indices_.is_complete() && extensions_supported_;
+
       // For the moment, we'll settle with just any discrete GPU that supports Vulkan and has the
       // proper queue families.
       return device_properties_.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
@@ -477,6 +796,27 @@ class VulkanApplication
         }
       }
 
+      if (m_physical_device != VK_NULL_HANDLE)
+      {
+        VkPhysicalDeviceProperties device_properties_;
+        vkGetPhysicalDeviceProperties(m_physical_device, &device_properties_);
+        std::cout << "Using device " << device_properties_.deviceName << "\n";
+
+        VkPhysicalDeviceFeatures device_features_;
+        vkGetPhysicalDeviceFeatures(m_physical_device, &device_features_);
+        m_sampler_anisotropy = (device_features_.samplerAnisotropy == VK_TRUE);
+
+        // Level geometry is submitted with indirect draws, both features are optional and we fall back
+        // to a loop of draws when they are missing
+        m_multi_draw_indirect = (device_features_.multiDrawIndirect == VK_TRUE);
+        m_draw_indirect_first_instance = (device_features_.drawIndirectFirstInstance == VK_TRUE);
+        m_max_draw_indirect_count = device_properties_.limits.maxDrawIndirectCount;
+
+        // Level textures are split into several array images to stay within these
+        m_max_image_array_layers = device_properties_.limits.maxImageArrayLayers;
+        m_max_image_dimension_2d = device_properties_.limits.maxImageDimension2D;
+      }
+
       if (m_physical_device == VK_NULL_HANDLE)
         throw std::runtime_error("failed to find a suitable GPU!");
     }
@@ -504,7 +844,9 @@ class VulkanApplication
       }
 
       VkPhysicalDeviceFeatures device_features_ = {};
-      device_features_.samplerAnisotropy = VK_TRUE;
+      device_features_.samplerAnisotropy = m_sampler_anisotropy ? VK_TRUE : VK_FALSE;
+      device_features_.multiDrawIndirect = m_multi_draw_indirect ? VK_TRUE : VK_FALSE;
+      device_features_.drawIndirectFirstInstance = m_draw_indirect_first_instance ? VK_TRUE : VK_FALSE;
 
       VkDeviceCreateInfo device_create_info_ = {};
       device_create_info_.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -513,8 +855,9 @@ class VulkanApplication
       device_create_info_.pEnabledFeatures = &device_features_;
 
       // Enable device extensions
-      device_create_info_.enabledExtensionCount = static_cast<uint32_t>(kDeviceExtensions.size());
-      device_create_info_.ppEnabledExtensionNames = kDeviceExtensions.data();
+      const std::vector<const char*> & device_extensions_ = m_headless ? kHeadlessDeviceExtensions : kDeviceExtensions;
+      device_create_info_.enabledExtensionCount = static_cast<uint32_t>(device_extensions_.size());
+      device_create_info_.ppEnabledExtensionNames = device_extensions_.data();
 
       if (kEnableValidationLayers)
       {
@@ -717,12 +1060,181 @@ class VulkanApplication
       return shader_module_;
     }
 
-    void create_graphics_pipeline()
+    std::string pipeline_cache_filename()
+    {
+      VkPhysicalDeviceProperties device_properties_;
+      vkGetPhysicalDeviceProperties(m_physical_device, &device_properties_);
+
+      // The cache blob is only valid for the exact device and driver that produced it, so the file
+      // name carries both the pipeline cache UUID and the driver version. A driver update simply
+      // makes us miss and rebuild a new file instead of feeding stale data to the driver.
+      std::ostringstream filename_;
+      filename_ << "pipeline_cache_";
+
+      for (unsigned int i = 0; i < VK_UUID_SIZE; ++i)
+        filename_ << std::hex << std::setw(2) << std::setfill('0') << (unsigned int)device_properties_.pipelineCacheUUID[i];
+
+      filename_ << "_" << std::dec << device_properties_.driverVersion << ".bin";
+
+      return filename_.str();
+    }
+
+    bool read_pipeline_cache_file(std::vector<char> & rData)
+    {
+      std::ifstream f_(m_pipeline_cache_filename, std::ios::ate | std::ios::binary);
+
+      if (!f_.is_open())
+        return false;
+
+      size_t file_size_ = (size_t)f_.tellg();
+
+      if (file_size_ < sizeof(PipelineCacheFileHeader))
+        return false;
+
+      PipelineCacheFileHeader header_;
+      f_.seekg(0);
+      f_.read(reinterpret_cast<char*>(&header_), sizeof(header_));
+
+      VkPhysicalDeviceProperties device_properties_;
+      vkGetPhysicalDeviceProperties(m_physical_device, &device_properties_);
+
+      if (header_.m_magic != kPipelineCacheMagic ||
+          header_.m_version != kPipelineCacheVersion ||
+          header_.m_vendor_id != device_properties_.vendorID ||
+          header_.m_device_id != device_properties_.deviceID ||
+          header_.m_driver_version != device_properties_.driverVersion ||
+          memcmp(header_.m_uuid, device_properties_.pipelineCacheUUID, VK_UUID_SIZE) != 0 ||
+          header_.m_data_size != file_size_ - sizeof(PipelineCacheFileHeader))
+        return false;
+
+      rData.resize(header_.m_data_size);
+      f_.read(rData.data(), header_.m_data_size);
+
+      if (!f_)
+        return false;
+
+      // The driver blob starts with its own header, validate it as well before handing it over
+      VkPipelineCacheHeaderVersionOne blob_header_;
+
+      if (rData.size() < sizeof(blob_header_))
+        return false;
+
+      memcpy(&blob_header_, rData.data(), sizeof(blob_header_));
+
+      if (blob_header_.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+          blob_header_.vendorID != device_properties_.vendorID ||
+          blob_header_.deviceID != device_properties_.deviceID ||
+          memcmp(blob_header_.pipelineCacheUUID, device_properties_.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        return false;
+
+      m_pipeline_cold_build_us = header_.m_cold_build_us;
+
+      return true;
+    }
+
+    void create_pipeline_cache()
+    {
+      m_pipeline_cache_filename = pipeline_cache_filename();
+      m_pipeline_cache_warm = false;
+      m_pipeline_cold_build_us = 0;
+
+      std::vector<char> cache_data_;
+
+      if (read_pipeline_cache_file(cache_data_))
+      {
+        m_pipeline_cache_warm = true;
+        std::cout << "Loaded pipeline cache " << m_pipeline_cache_filename << " (" << cache_data_.size() << " bytes)\n";
+      }
+      else
+      {
+        cache_data_.clear();
+        std::cout << "No valid pipeline cache found, pipelines will be built from scratch\n";
+      }
+
+      VkPipelineCacheCreateInfo create_info_ = {};
+      create_info_.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+      create_info_.initialDataSize = cache_data_.size();
+      create_info_.pInitialData = cache_data_.empty() ? nullptr : cache_data_.data();
+
+      if (vkCreatePipelineCache(m_device, &create_info_, nullptr, &m_pipeline_cache) != VK_SUCCESS)
+      {
+        // A corrupted blob that slipped through our checks should not prevent startup
+        create_info_.initialDataSize = 0;
+        create_info_.pInitialData = nullptr;
+        m_pipeline_cache_warm = false;
+
+        if (vkCreatePipelineCache(m_device, &create_info_, nullptr, &m_pipeline_cache) != VK_SUCCESS)
+          throw std::runtime_error("Failed to create pipeline cache!");
+      }
+    }
+
+    void save_pipeline_cache()
+    {
+      size_t data_size_ = 0;
+
+      if (vkGetPipelineCacheData(m_device, m_pipeline_cache, &data_size_, nullptr) != VK_SUCCESS || data_size_ == 0)
+        return;
+
+      std::vector<char> data_(data_size_);
+
+      if (vkGetPipelineCacheData(m_device, m_pipeline_cache, &data_size_, data_.data()) != VK_SUCCESS)
+        return;
+
+      VkPhysicalDeviceProperties device_properties_;
+      vkGetPhysicalDeviceProperties(m_physical_device, &device_properties_);
+
+      PipelineCacheFileHeader header_ = {};
+      header_.m_magic = kPipelineCacheMagic;
+      header_.m_version = kPipelineCacheVersion;
+      header_.m_vendor_id = device_properties_.vendorID;
+      header_.m_device_id = device_properties_.deviceID;
+      header_.m_driver_version = device_properties_.driverVersion;
+      memcpy(header_.m_uuid, device_properties_.pipelineCacheUUID, VK_UUID_SIZE);
+      header_.m_cold_build_us = m_pipeline_cold_build_us;
+      header_.m_data_size = data_size_;
+
+      // Write to a temporary file and rename it so a crash mid-write never leaves a truncated cache
+      std::string tmp_filename_ = m_pipeline_cache_filename + ".tmp";
+      std::ofstream f_(tmp_filename_, std::ios::binary | std::ios::trunc);
+
+      if (!f_.is_open())
+      {
+        std::cerr << "ERROR: Unable to write pipeline cache " << tmp_filename_ << "\n";
+        return;
+      }
+
+      f_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+      f_.write(data_.data(), data_size_);
+      f_.close();
+
+      if (std::rename(tmp_filename_.c_str(), m_pipeline_cache_filename.c_str()) != 0)
+        std::cerr << "ERROR: Unable to store pipeline cache " << m_pipeline_cache_filename << "\n";
+      else
+        std::cout << "Saved pipeline cache " << m_pipeline_cache_filename << " (" << data_size_ << " bytes)\n";
+    }
+
+    void create_pipeline_layout()
+    {
+        VkPipelineLayoutCreateInfo pipelinelayout_info_ = {};
+        pipelinelayout_info_.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelinelayout_info_.setLayoutCount = 1;
+        pipelinelayout_info_.pSetLayouts = &m_descriptorset_layout;
+        pipelinelayout_info_.pushConstantRangeCount = 0;
+        pipelinelayout_info_.pPushConstantRanges = nullptr;
+
+        if (vkCreatePipelineLayout(m_device, &pipelinelayout_info_, nullptr, &m_pipeline_layout) != VK_SUCCESS)
+            throw std::runtime_error("Failed to create pipeline layout!");
+    }
+
+    void create_graphics_pipelines()
     {
         //TODO: assert device
 
-        auto vertex_shader_code_ = read_file("shaders/vert.spv");
-        auto fragment_shader_code_ = read_file("shaders/frag.spv");
+        auto start_time_ = std::chrono::steady_clock::now();
+
+        // Level geometry fetches its texture through the per-draw surface buffer so it needs its own shaders
+        auto vertex_shader_code_ = read_file(m_level ? "shaders/level_vert.spv" : "shaders/vert.spv");
+        auto fragment_shader_code_ = read_file(m_level ? "shaders/level_frag.spv" : "shaders/frag.spv");
 
         VkShaderModule vertex_shader_module_ = create_shader_module(vertex_shader_code_);
         VkShaderModule fragment_shader_module_ = create_shader_module(fragment_shader_code_);
@@ -762,26 +1274,14 @@ class VulkanApplication
         input_assembly_info_.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
         input_assembly_info_.primitiveRestartEnable = VK_FALSE;
 
-        // Viewport
-        VkViewport viewport_ = {};
-        viewport_.x = 0.0f;
-        viewport_.y = 0.0f;
-        viewport_.width = (float)m_swap_chain_extent.width;
-        viewport_.height = (float)m_swap_chain_extent.height;
-        viewport_.minDepth = 0.0f;
-        viewport_.maxDepth = 1.0f;
-
-        // Scissor
-        VkRect2D scissor_ = {};
-        scissor_.offset = {0, 0};
-        scissor_.extent = m_swap_chain_extent;
-
+        // Viewport and scissor are dynamic so the pipelines do not depend on the swap chain extent
+        // and survive window resizes untouched
         VkPipelineViewportStateCreateInfo viewport_state_info_ = {};
         viewport_state_info_.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewport_state_info_.viewportCount = 1;
-        viewport_state_info_.pViewports = &viewport_;
+        viewport_state_info_.pViewports = nullptr;
         viewport_state_info_.scissorCount = 1;
-        viewport_state_info_.pScissors = &scissor_;
+        viewport_state_info_.pScissors = nullptr;
 
         // Rasterizer
         VkPipelineRasterizationStateCreateInfo rasterizer_info_ = {};
@@ -797,6 +1297,14 @@ class VulkanApplication
         rasterizer_info_.depthBiasClamp = 0.0f;
         rasterizer_info_.depthBiasSlopeFactor = 0.0f;
 
+        // Floors and ceilings are seen from both sides depending on the sector heights
+        VkPipelineRasterizationStateCreateInfo flat_rasterizer_info_ = rasterizer_info_;
+        flat_rasterizer_info_.cullMode = VK_CULL_MODE_NONE;
+
+        // Sprites are billboards, they are never back facing
+        VkPipelineRasterizationStateCreateInfo sprite_rasterizer_info_ = rasterizer_info_;
+        sprite_rasterizer_info_.cullMode = VK_CULL_MODE_NONE;
+
         // Multisampling
         VkPipelineMultisampleStateCreateInfo multisampling_info_ = {};
         multisampling_info_.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
@@ -806,20 +1314,23 @@ class VulkanApplication
         multisampling_info_.pSampleMask = nullptr;
         multisampling_info_.alphaToCoverageEnable = VK_FALSE;
 
-        // Color blending
+        // Color blending, walls and flats are opaque while sprites are alpha blended
         VkPipelineColorBlendAttachmentState colorblend_attachment_ = {};
         colorblend_attachment_.colorWriteMask = 
             VK_COLOR_COMPONENT_R_BIT |
             VK_COLOR_COMPONENT_G_BIT |
             VK_COLOR_COMPONENT_B_BIT |
             VK_COLOR_COMPONENT_A_BIT;
-        colorblend_attachment_.blendEnable = VK_TRUE;
-        colorblend_attachment_.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-        colorblend_attachment_.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-        colorblend_attachment_.colorBlendOp = VK_BLEND_OP_ADD;
-        colorblend_attachment_.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-        colorblend_attachment_.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-        colorblend_attachment_.alphaBlendOp = VK_BLEND_OP_ADD;
+        colorblend_attachment_.blendEnable = VK_FALSE;
+
+        VkPipelineColorBlendAttachmentState sprite_colorblend_attachment_ = colorblend_attachment_;
+        sprite_colorblend_attachment_.blendEnable = VK_TRUE;
+        sprite_colorblend_attachment_.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        sprite_colorblend_attachment_.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        sprite_colorblend_attachment_.colorBlendOp = VK_BLEND_OP_ADD;
+        sprite_colorblend_attachment_.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        sprite_colorblend_attachment_.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        sprite_colorblend_attachment_.alphaBlendOp = VK_BLEND_OP_ADD;
 
         VkPipelineColorBlendStateCreateInfo colorblend_info_ = {};
         colorblend_info_.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
@@ -832,10 +1343,22 @@ class VulkanApplication
         colorblend_info_.blendConstants[2] = 0.0f;
         colorblend_info_.blendConstants[3] = 0.0f;
 
+        VkPipelineColorBlendStateCreateInfo sprite_colorblend_info_ = colorblend_info_;
+        sprite_colorblend_info_.pAttachments = &sprite_colorblend_attachment_;
+
+        // Depth testing
+        VkPipelineDepthStencilStateCreateInfo depth_stencil_info_ = {};
+        depth_stencil_info_.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depth_stencil_info_.depthTestEnable = VK_TRUE;
+        depth_stencil_info_.depthWriteEnable = VK_TRUE;
+        depth_stencil_info_.depthCompareOp = VK_COMPARE_OP_LESS;
+        depth_stencil_info_.depthBoundsTestEnable = VK_FALSE;
+        depth_stencil_info_.stencilTestEnable = VK_FALSE;
+
         // Dynamic state
         VkDynamicState dynamic_states_[] = {
             VK_DYNAMIC_STATE_VIEWPORT,
-            VK_DYNAMIC_STATE_LINE_WIDTH
+            VK_DYNAMIC_STATE_SCISSOR
         };
 
         VkPipelineDynamicStateCreateInfo dynamicstate_info_ = {};
@@ -843,40 +1366,82 @@ class VulkanApplication
         dynamicstate_info_.dynamicStateCount = 2;
         dynamicstate_info_.pDynamicStates = dynamic_states_;
 
-        // Pipeline layout
-        VkPipelineLayoutCreateInfo pipelinelayout_info_ = {};
-        pipelinelayout_info_.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelinelayout_info_.setLayoutCount = 1;
-        pipelinelayout_info_.pSetLayouts = &m_descriptorset_layout;
-        pipelinelayout_info_.pushConstantRangeCount = 0;
-        pipelinelayout_info_.pPushConstantRanges = nullptr;
+        // The wall pipeline is the parent of the other two, drivers can reuse its compiled state
+        // when building the derivatives since they only differ in culling and blending.
+        VkGraphicsPipelineCreateInfo wall_pipeline_info_ = {};
+        wall_pipeline_info_.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        wall_pipeline_info_.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+        wall_pipeline_info_.stageCount = 2;
+        wall_pipeline_info_.pStages = shader_stages_;
+        wall_pipeline_info_.pVertexInputState = &vertex_input_info_;
+        wall_pipeline_info_.pInputAssemblyState = &input_assembly_info_;
+        wall_pipeline_info_.pViewportState = &viewport_state_info_;
+        wall_pipeline_info_.pRasterizationState = &rasterizer_info_;
+        wall_pipeline_info_.pMultisampleState = &multisampling_info_;
+        wall_pipeline_info_.pDepthStencilState = &depth_stencil_info_;
+        wall_pipeline_info_.pColorBlendState = &colorblend_info_;
+        wall_pipeline_info_.pDynamicState = &dynamicstate_info_;
+        wall_pipeline_info_.layout = m_pipeline_layout;
+        wall_pipeline_info_.renderPass = m_render_pass;
+        wall_pipeline_info_.subpass = 0;
+        wall_pipeline_info_.basePipelineHandle = VK_NULL_HANDLE;
+        wall_pipeline_info_.basePipelineIndex = -1;
+
+        VkGraphicsPipelineCreateInfo flat_pipeline_info_ = wall_pipeline_info_;
+        flat_pipeline_info_.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+        flat_pipeline_info_.pRasterizationState = &flat_rasterizer_info_;
+        flat_pipeline_info_.basePipelineIndex = 0;
+
+        VkGraphicsPipelineCreateInfo sprite_pipeline_info_ = wall_pipeline_info_;
+        sprite_pipeline_info_.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+        sprite_pipeline_info_.pRasterizationState = &sprite_rasterizer_info_;
+        sprite_pipeline_info_.pColorBlendState = &sprite_colorblend_info_;
+        sprite_pipeline_info_.basePipelineIndex = 0;
+
+        std::array<VkGraphicsPipelineCreateInfo, 3> pipeline_infos_ = {
+            wall_pipeline_info_,
+            flat_pipeline_info_,
+            sprite_pipeline_info_
+        };
+        std::array<VkPipeline, 3> pipelines_;
 
-        if (vkCreatePipelineLayout(m_device, &pipelinelayout_info_, nullptr, &m_pipeline_layout) != VK_SUCCESS)
-            throw std::runtime_error("Failed to create pipeline layout!");
+        // All pipelines are created up front in a single call so the driver can compile them together
+        if (vkCreateGraphicsPipelines(m_device,
+                                      m_pipeline_cache,
+                                      static_cast<uint32_t>(pipeline_infos_.size()),
+                                      pipeline_infos_.data(),
+                                      nullptr,
+                                      pipelines_.data()) != VK_SUCCESS)
+          throw std::runtime_error("Failed to create graphics pipelines!");
 
-        VkGraphicsPipelineCreateInfo pipeline_info_ = {};
-        pipeline_info_.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipeline_info_.stageCount = 2;
-        pipeline_info_.pStages = shader_stages_;
-        pipeline_info_.pVertexInputState = &vertex_input_info_;
-        pipeline_info_.pInputAssemblyState = &input_assembly_info_;
-        pipeline_info_.pViewportState = &viewport_state_info_;
-        pipeline_info_.pRasterizationState = &rasterizer_info_;
-        pipeline_info_.pMultisampleState = &multisampling_info_;
-        pipeline_info_.pDepthStencilState = nullptr;
-        pipeline_info_.pColorBlendState = &colorblend_info_;
-        pipeline_info_.pDynamicState = nullptr;
-        pipeline_info_.layout = m_pipeline_layout;
-        pipeline_info_.renderPass = m_render_pass;
-        pipeline_info_.subpass = 0;
-        pipeline_info_.basePipelineHandle = VK_NULL_HANDLE;
-        pipeline_info_.basePipelineIndex = -1;
-
-        if (vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipeline_info_, nullptr, &m_graphics_pipeline) != VK_SUCCESS)
-          throw std::runtime_error("Failed to create graphics pipeline!");
+        m_wall_pipeline = pipelines_[0];
+        m_flat_pipeline = pipelines_[1];
+        m_sprite_pipeline = pipelines_[2];
 
         vkDestroyShaderModule(m_device, fragment_shader_module_, nullptr);
         vkDestroyShaderModule(m_device, vertex_shader_module_, nullptr);
+
+        uint64_t build_us_ = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time_).count();
+
+        if (m_pipeline_cache_warm && m_pipeline_cold_build_us != 0)
+        {
+          int64_t saved_us_ = (int64_t)m_pipeline_cold_build_us - (int64_t)build_us_;
+          std::cout << "Created " << pipelines_.size() << " pipelines in " << build_us_ / 1000.0 << " ms using the pipeline cache "
+                    << "(cold build took " << m_pipeline_cold_build_us / 1000.0 << " ms, saved " << saved_us_ / 1000.0 << " ms)\n";
+        }
+        else
+        {
+          // Remember the cold build time so later warm starts can report how much they saved
+          m_pipeline_cold_build_us = build_us_;
+          std::cout << "Created " << pipelines_.size() << " pipelines in " << build_us_ / 1000.0 << " ms without a warm cache\n";
+        }
+    }
+
+    void destroy_graphics_pipelines()
+    {
+        vkDestroyPipeline(m_device, m_sprite_pipeline, nullptr);
+        vkDestroyPipeline(m_device, m_flat_pipeline, nullptr);
+        vkDestroyPipeline(m_device, m_wall_pipeline, nullptr);
     }
 
     void create_render_pass()
@@ -889,7 +1454,8 @@ class VulkanApplication
         color_attachment_.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         color_attachment_.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         color_attachment_.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        color_attachment_.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        // Offscreen images are copied into their readback buffer right after the render pass
+        color_attachment_.finalLayout = m_headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
         VkAttachmentDescription depth_attachment_ = {};
         depth_attachment_.format = find_depth_format();
@@ -923,6 +1489,17 @@ class VulkanApplication
         dependency_.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
         dependency_.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
+        // Make the color writes visible to the readback copy that follows the render pass
+        VkSubpassDependency readback_dependency_ = {};
+        readback_dependency_.srcSubpass = 0;
+        readback_dependency_.dstSubpass = VK_SUBPASS_EXTERNAL;
+        readback_dependency_.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        readback_dependency_.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        readback_dependency_.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        readback_dependency_.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        std::array<VkSubpassDependency, 2> dependencies_ = {dependency_, readback_dependency_};
+
         std::array<VkAttachmentDescription, 2> attachments_ = {color_attachment_, depth_attachment_};
         VkRenderPassCreateInfo render_pass_info_ = {};
         render_pass_info_.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -930,8 +1507,8 @@ class VulkanApplication
         render_pass_info_.pAttachments = attachments_.data();
         render_pass_info_.subpassCount = 1;
         render_pass_info_.pSubpasses = &subpass_;
-        render_pass_info_.dependencyCount = 1;
-        render_pass_info_.pDependencies = &dependency_;
+        render_pass_info_.dependencyCount = m_headless ? 2 : 1;
+        render_pass_info_.pDependencies = dependencies_.data();
         
         if (vkCreateRenderPass(m_device, &render_pass_info_, nullptr, &m_render_pass) != VK_SUCCESS)
             throw std::runtime_error("Failed to create render pass!");
@@ -944,13 +1521,14 @@ class VulkanApplication
         for (size_t i = 0; i < m_swap_chain_image_views.size(); ++i)
         {
             VkImageView attachments_[] = {
-                m_swap_chain_image_views[i]
+                m_swap_chain_image_views[i],
+                m_depth_image_view
             };
 
             VkFramebufferCreateInfo framebuffer_info_ = {};
             framebuffer_info_.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
             framebuffer_info_.renderPass = m_render_pass;
-            framebuffer_info_.attachmentCount = 1;
+            framebuffer_info_.attachmentCount = 2;
             framebuffer_info_.pAttachments = attachments_;
             framebuffer_info_.width = m_swap_chain_extent.width;
             framebuffer_info_.height = m_swap_chain_extent.height;
@@ -976,6 +1554,8 @@ class VulkanApplication
 
     void create_commandbuffers()
     {
+        PROFILE_ZONE("VulkanApplication::create_commandbuffers");
+
         m_commandbuffers.resize(m_swap_chain_framebuffers.size());
 
         VkCommandBufferAllocateInfo alloc_info_ = {};
@@ -1005,31 +1585,148 @@ class VulkanApplication
           renderpass_info_.renderArea.offset = {0, 0};
           renderpass_info_.renderArea.extent = m_swap_chain_extent;
 
-          VkClearValue clear_color_ = {0.0f, 0.0f, 0.0f, 1.0f};
-          renderpass_info_.clearValueCount = 1;
-          renderpass_info_.pClearValues = &clear_color_;
+          std::array<VkClearValue, 2> clear_values_ = {};
+          clear_values_[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
+          clear_values_[1].depthStencil = {1.0f, 0};
+          renderpass_info_.clearValueCount = static_cast<uint32_t>(clear_values_.size());
+          renderpass_info_.pClearValues = clear_values_.data();
 
           vkCmdBeginRenderPass(m_commandbuffers[i], &renderpass_info_, VK_SUBPASS_CONTENTS_INLINE);
 
-          vkCmdBindPipeline(m_commandbuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics_pipeline);
+          vkCmdBindPipeline(m_commandbuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_wall_pipeline);
+
+          VkViewport viewport_ = {};
+          viewport_.x = 0.0f;
+          viewport_.y = 0.0f;
+          viewport_.width = (float)m_swap_chain_extent.width;
+          viewport_.height = (float)m_swap_chain_extent.height;
+          viewport_.minDepth = 0.0f;
+          viewport_.maxDepth = 1.0f;
+          vkCmdSetViewport(m_commandbuffers[i], 0, 1, &viewport_);
+
+          VkRect2D scissor_ = {};
+          scissor_.offset = {0, 0};
+          scissor_.extent = m_swap_chain_extent;
+          vkCmdSetScissor(m_commandbuffers[i], 0, 1, &scissor_);
 
           VkBuffer vertex_buffers_[] = { m_vertexbuffer };
           VkDeviceSize offsets_[] = { 0 };
           vkCmdBindVertexBuffers(m_commandbuffers[i], 0, 1, vertex_buffers_, offsets_);
-          vkCmdBindIndexBuffer(m_commandbuffers[i], m_indexbuffer, 0, VK_INDEX_TYPE_UINT16);
+          vkCmdBindIndexBuffer(m_commandbuffers[i], m_indexbuffer, 0, m_level ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16);
 
-          vkCmdBindDescriptorSets(m_commandbuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout, 0, 1, &m_descriptorsets[i], 0, nullptr);
+          if (m_level)
+          {
+            // The whole level is drawn with one indirect call per pipeline and texture array, the CPU cost
+            // of a frame does not depend on how many surfaces there are
+            for (const LevelDrawRange & crRange : m_wall_draw_ranges)
+            {
+              vkCmdBindDescriptorSets(m_commandbuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout, 0, 1,
+                                      &m_descriptorsets[i * m_texture_images.size() + crRange.m_array], 0, nullptr);
+              record_level_draws(m_commandbuffers[i], crRange.m_first, crRange.m_count);
+            }
+
+            vkCmdBindPipeline(m_commandbuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_flat_pipeline);
+
+            for (const LevelDrawRange & crRange : m_flat_draw_ranges)
+            {
+              vkCmdBindDescriptorSets(m_commandbuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout, 0, 1,
+                                      &m_descriptorsets[i * m_texture_images.size() + crRange.m_array], 0, nullptr);
+              record_level_draws(m_commandbuffers[i], crRange.m_first, crRange.m_count);
+            }
+          }
+          else
+          {
+            vkCmdBindDescriptorSets(m_commandbuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout, 0, 1, &m_descriptorsets[i], 0, nullptr);
 
-          //vkCmdDraw(m_commandbuffers[i], static_cast<uint32_t>(kVertices.size()), 1, 0, 0);
-          vkCmdDrawIndexed(m_commandbuffers[i], static_cast<uint32_t>(kVertexIndices.size()), 1, 0, 0, 0);
+            //vkCmdDraw(m_commandbuffers[i], static_cast<uint32_t>(kVertices.size()), 1, 0, 0);
+            vkCmdDrawIndexed(m_commandbuffers[i], static_cast<uint32_t>(kVertexIndices.size()), 1, 0, 0, 0);
+          }
 
           vkCmdEndRenderPass(m_commandbuffers[i]);
 
+          if (m_headless)
+            record_readback(m_commandbuffers[i], i);
+
           if (vkEndCommandBuffer(m_commandbuffers[i]) != VK_SUCCESS)
             throw std::runtime_error("Failed to record command buffer!");
         }
     }
 
+    void record_level_draws(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount)
+    {
+        const VkDeviceSize stride_ = sizeof(VkDrawIndexedIndirectCommand);
+
+        // Without drawIndirectFirstInstance the shaders cannot find their surface from an indirect
+        // draw, so replay the commands as direct draws which always honor firstInstance
+        if (!m_draw_indirect_first_instance)
+        {
+          for (uint32_t d = firstDraw; d < firstDraw + drawCount; ++d)
+          {
+            const VkDrawIndexedIndirectCommand & crCommand = m_indirect_commands[d];
+            vkCmdDrawIndexed(commandBuffer,
+                             crCommand.indexCount,
+                             crCommand.instanceCount,
+                             crCommand.firstIndex,
+                             crCommand.vertexOffset,
+                             crCommand.firstInstance);
+          }
+
+          return;
+        }
+
+        // Without multiDrawIndirect every indirect call is limited to a single draw
+        uint32_t batch_ = m_multi_draw_indirect ? m_max_draw_indirect_count : 1;
+
+        for (uint32_t d = firstDraw; d < firstDraw + drawCount; d += batch_)
+        {
+          uint32_t count_ = std::min(batch_, firstDraw + drawCount - d);
+          vkCmdDrawIndexedIndirect(commandBuffer, m_indirect_buffer, d * stride_, count_, static_cast<uint32_t>(stride_));
+        }
+    }
+
+    void record_readback(VkCommandBuffer commandBuffer, size_t image)
+    {
+        VkBufferImageCopy region_ = {};
+        region_.bufferOffset = 0;
+        region_.bufferRowLength = 0;
+        region_.bufferImageHeight = 0;
+        region_.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region_.imageSubresource.mipLevel = 0;
+        region_.imageSubresource.baseArrayLayer = 0;
+        region_.imageSubresource.layerCount = 1;
+        region_.imageOffset = {0, 0, 0};
+        region_.imageExtent = {m_swap_chain_extent.width, m_swap_chain_extent.height, 1};
+
+        vkCmdCopyImageToBuffer(commandBuffer,
+                               m_swap_chain_images[image],
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               m_readback_buffers[image],
+                               1,
+                               &region_);
+
+        // Make the copy visible to the host once the fence of the frame signals
+        VkBufferMemoryBarrier barrier_ = {};
+        barrier_.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier_.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier_.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        barrier_.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier_.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier_.buffer = m_readback_buffers[image];
+        barrier_.offset = 0;
+        barrier_.size = VK_WHOLE_SIZE;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                             0,
+                             0,
+                             nullptr,
+                             1,
+                             &barrier_,
+                             0,
+                             nullptr);
+    }
+
     void create_semaphores()
     {
         m_image_available_semaphores.resize(kMaxFramesInFlight);
@@ -1066,14 +1763,27 @@ class VulkanApplication
 
         vkFreeCommandBuffers(m_device, m_commandpool, static_cast<uint32_t>(m_commandbuffers.size()), m_commandbuffers.data());
 
-        vkDestroyPipeline(m_device, m_graphics_pipeline, nullptr);
-        vkDestroyPipelineLayout(m_device, m_pipeline_layout, nullptr);
-        vkDestroyRenderPass(m_device, m_render_pass, nullptr);
+
+        vkDestroyImageView(m_device, m_depth_image_view, nullptr);
+        vkDestroyImage(m_device, m_depth_image, nullptr);
+        m_allocator->free(m_depth_image_allocation);
 
         for (unsigned int i = 0; i < m_swap_chain_image_views.size(); ++i)
           vkDestroyImageView(m_device, m_swap_chain_image_views[i], nullptr);
 
-        vkDestroySwapchainKHR(m_device, m_swap_chain, nullptr);
+        if (m_headless)
+        {
+            for (unsigned int i = 0; i < m_swap_chain_images.size(); ++i)
+            {
+                vkDestroyImage(m_device, m_swap_chain_images[i], nullptr);
+                m_allocator->free(m_offscreen_allocations[i]);
+
+                vkDestroyBuffer(m_device, m_readback_buffers[i], nullptr);
+                m_allocator->free(m_readback_allocations[i]);
+            }
+        }
+        else
+            vkDestroySwapchainKHR(m_device, m_swap_chain, nullptr);
     }
 
     void recreate_swapchain()
@@ -1089,12 +1799,26 @@ class VulkanApplication
 
         vkDeviceWaitIdle(m_device);
 
+        VkFormat old_format_ = m_swap_chain_format;
+
         cleanup_swapchain();
 
         create_swap_chain();
         create_image_views();
-        create_render_pass();
-        create_graphics_pipeline();
+
+        // The render pass and the pipelines only depend on the swap chain format (viewport and scissor
+        // are dynamic), so a plain resize keeps them. If the format changes we rebuild them, which is
+        // cheap anyway since the pipeline cache is warm by now.
+        if (m_swap_chain_format != old_format_)
+        {
+            destroy_graphics_pipelines();
+            vkDestroyRenderPass(m_device, m_render_pass, nullptr);
+
+            create_render_pass();
+            create_graphics_pipelines();
+        }
+
+        create_depth_resources();
         create_framebuffers();
         create_commandbuffers();
     }
@@ -1105,20 +1829,17 @@ class VulkanApplication
         app->m_framebuffer_resized = true;
     }
 
-    uint32_t find_memory_type(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+    void create_allocator()
     {
-      VkPhysicalDeviceMemoryProperties mem_properties_;
-      vkGetPhysicalDeviceMemoryProperties(m_physical_device, &mem_properties_);
-
-      for (uint32_t i = 0; i < mem_properties_.memoryTypeCount; ++i)
-        if ((typeFilter & (1 << i)) &&
-            ((mem_properties_.memoryTypes[i].propertyFlags & properties) == properties))
-          return i;
-
-      throw std::runtime_error("Failed to find suitable memory type!");
+      m_allocator = std::make_unique<VulkanMemoryAllocator>(m_physical_device, m_device, kMaxFramesInFlight);
     }
 
-    void create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer & rBuffer, VkDeviceMemory & rBufferMemory)
+    void create_buffer(VkDeviceSize size,
+                       VkBufferUsageFlags usage,
+                       VkMemoryPropertyFlags properties,
+                       VkBuffer & rBuffer,
+                       VulkanAllocation & rAllocation,
+                       AllocationLifetime lifetime = AllocationLifetime::kPersistent)
     {
       VkBufferCreateInfo buffer_info_ = {};
       buffer_info_.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1132,15 +1853,9 @@ class VulkanApplication
       VkMemoryRequirements mem_requirements_;
       vkGetBufferMemoryRequirements(m_device, rBuffer, &mem_requirements_);
 
-      VkMemoryAllocateInfo alloc_info_ = {};
-      alloc_info_.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-      alloc_info_.allocationSize = mem_requirements_.size;
-      alloc_info_.memoryTypeIndex = find_memory_type(mem_requirements_.memoryTypeBits, properties);
+      rAllocation = m_allocator->allocate(mem_requirements_, properties, lifetime, false);
 
-      if (vkAllocateMemory(m_device, &alloc_info_, nullptr, &rBufferMemory) != VK_SUCCESS)
-        throw std::runtime_error("Failed to allocate vertex buffer memory!");
-
-      vkBindBufferMemory(m_device, rBuffer, rBufferMemory, 0);
+      vkBindBufferMemory(m_device, rBuffer, rAllocation.m_memory, rAllocation.m_offset);
     }
 
     void copy_buffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
@@ -1157,60 +1872,159 @@ class VulkanApplication
         end_single_time_commands(command_buffer_);
     }
 
-    void create_vertexbuffer()
+    // Creates a device local buffer and fills it through a staging buffer
+    void create_device_local_buffer(const void * pData,
+                                    VkDeviceSize size,
+                                    VkBufferUsageFlags usage,
+                                    VkBuffer & rBuffer,
+                                    VulkanAllocation & rAllocation)
     {
-      VkDeviceSize buffer_size_ = sizeof(kVertices[0]) * kVertices.size();
-
       VkBuffer staging_buffer_;
-      VkDeviceMemory staging_buffer_memory_;
-      create_buffer(buffer_size_,
+      VulkanAllocation staging_buffer_allocation_;
+      create_buffer(size,
                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                     staging_buffer_,
-                    staging_buffer_memory_);
+                    staging_buffer_allocation_,
+                    AllocationLifetime::kFrame);
 
-      void* data_;
-      vkMapMemory(m_device, staging_buffer_memory_, 0, buffer_size_, 0, &data_);
-      memcpy(data_, kVertices.data(), (size_t)buffer_size_);
-      vkUnmapMemory(m_device, staging_buffer_memory_);
+      memcpy(staging_buffer_allocation_.m_mapped, pData, (size_t)size);
 
-      create_buffer(buffer_size_,
-                    VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      create_buffer(size,
+                    VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                    m_vertexbuffer, m_vertexbuffer_memory);
+                    rBuffer, rAllocation);
 
-      copy_buffer(staging_buffer_, m_vertexbuffer, buffer_size_);
+      copy_buffer(staging_buffer_, rBuffer, size);
 
       vkDestroyBuffer(m_device, staging_buffer_, nullptr);
-      vkFreeMemory(m_device, staging_buffer_memory_, nullptr);
+      m_allocator->free(staging_buffer_allocation_);
+    }
+
+    void create_vertexbuffer()
+    {
+      if (!m_level)
+      {
+        create_device_local_buffer(kVertices.data(),
+                                   sizeof(kVertices[0]) * kVertices.size(),
+                                   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                   m_vertexbuffer, m_vertexbuffer_allocation);
+        return;
+      }
+
+      // Level vertices carry the sector light in the color and texel coordinates in the texcoord
+      std::vector<Vertex> vertices_;
+      vertices_.reserve(m_level->vertices().size());
+
+      for (const LevelVertex & crV : m_level->vertices())
+        vertices_.push_back({ {crV.m_x, crV.m_y, crV.m_z}, {crV.m_light, crV.m_light, crV.m_light}, {crV.m_u, crV.m_v} });
+
+      create_device_local_buffer(vertices_.data(),
+                                 sizeof(vertices_[0]) * vertices_.size(),
+                                 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                 m_vertexbuffer, m_vertexbuffer_allocation);
     }
 
     void create_indexbuffer()
     {
-      VkDeviceSize buffer_size_ = sizeof(kVertexIndices[0]) * kVertexIndices.size();
+      if (!m_level)
+      {
+        create_device_local_buffer(kVertexIndices.data(),
+                                   sizeof(kVertexIndices[0]) * kVertexIndices.size(),
+                                   VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                   m_indexbuffer, m_indexbuffer_allocation);
+        return;
+      }
 
-      VkBuffer staging_buffer_;
-      VkDeviceMemory staging_buffer_memory_;
-      create_buffer(buffer_size_,
-                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                    staging_buffer_,
-                    staging_buffer_memory_);
+      create_device_local_buffer(m_level->indices().data(),
+                                 sizeof(uint32_t) * m_level->indices().size(),
+                                 VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                 m_indexbuffer, m_indexbuffer_allocation);
+    }
 
-      void* data_;
-      vkMapMemory(m_device, staging_buffer_memory_, 0, buffer_size_, 0, &data_);
-      memcpy(data_, kVertexIndices.data(), (size_t)buffer_size_);
-      vkUnmapMemory(m_device, staging_buffer_memory_);
+    void create_level_draw_buffers()
+    {
+      // One indexed indirect command per surface, walls first and flats after them so each pipeline
+      // draws a contiguous range, and within them sorted by texture array so every array is a range of
+      // its own. Every command uses its own index as firstInstance, which is how the shaders find the
+      // surface texture in the storage buffer through gl_InstanceIndex.
+      std::vector<uint32_t> surface_textures_;
 
-      create_buffer(buffer_size_,
-                    VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                    m_indexbuffer, m_indexbuffer_memory);
+      m_indirect_commands.clear();
+      m_wall_draw_ranges.clear();
+      m_flat_draw_ranges.clear();
+
+      for (const std::vector<LevelSurface> * pSurfaces : { &m_level->wall_surfaces(), &m_level->flat_surfaces() })
+      {
+        std::vector<LevelDrawRange> & rRanges = (pSurfaces == &m_level->wall_surfaces()) ? m_wall_draw_ranges : m_flat_draw_ranges;
 
-      copy_buffer(staging_buffer_, m_indexbuffer, buffer_size_);
+        std::vector<const LevelSurface *> sorted_;
+        for (const LevelSurface & crSurface : *pSurfaces)
+          sorted_.push_back(&crSurface);
 
-      vkDestroyBuffer(m_device, staging_buffer_, nullptr);
-      vkFreeMemory(m_device, staging_buffer_memory_, nullptr);
+        std::stable_sort(sorted_.begin(), sorted_.end(), [this](const LevelSurface * pA, const LevelSurface * pB) {
+          return m_level_texture_arrays[pA->m_texture] < m_level_texture_arrays[pB->m_texture];
+        });
+
+        for (const LevelSurface * pSurface : sorted_)
+        {
+          const LevelSurface & crSurface = *pSurface;
+          uint32_t array_ = m_level_texture_arrays[crSurface.m_texture];
+
+          if (rRanges.empty() || rRanges.back().m_array != array_)
+            rRanges.push_back({ array_, static_cast<uint32_t>(m_indirect_commands.size()), 0 });
+
+          ++rRanges.back().m_count;
+
+          VkDrawIndexedIndirectCommand command_ = {};
+          command_.indexCount = crSurface.m_index_count;
+          command_.instanceCount = 1;
+          command_.firstIndex = crSurface.m_first_index;
+          command_.vertexOffset = 0;
+          command_.firstInstance = static_cast<uint32_t>(m_indirect_commands.size());
+
+          m_indirect_commands.push_back(command_);
+          surface_textures_.push_back(crSurface.m_texture);
+        }
+      }
+
+      m_wall_draw_count = static_cast<uint32_t>(m_level->wall_surfaces().size());
+      m_flat_draw_count = static_cast<uint32_t>(m_level->flat_surfaces().size());
+
+      // Empty storage buffers are not allowed, keep at least one element around
+      if (m_indirect_commands.empty())
+      {
+        m_indirect_commands.push_back({});
+        surface_textures_.push_back(0);
+      }
+
+      // Size in texels and layer in its array of every texture
+      std::vector<glm::vec4> texture_infos_;
+      for (size_t t = 0; t < m_level->textures().size(); ++t)
+        texture_infos_.push_back(glm::vec4(m_level->textures()[t].m_width, m_level->textures()[t].m_height, m_level_texture_layers[t], 0.0f));
+
+      if (texture_infos_.empty())
+        texture_infos_.push_back(glm::vec4(1.0f, 1.0f, 0.0f, 0.0f));
+
+      create_device_local_buffer(m_indirect_commands.data(),
+                                 sizeof(VkDrawIndexedIndirectCommand) * m_indirect_commands.size(),
+                                 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                 m_indirect_buffer, m_indirect_buffer_allocation);
+
+      create_device_local_buffer(surface_textures_.data(),
+                                 sizeof(uint32_t) * surface_textures_.size(),
+                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                 m_surface_buffer, m_surface_buffer_allocation);
+
+      create_device_local_buffer(texture_infos_.data(),
+                                 sizeof(glm::vec4) * texture_infos_.size(),
+                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                 m_texture_info_buffer, m_texture_info_buffer_allocation);
+
+      std::cout << "Level draws: " << m_wall_draw_count << " walls and " << m_flat_draw_count << " flats in "
+                << (m_multi_draw_indirect && m_draw_indirect_first_instance
+                    ? std::to_string(m_wall_draw_ranges.size() + m_flat_draw_ranges.size()) + " indirect calls"
+                    : std::string("a draw loop (no multi-draw indirect support)")) << "\n";
     }
 
     void create_descriptorset_layout()
@@ -1229,7 +2043,24 @@ class VulkanApplication
       sampler_layout_binding_.pImmutableSamplers = nullptr;
       sampler_layout_binding_.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-      std::array<VkDescriptorSetLayoutBinding, 2> bindings_ = { ubo_layout_binding_, sampler_layout_binding_ };
+      std::vector<VkDescriptorSetLayoutBinding> bindings_ = { ubo_layout_binding_, sampler_layout_binding_ };
+
+      if (m_level)
+      {
+        // Per-draw texture indices and per-texture sizes for the level shaders
+        VkDescriptorSetLayoutBinding surface_layout_binding_ = {};
+        surface_layout_binding_.binding = 2;
+        surface_layout_binding_.descriptorCount = 1;
+        surface_layout_binding_.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        surface_layout_binding_.pImmutableSamplers = nullptr;
+        surface_layout_binding_.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+        VkDescriptorSetLayoutBinding texture_info_layout_binding_ = surface_layout_binding_;
+        texture_info_layout_binding_.binding = 3;
+
+        bindings_.push_back(surface_layout_binding_);
+        bindings_.push_back(texture_info_layout_binding_);
+      }
 
       VkDescriptorSetLayoutCreateInfo layout_info_ = {};
       layout_info_.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -1245,25 +2076,51 @@ class VulkanApplication
         VkDeviceSize buffer_size_ = sizeof(UniformBufferObject);
 
         m_uniform_buffers.resize(m_swap_chain_images.size());
-        m_uniformbuffers_memory.resize(m_swap_chain_images.size());
+        m_uniformbuffers_allocation.resize(m_swap_chain_images.size());
 
         for (size_t i = 0; i < m_swap_chain_images.size(); ++i)
             create_buffer(buffer_size_,
                           VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                           m_uniform_buffers[i],
-                          m_uniformbuffers_memory[i]);
+                          m_uniformbuffers_allocation[i]);
     }
 
     void update_uniformbuffer(uint32_t currentImage)
     {
+      PROFILE_ZONE("VulkanApplication::update_uniformbuffer");
+
       static auto start_time_ = std::chrono::high_resolution_clock::now();
 
       auto current_time_ = std::chrono::high_resolution_clock::now();
       float time_ = std::chrono::duration<float, std::chrono::seconds::period>(current_time_ - start_time_).count();
 
+      // Headless captures must be reproducible run after run, so animation follows the frame count
+      if (m_headless)
+        time_ = m_frame_number * kHeadlessFrameTime;
+
       UniformBufferObject ubo_ = {};
-      
+
+      if (m_level)
+      {
+        // Stand on the player 1 start and slowly look around
+        glm::vec3 eye_(m_level->start_x(), m_level->start_y(), m_level->start_z());
+        float angle_ = m_level->start_angle() + time_ * glm::radians(30.0f);
+
+        ubo_.m_model = glm::mat4(1.0f);
+        ubo_.m_view = glm::lookAt(eye_,
+                                  eye_ + glm::vec3(std::cos(angle_), std::sin(angle_), 0.0f),
+                                  glm::vec3(0.0f, 0.0f, 1.0f));
+        ubo_.m_proj = glm::perspective(glm::radians(74.0f),
+                                       m_swap_chain_extent.width / (float)m_swap_chain_extent.height,
+                                       4.0f,
+                                       16384.0f);
+        ubo_.m_proj[1][1] *= -1;
+
+        memcpy(m_uniformbuffers_allocation[currentImage].m_mapped, &ubo_, sizeof(ubo_));
+        return;
+      }
+
       ubo_.m_model = glm::rotate(glm::mat4(1.0f),
                                  time_ * glm::radians(90.0f),
                                  glm::vec3(0.0f, 0.0f, 1.0f));
@@ -1279,28 +2136,31 @@ class VulkanApplication
 
       ubo_.m_proj[1][1] *= -1;
 
-      void* data_;
-
-      vkMapMemory(m_device, m_uniformbuffers_memory[currentImage], 0, sizeof(ubo_), 0, &data_);
-      memcpy(data_, &ubo_, sizeof(ubo_));
-      vkUnmapMemory(m_device, m_uniformbuffers_memory[currentImage]);
+      memcpy(m_uniformbuffers_allocation[currentImage].m_mapped, &ubo_, sizeof(ubo_));
     }
 
     void create_descriptorpool()
     {
-        std::array<VkDescriptorPoolSize, 2> pool_sizes_ = {};
+        // A descriptor set per swap chain image and texture array
+        uint32_t sets_ = static_cast<uint32_t>(m_swap_chain_images.size() * m_texture_images.size());
+
+        std::vector<VkDescriptorPoolSize> pool_sizes_(m_level ? 3 : 2);
         pool_sizes_[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        pool_sizes_[0].descriptorCount = static_cast<uint32_t>(m_swap_chain_images.size());
+        pool_sizes_[0].descriptorCount = sets_;
         pool_sizes_[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        pool_sizes_[1].descriptorCount = static_cast<uint32_t>(m_swap_chain_images.size());
+        pool_sizes_[1].descriptorCount = sets_;
+
+        if (m_level)
+        {
+          pool_sizes_[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+          pool_sizes_[2].descriptorCount = 2 * sets_;
+        }
 
         VkDescriptorPoolCreateInfo pool_info_ = {};
         pool_info_.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         pool_info_.poolSizeCount = static_cast<uint32_t>(pool_sizes_.size());
         pool_info_.pPoolSizes = pool_sizes_.data();
-        pool_info_.maxSets = static_cast<uint32_t>(m_swap_chain_images.size());
-
-        pool_info_.maxSets = static_cast<uint32_t>(m_swap_chain_images.size());
+        pool_info_.maxSets = sets_;
 
         if (vkCreateDescriptorPool(m_device, &pool_info_, nullptr, &m_descriptorpool) != VK_SUCCESS)
             throw std::runtime_error("Failed to create descriptor pool!");
@@ -1308,20 +2168,24 @@ class VulkanApplication
 
     void create_descriptorsets()
     {
-        std::vector<VkDescriptorSetLayout> layouts_(m_swap_chain_images.size(), m_descriptorset_layout);
+        // The sets of swap chain image i are i * arrays + array, they only differ in the texture array
+        size_t arrays_ = m_texture_images.size();
+        std::vector<VkDescriptorSetLayout> layouts_(m_swap_chain_images.size() * arrays_, m_descriptorset_layout);
         VkDescriptorSetAllocateInfo alloc_info_ = {};
         alloc_info_.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
         alloc_info_.descriptorPool = m_descriptorpool;
-        alloc_info_.descriptorSetCount = static_cast<uint32_t>(m_swap_chain_images.size());
+        alloc_info_.descriptorSetCount = static_cast<uint32_t>(layouts_.size());
         alloc_info_.pSetLayouts = layouts_.data();
 
-        m_descriptorsets.resize(m_swap_chain_images.size());
+        m_descriptorsets.resize(layouts_.size());
 
         if (vkAllocateDescriptorSets(m_device, &alloc_info_, m_descriptorsets.data()) != VK_SUCCESS)
             throw std::runtime_error("Failed to allocate descriptor sets!");
 
-        for (size_t i = 0; i < m_swap_chain_images.size(); ++i)
+        for (size_t d = 0; d < m_descriptorsets.size(); ++d)
         {
+            size_t i = d / arrays_;
+
             VkDescriptorBufferInfo buffer_info_ = {};
             buffer_info_.buffer = m_uniform_buffers[i];
             buffer_info_.offset = 0;
@@ -1329,13 +2193,16 @@ class VulkanApplication
 
             VkDescriptorImageInfo image_info_ = {};
             image_info_.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            image_info_.imageView = m_texture_image_view;
+            image_info_.imageView = m_texture_image_views[d % arrays_];
             image_info_.sampler = m_texture_sampler;
 
-            std::array<VkWriteDescriptorSet, 2> descriptor_writes_ = {};
+            VkDescriptorBufferInfo surface_info_ = {};
+            VkDescriptorBufferInfo texture_info_ = {};
+
+            std::vector<VkWriteDescriptorSet> descriptor_writes_(m_level ? 4 : 2);
 
             descriptor_writes_[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptor_writes_[0].dstSet = m_descriptorsets[i];
+            descriptor_writes_[0].dstSet = m_descriptorsets[d];
             descriptor_writes_[0].dstBinding = 0;
             descriptor_writes_[0].dstArrayElement = 0;
             descriptor_writes_[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -1345,13 +2212,36 @@ class VulkanApplication
             descriptor_writes_[0].pTexelBufferView = nullptr;
 
             descriptor_writes_[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptor_writes_[1].dstSet = m_descriptorsets[i];
+            descriptor_writes_[1].dstSet = m_descriptorsets[d];
             descriptor_writes_[1].dstBinding = 1;
             descriptor_writes_[1].dstArrayElement = 0;
             descriptor_writes_[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
             descriptor_writes_[1].descriptorCount = 1;
             descriptor_writes_[1].pImageInfo = &image_info_;
 
+            if (m_level)
+            {
+                surface_info_.buffer = m_surface_buffer;
+                surface_info_.offset = 0;
+                surface_info_.range = VK_WHOLE_SIZE;
+
+                texture_info_.buffer = m_texture_info_buffer;
+                texture_info_.offset = 0;
+                texture_info_.range = VK_WHOLE_SIZE;
+
+                descriptor_writes_[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptor_writes_[2].dstSet = m_descriptorsets[d];
+                descriptor_writes_[2].dstBinding = 2;
+                descriptor_writes_[2].dstArrayElement = 0;
+                descriptor_writes_[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                descriptor_writes_[2].descriptorCount = 1;
+                descriptor_writes_[2].pBufferInfo = &surface_info_;
+
+                descriptor_writes_[3] = descriptor_writes_[2];
+                descriptor_writes_[3].dstBinding = 3;
+                descriptor_writes_[3].pBufferInfo = &texture_info_;
+            }
+
             vkUpdateDescriptorSets(m_device,
                                    static_cast<uint32_t>(descriptor_writes_.size()),
                                    descriptor_writes_.data(),
@@ -1360,7 +2250,7 @@ class VulkanApplication
         }
     }
 
-    void create_image(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+    void create_image(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VulkanAllocation& imageAllocation, uint32_t layers = 1)
     {
         VkImageCreateInfo image_info_ = {};
         image_info_.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1369,7 +2259,7 @@ class VulkanApplication
         image_info_.extent.height = height;
         image_info_.extent.depth = 1;
         image_info_.mipLevels = 1;
-        image_info_.arrayLayers = 1;
+        image_info_.arrayLayers = layers;
         image_info_.format = format;
         image_info_.tiling = tiling;
         image_info_.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -1384,19 +2274,147 @@ class VulkanApplication
         VkMemoryRequirements mem_requirements_;
         vkGetImageMemoryRequirements(m_device, image, &mem_requirements_);
 
-        VkMemoryAllocateInfo alloc_info_ = {};
-        alloc_info_.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        alloc_info_.allocationSize = mem_requirements_.size;
-        alloc_info_.memoryTypeIndex = find_memory_type(mem_requirements_.memoryTypeBits, properties);
+        imageAllocation = m_allocator->allocate(mem_requirements_,
+                                               properties,
+                                               AllocationLifetime::kPersistent,
+                                               tiling == VK_IMAGE_TILING_OPTIMAL);
+
+        vkBindImageMemory(m_device, image, imageAllocation.m_memory, imageAllocation.m_offset);
+    }
+
+    // Groups the level textures into array images. Textures are grouped by size class (their size rounded
+    // up to powers of two), so a wide texture does not blow up the layers of all the others, and a class
+    // is split into several arrays when it has more textures than maxImageArrayLayers. Smaller textures
+    // sit at the top-left corner of their layer and the shader scales their coordinates accordingly.
+    std::vector<LevelTextureArray> plan_level_texture_arrays()
+    {
+        const std::vector<LevelTextureImage> & textures_ = m_level->textures();
+
+        std::vector<LevelTextureArray> arrays_;
+        std::map<std::pair<uint32_t, uint32_t>, size_t> open_arrays_;
+
+        m_level_texture_arrays.assign(textures_.size(), 0);
+        m_level_texture_layers.assign(textures_.size(), 0);
+
+        for (size_t t = 0; t < textures_.size(); ++t)
+        {
+          const LevelTextureImage & crTexture = textures_[t];
+
+          if (crTexture.m_width > m_max_image_dimension_2d || crTexture.m_height > m_max_image_dimension_2d)
+            throw std::runtime_error("Failed to create level texture " + crTexture.m_name + ", it is larger than maxImageDimension2D!");
+
+          uint32_t width_ = 1;
+          while (width_ < crTexture.m_width)
+            width_ *= 2;
+
+          uint32_t height_ = 1;
+          while (height_ < crTexture.m_height)
+            height_ *= 2;
+
+          std::pair<uint32_t, uint32_t> class_(std::min(width_, m_max_image_dimension_2d), std::min(height_, m_max_image_dimension_2d));
+          auto open_ = open_arrays_.find(class_);
+
+          if (open_ == open_arrays_.end() || arrays_[open_->second].m_textures.size() >= m_max_image_array_layers)
+          {
+            open_arrays_[class_] = arrays_.size();
+            arrays_.push_back({ class_.first, class_.second, {} });
+          }
+
+          LevelTextureArray & rArray = arrays_[open_arrays_[class_]];
+          m_level_texture_arrays[t] = static_cast<uint32_t>(&rArray - arrays_.data());
+          m_level_texture_layers[t] = static_cast<uint32_t>(rArray.m_textures.size());
+          rArray.m_textures.push_back(static_cast<uint32_t>(t));
+        }
+
+        // Array images cannot be empty, a level without textures still gets a 1x1 one
+        if (arrays_.empty())
+          arrays_.push_back({ 1, 1, {} });
+
+        return arrays_;
+    }
+
+    void create_level_textureimage()
+    {
+        const std::vector<LevelTextureImage> & textures_ = m_level->textures();
+        std::vector<LevelTextureArray> arrays_ = plan_level_texture_arrays();
+
+        VkDeviceSize total_size_ = 0;
+
+        for (const LevelTextureArray & crArray : arrays_)
+        {
+          uint32_t layers_ = std::max<uint32_t>(1, static_cast<uint32_t>(crArray.m_textures.size()));
+          VkDeviceSize layer_size_ = static_cast<VkDeviceSize>(crArray.m_width) * crArray.m_height * 4;
+          VkDeviceSize image_size_ = layer_size_ * layers_;
+
+          VkBuffer staging_buffer_;
+          VulkanAllocation staging_buffer_allocation_;
+
+          create_buffer(image_size_,
+                        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        staging_buffer_,
+                        staging_buffer_allocation_,
+                        AllocationLifetime::kFrame);
+
+          uint8_t * staging_ = static_cast<uint8_t*>(staging_buffer_allocation_.m_mapped);
+          memset(staging_, 0, static_cast<size_t>(image_size_));
+
+          for (size_t l = 0; l < crArray.m_textures.size(); ++l)
+          {
+            const LevelTextureImage & crTexture = textures_[crArray.m_textures[l]];
+
+            for (uint32_t y = 0; y < crTexture.m_height; ++y)
+              memcpy(staging_ + l * layer_size_ + y * crArray.m_width * 4,
+                     crTexture.m_rgba.data() + y * crTexture.m_width * 4,
+                     crTexture.m_width * 4);
+          }
 
-        if (vkAllocateMemory(m_device, &alloc_info_, nullptr, &imageMemory) != VK_SUCCESS)
-            throw std::runtime_error("failed to allocate image memory!");
+          VkImage image_;
+          VulkanAllocation image_allocation_;
+
+          create_image(crArray.m_width,
+                       crArray.m_height,
+                       VK_FORMAT_R8G8B8A8_UNORM,
+                       VK_IMAGE_TILING_OPTIMAL,
+                       VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                       image_,
+                       image_allocation_,
+                       layers_);
+
+          transition_image_layout(image_,
+                                  VK_FORMAT_R8G8B8A8_UNORM,
+                                  VK_IMAGE_LAYOUT_UNDEFINED,
+                                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                  layers_);
+          copy_buffer_to_image(staging_buffer_, image_, crArray.m_width, crArray.m_height, layers_);
+          transition_image_layout(image_,
+                                  VK_FORMAT_R8G8B8A8_UNORM,
+                                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                  layers_);
+
+          vkDestroyBuffer(m_device, staging_buffer_, nullptr);
+          m_allocator->free(staging_buffer_allocation_);
+
+          m_texture_images.push_back(image_);
+          m_texture_image_allocations.push_back(image_allocation_);
+          m_texture_layers.push_back(layers_);
+          total_size_ += image_size_;
+        }
 
-        vkBindImageMemory(m_device, image, imageMemory, 0);
+        std::cout << "Level textures: " << textures_.size() << " in " << arrays_.size() << " texture arrays of "
+                  << total_size_ / 1024 << " KB\n";
     }
 
     void create_textureimage()
     {
+        if (m_level)
+        {
+          create_level_textureimage();
+          return;
+        }
+
         int tex_width_;
         int tex_height_;
         int tex_channels_;
@@ -1408,46 +2426,50 @@ class VulkanApplication
             throw std::runtime_error("Failed to load texture image!");
 
         VkBuffer staging_buffer_;
-        VkDeviceMemory staging_buffer_memory_;
+        VulkanAllocation staging_buffer_allocation_;
 
         create_buffer(image_size_,
                       VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                       staging_buffer_,
-                      staging_buffer_memory_);
-
-        void* data_;
+                      staging_buffer_allocation_,
+                      AllocationLifetime::kFrame);
 
-        vkMapMemory(m_device, staging_buffer_memory_, 0, image_size_, 0, &data_);
-        memcpy(data_, pixels_, static_cast<size_t>(image_size_));
-        vkUnmapMemory(m_device, staging_buffer_memory_);
+        memcpy(staging_buffer_allocation_.m_mapped, pixels_, static_cast<size_t>(image_size_));
 
         stbi_image_free(pixels_);
 
+        VkImage image_;
+        VulkanAllocation image_allocation_;
+
         create_image(tex_width_,
                      tex_height_,
                      VK_FORMAT_R8G8B8A8_UNORM,
                      VK_IMAGE_TILING_OPTIMAL,
                      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                     m_texture_image,
-                     m_texture_image_memory);
+                     image_,
+                     image_allocation_);
 
-        transition_image_layout(m_texture_image,
+        transition_image_layout(image_,
                                 VK_FORMAT_R8G8B8A8_UNORM,
                                 VK_IMAGE_LAYOUT_UNDEFINED,
                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
         copy_buffer_to_image(staging_buffer_,
-                             m_texture_image,
+                             image_,
                              static_cast<uint32_t>(tex_width_),
                              static_cast<uint32_t>(tex_height_));
-        transition_image_layout(m_texture_image,
+        transition_image_layout(image_,
                                 VK_FORMAT_R8G8B8A8_UNORM,
                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
         vkDestroyBuffer(m_device, staging_buffer_, nullptr);
-        vkFreeMemory(m_device, staging_buffer_memory_, nullptr);
+        m_allocator->free(staging_buffer_allocation_);
+
+        m_texture_images.push_back(image_);
+        m_texture_image_allocations.push_back(image_allocation_);
+        m_texture_layers.push_back(1);
     }
 
     VkCommandBuffer begin_single_time_commands()
@@ -1485,7 +2507,7 @@ class VulkanApplication
         vkFreeCommandBuffers(m_device, m_commandpool, 1, &commandBuffer);
     }
 
-    void transition_image_layout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout)
+    void transition_image_layout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t layers = 1)
     {
         VkCommandBuffer command_buffer_ = begin_single_time_commands();
 
@@ -1502,7 +2524,7 @@ class VulkanApplication
         barrier_.subresourceRange.baseMipLevel = 0;
         barrier_.subresourceRange.levelCount = 1;
         barrier_.subresourceRange.baseArrayLayer = 0;
-        barrier_.subresourceRange.layerCount = 1;
+        barrier_.subresourceRange.layerCount = layers;
 
 
         if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
@@ -1562,10 +2584,11 @@ class VulkanApplication
         end_single_time_commands(command_buffer_);
     }
 
-    void copy_buffer_to_image(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+    void copy_buffer_to_image(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layers = 1)
     {
       VkCommandBuffer command_buffer_ = begin_single_time_commands();
 
+      // Layers are tightly packed one after the other in the buffer
       VkBufferImageCopy region_ = {};
       region_.bufferOffset = 0;
       region_.bufferRowLength = 0;
@@ -1573,7 +2596,7 @@ class VulkanApplication
       region_.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
       region_.imageSubresource.mipLevel = 0;
       region_.imageSubresource.baseArrayLayer = 0;
-      region_.imageSubresource.layerCount = 1;
+      region_.imageSubresource.layerCount = layers;
       region_.imageOffset = {0, 0, 0};
       region_.imageExtent = { width, height, 1 };
 
@@ -1589,17 +2612,31 @@ class VulkanApplication
 
     void create_textureimageview()
     {
-        m_texture_image_view = create_image_view(m_texture_image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+        for (size_t a = 0; a < m_texture_images.size(); ++a)
+        {
+          if (m_level)
+            m_texture_image_views.push_back(create_image_view(m_texture_images[a],
+                                                              VK_FORMAT_R8G8B8A8_UNORM,
+                                                              VK_IMAGE_ASPECT_COLOR_BIT,
+                                                              VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+                                                              m_texture_layers[a]));
+          else
+            m_texture_image_views.push_back(create_image_view(m_texture_images[a], VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT));
+        }
     }
 
-    VkImageView create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+    VkImageView create_image_view(VkImage image,
+                                  VkFormat format,
+                                  VkImageAspectFlags aspectFlags,
+                                  VkImageViewType viewType = VK_IMAGE_VIEW_TYPE_2D,
+                                  uint32_t layers = 1)
     {
         VkImageView image_view_;
 
         VkImageViewCreateInfo create_info_ = {};
         create_info_.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
         create_info_.image = image;
-        create_info_.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        create_info_.viewType = viewType;
         create_info_.format = format;
         create_info_.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
         create_info_.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -1609,7 +2646,7 @@ class VulkanApplication
         create_info_.subresourceRange.baseMipLevel = 0;
         create_info_.subresourceRange.levelCount = 1;
         create_info_.subresourceRange.baseArrayLayer = 0;
-        create_info_.subresourceRange.layerCount = 1;
+        create_info_.subresourceRange.layerCount = layers;
 
         if (vkCreateImageView(m_device, &create_info_, nullptr, &image_view_) != VK_SUCCESS)
             throw std::runtime_error("Failed to create texture image view!");
@@ -1621,12 +2658,14 @@ class VulkanApplication
     {
         VkSamplerCreateInfo sampler_info_ = {};
         sampler_info_.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-        sampler_info_.magFilter = VK_FILTER_LINEAR;
-        sampler_info_.minFilter = VK_FILTER_LINEAR;
+        // Level textures are wrapped manually inside their layer, linear filtering would bleed across the
+        // wrap seams (and DOOM textures look right unfiltered anyway)
+        sampler_info_.magFilter = m_level ? VK_FILTER_NEAREST : VK_FILTER_LINEAR;
+        sampler_info_.minFilter = m_level ? VK_FILTER_NEAREST : VK_FILTER_LINEAR;
         sampler_info_.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
         sampler_info_.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
         sampler_info_.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        sampler_info_.anisotropyEnable = VK_TRUE;
+        sampler_info_.anisotropyEnable = m_sampler_anisotropy ? VK_TRUE : VK_FALSE;
         sampler_info_.maxAnisotropy = 16;
         sampler_info_.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
         sampler_info_.unnormalizedCoordinates = VK_FALSE;
@@ -1680,7 +2719,7 @@ class VulkanApplication
                      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                      m_depth_image,
-                     m_depth_image_memory);
+                     m_depth_image_allocation);
 
         m_depth_image_view = create_image_view(m_depth_image, depth_format_, VK_IMAGE_ASPECT_DEPTH_BIT);
 
@@ -1704,7 +2743,13 @@ class VulkanApplication
     VkDescriptorSetLayout m_descriptorset_layout;
     VkPipelineLayout m_pipeline_layout;
     VkRenderPass m_render_pass;
-    VkPipeline m_graphics_pipeline;
+    VkPipelineCache m_pipeline_cache;
+    std::string m_pipeline_cache_filename;
+    bool m_pipeline_cache_warm;
+    uint64_t m_pipeline_cold_build_us;
+    VkPipeline m_wall_pipeline;
+    VkPipeline m_flat_pipeline;
+    VkPipeline m_sprite_pipeline;
     std::vector<VkFramebuffer> m_swap_chain_framebuffers;
     VkCommandPool m_commandpool;
     std::vector<VkCommandBuffer> m_commandbuffers;
@@ -1715,26 +2760,63 @@ class VulkanApplication
     size_t m_current_frame;
     bool m_framebuffer_resized;
 
+    std::unique_ptr<VulkanMemoryAllocator> m_allocator;
+
     VkBuffer m_vertexbuffer;
-    VkDeviceMemory m_vertexbuffer_memory;
+    VulkanAllocation m_vertexbuffer_allocation;
 
     VkBuffer m_indexbuffer;
-    VkDeviceMemory m_indexbuffer_memory;
+    VulkanAllocation m_indexbuffer_allocation;
 
     std::vector<VkBuffer> m_uniform_buffers;
-    std::vector<VkDeviceMemory> m_uniformbuffers_memory;
+    std::vector<VulkanAllocation> m_uniformbuffers_allocation;
     VkDescriptorPool m_descriptorpool;
     std::vector<VkDescriptorSet> m_descriptorsets;
 
-    VkImage m_texture_image;
-    VkDeviceMemory m_texture_image_memory;
-    VkImageView m_texture_image_view;
+    // One image per level texture array, or the texture of the test quad
+    std::vector<VkImage> m_texture_images;
+    std::vector<VulkanAllocation> m_texture_image_allocations;
+    std::vector<uint32_t> m_texture_layers;
+    std::vector<VkImageView> m_texture_image_views;
     VkSampler m_texture_sampler;
 
     VkImage m_depth_image;
-    VkDeviceMemory m_depth_image_memory;
+    VulkanAllocation m_depth_image_allocation;
     VkImageView m_depth_image_view;
 
+    bool m_headless;
+    bool m_sampler_anisotropy = false;
+    bool m_multi_draw_indirect = false;
+    bool m_draw_indirect_first_instance = false;
+    uint32_t m_max_draw_indirect_count = 1;
+    uint32_t m_max_image_array_layers = 256;
+    uint32_t m_max_image_dimension_2d = 4096;
+
+    std::shared_ptr<const LevelMesh> m_level;
+    std::vector<VkDrawIndexedIndirectCommand> m_indirect_commands;
+    uint32_t m_wall_draw_count = 0;
+    uint32_t m_flat_draw_count = 0;
+
+    // Texture array and layer of every level texture, and the draws of each array
+    std::vector<uint32_t> m_level_texture_arrays;
+    std::vector<uint32_t> m_level_texture_layers;
+    std::vector<LevelDrawRange> m_wall_draw_ranges;
+    std::vector<LevelDrawRange> m_flat_draw_ranges;
+    VkBuffer m_indirect_buffer;
+    VulkanAllocation m_indirect_buffer_allocation;
+    VkBuffer m_surface_buffer;
+    VulkanAllocation m_surface_buffer_allocation;
+    VkBuffer m_texture_info_buffer;
+    VulkanAllocation m_texture_info_buffer_allocation;
+    uint64_t m_frame_number;
+    unsigned int m_capture_interval = 0;
+    std::string m_capture_prefix;
+    std::vector<VulkanAllocation> m_offscreen_allocations;
+    std::vector<VkBuffer> m_readback_buffers;
+    std::vector<VulkanAllocation> m_readback_allocations;
+    std::vector<uint64_t> m_readback_frames;
+    std::vector<bool> m_readback_pending;
+
     std::shared_ptr<GLFWwindow*> m_window;
 };
 
@@ -0,0 +1,411 @@
+#ifndef VULKAN_MEMORY_ALLOCATOR_HPP_
+#define VULKAN_MEMORY_ALLOCATOR_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "suballocators.hpp"
+
+// Drivers cap the number of live vkAllocateMemory allocations (maxMemoryAllocationCount is often
+// 4096) and each call is slow, so resources are sub-allocated from a few big blocks per memory type
+// instead. Long-lived resources use a buddy allocator per block and per-frame data (staging buffers,
+// transient uploads) bumps a linear allocator that is recycled when its frame comes around again.
+
+enum class AllocationLifetime
+{
+  kPersistent,
+  kFrame
+};
+
+struct VulkanAllocation
+{
+  VkDeviceMemory m_memory = VK_NULL_HANDLE;
+  VkDeviceSize m_offset = 0;
+  VkDeviceSize m_size = 0;
+  VkDeviceSize m_requested_size = 0;
+  uint32_t m_pool = 0;
+  uint32_t m_block = 0;
+  AllocationLifetime m_lifetime = AllocationLifetime::kPersistent;
+
+  // Host pointer to the start of the allocation when the memory type is host visible. Blocks are
+  // mapped persistently since a VkDeviceMemory shared by several resources cannot be mapped twice.
+  void* m_mapped = nullptr;
+};
+
+struct VulkanMemoryStats
+{
+  VkDeviceSize m_bytes_requested = 0;
+  VkDeviceSize m_bytes_used = 0;
+  VkDeviceSize m_bytes_reserved = 0;
+  uint32_t m_block_count = 0;
+  uint32_t m_allocation_count = 0;
+  uint32_t m_device_allocation_calls = 0;
+
+  // 0 when all the free space of a pool sits in a single range, close to 1 when it is scattered
+  // in small pieces that cannot serve a big request even if the total free space is large.
+  float m_fragmentation = 0.0f;
+
+  inline friend std::ostream& operator<<(std::ostream& rOs, const VulkanMemoryStats& crStats)
+  {
+    rOs << "GPU MEMORY - ";
+    rOs << crStats.m_allocation_count << " allocations in " << crStats.m_block_count << " blocks\n";
+    rOs << "Requested: " << crStats.m_bytes_requested << " bytes\n";
+    rOs << "Used: " << crStats.m_bytes_used << " bytes\n";
+    rOs << "Reserved: " << crStats.m_bytes_reserved << " bytes\n";
+    rOs << "vkAllocateMemory calls: " << crStats.m_device_allocation_calls << "\n";
+    rOs << "Fragmentation: " << crStats.m_fragmentation << "\n";
+    return rOs;
+  }
+};
+
+class VulkanMemoryAllocator
+{
+  const uint32_t kLinearBlock = UINT32_MAX;
+  const VkDeviceSize kMinBlockSize = 256;
+
+  struct MemoryBlock
+  {
+    VkDeviceMemory m_memory = VK_NULL_HANDLE;
+    VkDeviceSize m_size = 0;
+    uint8_t* m_mapped = nullptr;
+    uint32_t m_allocation_count = 0;
+
+    // Null for dedicated blocks, which hold a single resource bigger than the regular block size
+    std::unique_ptr<BuddyAllocator> m_buddy;
+  };
+
+  struct MemoryPool
+  {
+    uint32_t m_memory_type = 0;
+    std::vector<MemoryBlock> m_blocks;
+
+    MemoryBlock m_linear_block;
+    std::unique_ptr<LinearAllocator> m_linear;
+  };
+
+  public:
+
+    VulkanMemoryAllocator(VkPhysicalDevice physicalDevice,
+                          VkDevice device,
+                          unsigned int frameCount,
+                          VkDeviceSize blockSize = 64 * 1024 * 1024,
+                          VkDeviceSize frameBlockSize = 16 * 1024 * 1024)
+    {
+      assert(is_power_of_two(blockSize));
+
+      m_device = device;
+      m_frame_count = frameCount;
+      m_current_frame = 0;
+      m_block_size = blockSize;
+      m_frame_block_size = frameBlockSize;
+      m_device_allocation_calls = 0;
+      m_bytes_requested = 0;
+
+      vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memory_properties);
+
+      // Buffers and optimal-tiling images get separate pools per memory type so they never share a
+      // bufferImageGranularity page and we do not have to pad every allocation to it.
+      m_pools.resize(m_memory_properties.memoryTypeCount * 2);
+
+      for (uint32_t i = 0; i < m_pools.size(); ++i)
+        m_pools[i].m_memory_type = i / 2;
+    }
+
+    ~VulkanMemoryAllocator()
+    {
+      for (auto & pool : m_pools)
+      {
+        for (auto & block : pool.m_blocks)
+          release_block(block);
+
+        release_block(pool.m_linear_block);
+      }
+    }
+
+    VulkanAllocation allocate(const VkMemoryRequirements & crRequirements,
+                              VkMemoryPropertyFlags properties,
+                              AllocationLifetime lifetime,
+                              bool optimalImage)
+    {
+      uint32_t memory_type_ = find_memory_type(crRequirements.memoryTypeBits, properties);
+      uint32_t pool_index_ = memory_type_ * 2 + (optimalImage ? 1 : 0);
+      MemoryPool & pool_ = m_pools[pool_index_];
+
+      VulkanAllocation allocation_;
+      allocation_.m_pool = pool_index_;
+      allocation_.m_requested_size = crRequirements.size;
+
+      if (lifetime == AllocationLifetime::kFrame && allocate_linear(pool_, crRequirements, allocation_))
+      {
+        m_bytes_requested += crRequirements.size;
+        return allocation_;
+      }
+
+      // Per-frame requests that do not fit the frame arena just become regular allocations, they
+      // are returned through free() like any other.
+      allocation_.m_lifetime = AllocationLifetime::kPersistent;
+
+      if (crRequirements.size > m_block_size)
+        allocate_dedicated(pool_, crRequirements, allocation_);
+      else
+        allocate_buddy(pool_, crRequirements, allocation_);
+
+      m_bytes_requested += crRequirements.size;
+
+      return allocation_;
+    }
+
+    void free(VulkanAllocation & rAllocation)
+    {
+      if (rAllocation.m_memory == VK_NULL_HANDLE)
+        return;
+
+      m_bytes_requested -= rAllocation.m_requested_size;
+
+      // Per-frame memory is reclaimed in bulk by begin_frame()
+      if (rAllocation.m_lifetime == AllocationLifetime::kFrame)
+      {
+        rAllocation = VulkanAllocation();
+        return;
+      }
+
+      MemoryBlock & block_ = m_pools[rAllocation.m_pool].m_blocks[rAllocation.m_block];
+      block_.m_allocation_count--;
+
+      if (block_.m_buddy)
+        block_.m_buddy->free(rAllocation.m_offset, rAllocation.m_size);
+      else
+        release_block(block_);
+
+      rAllocation = VulkanAllocation();
+    }
+
+    // Called once the fence of the given frame slot has signaled, everything allocated with a
+    // per-frame lifetime during the previous use of that slot is no longer in use by the GPU.
+    void begin_frame(unsigned int frame)
+    {
+      m_current_frame = frame % m_frame_count;
+
+      for (auto & pool : m_pools)
+        if (pool.m_linear)
+          pool.m_linear->reset(m_current_frame);
+    }
+
+    VulkanMemoryStats stats() const
+    {
+      VulkanMemoryStats stats_;
+      stats_.m_bytes_requested = m_bytes_requested;
+      stats_.m_device_allocation_calls = m_device_allocation_calls;
+
+      float fragmentation_ = 0.0f;
+      unsigned int fragmented_pools_ = 0;
+
+      for (const auto & pool : m_pools)
+      {
+        VkDeviceSize pool_free_ = 0;
+        VkDeviceSize pool_largest_free_ = 0;
+
+        for (const auto & block : pool.m_blocks)
+        {
+          if (block.m_memory == VK_NULL_HANDLE)
+            continue;
+
+          stats_.m_block_count++;
+          stats_.m_allocation_count += block.m_allocation_count;
+          stats_.m_bytes_reserved += block.m_size;
+
+          if (block.m_buddy)
+          {
+            stats_.m_bytes_used += block.m_buddy->used();
+            pool_free_ += block.m_size - block.m_buddy->used();
+            pool_largest_free_ = std::max<VkDeviceSize>(pool_largest_free_, block.m_buddy->largest_free());
+          }
+          else
+            stats_.m_bytes_used += block.m_size;
+        }
+
+        if (pool.m_linear)
+        {
+          stats_.m_block_count++;
+          stats_.m_bytes_reserved += pool.m_linear_block.m_size;
+          stats_.m_bytes_used += pool.m_linear->used();
+        }
+
+        if (pool_free_ != 0)
+        {
+          fragmentation_ += 1.0f - (float)pool_largest_free_ / (float)pool_free_;
+          fragmented_pools_++;
+        }
+      }
+
+      stats_.m_fragmentation = fragmented_pools_ != 0 ? fragmentation_ / fragmented_pools_ : 0.0f;
+
+      return stats_;
+    }
+
+  private:
+
+    uint32_t find_memory_type(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+    {
+      for (uint32_t i = 0; i < m_memory_properties.memoryTypeCount; ++i)
+        if ((typeFilter & (1 << i)) &&
+            ((m_memory_properties.memoryTypes[i].propertyFlags & properties) == properties))
+          return i;
+
+      throw std::runtime_error("Failed to find suitable memory type!");
+    }
+
+    void create_block(uint32_t memoryType, VkDeviceSize size, MemoryBlock & rBlock)
+    {
+      VkMemoryAllocateInfo alloc_info_ = {};
+      alloc_info_.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+      alloc_info_.allocationSize = size;
+      alloc_info_.memoryTypeIndex = memoryType;
+
+      if (vkAllocateMemory(m_device, &alloc_info_, nullptr, &rBlock.m_memory) != VK_SUCCESS)
+        throw std::runtime_error("Failed to allocate device memory block!");
+
+      m_device_allocation_calls++;
+
+      rBlock.m_size = size;
+      rBlock.m_allocation_count = 0;
+      rBlock.m_mapped = nullptr;
+
+      if (m_memory_properties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+      {
+        void* data_;
+
+        if (vkMapMemory(m_device, rBlock.m_memory, 0, VK_WHOLE_SIZE, 0, &data_) != VK_SUCCESS)
+          throw std::runtime_error("Failed to map device memory block!");
+
+        rBlock.m_mapped = static_cast<uint8_t*>(data_);
+      }
+    }
+
+    void release_block(MemoryBlock & rBlock)
+    {
+      if (rBlock.m_memory == VK_NULL_HANDLE)
+        return;
+
+      if (rBlock.m_mapped)
+        vkUnmapMemory(m_device, rBlock.m_memory);
+
+      vkFreeMemory(m_device, rBlock.m_memory, nullptr);
+
+      rBlock.m_memory = VK_NULL_HANDLE;
+      rBlock.m_mapped = nullptr;
+      rBlock.m_size = 0;
+      rBlock.m_allocation_count = 0;
+      rBlock.m_buddy.reset();
+    }
+
+    bool allocate_linear(MemoryPool & rPool, const VkMemoryRequirements & crRequirements, VulkanAllocation & rAllocation)
+    {
+      if (!rPool.m_linear)
+      {
+        create_block(rPool.m_memory_type, m_frame_block_size, rPool.m_linear_block);
+        rPool.m_linear = std::make_unique<LinearAllocator>(m_frame_block_size, m_frame_count);
+      }
+
+      uint64_t offset_;
+
+      if (!rPool.m_linear->allocate(m_current_frame, crRequirements.size, crRequirements.alignment, offset_))
+        return false;
+
+      rAllocation.m_memory = rPool.m_linear_block.m_memory;
+      rAllocation.m_offset = offset_;
+      rAllocation.m_size = crRequirements.size;
+      rAllocation.m_block = kLinearBlock;
+      rAllocation.m_lifetime = AllocationLifetime::kFrame;
+      rAllocation.m_mapped = rPool.m_linear_block.m_mapped ? rPool.m_linear_block.m_mapped + offset_ : nullptr;
+
+      return true;
+    }
+
+    void allocate_buddy(MemoryPool & rPool, const VkMemoryRequirements & crRequirements, VulkanAllocation & rAllocation)
+    {
+      uint64_t offset_;
+      uint64_t allocated_size_;
+      uint32_t free_slot_ = UINT32_MAX;
+
+      for (uint32_t i = 0; i < rPool.m_blocks.size(); ++i)
+      {
+        MemoryBlock & block_ = rPool.m_blocks[i];
+
+        if (block_.m_memory == VK_NULL_HANDLE)
+        {
+          free_slot_ = std::min(free_slot_, i);
+          continue;
+        }
+
+        if (block_.m_buddy && block_.m_buddy->allocate(crRequirements.size, crRequirements.alignment, offset_, allocated_size_))
+        {
+          fill_allocation(block_, i, offset_, allocated_size_, rAllocation);
+          return;
+        }
+      }
+
+      // No block has room, grab a new one
+      if (free_slot_ == UINT32_MAX)
+      {
+        free_slot_ = static_cast<uint32_t>(rPool.m_blocks.size());
+        rPool.m_blocks.emplace_back();
+      }
+
+      MemoryBlock & block_ = rPool.m_blocks[free_slot_];
+      create_block(rPool.m_memory_type, m_block_size, block_);
+      block_.m_buddy = std::make_unique<BuddyAllocator>(m_block_size, kMinBlockSize);
+
+      if (!block_.m_buddy->allocate(crRequirements.size, crRequirements.alignment, offset_, allocated_size_))
+        throw std::runtime_error("Failed to sub-allocate from a fresh memory block!");
+
+      fill_allocation(block_, free_slot_, offset_, allocated_size_, rAllocation);
+    }
+
+    void allocate_dedicated(MemoryPool & rPool, const VkMemoryRequirements & crRequirements, VulkanAllocation & rAllocation)
+    {
+      uint32_t slot_ = 0;
+
+      while (slot_ < rPool.m_blocks.size() && rPool.m_blocks[slot_].m_memory != VK_NULL_HANDLE)
+        ++slot_;
+
+      if (slot_ == rPool.m_blocks.size())
+        rPool.m_blocks.emplace_back();
+
+      MemoryBlock & block_ = rPool.m_blocks[slot_];
+      create_block(rPool.m_memory_type, crRequirements.size, block_);
+
+      fill_allocation(block_, slot_, 0, crRequirements.size, rAllocation);
+    }
+
+    void fill_allocation(MemoryBlock & rBlock, uint32_t blockIndex, uint64_t offset, uint64_t size, VulkanAllocation & rAllocation)
+    {
+      rBlock.m_allocation_count++;
+
+      rAllocation.m_memory = rBlock.m_memory;
+      rAllocation.m_offset = offset;
+      rAllocation.m_size = size;
+      rAllocation.m_block = blockIndex;
+      rAllocation.m_lifetime = AllocationLifetime::kPersistent;
+      rAllocation.m_mapped = rBlock.m_mapped ? rBlock.m_mapped + offset : nullptr;
+    }
+
+    VkDevice m_device;
+    VkPhysicalDeviceMemoryProperties m_memory_properties;
+    unsigned int m_frame_count;
+    unsigned int m_current_frame;
+    VkDeviceSize m_block_size;
+    VkDeviceSize m_frame_block_size;
+    VkDeviceSize m_bytes_requested;
+    uint32_t m_device_allocation_calls;
+    std::vector<MemoryPool> m_pools;
+};
+
+#endif
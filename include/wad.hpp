@@ -2,6 +2,7 @@
 #define WAD_HPP_
 
 #include <cassert>
+#include <cstring>
 #include <fstream>
 #include <functional>
 #include <iostream>
@@ -9,9 +10,15 @@
 #include <memory>
 #include <ostream>
 #include <regex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "hash.hpp"
+#include "logger.hpp"
 #include "ppm_writer.hpp"
+#include "profiler.hpp"
 #include "readers.hpp"
 
 #define WAD_HEADER_TYPE_LENGTH 4
@@ -22,6 +29,7 @@
 #define WAD_ENTRY_NAME_LENGTH 8
 #define WAD_LEVEL_SECTOR_TEXTURE_NAME_LENGTH 8
 #define WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH 8
+#define WAD_FLAT_SIZE 64
 
 // http://www.gamers.org/dhs/helpdocs/dmsp1666.html
 
@@ -48,7 +56,7 @@ struct WADPaletteColor
 
 struct WADSpritePost
 {
-  uint8_t col;
+  unsigned short col;
   uint8_t row;
   uint8_t size;
   std::vector<uint8_t> pixels;
@@ -61,12 +69,40 @@ struct WADSprite
   unsigned int left_offset;
   unsigned int top_offset;
   std::vector<WADSpritePost> posts;
+
+  // Hash of the lump the picture was decoded from, identical lumps give identical pictures
+  uint64_t hash = 0;
+};
+
+struct WADTexture
+{
+  std::string name;
+  unsigned int width;
+  unsigned int height;
+
+  // Composited texture stored column-major (pixels[x * height + y]) as indices into the palette since
+  // the renderer draws walls column by column
+  std::vector<uint8_t> pixels;
+
+  // Hash of the size and pixels, textures composited from different patches may still be identical
+  uint64_t hash = 0;
+};
+
+struct WADSound
+{
+  unsigned int sample_rate;
+
+  // Unsigned 8-bit mono PCM, 128 is silence
+  std::vector<uint8_t> samples;
+
+  // Hash of the lump the sound was read from
+  uint64_t hash = 0;
 };
 
 struct WADLevelThing
 {
-  unsigned short x;
-  unsigned short y;
+  short x;
+  short y;
   unsigned short angle;
   unsigned short type;
   unsigned short options;
@@ -85,8 +121,8 @@ struct WADLevelLinedef
 
 struct WADLevelSidedef
 {
-  unsigned short x_offset;
-  unsigned short y_offset;
+  short x_offset;
+  short y_offset;
   std::string upper_texture;
   std::string lower_texture;
   std::string middle_texture;
@@ -95,8 +131,8 @@ struct WADLevelSidedef
 
 struct WADLevelVertex
 {
-  unsigned short x;
-  unsigned short y;
+  short x;
+  short y;
 };
 
 struct WADLevelSeg
@@ -106,7 +142,7 @@ struct WADLevelSeg
   unsigned short angle;
   unsigned short linedef;
   unsigned short direction;
-  unsigned short offset;
+  short offset;
 };
 
 struct WADLevelSubSector
@@ -117,26 +153,26 @@ struct WADLevelSubSector
 
 struct WADLevelNode
 {
-  unsigned short x_start;
-  unsigned short y_start;
-  unsigned short dx;
-  unsigned short dy;
-  unsigned short right_y_upper;
-  unsigned short right_y_lower;
-  unsigned short right_x_lower;
-  unsigned short right_x_upper;
-  unsigned short left_y_upper;
-  unsigned short left_y_lower;
-  unsigned short left_x_lower;
-  unsigned short left_x_upper;
+  short x_start;
+  short y_start;
+  short dx;
+  short dy;
+  short right_y_upper;
+  short right_y_lower;
+  short right_x_lower;
+  short right_x_upper;
+  short left_y_upper;
+  short left_y_lower;
+  short left_x_lower;
+  short left_x_upper;
   unsigned short right_child;
   unsigned short left_child;
 };
 
 struct WADLevelSector
 {
-  unsigned short floor_height;
-  unsigned short ceiling_height;
+  short floor_height;
+  short ceiling_height;
   std::string floor_texture;
   std::string ceiling_texture;
   unsigned short light_level;
@@ -160,13 +196,41 @@ struct WADLevelSector
   }
 };
 
+// The blocklists flattened, the lines of block b are lines[offsets[b]] up to lines[offsets[b + 1]]
 struct WADLevelBlockmap
 {
-  unsigned short x;
-  unsigned short y;
+  short x;
+  short y;
   unsigned short num_cols;
   unsigned short num_rows;
-  std::vector<std::vector<unsigned short>> blocklists;
+  std::vector<uint32_t> offsets;
+  std::vector<unsigned short> lines;
+
+  size_t blocks() const
+  {
+    return offsets.empty() ? 0 : offsets.size() - 1;
+  }
+};
+
+// The REJECT table packed like the lump, bit from * sectors + to (least significant first) is set when
+// nothing in sector from can see sector to. The bits are read from the lump or mapped straight from a level
+// cache file, in which case the pointer also keeps the mapping alive. Bits past a short lump read as zero.
+struct WADLevelReject
+{
+  std::shared_ptr<const uint8_t> bits;
+  size_t size = 0;
+  unsigned int sectors = 0;
+
+  bool empty() const
+  {
+    return size == 0;
+  }
+
+  bool rejected(unsigned int from, unsigned int to) const
+  {
+    size_t bit_ = (size_t)from * sectors + to;
+    return (bit_ >> 3) < size && ((bits.get()[bit_ >> 3] >> (bit_ & 7)) & 1);
+  }
 };
 
 struct WADLevel
@@ -181,45 +245,205 @@ struct WADLevel
   std::vector<WADLevelNode> nodes;
   std::vector<WADLevelSector> sectors;
   WADLevelBlockmap blockmap;
-  std::vector<std::vector<bool>> reject;
+  WADLevelReject reject;
 };
 
 class WAD
 {
 	public:
 
-		WAD(const std::string & filename)
+		WAD(const std::string & filename, bool write_images = true)
+			: WAD(std::vector<std::string>{ filename }, write_images)
 		{
-			m_offset = 0;
 
-			// Load the whole WAD file into memory, it only takes a few MiBs
-			load_wad(filename);
+		}
+
+		// Mounts an IWAD followed by any number of PWADs. All of them end up in one merged directory where
+		// a lump of a later file overrides the lumps with the same name of the earlier ones, like DOOM's -file.
+		// Unless write_images is false, the palettes, color maps and a few sprites are also dumped as PPM
+		// files to the working directory for debugging.
+		WAD(const std::vector<std::string> & crFilenames, bool write_images = true)
+		{
+			m_offset = 0;
 
-			read_header();
+			// Load all the WAD files into memory, back to back in a single buffer so every lump is stored once
+			// and the readers below work on any of them with plain offsets
+			LogTimer timer_;
+			load_wads(crFilenames);
+			LOG_INFO("Read WADs", { { "files", crFilenames.size() }, { "lumps", m_directory.size() }, { "ms", timer_.ms() } });
 
-			// Pre-allocate directory since we know its size from the header and then read it
-			m_directory.reserve(m_wad_header.lump_count);
-			read_directory();
+			hash_lumps();
+			read_namespaces();
 
       // Pre-allocate the 14 palettes that original DOOM uses and read them
       m_palettes.reserve(14);
+      timer_.restart();
 			read_palettes();
-      std::cout << "Read " << m_palettes.size() << " palettes...\n";
-			write_palettes();
+      LOG_INFO("Read palettes", { { "count", m_palettes.size() }, { "ms", timer_.ms() } });
+			if (write_images)
+				write_palettes();
 
       // Pre-allocate the 34 colormaps that original DOOM uses and read them
       m_colormaps.reserve(34);
+      timer_.restart();
       read_colormaps();
-      std::cout << "Read " << m_colormaps.size() << " color maps...\n";
-      write_colormaps();
+      LOG_INFO("Read color maps", { { "count", m_colormaps.size() }, { "ms", timer_.ms() } });
+      if (write_images)
+        write_colormaps();
 
+      timer_.restart();
       read_sprites();
-      std::cout << "Read " << m_sprites.size() << " sprites...\n";
-      write_sprites();
+      LOG_INFO("Read sprites", { { "count", m_sprites.size() }, { "ms", timer_.ms() } });
+      if (write_images)
+        write_sprites();
+
+      timer_.restart();
+      read_textures();
+      LOG_INFO("Read textures", { { "count", m_textures.size() }, { "patches", m_patch_names.size() }, { "ms", timer_.ms() } });
+
+      timer_.restart();
+      read_flats();
+      LOG_INFO("Read flats", { { "count", m_flats.size() }, { "ms", timer_.ms() } });
+
+      timer_.restart();
+      read_sounds();
+      LOG_INFO("Read sounds", { { "count", m_sounds.size() }, { "ms", timer_.ms() } });
+
+      timer_.restart();
+      read_music();
+      LOG_INFO("Found music", { { "count", m_music.size() }, { "ms", timer_.ms() } });
 
-      read_levels();
+      index_levels();
 		}
 
+    const std::vector<std::vector<WADPaletteColor>> & palettes() const
+    {
+      return m_palettes;
+    }
+
+    const std::vector<std::vector<uint8_t>> & colormaps() const
+    {
+      return m_colormaps;
+    }
+
+    const std::map<std::string, WADTexture> & textures() const
+    {
+      return m_textures;
+    }
+
+    const std::map<std::string, std::vector<uint8_t>> & flats() const
+    {
+      return m_flats;
+    }
+
+    const std::map<std::string, WADSound> & sounds() const
+    {
+      return m_sounds;
+    }
+
+    // Music lumps in MUS format by name, their data is converted or played straight from the WAD
+    const std::map<std::string, WADEntry> & music() const
+    {
+      return m_music;
+    }
+
+    // Sprites with identical lumps point to the same picture
+    const std::map<std::string, std::shared_ptr<const WADSprite>> & sprites() const
+    {
+      return m_sprites;
+    }
+
+    // Labels of the levels in the order they appear, the levels are only read when first asked for
+    const std::vector<std::string> & level_names() const
+    {
+      return m_level_names;
+    }
+
+    const WADLevel & level(const std::string & crName)
+    {
+      auto level_ = m_levels.find(crName);
+
+      if (level_ != m_levels.end())
+        return level_->second;
+
+      return m_levels[crName] = read_level(crName);
+    }
+
+    // Directory entries of a level, its label followed by its lumps
+    std::vector<WADEntry> level_lumps(const std::string & crName) const
+    {
+      unsigned int index_ = level_label(crName);
+      std::vector<WADEntry> lumps_ { m_directory[index_] };
+
+      while (index_ + 1 < m_directory.size() && level_lump_readers().count(m_directory[index_ + 1].name) != 0)
+        lumps_.push_back(m_directory[++index_]);
+
+      return lumps_;
+    }
+
+    // The merged directory, every lump of every mounted file in mount order
+    const std::vector<WADEntry> & directory() const
+    {
+      return m_directory;
+    }
+
+    const uint8_t * lump_data(const WADEntry & crEntry) const
+    {
+      return m_wad_data.get() + crEntry.offset;
+    }
+
+    // Last lump with the given name in mount order, null if there is none
+    const WADEntry * find_lump(const std::string & crName) const
+    {
+      auto lump_ = m_lump_map.find(crName);
+      return (lump_ != m_lump_map.end()) ? &m_directory[lump_->second] : nullptr;
+    }
+
+    unsigned int lump_count() const
+    {
+      return m_directory.size();
+    }
+
+    // Hash of the contents of the lump at the given index of the merged directory, byte-identical lumps
+    // have the same hash no matter their name or the file they come from
+    uint64_t lump_hash(unsigned int index) const
+    {
+      return m_lump_hashes[index];
+    }
+
+    uint64_t flat_hash(const std::string & crName) const
+    {
+      auto hash_ = m_flat_hashes.find(crName);
+      return (hash_ != m_flat_hashes.end()) ? hash_->second : 0;
+    }
+
+    // Hash of the names and contents of the lumps of a level, it changes whenever any of them does
+    uint64_t level_hash(const std::string & crName) const
+    {
+      unsigned int index_ = level_label(crName);
+      uint64_t hash_ = 0;
+
+      for (const WADEntry & crEntry : level_lumps(crName))
+      {
+        hash_ = hash_combine(hash_, hash64((const uint8_t *)crEntry.name.data(), crEntry.name.size()));
+        hash_ = hash_combine(hash_, m_lump_hashes[index_++]);
+      }
+
+      return hash_;
+    }
+
+    // Parsing stages on their own, e.g., to time them: a level lump is read into rLevel like level() reads
+    // every lump of a level, and a picture is decoded from a sprite or patch lump
+    void read_level_lump(WADLevel & rLevel, const WADEntry & crEntry)
+    {
+      (this->*(level_lump_readers().at(crEntry.name)))(rLevel, crEntry);
+    }
+
+    WADSprite decode_picture(const WADEntry & crEntry)
+    {
+      return read_picture(crEntry);
+    }
+
 		friend std::ostream& operator<<(std::ostream& rOs, const WAD& rWad)
 		{
 			rOs << "WAD file\n";
@@ -235,29 +459,57 @@ class WAD
 
 	private:
 
-		void load_wad(const std::string & filename)
+		void load_wads(const std::vector<std::string> & crFilenames)
 		{
-			std::cout << "Reading WAD " << filename << "\n";
-			std::ifstream wad_file_(filename, std::ios::binary | std::ios::ate);
+			PROFILE_ZONE("WAD::load_wads");
 
-			if (!wad_file_)
-				throw std::runtime_error("Could not open file " + filename);
+			if (crFilenames.empty())
+				throw std::runtime_error("No WAD files to load");
 
-			std::streamsize wad_size_ = wad_file_.tellg();
-			std::cout << "WAD file size is " << wad_size_ << "\n";
+			std::vector<std::ifstream> wad_files_;
+			std::vector<unsigned int> wad_sizes_;
+			size_t total_size_ = 0;
 
-			m_wad_data = std::make_unique<uint8_t[]>((unsigned int)wad_size_);
+			for (const std::string & crFilename : crFilenames)
+			{
+				wad_files_.emplace_back(crFilename, std::ios::binary | std::ios::ate);
+
+				if (!wad_files_.back())
+					throw std::runtime_error("Could not open file " + crFilename);
+
+				std::streamsize wad_size_ = wad_files_.back().tellg();
+				LOG_INFO("Read WAD", { { "file", crFilename }, { "bytes", (int64_t)wad_size_ } });
+
+				wad_sizes_.push_back((unsigned int)wad_size_);
+				total_size_ += wad_size_;
+			}
+
+			if (total_size_ > 0xFFFFFFFFu)
+				throw std::runtime_error("WAD files are too large to be mounted together");
+
+			m_wad_data = std::make_unique<uint8_t[]>(total_size_);
+
+			unsigned int base_ = 0;
+
+			for (unsigned int i = 0; i < wad_files_.size(); ++i)
+			{
+				wad_files_[i].seekg(0, std::ios::beg);
+				wad_files_[i].read((char*)m_wad_data.get() + base_, wad_sizes_[i]);
+				wad_files_[i].close();
 
-			wad_file_.seekg(0, std::ios::beg);
-			wad_file_.read((char*)m_wad_data.get(), wad_size_);
-			wad_file_.close();
+				WADHeader header_ = read_header(base_);
 
-			std::cout << "WAD read successfully!\n";
+				if (i == 0)
+					m_wad_header = header_;
+
+				read_directory(header_, base_);
+				base_ += wad_sizes_[i];
+			}
 
 			m_offset = 0;
 		}
 
-		void read_header()
+		WADHeader read_header(unsigned int base)
 		{
 			assert(m_wad_data);
 
@@ -266,36 +518,104 @@ class WAD
 			//	(2)	an unsigned int (4-byte) to hold the number of lumps in the WAD file
 			//	(3) an unsigned int (4-byte) that indicates the file offset to the start of the directory
 
-			copy_and_capitalize_buffer(m_wad_header.type, m_wad_data, m_offset, WAD_HEADER_TYPE_LENGTH);
-			m_wad_header.lump_count = read_uint(m_wad_data, m_offset);
-			m_wad_header.directory_offset = read_uint(m_wad_data, m_offset);
+			WADHeader header_;
+
+			m_offset = base;
+			copy_and_capitalize_buffer(header_.type, m_wad_data, m_offset, WAD_HEADER_TYPE_LENGTH);
+			header_.lump_count = read_uint(m_wad_data, m_offset);
+			header_.directory_offset = read_uint(m_wad_data, m_offset);
+
+			return header_;
 		}
 
-		void read_directory()
+		void read_directory(const WADHeader & crHeader, unsigned int base)
 		{
 			assert(m_wad_data);
-			assert(m_wad_header.lump_count != 0);
 
 			// The directory has one 16-byte entry for every lump. Each entry consists of three parts:
 			//	(1) an unsigned int (4-byte) which indicates the file offset to the start of the lump
 			//	(2) an unsigned int (4-byte) which indicates the size of the lump in bytes
 			//	(3) an ASCII string (8-byte) which holds the name of the lump (padded with zeroes)
+			//
+			// Offsets are made relative to the merged buffer and the index always points to the last lump with
+			// a name, so the lumps of a file mounted later override those of the files before it
+
+			m_directory.reserve(m_directory.size() + crHeader.lump_count);
+			m_lump_map.reserve(m_lump_map.size() + crHeader.lump_count);
 
-			m_offset = m_wad_header.directory_offset;
-			for (unsigned int i = 0; i < m_wad_header.lump_count; ++i)
+			m_offset = base + crHeader.directory_offset;
+			for (unsigned int i = 0; i < crHeader.lump_count; ++i)
 			{
 				WADEntry entry_;
-				entry_.offset = read_uint(m_wad_data, m_offset);
+				entry_.offset = base + read_uint(m_wad_data, m_offset);
 				entry_.size = read_uint(m_wad_data, m_offset);
 				copy_and_capitalize_buffer(entry_.name, m_wad_data, m_offset, 8);
 
+				m_lump_map[entry_.name] = m_directory.size();
 				m_directory.push_back(entry_);
-				m_lump_map.insert(std::pair<std::string, unsigned int>(entry_.name, i));
+			}
+		}
+
+		void hash_lumps()
+		{
+			PROFILE_ZONE("WAD::hash_lumps");
+
+			m_lump_hashes.resize(m_directory.size());
+
+			auto hash_range_ = [this](unsigned int first, unsigned int step) {
+				for (unsigned int i = first; i < m_directory.size(); i += step)
+					m_lump_hashes[i] = hash64(m_wad_data.get() + m_directory[i].offset, m_directory[i].size);
+			};
+
+			// Hashing runs at memory speed, a few threads only pay off for the large IWADs and PWAD collections
+			size_t total_size_ = 0;
+			for (const WADEntry & crEntry : m_directory)
+				total_size_ += crEntry.size;
+
+			unsigned int threads_ = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), total_size_ / (4 << 20) + 1);
+			std::vector<std::thread> workers_;
+
+			for (unsigned int t = 1; t < threads_; ++t)
+				workers_.emplace_back(hash_range_, t, threads_);
+
+			hash_range_(0, threads_);
+
+			for (std::thread & rWorker : workers_)
+				rWorker.join();
+		}
+
+		void read_namespaces()
+		{
+			PROFILE_ZONE("WAD::read_namespaces");
+
+			assert(m_directory.size() != 0);
+
+			// Sprites and flats are only found between their markers, S_START/S_END and F_START/F_END, which
+			// PWADs usually write as SS_START/SS_END and FF_START/FF_END. Every file can have its own section
+			// so all of them are merged into one list of lumps per namespace, in mount order so later files
+			// override sprites and flats with the same name.
+
+			std::vector<unsigned int> * pNamespace = nullptr;
+
+			for (unsigned int i = 0; i < m_directory.size(); ++i)
+			{
+				const std::string & crName = m_directory[i].name;
+
+				if (crName == "S_START" || crName == "SS_START")
+					pNamespace = &m_sprite_lumps;
+				else if (crName == "F_START" || crName == "FF_START")
+					pNamespace = &m_flat_lumps;
+				else if (crName == "S_END" || crName == "SS_END" || crName == "F_END" || crName == "FF_END")
+					pNamespace = nullptr;
+				else if (pNamespace != nullptr && m_directory[i].size != 0)
+					pNamespace->push_back(i);
 			}
 		}
 
 		void read_palettes()
 		{
+			PROFILE_ZONE("WAD::read_palettes");
+
 			assert(m_wad_data);
 			assert(m_lump_map.find("PLAYPAL") != m_lump_map.end());
 
@@ -324,6 +644,8 @@ class WAD
 
 		void write_palettes()
 		{
+			PROFILE_ZONE("WAD::write_palettes");
+
 			assert(m_palettes.size() != 0);
 
 			PPMWriter writer_;
@@ -334,6 +656,8 @@ class WAD
 
     void read_colormaps()
     {
+      PROFILE_ZONE("WAD::read_colormaps");
+
       assert(m_wad_data);
       assert(m_lump_map.find("COLORMAP") != m_lump_map.end());
 
@@ -357,6 +681,8 @@ class WAD
 
     void write_colormaps()
     {
+      PROFILE_ZONE("WAD::write_colormaps");
+
       assert(m_colormaps.size() != 0);
 
       PPMWriter writer_;
@@ -379,83 +705,99 @@ class WAD
       writer_.write<WADPaletteColor>(colormap_img_, m_colormaps.size()  * m_palettes.size(), 256, "colormaps.ppm");
     }
 
-    void read_sprites()
+    WADSprite read_picture(const WADEntry & crEntry)
     {
-      assert(m_wad_data);
-
-      std::vector<std::string> sprite_names_ { "SUITA0", "TROOA1", "BKEYA0" };
+      m_offset = crEntry.offset;
+
+      WADSprite sprite_;
+
+      // Each picture starts with an 8-byte header of four shorts. Those four fields are the following:
+      //  (1) The width of the picture (number of columns of pixels)
+      //  (2) The height of the picture (number of rows of pixels)
+      //  (3) The left offset (number of pixels to the left of the center where the first column is drawn)
+      //  (4) The top offset (number of pixels to the top of the center where the top row is drawn).
+
+      sprite_.width = read_ushort(m_wad_data, m_offset);
+      sprite_.height = read_ushort(m_wad_data, m_offset);
+      sprite_.left_offset = read_ushort(m_wad_data, m_offset);
+      sprite_.top_offset = read_ushort(m_wad_data, m_offset);
+
+      // After the header, there are as many 4-byte integers as columns in the picture. Each one of them
+      // is a pointer to the data start for each column (an offset from the first byte of the LUMP)
+
+      std::vector<unsigned int> column_offsets_(sprite_.width);
+      for (unsigned int i = 0; i < sprite_.width; ++i)
+        column_offsets_[i] = read_uint(m_wad_data, m_offset);
+
+      // Each column data is an array of bytes arranged in another structure named POSTS. Each POST has
+      // the following structure:
+      //  (1) The first byte is the row to start drawing
+      //  (2) The second byte is the size of the post (the amount of pixels to draw downwards)
+      //  (3) As many bytes as pixels in the post + 2 additional bytes. Each byte defines the color index
+      //      in the current game palette that the pixel uses. The first and last bytes of this arrangement
+      //      are TO BE IGNORED, THEY ARE NOT DRAWN
+      //
+      // After the last byte of the POST, there might be another POST with the same structure as before
+      // or the column might end. A 255 (0xFF) value after a post indicates that the column ends and the
+      // following pixels are transparent. Note that a column may immediately begin with 0xFF and no post
+      // at all. In such case, the whole column is transparent.
 
-      for (std::string s : sprite_names_)
+      for (unsigned int i = 0; i < sprite_.width; ++i)
       {
-        assert(m_lump_map.find(s) != m_lump_map.end());
-        WADEntry sprite_lump_ = m_directory[m_lump_map[s]];
-        m_offset = sprite_lump_.offset;
-
-        WADSprite sprite_;
-
-        // Each picture starts with an 8-byte header of four shorts. Those four fields are the following:
-        //  (1) The width of the picture (number of columns of pixels)
-        //  (2) The height of the picture (number of rows of pixels)
-        //  (3) The left offset (number of pixels to the left of the center where the first column is drawn)
-        //  (4) The top offset (number of pixels to the top of the center where the top row is drawn).
-
-        sprite_.width = read_ushort(m_wad_data, m_offset);
-        sprite_.height = read_ushort(m_wad_data, m_offset);
-        sprite_.left_offset = read_ushort(m_wad_data, m_offset);
-        sprite_.top_offset = read_ushort(m_wad_data, m_offset);
-
-        std::cout << "Read sprite " << s << " (" << sprite_.width << ", " << sprite_.height << ", " << sprite_.left_offset << ", " << sprite_.top_offset << ")\n";
-
-        // After the header, there are as many 4-byte integers as columns in the picture. Each one of them
-        // is a pointer to the data start for each column (an offset from the first byte of the LUMP)
-
-        std::vector<unsigned int> column_offsets_(sprite_.width);
-        for (int i = 0; i < sprite_.width; ++i)
-          column_offsets_[i] = read_uint(m_wad_data, m_offset);
-
-        // Each column data is an array of bytes arranged in another structure named POSTS. Each POST has
-        // the following structure:
-        //  (1) The first byte is the row to start drawing
-        //  (2) The second byte is the size of the post (the amount of pixels to draw downwards)
-        //  (3) As many bytes as pixels in the post + 2 additional bytes. Each byte defines the color index
-        //      in the current game palette that the pixel uses. The first and last bytes of this arrangement
-        //      are TO BE IGNORED, THEY ARE NOT DRAWN
-        //
-        // After the last byte of the POST, there might be another POST with the same structure as before
-        // or the column might end. A 255 (0xFF) value after a post indicates that the column ends and the
-        // following pixels are transparent. Note that a column may immediately begin with 0xFF and no post
-        // at all. In such case, the whole column is transparent.
-
-        for (int i = 0; i < sprite_.width; ++i)
+        m_offset = crEntry.offset + column_offsets_[i];
+
+        while (m_wad_data[m_offset] != 0xFF)
         {
-          m_offset = sprite_lump_.offset + column_offsets_[i];
+          WADSpritePost post_;
+          post_.col = i;
+          post_.row = m_wad_data[m_offset++];
+          post_.size = m_wad_data[m_offset++];
 
-          while (m_wad_data[m_offset] != 0xFF)
-          {
-            WADSpritePost post_;
-            post_.col = i;
-            post_.row = m_wad_data[m_offset++];
-            post_.size = m_wad_data[m_offset++];
+          // Skip the first unused pixel
+          m_offset++;
 
-            // Skip the first unused pixel
-            m_offset++;
+          for (uint8_t k = 0; k < post_.size; ++k)
+            post_.pixels.push_back(m_wad_data[m_offset++]);
 
-            for (uint8_t k = 0; k < post_.size; ++k)
-              post_.pixels.push_back(m_wad_data[m_offset++]);
+          // Skip the last unused pixel
+          m_offset++;
 
-            // Skip the last unused pixel
-            m_offset++;
+          sprite_.posts.push_back(post_);
+        }
+      }
 
-            sprite_.posts.push_back(post_);
-          }
+      return sprite_;
+    }
+
+    void read_sprites()
+    {
+      PROFILE_ZONE("WAD::read_sprites");
+
+      assert(m_wad_data);
+
+      // Sprites are all the pictures in the sprite namespace. Identical lumps (e.g., the same frame under
+      // several names or copied between PWADs) are only decoded once and share the picture.
+      std::unordered_map<uint64_t, std::shared_ptr<const WADSprite>> decoded_;
+
+      for (unsigned int i : m_sprite_lumps)
+      {
+        std::shared_ptr<const WADSprite> & rSprite = decoded_[m_lump_hashes[i]];
+
+        if (!rSprite)
+        {
+          auto sprite_ = std::make_shared<WADSprite>(read_picture(m_directory[i]));
+          sprite_->hash = m_lump_hashes[i];
+          rSprite = sprite_;
         }
 
-        m_sprites.insert(std::pair<std::string, WADSprite>(s, sprite_));
+        m_sprites[m_directory[i].name] = rSprite;
       }
     }
 
     void write_sprites()
     {
+      PROFILE_ZONE("WAD::write_sprites");
+
       assert(m_palettes.size() != 0);
       // TODO: Colormaps are not used in this routine
       assert(m_colormaps.size() != 0);
@@ -463,10 +805,17 @@ class WAD
 
       PPMWriter writer_;
 
-      for (auto s : m_sprites)
+      // Only dump a few sprites for debugging, writing all of them takes ages
+      std::vector<std::string> sprite_names_ { "SUITA0", "TROOA1", "BKEYA0" };
+
+      for (std::string name_ : sprite_names_)
       {
-        std::string name_ = s.first;
-        WADSprite sprite_ = s.second;
+        if (m_sprites.find(name_) == m_sprites.end())
+          continue;
+
+        const WADSprite & sprite_ = *m_sprites[name_];
+        LOG_DEBUG("Writing sprite", { { "sprite", name_ }, { "width", sprite_.width }, { "height", sprite_.height },
+                                      { "left_offset", sprite_.left_offset }, { "top_offset", sprite_.top_offset } });
 
         std::vector<WADPaletteColor> texture_(sprite_.width * m_palettes.size() * sprite_.height);
 
@@ -489,9 +838,238 @@ class WAD
       }
     }
 
+    void read_patch_names()
+    {
+      assert(m_wad_data);
+      assert(m_lump_map.find("PNAMES") != m_lump_map.end());
+
+      // The PNAMES lump lists every wall patch that textures can reference. It starts with an int (4 bytes)
+      // with the number of patches followed by that many 8-byte ASCII names (padded with zeroes). Textures
+      // refer to patches by their index in this list.
+
+      WADEntry pnames_ = m_directory[m_lump_map["PNAMES"]];
+      m_offset = pnames_.offset;
+
+      unsigned int num_patches_ = read_uint(m_wad_data, m_offset);
+      m_patch_names.reserve(num_patches_);
+
+      for (unsigned int i = 0; i < num_patches_; ++i)
+      {
+        std::string name_;
+        copy_and_capitalize_buffer(name_, m_wad_data, m_offset, 8);
+        m_patch_names.push_back(name_);
+      }
+    }
+
+    void read_texture_lump(const WADEntry & crEntry, std::unordered_map<uint64_t, WADSprite> & rDecodedPatches)
+    {
+      // Each TEXTUREx lump starts with an int (4 bytes) with the number of textures in the lump and then
+      // as many ints with the offset to each texture definition (from the start of the lump). A texture
+      // definition has the following fields:
+      //  (1) an ASCII string (8 bytes) with the name of the texture
+      //  (2) an int (4 bytes) masked flag, unused
+      //  (3) a short (2 bytes) with the width of the texture
+      //  (4) a short (2 bytes) with the height of the texture
+      //  (5) an int (4 bytes) column directory, obsolete and unused
+      //  (6) a short (2 bytes) with the number of patches that compose the texture
+      //  (7) as many 10-byte patch descriptors as patches, each with five shorts: the X and Y origin of
+      //      the patch inside the texture, the patch index in PNAMES and two unused fields (stepdir and
+      //      colormap)
+
+      m_offset = crEntry.offset;
+      unsigned int num_textures_ = read_uint(m_wad_data, m_offset);
+
+      std::vector<unsigned int> texture_offsets_(num_textures_);
+      for (unsigned int i = 0; i < num_textures_; ++i)
+        texture_offsets_[i] = read_uint(m_wad_data, m_offset);
+
+      for (unsigned int i = 0; i < num_textures_; ++i)
+      {
+        m_offset = crEntry.offset + texture_offsets_[i];
+
+        WADTexture texture_;
+        copy_and_capitalize_buffer(texture_.name, m_wad_data, m_offset, 8);
+        m_offset += 4;
+        texture_.width = read_ushort(m_wad_data, m_offset);
+        texture_.height = read_ushort(m_wad_data, m_offset);
+        m_offset += 4;
+        unsigned short num_patches_ = read_ushort(m_wad_data, m_offset);
+
+        struct PatchDescriptor { short x; short y; unsigned short patch; };
+        std::vector<PatchDescriptor> patches_(num_patches_);
+
+        for (unsigned short k = 0; k < num_patches_; ++k)
+        {
+          patches_[k].x = read_short(m_wad_data, m_offset);
+          patches_[k].y = read_short(m_wad_data, m_offset);
+          patches_[k].patch = read_ushort(m_wad_data, m_offset);
+          m_offset += 4;
+        }
+
+        // Composite the patches into a single column-major image, the patch posts are clipped against
+        // the texture bounds since patches may hang over the edges
+        texture_.pixels.assign(texture_.width * texture_.height, 0);
+
+        for (const PatchDescriptor & crPatch : patches_)
+        {
+          if (crPatch.patch >= m_patch_names.size() || m_lump_map.find(m_patch_names[crPatch.patch]) == m_lump_map.end())
+          {
+            LOG_ERROR("Texture references a missing patch", { { "texture", texture_.name } });
+            continue;
+          }
+
+          // Patches are shared by many textures (and copied between PWADs), each one is decoded once
+          unsigned int patch_lump_ = m_lump_map[m_patch_names[crPatch.patch]];
+          auto decoded_ = rDecodedPatches.find(m_lump_hashes[patch_lump_]);
+
+          if (decoded_ == rDecodedPatches.end())
+            decoded_ = rDecodedPatches.emplace(m_lump_hashes[patch_lump_], read_picture(m_directory[patch_lump_])).first;
+
+          const WADSprite & patch_ = decoded_->second;
+
+          for (const WADSpritePost & crPost : patch_.posts)
+          {
+            int x_ = crPatch.x + crPost.col;
+
+            if (x_ < 0 || x_ >= (int)texture_.width)
+              continue;
+
+            for (unsigned int p = 0; p < crPost.size; ++p)
+            {
+              int y_ = crPatch.y + crPost.row + p;
+
+              if (y_ >= 0 && y_ < (int)texture_.height)
+                texture_.pixels[x_ * texture_.height + y_] = crPost.pixels[p];
+            }
+          }
+        }
+
+        texture_.hash = hash_combine(hash64(texture_.pixels.data(), texture_.pixels.size()), ((uint64_t)texture_.width << 32) | texture_.height);
+        m_textures[texture_.name] = texture_;
+      }
+    }
+
+    void read_textures()
+    {
+      PROFILE_ZONE("WAD::read_textures");
+
+      assert(m_wad_data);
+
+      read_patch_names();
+
+      std::unordered_map<uint64_t, WADSprite> decoded_patches_;
+
+      // Shareware and registered DOOM only ship TEXTURE1, TEXTURE2 holds the extra textures of the
+      // registered version
+      for (std::string lump_name_ : { "TEXTURE1", "TEXTURE2" })
+      {
+        if (m_lump_map.find(lump_name_) != m_lump_map.end())
+          read_texture_lump(m_directory[m_lump_map[lump_name_]], decoded_patches_);
+      }
+    }
+
+    void read_flats()
+    {
+      PROFILE_ZONE("WAD::read_flats");
+
+      assert(m_wad_data);
+
+      // Flats are the floor and ceiling textures. They live in the flat namespace and each one is a raw
+      // 64x64 block of palette indices stored row by row, there is no header at all. The section also
+      // contains nested F1_START/F1_END markers which are just zero-sized lumps.
+
+      for (unsigned int i : m_flat_lumps)
+      {
+        const WADEntry & entry_ = m_directory[i];
+
+        if (entry_.size != WAD_FLAT_SIZE * WAD_FLAT_SIZE)
+          continue;
+
+        std::vector<uint8_t> flat_(m_wad_data.get() + entry_.offset, m_wad_data.get() + entry_.offset + entry_.size);
+        m_flats[entry_.name] = flat_;
+        m_flat_hashes[entry_.name] = m_lump_hashes[i];
+      }
+    }
+
+    void read_sounds()
+    {
+      PROFILE_ZONE("WAD::read_sounds");
+
+      assert(m_wad_data);
+
+      // Sound effects are the DS lumps in DMX format. They start with an 8-byte header:
+      //  (1) an unsigned short (2 bytes) with the format, always 3
+      //  (2) an unsigned short (2 bytes) with the sample rate, usually 11025 Hz
+      //  (3) an unsigned int (4 bytes) with the number of samples
+      // followed by the samples as unsigned bytes. The first and last 16 samples are padding that DMX
+      // never plays, they are skipped like the original does.
+
+      for (const auto & crLump : m_lump_map)
+      {
+        const WADEntry & crEntry = m_directory[crLump.second];
+
+        if (crEntry.name.compare(0, 2, "DS") != 0 || crEntry.size < 8)
+          continue;
+
+        m_offset = crEntry.offset;
+        unsigned short format_ = read_ushort(m_wad_data, m_offset);
+        unsigned short sample_rate_ = read_ushort(m_wad_data, m_offset);
+        unsigned int length_ = read_uint(m_wad_data, m_offset);
+
+        if (format_ != 3 || length_ > crEntry.size - 8)
+        {
+          LOG_ERROR("Sound is not a DMX sound", { { "lump", crEntry.name } });
+          continue;
+        }
+
+        unsigned int first_ = m_offset;
+        unsigned int last_ = m_offset + length_;
+
+        if (length_ > 32)
+        {
+          first_ += 16;
+          last_ -= 16;
+        }
+
+        WADSound sound_;
+        sound_.sample_rate = sample_rate_;
+        sound_.samples.assign(m_wad_data.get() + first_, m_wad_data.get() + last_);
+        sound_.hash = m_lump_hashes[crLump.second];
+        m_sounds[crEntry.name] = sound_;
+      }
+    }
+
+    void read_music()
+    {
+      PROFILE_ZONE("WAD::read_music");
+
+      assert(m_wad_data);
+
+      // Music is found in the D_ lumps in MUS format, a compact MIDI-like score that starts with the
+      // "MUS" signature followed by 0x1A. Lumps without it (e.g., MIDI files from some PWADs) are skipped.
+
+      for (const auto & crLump : m_lump_map)
+      {
+        const WADEntry & crEntry = m_directory[crLump.second];
+
+        if (crEntry.name.compare(0, 2, "D_") != 0 || crEntry.size < 16)
+          continue;
+
+        if (memcmp(m_wad_data.get() + crEntry.offset, "MUS\x1A", 4) != 0)
+        {
+          LOG_ERROR("Music is not a MUS lump", { { "lump", crEntry.name } });
+          continue;
+        }
+
+        m_music[crEntry.name] = crEntry;
+      }
+    }
+
     void read_level_things(WADLevel & rLevel, WADEntry entry)
     {
-      std::cout << "Reading THINGS\n";
+      PROFILE_ZONE("WAD::read_level_things");
+
+      LogTimer timer_;
 
       m_offset = entry.offset;
 
@@ -501,14 +1079,14 @@ class WAD
 
         // THINGS are generic descriptors for monsters, weapons, keys, barrels, ... Each one of them takes 10 bytes to
         // specify various aspects:
-        //  (1) unsigned short (2 bytes) X coordinate position of the THING
-        //  (2) unsigned short (2 bytes) Y coordinate position of the THING
+        //  (1) signed short (2 bytes) X coordinate position of the THING
+        //  (2) signed short (2 bytes) Y coordinate position of the THING
         //  (3) unsigned short (2 bytes) angle the THING faces (values rounded to the nearest 45 degree angle)
         //  (4) unsigned short (2 bytes) type of THING
         //  (5) unsigned short (2 bytes) options for the THING
 
-        thing_.x = read_ushort(m_wad_data, m_offset);
-        thing_.y = read_ushort(m_wad_data, m_offset);
+        thing_.x = read_short(m_wad_data, m_offset);
+        thing_.y = read_short(m_wad_data, m_offset);
         thing_.angle = read_ushort(m_wad_data, m_offset);
         thing_.type = read_ushort(m_wad_data, m_offset);
         thing_.options = read_ushort(m_wad_data, m_offset);
@@ -516,12 +1094,14 @@ class WAD
         rLevel.things.push_back(thing_);
       }
 
-      std::cout << "Read " << rLevel.things.size() << " THINGS...\n";
+      LOG_INFO("Read level lump", { { "lump", "THINGS" }, { "count", rLevel.things.size() }, { "bytes", entry.size }, { "ms", timer_.ms() } });
     }
 
     void read_level_linedefs(WADLevel & rLevel, WADEntry entry)
     {
-      std::cout << "Reading LINEDEFS\n";
+      PROFILE_ZONE("WAD::read_level_linedefs");
+
+      LogTimer timer_;
 
       m_offset = entry.offset;
 
@@ -549,12 +1129,14 @@ class WAD
         rLevel.linedefs.push_back(linedef_);
       }
 
-      std::cout << "Read " << rLevel.linedefs.size() << " LINEDEFS...\n";
+      LOG_INFO("Read level lump", { { "lump", "LINEDEFS" }, { "count", rLevel.linedefs.size() }, { "bytes", entry.size }, { "ms", timer_.ms() } });
     }
 
     void read_level_sidedefs(WADLevel & rLevel, WADEntry entry)
     {
-      std::cout << "Reading SIDEDEFS\n";
+      PROFILE_ZONE("WAD::read_level_sidedefs");
+
+      LogTimer timer_;
 
       m_offset = entry.offset;
 
@@ -564,15 +1146,15 @@ class WAD
 
         // SIDEDEFS are a definition of what wall textures to draw along a LINEDEF so a group of SIDEDEFS outline the
         // space of a SECTOR. Each SIDEDEF is composed of 30 bytes distributed among six fields:
-        //  (1) an unsigned short (2 bytes) for the horizontal offset for the texture
-        //  (2) an unsigned short (2 bytes) for the vertical offset of the texture
+        //  (1) a signed short (2 bytes) for the horizontal offset for the texture
+        //  (2) a signed short (2 bytes) for the vertical offset of the texture
         //  (3) an ASCII string (8 bytes) that indicates the texture name for the upper part of the wall
         //  (4) an ASCII string (8 bytes) that indicates the texture name for the lower part of the wall
         //  (5) an ASCII string (8 bytes) that indicates the texture name for the middle part of the wall
         //  (6) an unsigned short (2 bytes) to reference the SECTOR that this SIDEDEF faces or surrounds
 
-        sidedef_.x_offset = read_ushort(m_wad_data, m_offset);
-        sidedef_.y_offset = read_ushort(m_wad_data, m_offset);
+        sidedef_.x_offset = read_short(m_wad_data, m_offset);
+        sidedef_.y_offset = read_short(m_wad_data, m_offset);
         copy_and_capitalize_buffer(sidedef_.upper_texture, m_wad_data, m_offset, WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH);
         copy_and_capitalize_buffer(sidedef_.lower_texture, m_wad_data, m_offset, WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH);
         copy_and_capitalize_buffer(sidedef_.middle_texture, m_wad_data, m_offset, WAD_LEVEL_SIDEDEF_TEXTURE_NAME_LENGTH);
@@ -581,12 +1163,14 @@ class WAD
         rLevel.sidedefs.push_back(sidedef_);
       }
 
-      std::cout << "Read " << rLevel.sidedefs.size() << " SIDEDEFS...\n";
+      LOG_INFO("Read level lump", { { "lump", "SIDEDEFS" }, { "count", rLevel.sidedefs.size() }, { "bytes", entry.size }, { "ms", timer_.ms() } });
     }
 
     void read_level_vertexes(WADLevel & rLevel, WADEntry entry)
     {
-      std::cout << "Reading VERTEXES\n";
+      PROFILE_ZONE("WAD::read_level_vertexes");
+
+      LogTimer timer_;
 
       m_offset = entry.offset;
 
@@ -595,21 +1179,23 @@ class WAD
         WADLevelVertex vertex_;
 
         // VERTEXES are the beginning and the end of SEGS and LINEDEFS. Each vertex is 4 bytes long and contains two fields:
-        //  (1) an unsigned short (2 bytes) for the X coordinate
-        //  (2) an unsigned short (2 bytes) for the Y coordinate
+        //  (1) a signed short (2 bytes) for the X coordinate
+        //  (2) a signed short (2 bytes) for the Y coordinate
 
-        vertex_.x = read_ushort(m_wad_data, m_offset);
-        vertex_.y = read_ushort(m_wad_data, m_offset);
+        vertex_.x = read_short(m_wad_data, m_offset);
+        vertex_.y = read_short(m_wad_data, m_offset);
 
         rLevel.vertices.push_back(vertex_);
       }
 
-      std::cout << "Read " << rLevel.vertices.size() << " VERTEXES...\n";
+      LOG_INFO("Read level lump", { { "lump", "VERTEXES" }, { "count", rLevel.vertices.size() }, { "bytes", entry.size }, { "ms", timer_.ms() } });
     }
 
     void read_level_segs(WADLevel & rLevel, WADEntry entry)
     {
-      std::cout << "Reading SEGS\n";
+      PROFILE_ZONE("WAD::read_level_segs");
+
+      LogTimer timer_;
 
       m_offset = entry.offset;
 
@@ -623,24 +1209,26 @@ class WAD
         //  (3) a signed short (2 bytes) to indicate the angle in BAM format
         //  (4) an unsigned short (2 bytes) that tells the LINEDEF that this SEG goes along
         //  (5) an unsigned short (2 bytes) for the direction of the SEG w.r.t. the LINEDEF (0 - same, 1 - opposite)
-        //  (6) an unsigned short (2 bytes) which expresses the distance along the LINEDEF to the start of this SEG
+        //  (6) a signed short (2 bytes) which expresses the distance along the LINEDEF to the start of this SEG
 
         seg_.start = read_ushort(m_wad_data, m_offset);
         seg_.end = read_ushort(m_wad_data, m_offset);
         seg_.angle = read_ushort(m_wad_data, m_offset);
         seg_.linedef = read_ushort(m_wad_data, m_offset);
         seg_.direction = read_ushort(m_wad_data, m_offset);
-        seg_.offset = read_ushort(m_wad_data, m_offset);
+        seg_.offset = read_short(m_wad_data, m_offset);
 
         rLevel.segs.push_back(seg_);
       }
 
-      std::cout << "Read " << rLevel.segs.size() << " SEGS...\n";
+      LOG_INFO("Read level lump", { { "lump", "SEGS" }, { "count", rLevel.segs.size() }, { "bytes", entry.size }, { "ms", timer_.ms() } });
     }
 
     void read_level_ssectors(WADLevel & rLevel, WADEntry entry)
     {
-      std::cout << "Reading SSECTORS\n";
+      PROFILE_ZONE("WAD::read_level_ssectors");
+
+      LogTimer timer_;
 
       m_offset = entry.offset;
 
@@ -659,12 +1247,14 @@ class WAD
         rLevel.ssectors.push_back(ssector_);
       }
 
-      std::cout << "Read " << rLevel.ssectors.size() << " SSECTORS...\n";
+      LOG_INFO("Read level lump", { { "lump", "SSECTORS" }, { "count", rLevel.ssectors.size() }, { "bytes", entry.size }, { "ms", timer_.ms() } });
     }
 
     void read_level_nodes(WADLevel & rLevel, WADEntry entry)
     {
-      std::cout << "Reading NODES\n";
+      PROFILE_ZONE("WAD::read_level_nodes");
+
+      LogTimer timer_;
 
       m_offset = entry.offset;
 
@@ -674,43 +1264,47 @@ class WAD
 
         // NODEs are branches in the binary space partiion that divides the level up. Each NODE has
         // 28 bytes in 14 short fields:
-        //  (1) unsigned short (2 bytes) X coordinate of the partition line's start
-        //  (2) unsigned short (2 bytes) Y coordinate of the partition line's start
-        //  (3) unsigned short (2 bytes) change in X to the end of the partition line
-        //  (4) unsigned short (2 bytes) change in Y to the end of the partition line
-        //  (5) unsigned short (2 bytes) Y upper bound of the right bounding box
-        //  (6) unsigned short (2 bytes) Y lower bound of the right bounding box
-        //  (7) unsigned short (2 bytes) X lower bound of the right bounding box
-        //  (8) unsigned short (2 bytes) X upper bound of the right bounding box
-        //  (9) unsigned short (2 bytes) Y upper bound of the left bounding box
-        //  (10) unsigned short (2 bytes) Y lower bound of the left bounding box
-        //  (11) unsigned short (2 bytes) X lower bound of the left bounding box
-        //  (12) unsigned short (2 bytes) X upper bound of the left bounding box
+        //  (1) signed short (2 bytes) X coordinate of the partition line's start
+        //  (2) signed short (2 bytes) Y coordinate of the partition line's start
+        //  (3) signed short (2 bytes) change in X to the end of the partition line
+        //  (4) signed short (2 bytes) change in Y to the end of the partition line
+        //  (5) signed short (2 bytes) Y upper bound of the right bounding box
+        //  (6) signed short (2 bytes) Y lower bound of the right bounding box
+        //  (7) signed short (2 bytes) X lower bound of the right bounding box
+        //  (8) signed short (2 bytes) X upper bound of the right bounding box
+        //  (9) signed short (2 bytes) Y upper bound of the left bounding box
+        //  (10) signed short (2 bytes) Y lower bound of the left bounding box
+        //  (11) signed short (2 bytes) X lower bound of the left bounding box
+        //  (12) signed short (2 bytes) X upper bound of the left bounding box
         //  (13) unsigned short (2 bytes) NODE or SSECTOR number for the right child
         //  (14) unsigned short (2 bytes) NODE or SSECTOR number for the left child
 
-        node_.x_start = read_ushort(m_wad_data, m_offset);
-        node_.y_start = read_ushort(m_wad_data, m_offset);
-        node_.right_y_upper = read_ushort(m_wad_data, m_offset);
-        node_.right_y_lower = read_ushort(m_wad_data, m_offset);
-        node_.right_x_lower = read_ushort(m_wad_data, m_offset);
-        node_.right_x_upper = read_ushort(m_wad_data, m_offset);
-        node_.left_y_upper = read_ushort(m_wad_data, m_offset);
-        node_.left_y_lower = read_ushort(m_wad_data, m_offset);
-        node_.left_x_lower = read_ushort(m_wad_data, m_offset);
-        node_.left_x_upper = read_ushort(m_wad_data, m_offset);
+        node_.x_start = read_short(m_wad_data, m_offset);
+        node_.y_start = read_short(m_wad_data, m_offset);
+        node_.dx = read_short(m_wad_data, m_offset);
+        node_.dy = read_short(m_wad_data, m_offset);
+        node_.right_y_upper = read_short(m_wad_data, m_offset);
+        node_.right_y_lower = read_short(m_wad_data, m_offset);
+        node_.right_x_lower = read_short(m_wad_data, m_offset);
+        node_.right_x_upper = read_short(m_wad_data, m_offset);
+        node_.left_y_upper = read_short(m_wad_data, m_offset);
+        node_.left_y_lower = read_short(m_wad_data, m_offset);
+        node_.left_x_lower = read_short(m_wad_data, m_offset);
+        node_.left_x_upper = read_short(m_wad_data, m_offset);
         node_.right_child = read_ushort(m_wad_data, m_offset);
         node_.left_child = read_ushort(m_wad_data, m_offset);
 
         rLevel.nodes.push_back(node_);
       }
 
-      std::cout << "Read " << rLevel.nodes.size() << " NODES...\n";
+      LOG_INFO("Read level lump", { { "lump", "NODES" }, { "count", rLevel.nodes.size() }, { "bytes", entry.size }, { "ms", timer_.ms() } });
     }
 
     void read_level_sectors(WADLevel & rLevel, WADEntry entry)
     {
-      std::cout << "Reading SECTORS\n";
+      PROFILE_ZONE("WAD::read_level_sectors");
+
+      LogTimer timer_;
 
       m_offset = entry.offset;
 
@@ -720,16 +1314,16 @@ class WAD
 
         // SECTORS are horizonal areas of the map where floor and ceiling heights are defined. Each
         // SECTOR's record is 26 bytes long and it is divided into seven fields:
-        //  (1) unsigned short (2 bytes) floor height
-        //  (2) unsigned short (2 bytes) ceiling height
+        //  (1) signed short (2 bytes) floor height
+        //  (2) signed short (2 bytes) ceiling height
         //  (3) ASCII string (8 bytes) name of floor texture
         //  (4) ASCII string (8 bytes) name of ceiling texture
         //  (5) unsigned short (2 bytes) light level for the sector
         //  (6) unsigned short (2 bytes) special flags
         //  (7) unsigned short (2 bytes) tag number of the sector
 
-        sector_.floor_height = read_ushort(m_wad_data, m_offset);
-        sector_.ceiling_height = read_ushort(m_wad_data, m_offset);
+        sector_.floor_height = read_short(m_wad_data, m_offset);
+        sector_.ceiling_height = read_short(m_wad_data, m_offset);
         copy_and_capitalize_buffer(sector_.floor_texture, m_wad_data, m_offset, WAD_LEVEL_SECTOR_TEXTURE_NAME_LENGTH);
         copy_and_capitalize_buffer(sector_.ceiling_texture, m_wad_data, m_offset, WAD_LEVEL_SECTOR_TEXTURE_NAME_LENGTH);
         sector_.light_level = read_ushort(m_wad_data, m_offset);
@@ -739,61 +1333,44 @@ class WAD
         rLevel.sectors.push_back(sector_);
       }
 
-      std::cout << "Read " << rLevel.sectors.size() << " SECTORS...\n";
+      LOG_INFO("Read level lump", { { "lump", "SECTORS" }, { "count", rLevel.sectors.size() }, { "bytes", entry.size }, { "ms", timer_.ms() } });
     }
 
     void read_level_reject(WADLevel & rLevel, WADEntry entry)
     {
-      assert(rLevel.sectors.size() != 0);
+      PROFILE_ZONE("WAD::read_level_reject");
 
-      // Pre-allocate a SECTORS x SECTORS matrix for the REJECT table
-      for (unsigned int i = 0; i < rLevel.sectors.size(); ++i)
-        rLevel.reject.push_back(std::vector<bool>(rLevel.sectors.size()));
-
-      std::cout << "Reading REJECT\n";
+      assert(rLevel.sectors.size() != 0);
 
-      m_offset = entry.offset;
-      unsigned int col_ = 0;
-      unsigned int row_ = 0;
+      LogTimer timer_;
 
       // The REJECT table controls whether monsters in a given sector can detect or attack
       // the player in other sector. It is a table of sectors vs. sectors where a 1 means
       // that the monster cannot be activated nor attack the player in that sector combo.
 
-      while (m_offset < entry.offset + entry.size)
-      {
-        // The REJECT LUMP contains (SECTORS ^ 2) / 8 bytes rounded up. It is an array of
-        // bits that can be transformed into a table taking special care. Reading the table
-        // left-to-right and top-to-bottom, the first bit in the table is the bit 0 of byte 0,
-        // the second bit of the table is the bit 1 of byte 0 (read from least to most significant).
-
-        std::bitset<8> byte_ = m_wad_data[m_offset++];
-
-        for (unsigned int i = 0; i < 8; ++i)
-        {
-          if (col_ == rLevel.sectors.size())
-          {
-            col_ = 0;
-            row_++;
-          }
+      // The REJECT LUMP contains (SECTORS ^ 2) / 8 bytes rounded up. Reading the table
+      // left-to-right and top-to-bottom, with a row per looking sector, the first bit in the
+      // table is the bit 0 of byte 0, the second bit of the table is the bit 1 of byte 0 (read
+      // from least to most significant). The lump is kept like that, without unpacking it.
 
-          // Check if we have already filled the table even if we still have bits left (rounding)
-          if (row_ >= rLevel.sectors.size())
-            break;
+      size_t sectors_ = rLevel.sectors.size();
+      size_t size_ = std::min<size_t>(entry.size, (sectors_ * sectors_ + 7) / 8);
 
-          //TODO: Make sure that test(i) tests the least significant one
-          rLevel.reject[col_][row_] = byte_.test(i);
+      std::shared_ptr<uint8_t> bits_(new uint8_t[size_], std::default_delete<uint8_t[]>());
+      memcpy(bits_.get(), m_wad_data.get() + entry.offset, size_);
 
-          col_++;
-        }
-      }
+      rLevel.reject.bits = bits_;
+      rLevel.reject.size = size_;
+      rLevel.reject.sectors = sectors_;
 
-      std::cout << "Read REJECT matrix " << rLevel.sectors.size() << "x" << rLevel.sectors.size() << "\n";
+      LOG_INFO("Read level lump", { { "lump", "REJECT" }, { "sectors", rLevel.sectors.size() }, { "bytes", entry.size }, { "ms", timer_.ms() } });
     }
 
     void read_level_blockmap(WADLevel & rLevel, WADEntry entry)
     {
-      std::cout << "Reading BLOCKMAP\n";
+      PROFILE_ZONE("WAD::read_level_blockmap");
+
+      LogTimer timer_;
 
       m_offset = entry.offset;
 
@@ -802,34 +1379,37 @@ class WAD
       // BLOCKMAP and it is divided into three parts: header, offsets, and lists.
 
       // The header of the BLOCKMAP contains 8 bytes divided into four fields:
-      //  (1) unsigned short (2 bytes) the X coordinate of the block grid origin
-      //  (2) unsigned short (2 bytes) the Y coordinate of the block grid origin
+      //  (1) signed short (2 bytes) the X coordinate of the block grid origin
+      //  (2) signed short (2 bytes) the Y coordinate of the block grid origin
       //  (3) unsigned short (2 bytes) the number of columns in the map
       //  (4) unsigned short (2 bytes) the number of rows in the map
 
-      rLevel.blockmap.x = read_ushort(m_wad_data, m_offset);
-      rLevel.blockmap.y = read_ushort(m_wad_data, m_offset);
+      rLevel.blockmap.x = read_short(m_wad_data, m_offset);
+      rLevel.blockmap.y = read_short(m_wad_data, m_offset);
       rLevel.blockmap.num_cols = read_ushort(m_wad_data, m_offset);
       rLevel.blockmap.num_rows = read_ushort(m_wad_data, m_offset);
 
       // After the header, there are N (number of columns in the map times the
       // number of rows) offsets to blocklists. Each offset is a short integer
-      // that indicates the starting byte of the corresponding blocklist from
-      // the beginning of the BLOCKMAP LUMP.
+      // that indicates the starting short (i.e., in 2-byte units) of the
+      // corresponding blocklist from the beginning of the BLOCKMAP LUMP.
 
       unsigned int num_blocks_ = rLevel.blockmap.num_cols * rLevel.blockmap.num_rows;
-      std::vector<unsigned short> blocklists_offsets_(num_blocks_);
+      std::vector<unsigned short> blocklists_offsets_;
+      blocklists_offsets_.reserve(num_blocks_);
       for (unsigned int i = 0; i < num_blocks_; ++i)
         blocklists_offsets_.push_back(read_ushort(m_wad_data, m_offset));
 
       // Each blocklist startrs with a short (0x0000) and ends with another
       // short (0xFFFF). In between there are short indices to LINEDEFs.
 
+      // The blocklists are flattened one after the other, shared lists are repeated
+      rLevel.blockmap.offsets.reserve(num_blocks_ + 1);
+      rLevel.blockmap.offsets.push_back(0);
+
       for (unsigned int i = 0; i < blocklists_offsets_.size(); ++i)
       {
-        std::vector<unsigned short> blocklist_;
-
-        m_offset = entry.offset + blocklists_offsets_[i];
+        m_offset = entry.offset + blocklists_offsets_[i] * 2;
 
         // Skip the 0x0000 start of the blocklist
         read_ushort(m_wad_data, m_offset);
@@ -838,35 +1418,22 @@ class WAD
         unsigned short linedef_index_ = read_ushort(m_wad_data, m_offset);
         while (linedef_index_ != 0xFFFF)
         {
-          blocklist_.push_back(linedef_index_);
+          rLevel.blockmap.lines.push_back(linedef_index_);
           linedef_index_ = read_ushort(m_wad_data, m_offset);
         }
 
-        rLevel.blockmap.blocklists.push_back(blocklist_);
+        rLevel.blockmap.offsets.push_back(rLevel.blockmap.lines.size());
       }
 
-      std::cout << "Read " << rLevel.blockmap.blocklists.size() << " lists in the BLOCKMAP...\n";
+      LOG_INFO("Read level lump", { { "lump", "BLOCKMAP" }, { "count", rLevel.blockmap.blocks() }, { "bytes", entry.size }, { "ms", timer_.ms() } });
     }
 
-    void read_levels()
-    {
-      assert(m_wad_data);
-      assert(m_lump_map.size() != 0);
-      assert(m_directory.size() != 0);
-
-      // DOOM levels have an ExMy label in the directory (where both x and y are single ASCII digits). The label just
-      // indicates that the following LUMPs are part of such level. Actually, the ENTRY for each ExMy does not point to
-      // any LUMP and its size is zero.
-      
-      std::regex level_label_regex_("E[[:digit:]]M[[:digit:]]");
-
-      // Map each possible LUMP name which belongs to a level to the corresponding function to read it
+    typedef void (WAD::*LevelLumpReader)(WADLevel &, WADEntry);
 
-      //
-      // TODO: Make this use STD functional
-      //
-      typedef void (WAD::*read_function_)(WADLevel &, WADEntry);
-      std::map<std::string, read_function_> level_lump_names_ {
+    // Map each possible LUMP name which belongs to a level to the corresponding function to read it
+    static const std::map<std::string, LevelLumpReader> & level_lump_readers()
+    {
+      static const std::map<std::string, LevelLumpReader> kReaders {
         {"THINGS", &WAD::read_level_things},
         {"LINEDEFS", &WAD::read_level_linedefs},
         {"SIDEDEFS", &WAD::read_level_sidedefs},
@@ -879,27 +1446,61 @@ class WAD
         {"BLOCKMAP", &WAD::read_level_blockmap},
       };
 
-      for (auto e : m_lump_map)
+      return kReaders;
+    }
+
+    void index_levels()
+    {
+      PROFILE_ZONE("WAD::index_levels");
+
+      assert(m_wad_data);
+      assert(m_lump_map.size() != 0);
+      assert(m_directory.size() != 0);
+
+      // DOOM levels have an ExMy label in the directory (where both x and y are single ASCII digits). The label just
+      // indicates that the following LUMPs are part of such level. Actually, the ENTRY for each ExMy does not point to
+      // any LUMP and its size is zero.
+      
+      std::regex level_label_regex_("E[[:digit:]]M[[:digit:]]");
+
+      // A level of a later file replaces the whole level with the same label, the index only keeps its label
+      for (unsigned int i = 0; i < m_directory.size(); ++i)
       {
-        std::string lump_name_ = e.first;
-        unsigned int directory_index_ = e.second;
+        const std::string & crName = m_directory[i].name;
 
-        if (std::regex_match(lump_name_, level_label_regex_))
+        if (m_lump_map[crName] == i && std::regex_match(crName, level_label_regex_))
         {
-          std::cout << "Found level " << lump_name_ << "\n";
+          LOG_DEBUG("Found level", { { "level", crName } });
+          m_level_labels[crName] = i;
+          m_level_names.push_back(crName);
+        }
+      }
+    }
+
+    unsigned int level_label(const std::string & crName) const
+    {
+      auto label_ = m_level_labels.find(crName);
 
-          WADLevel level_;
-          level_.name = lump_name_;
+      if (label_ == m_level_labels.end())
+        throw std::runtime_error("Could not find level " + crName);
 
-          while(level_lump_names_.find(m_directory[++directory_index_].name) != level_lump_names_.end())
-          {
-            WADEntry entry_ = m_directory[directory_index_];
-            (this->*(level_lump_names_[entry_.name]))(level_, entry_);
-          }
+      return label_->second;
+    }
 
-          m_levels.push_back(level_);
-        }
+    WADLevel read_level(const std::string & crName)
+    {
+      PROFILE_ZONE("WAD::read_level");
+
+      WADLevel level_;
+      level_.name = crName;
+
+      for (const WADEntry & crEntry : level_lumps(crName))
+      {
+        if (crEntry.name != crName)
+          (this->*(level_lump_readers().at(crEntry.name)))(level_, crEntry);
       }
+
+      return level_;
     }
 
 		unsigned int m_offset;
@@ -907,11 +1508,22 @@ class WAD
 
 		WADHeader m_wad_header;
 		std::vector<WADEntry> m_directory;
-		std::map<std::string, unsigned int> m_lump_map; 
+		std::unordered_map<std::string, unsigned int> m_lump_map;
+		std::vector<uint64_t> m_lump_hashes;
+    std::vector<unsigned int> m_sprite_lumps;
+    std::vector<unsigned int> m_flat_lumps;
 		std::vector<std::vector<WADPaletteColor>> m_palettes;
     std::vector<std::vector<uint8_t>> m_colormaps;
-    std::map<std::string, WADSprite> m_sprites;
-    std::vector<WADLevel> m_levels;
+    std::map<std::string, std::shared_ptr<const WADSprite>> m_sprites;
+    std::vector<std::string> m_patch_names;
+    std::map<std::string, WADTexture> m_textures;
+    std::map<std::string, std::vector<uint8_t>> m_flats;
+    std::map<std::string, uint64_t> m_flat_hashes;
+    std::map<std::string, WADSound> m_sounds;
+    std::map<std::string, WADEntry> m_music;
+    std::map<std::string, unsigned int> m_level_labels;
+    std::vector<std::string> m_level_names;
+    std::map<std::string, WADLevel> m_levels;
 };
 
 #endif
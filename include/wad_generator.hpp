@@ -0,0 +1,539 @@
+#ifndef WAD_GENERATOR_HPP_
+#define WAD_GENERATOR_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "level_geometry.hpp"
+#include "wad.hpp"
+#include "wad_writer.hpp"
+
+// Builds synthetic WADs of any size for scaling tests, the shareware levels are too small to show how the
+// loaders and the renderer behave at the limits of the format. The level is a grid of square rooms, one
+// sector each with its own floor, ceiling and light, opened into each other with two-sided lines so
+// everything can be seen and walked. Its NODES split the grid in halves down to one subsector per room and
+// its BLOCKMAP lists every line in the blocks it touches, so the BSP walk, the collision checks and the
+// sight lines work on it like on a level built by a node builder.
+//
+// The file is self-contained, with the palettes, colormaps, flats, patches, textures and sprites the WAD
+// class and the renderer need, and everything goes through WADLevel and WADWriter::add_level like real
+// levels do. The format limits what can be asked for: vertices, lines, sides, segs and sectors are 16-bit
+// indices, subsectors and nodes 15-bit ones, coordinates fit in a short and the blocklists must start in
+// the first 64K words of the BLOCKMAP. Rooms take four segs, so a grid has at most 16383 of them and about
+// 32K lines. Extra sectors no line uses raise the count to 65535 for a REJECT table of the maximum size.
+
+const unsigned int kSyntheticPatchSize = 128;
+const unsigned int kSyntheticPatches = 8;
+const unsigned int kSyntheticBlockSize = 128;
+
+struct SyntheticWADOptions
+{
+  std::string m_level_name = "E1M1";
+
+  // Rooms of the grid and their side in map units
+  unsigned int m_columns = 32;
+  unsigned int m_rows = 32;
+  unsigned int m_cell_size = 128;
+
+  // Sectors after the ones of the rooms that no line references, they only grow SECTORS and REJECT
+  unsigned int m_extra_sectors = 0;
+
+  // Zombiemen spread over the rooms, the player starts in the first one
+  unsigned int m_monsters = 64;
+
+  // Sprites besides the zombieman, square and m_sprite_size pixels wide
+  unsigned int m_sprites = 0;
+  unsigned int m_sprite_size = 64;
+
+  // Wall textures, the lines take them in turn, square and made of 128x128 patches
+  unsigned int m_textures = 4;
+  unsigned int m_texture_size = 128;
+};
+
+// small is a level of about the size of E1M1, lines has the most lines a grid fits and sectors the same
+// grid with a REJECT of 65535x65535 (512 MiB), sprites and textures stress the picture decoding and the
+// texture compositing with a small level
+inline SyntheticWADOptions synthetic_preset(const std::string & crName)
+{
+  SyntheticWADOptions options_;
+
+  if (crName == "small")
+    return options_;
+
+  if (crName == "lines" || crName == "sectors")
+  {
+    options_.m_columns = 127;
+    options_.m_rows = 128;
+    options_.m_cell_size = 32;
+    options_.m_monsters = 1024;
+
+    if (crName == "sectors")
+      options_.m_extra_sectors = 65535 - options_.m_columns * options_.m_rows;
+  }
+  else if (crName == "sprites")
+  {
+    options_.m_columns = options_.m_rows = 16;
+    options_.m_monsters = 255;
+    options_.m_sprites = 4096;
+  }
+  else if (crName == "textures")
+  {
+    options_.m_columns = options_.m_rows = 16;
+    options_.m_cell_size = 256;
+    options_.m_textures = 16;
+    options_.m_texture_size = 2048;
+  }
+  else
+    throw std::runtime_error("Failed to generate WAD, unknown preset " + crName + "!");
+
+  return options_;
+}
+
+// Lines are listed in every block their bounding box overlaps that they actually cross
+inline void build_blockmap(WADLevel & rLevel)
+{
+  if (rLevel.vertices.empty())
+    throw std::runtime_error("Failed to build the BLOCKMAP of " + rLevel.name + ", it has no vertices!");
+
+  int min_x_ = rLevel.vertices[0].x, max_x_ = min_x_;
+  int min_y_ = rLevel.vertices[0].y, max_y_ = min_y_;
+
+  for (const WADLevelVertex & crVertex : rLevel.vertices)
+  {
+    min_x_ = std::min<int>(min_x_, crVertex.x);
+    max_x_ = std::max<int>(max_x_, crVertex.x);
+    min_y_ = std::min<int>(min_y_, crVertex.y);
+    max_y_ = std::max<int>(max_y_, crVertex.y);
+  }
+
+  WADLevelBlockmap & rBlockmap = rLevel.blockmap;
+  rBlockmap.x = min_x_;
+  rBlockmap.y = min_y_;
+  rBlockmap.num_cols = (max_x_ - min_x_) / kSyntheticBlockSize + 1;
+  rBlockmap.num_rows = (max_y_ - min_y_) / kSyntheticBlockSize + 1;
+  std::vector<std::vector<unsigned short>> blocklists_(rBlockmap.num_cols * rBlockmap.num_rows);
+
+  for (size_t i = 0; i < rLevel.linedefs.size(); ++i)
+  {
+    const WADLevelVertex & crFrom = rLevel.vertices[rLevel.linedefs[i].from];
+    const WADLevelVertex & crTo = rLevel.vertices[rLevel.linedefs[i].to];
+
+    int first_col_ = (std::min(crFrom.x, crTo.x) - min_x_) / kSyntheticBlockSize;
+    int last_col_ = (std::max(crFrom.x, crTo.x) - min_x_) / kSyntheticBlockSize;
+    int first_row_ = (std::min(crFrom.y, crTo.y) - min_y_) / kSyntheticBlockSize;
+    int last_row_ = (std::max(crFrom.y, crTo.y) - min_y_) / kSyntheticBlockSize;
+
+    for (int row = first_row_; row <= last_row_; ++row)
+    {
+      for (int col = first_col_; col <= last_col_; ++col)
+      {
+        // Diagonal lines only go in the blocks with corners on both sides of them
+        if (crFrom.x != crTo.x && crFrom.y != crTo.y)
+        {
+          double x0_ = min_x_ + col * (double)kSyntheticBlockSize, x1_ = x0_ + kSyntheticBlockSize;
+          double y0_ = min_y_ + row * (double)kSyntheticBlockSize, y1_ = y0_ + kSyntheticBlockSize;
+          double dx_ = crTo.x - crFrom.x, dy_ = crTo.y - crFrom.y;
+          int sides_ = 0;
+
+          for (double x : { x0_, x1_ })
+            for (double y : { y0_, y1_ })
+              sides_ |= (line_side(crFrom.x, crFrom.y, dx_, dy_, x, y) > 0.0) ? 1 : 2;
+
+          if (sides_ != 3)
+            continue;
+        }
+
+        blocklists_[row * rBlockmap.num_cols + col].push_back(i);
+      }
+    }
+  }
+
+  rBlockmap.offsets.assign(1, 0);
+  rBlockmap.lines.clear();
+
+  for (const std::vector<unsigned short> & crBlocklist : blocklists_)
+  {
+    rBlockmap.lines.insert(rBlockmap.lines.end(), crBlocklist.begin(), crBlocklist.end());
+    rBlockmap.offsets.push_back(rBlockmap.lines.size());
+  }
+}
+
+// The grid of rooms with its things, lines, sides, segs, subsectors, nodes, sectors and BLOCKMAP. REJECT is
+// left empty, which add_level writes as a table where no sector is rejected.
+inline WADLevel generate_level(const SyntheticWADOptions & crOptions)
+{
+  const unsigned int columns_ = crOptions.m_columns, rows_ = crOptions.m_rows, size_ = crOptions.m_cell_size;
+  const size_t cells_ = (size_t)columns_ * rows_;
+  const size_t vertices_ = (size_t)(columns_ + 1) * (rows_ + 1);
+  const size_t horizontal_ = (size_t)columns_ * (rows_ + 1);
+  const size_t lines_ = horizontal_ + (size_t)(columns_ + 1) * rows_;
+  const size_t sides_ = 2 * lines_ - 2 * (columns_ + rows_);
+
+  if (cells_ == 0)
+    throw std::runtime_error("Failed to generate level " + crOptions.m_level_name + ", it has no rooms!");
+
+  if (cells_ * 4 > 0xFFFF || vertices_ > 0xFFFF || lines_ > 0xFFFF || sides_ > 0xFFFF)
+    throw std::runtime_error("Failed to generate level " + crOptions.m_level_name + ", it has more segs, vertices, lines or sides than 16 bits index!");
+
+  if (cells_ + crOptions.m_extra_sectors > 0xFFFF)
+    throw std::runtime_error("Failed to generate level " + crOptions.m_level_name + ", it has more sectors than 16 bits index!");
+
+  if ((size_t)columns_ * size_ > 0xFFFF || (size_t)rows_ * size_ > 0xFFFF || size_ < 32)
+    throw std::runtime_error("Failed to generate level " + crOptions.m_level_name + ", its rooms are smaller than 32 units or do not fit in 16-bit coordinates!");
+
+  if (crOptions.m_monsters >= cells_)
+    throw std::runtime_error("Failed to generate level " + crOptions.m_level_name + ", it needs a room for each monster and the player!");
+
+  WADLevel level_;
+  level_.name = crOptions.m_level_name;
+
+  // Centered on the origin to make the most of the coordinates
+  const int origin_x_ = -(int)(columns_ * size_ / 2);
+  const int origin_y_ = -(int)(rows_ * size_ / 2);
+
+  auto vertex_ = [columns_](unsigned int col, unsigned int row) { return (unsigned short)(row * (columns_ + 1) + col); };
+  auto cell_ = [columns_](unsigned int col, unsigned int row) { return (unsigned short)(row * columns_ + col); };
+
+  level_.vertices.reserve(vertices_);
+  for (unsigned int row = 0; row <= rows_; ++row)
+    for (unsigned int col = 0; col <= columns_; ++col)
+      level_.vertices.push_back({ (short)(origin_x_ + (int)(col * size_)), (short)(origin_y_ + (int)(row * size_)) });
+
+  // Floors step at most 24 units between neighbours, so every room can be walked into
+  level_.sectors.reserve(cells_ + crOptions.m_extra_sectors);
+  for (unsigned int row = 0; row < rows_; ++row)
+  {
+    for (unsigned int col = 0; col < columns_; ++col)
+    {
+      short floor_ = ((col + 2 * row) % 4) * 8;
+      short ceiling_ = 160 + (col % 3) * 16;
+      unsigned short light_ = 128 + ((col * 5 + row * 3) % 8) * 16;
+      level_.sectors.push_back({ floor_, ceiling_, "SYNFLOOR", "SYNCEIL", light_, 0, 0 });
+    }
+  }
+
+  for (unsigned int i = 0; i < crOptions.m_extra_sectors; ++i)
+    level_.sectors.push_back({ 0, 128, "SYNFLOOR", "SYNCEIL", 160, 0, 0 });
+
+  // Lines go around the grid with the room they belong to on their right (front) side, the room across
+  // on the back. Horizontal lines come first, row by row, then the vertical ones column by column.
+  level_.linedefs.reserve(lines_);
+  level_.sidedefs.reserve(sides_);
+
+  auto add_line_ = [&level_, &crOptions](unsigned short from, unsigned short to, unsigned short front, int back) {
+    std::string texture_ = "SYNW" + std::to_string(1000 + level_.linedefs.size() % crOptions.m_textures).substr(1);
+    unsigned short front_side_ = level_.sidedefs.size();
+    unsigned short back_side_ = 0xFFFF;
+
+    if (back < 0)
+      level_.sidedefs.push_back({ 0, 0, "-", "-", texture_, front });
+    else
+    {
+      level_.sidedefs.push_back({ 0, 0, texture_, texture_, "-", front });
+      back_side_ = level_.sidedefs.size();
+      level_.sidedefs.push_back({ 0, 0, texture_, texture_, "-", (unsigned short)back });
+    }
+
+    // Blocking when one-sided, two-sided otherwise
+    unsigned short flags_ = (back < 0) ? 0x0001 : 0x0004;
+    level_.linedefs.push_back({ from, to, flags_, 0, 0, front_side_, back_side_ });
+  };
+
+  for (unsigned int row = 0; row <= rows_; ++row)
+  {
+    for (unsigned int col = 0; col < columns_; ++col)
+    {
+      if (row == 0)
+        add_line_(vertex_(col + 1, 0), vertex_(col, 0), cell_(col, 0), -1);
+      else
+        add_line_(vertex_(col, row), vertex_(col + 1, row), cell_(col, row - 1), (row < rows_) ? cell_(col, row) : -1);
+    }
+  }
+
+  for (unsigned int col = 0; col <= columns_; ++col)
+  {
+    for (unsigned int row = 0; row < rows_; ++row)
+    {
+      if (col == columns_)
+        add_line_(vertex_(col, row + 1), vertex_(col, row), cell_(col - 1, row), -1);
+      else
+        add_line_(vertex_(col, row), vertex_(col, row + 1), cell_(col, row), (col > 0) ? cell_(col - 1, row) : -1);
+    }
+  }
+
+  // Every room is one subsector with four segs going clockwise, left, top, right and bottom, so the room
+  // is on their right. Direction 1 means the seg runs against its line, on its back side.
+  auto horizontal_line_ = [columns_](unsigned int col, unsigned int row) { return (unsigned short)(row * columns_ + col); };
+  auto vertical_line_ = [rows_, horizontal_](unsigned int col, unsigned int row) { return (unsigned short)(horizontal_ + col * rows_ + row); };
+
+  level_.segs.reserve(cells_ * 4);
+  level_.ssectors.reserve(cells_);
+
+  for (unsigned int row = 0; row < rows_; ++row)
+  {
+    for (unsigned int col = 0; col < columns_; ++col)
+    {
+      level_.ssectors.push_back({ 4, (unsigned short)level_.segs.size() });
+
+      level_.segs.push_back({ vertex_(col, row), vertex_(col, row + 1), 0x4000, vertical_line_(col, row), 0, 0 });
+      level_.segs.push_back({ vertex_(col, row + 1), vertex_(col + 1, row + 1), 0x0000, horizontal_line_(col, row + 1), 0, 0 });
+      level_.segs.push_back({ vertex_(col + 1, row + 1), vertex_(col + 1, row), 0xC000, vertical_line_(col + 1, row), (unsigned short)((col + 1 < columns_) ? 1 : 0), 0 });
+      level_.segs.push_back({ vertex_(col + 1, row), vertex_(col, row), 0x8000, horizontal_line_(col, row), (unsigned short)((row > 0) ? 1 : 0), 0 });
+    }
+  }
+
+  // Halves the longest side of a block of rooms until one is left, children before their parent so the
+  // root ends up last. Vertical partitions point up and have the right half on their right (front) side,
+  // horizontal ones point right and have the bottom half there.
+  level_.nodes.reserve(cells_ - 1);
+
+  std::function<unsigned short(unsigned int, unsigned int, unsigned int, unsigned int)> build_node_;
+  build_node_ = [&](unsigned int col0, unsigned int row0, unsigned int col1, unsigned int row1) -> unsigned short {
+    if (col1 - col0 == 1 && row1 - row0 == 1)
+      return cell_(col0, row0) | LEVEL_SUBSECTOR_FLAG;
+
+    auto x_ = [&](unsigned int col) { return (short)(origin_x_ + (int)(col * size_)); };
+    auto y_ = [&](unsigned int row) { return (short)(origin_y_ + (int)(row * size_)); };
+
+    WADLevelNode node_;
+
+    if (col1 - col0 >= row1 - row0)
+    {
+      unsigned int middle_ = (col0 + col1) / 2;
+      node_ = { x_(middle_), y_(row0), 0, (short)size_,
+                y_(row1), y_(row0), x_(middle_), x_(col1),
+                y_(row1), y_(row0), x_(col0), x_(middle_), 0, 0 };
+      node_.right_child = build_node_(middle_, row0, col1, row1);
+      node_.left_child = build_node_(col0, row0, middle_, row1);
+    }
+    else
+    {
+      unsigned int middle_ = (row0 + row1) / 2;
+      node_ = { x_(col0), y_(middle_), (short)size_, 0,
+                y_(middle_), y_(row0), x_(col0), x_(col1),
+                y_(row1), y_(middle_), x_(col0), x_(col1), 0, 0 };
+      node_.right_child = build_node_(col0, row0, col1, middle_);
+      node_.left_child = build_node_(col0, middle_, col1, row1);
+    }
+
+    level_.nodes.push_back(node_);
+    return level_.nodes.size() - 1;
+  };
+
+  build_node_(0, 0, columns_, rows_);
+
+  // The player looks north from the first room, the monsters take the rest evenly
+  auto center_ = [&](size_t cell) {
+    return std::make_pair((short)(origin_x_ + (int)((cell % columns_) * size_ + size_ / 2)),
+                          (short)(origin_y_ + (int)((cell / columns_) * size_ + size_ / 2)));
+  };
+
+  level_.things.reserve(crOptions.m_monsters + 1);
+  level_.things.push_back({ center_(0).first, center_(0).second, 90, 1, 7 });
+
+  for (unsigned int i = 0; i < crOptions.m_monsters; ++i)
+  {
+    auto position_ = center_(1 + i * (cells_ - 1) / crOptions.m_monsters);
+    level_.things.push_back({ position_.first, position_.second, 270, 3004, 7 });
+  }
+
+  build_blockmap(level_);
+
+  return level_;
+}
+
+// A picture lump with a single post per column, pixels given by column and row
+template <typename Pixel>
+std::vector<uint8_t> synthetic_picture(unsigned int width, unsigned int height, short leftOffset, short topOffset, Pixel pixel)
+{
+  std::vector<uint8_t> picture_(8 + width * 4 + width * (height + 5));
+  uint8_t * pData = picture_.data();
+
+  auto put_ = [&pData](uint32_t value, unsigned int bytes) {
+    for (unsigned int i = 0; i < bytes; ++i)
+      *pData++ = (value >> (i * 8)) & 0xFF;
+  };
+
+  put_(width, 2);
+  put_(height, 2);
+  put_((unsigned short)leftOffset, 2);
+  put_((unsigned short)topOffset, 2);
+
+  for (unsigned int x = 0; x < width; ++x)
+    put_(8 + width * 4 + x * (height + 5), 4);
+
+  for (unsigned int x = 0; x < width; ++x)
+  {
+    put_(0, 1);
+    put_(height, 1);
+    put_(0, 1);
+
+    for (unsigned int y = 0; y < height; ++y)
+      put_(pixel(x, y), 1);
+
+    put_(0, 1);
+    put_(0xFF, 1);
+  }
+
+  return picture_;
+}
+
+// Writes a PWAD with the generated level and everything it needs, which works as an IWAD on its own
+inline void generate_wad(const SyntheticWADOptions & crOptions, const std::string & crFilename)
+{
+  if (crOptions.m_textures == 0 || crOptions.m_texture_size == 0 || crOptions.m_texture_size % kSyntheticPatchSize != 0 || crOptions.m_texture_size > 8192)
+    throw std::runtime_error("Failed to generate WAD " + crFilename + ", textures must be made of 128x128 patches and at most 8192 wide!");
+
+  if (crOptions.m_textures > 1000 || crOptions.m_sprites > 26 * 26 * 26)
+    throw std::runtime_error("Failed to generate WAD " + crFilename + ", it has more textures or sprites than names for them!");
+
+  if (crOptions.m_sprite_size == 0 || crOptions.m_sprite_size > 254)
+    throw std::runtime_error("Failed to generate WAD " + crFilename + ", sprites must take one post per column!");
+
+  WADLevel level_ = generate_level(crOptions);
+  WADWriter writer_(crFilename, "PWAD");
+
+  // 16 hues with 16 shades each, the later palettes turn to red like the pain palettes do
+  const uint8_t kHues[16][3] = {
+    { 255, 255, 255 }, { 255, 64, 64 }, { 64, 255, 64 }, { 64, 64, 255 }, { 255, 255, 64 }, { 255, 64, 255 },
+    { 64, 255, 255 }, { 255, 160, 64 }, { 160, 96, 48 }, { 128, 160, 128 }, { 160, 128, 160 }, { 96, 96, 160 },
+    { 200, 180, 140 }, { 120, 200, 80 }, { 200, 80, 120 }, { 128, 128, 128 } };
+
+  std::vector<uint8_t> palettes_;
+  palettes_.reserve(14 * 256 * 3);
+
+  for (unsigned int p = 0; p < 14; ++p)
+    for (unsigned int i = 0; i < 256; ++i)
+      for (unsigned int c = 0; c < 3; ++c)
+      {
+        unsigned int value_ = kHues[i / 16][c] * (i % 16 + 1) / 16;
+        unsigned int tint_ = (c == 0) ? 255 : 0;
+        palettes_.push_back((value_ * (14 - p) + tint_ * p / 2) / (14 + p / 2));
+      }
+
+  writer_.add("PLAYPAL", std::move(palettes_));
+
+  // 32 light levels darken the shade within the hue, then the invulnerability map and a black one
+  std::vector<uint8_t> colormaps_;
+  colormaps_.reserve(34 * 256);
+
+  for (unsigned int m = 0; m < 34; ++m)
+    for (unsigned int i = 0; i < 256; ++i)
+      colormaps_.push_back((m < 32) ? (i / 16) * 16 + (i % 16) * (32 - m) / 32 : (m == 32) ? 240 + i % 16 : 0);
+
+  writer_.add("COLORMAP", std::move(colormaps_));
+
+  writer_.add_level(level_);
+  writer_.flush();
+
+  // The zombieman of the monsters and the extra sprites, with the origin at their feet
+  writer_.add("S_START", nullptr, 0);
+
+  unsigned int sprite_size_ = crOptions.m_sprite_size;
+  writer_.add("POSSA0", synthetic_picture(sprite_size_, sprite_size_, sprite_size_ / 2, sprite_size_, [](unsigned int x, unsigned int y) {
+    return 16 * 7 + ((x / 4 + y / 4) % 2) * 8 + 7;
+  }));
+
+  for (unsigned int i = 0; i < crOptions.m_sprites; ++i)
+  {
+    char name_[9];
+    snprintf(name_, sizeof(name_), "S%c%c%cA0", 'A' + i / 676, 'A' + (i / 26) % 26, 'A' + i % 26);
+
+    // The first pixels hold the index, so no two sprites are the same lump and all of them get decoded
+    writer_.add(name_, synthetic_picture(sprite_size_, sprite_size_, sprite_size_ / 2, sprite_size_, [i](unsigned int x, unsigned int y) {
+      if (x == 0 && y < 2)
+        return (i >> (y * 8)) & 0xFF;
+
+      return ((i + x / 8 + y / 8) % 16) * 16 + 8 + (x + y) % 8;
+    }));
+  }
+
+  writer_.add("S_END", nullptr, 0);
+
+  // Patches of bricks in different hues, the textures tile them
+  std::vector<uint8_t> pnames_ { kSyntheticPatches, 0, 0, 0 };
+
+  for (unsigned int p = 0; p < kSyntheticPatches; ++p)
+  {
+    std::string name_ = "SYNP" + std::to_string(1000 + p).substr(1);
+    writer_.add(name_, synthetic_picture(kSyntheticPatchSize, kSyntheticPatchSize, 0, 0, [p](unsigned int x, unsigned int y) {
+      bool mortar_ = (y % 16 == 0) || ((x + (y / 16 % 2) * 16) % 32 == 0);
+      return (p + 1) * 16 + (mortar_ ? 4 : 10 + (x * 7 + y * 3) % 5);
+    }));
+
+    name_.resize(WAD_ENTRY_NAME_LENGTH, '\0');
+    pnames_.insert(pnames_.end(), name_.begin(), name_.end());
+  }
+
+  writer_.add("PNAMES", std::move(pnames_));
+
+  // TEXTURE1 is the count, the offsets to the definitions and the definitions, see read_texture_lump
+  unsigned int tiles_ = crOptions.m_texture_size / kSyntheticPatchSize;
+  unsigned int definition_size_ = 22 + tiles_ * tiles_ * 10;
+  std::vector<uint8_t> textures_;
+  textures_.reserve(4 + crOptions.m_textures * (4 + definition_size_));
+
+  auto put_ = [&textures_](uint32_t value, unsigned int bytes) {
+    for (unsigned int i = 0; i < bytes; ++i)
+      textures_.push_back((value >> (i * 8)) & 0xFF);
+  };
+
+  put_(crOptions.m_textures, 4);
+  for (unsigned int t = 0; t < crOptions.m_textures; ++t)
+    put_(4 + crOptions.m_textures * 4 + t * definition_size_, 4);
+
+  for (unsigned int t = 0; t < crOptions.m_textures; ++t)
+  {
+    std::string name_ = "SYNW" + std::to_string(1000 + t).substr(1);
+    name_.resize(WAD_ENTRY_NAME_LENGTH, '\0');
+    textures_.insert(textures_.end(), name_.begin(), name_.end());
+
+    put_(0, 4);
+    put_(crOptions.m_texture_size, 2);
+    put_(crOptions.m_texture_size, 2);
+    put_(0, 4);
+    put_(tiles_ * tiles_, 2);
+
+    for (unsigned int y = 0; y < tiles_; ++y)
+    {
+      for (unsigned int x = 0; x < tiles_; ++x)
+      {
+        put_(x * kSyntheticPatchSize, 2);
+        put_(y * kSyntheticPatchSize, 2);
+        put_((t + x + y) % kSyntheticPatches, 2);
+        put_(1, 2);
+        put_(0, 2);
+      }
+    }
+  }
+
+  writer_.add("TEXTURE1", std::move(textures_));
+
+  // Raw 64x64 flats, a checkerboard floor and a plain ceiling
+  writer_.add("F_START", nullptr, 0);
+
+  std::vector<uint8_t> floor_(WAD_FLAT_SIZE * WAD_FLAT_SIZE), ceiling_(WAD_FLAT_SIZE * WAD_FLAT_SIZE);
+  for (unsigned int i = 0; i < floor_.size(); ++i)
+  {
+    floor_[i] = 8 * 16 + (((i % WAD_FLAT_SIZE) / 16 + i / (WAD_FLAT_SIZE * 16)) % 2) * 4 + 8;
+    ceiling_[i] = 15 * 16 + 10 + (i % 3);
+  }
+
+  writer_.add("SYNFLOOR", std::move(floor_));
+  writer_.add("SYNCEIL", std::move(ceiling_));
+  writer_.add("F_END", nullptr, 0);
+
+  writer_.finish();
+
+  std::cout << "Generated " << level_.name << " with " << level_.linedefs.size() << " linedefs, " << level_.sectors.size()
+            << " sectors, " << level_.things.size() << " things, " << crOptions.m_sprites + 1 << " sprites and "
+            << crOptions.m_textures << " textures of " << crOptions.m_texture_size << "x" << crOptions.m_texture_size << "\n";
+}
+
+#endif
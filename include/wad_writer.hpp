@@ -0,0 +1,512 @@
+#ifndef WAD_WRITER_HPP_
+#define WAD_WRITER_HPP_
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "hash.hpp"
+#include "wad.hpp"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Writes IWAD and PWAD files from spans of lump data. Lumps are not copied, the writer keeps pointers to
+// the caller's bytes (e.g., straight into a mounted WAD) and hands them to writev in batches, so the data
+// goes from where it already is to the file. The directory is written last and the header, which points
+// to it, after that.
+//
+// Byte-identical lumps are only written once, later directory entries point to the offset of the first
+// copy. Everything goes to a temporary file that only replaces the destination when finished, so a PWAD
+// can be rebuilt in place from itself.
+//
+// Spans must stay valid until the next flush (or until finish). Streaming builds flush after each batch
+// of lumps to release them, the writer also flushes by itself every kMaxPendingBytes. Lumps built on the
+// fly (e.g., the ones add_level encodes) are handed over instead and kept by the writer until then.
+class WADWriter
+{
+  public:
+
+    static const size_t kMaxPendingBytes = 64 << 20;
+
+    WADWriter(const std::string & crFilename, const std::string & crType = "PWAD")
+      : m_filename(crFilename), m_temporary_filename(crFilename + ".tmp"), m_type(crType)
+    {
+      if (m_type != "IWAD" && m_type != "PWAD")
+        throw std::runtime_error("Failed to create WAD " + crFilename + ", unknown type " + crType + "!");
+
+      m_file = ::open(m_temporary_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+      if (m_file < 0)
+        throw std::runtime_error("Failed to create WAD " + m_temporary_filename + "!");
+
+      // Room for the header, it is only known at the end
+      m_end = m_written = 12;
+
+      if (::lseek(m_file, m_written, SEEK_SET) < 0)
+        fail();
+    }
+
+    ~WADWriter()
+    {
+      if (m_read_file >= 0)
+        ::close(m_read_file);
+
+      // A writer that was never finished leaves the destination untouched
+      if (m_file >= 0)
+      {
+        ::close(m_file);
+        std::remove(m_temporary_filename.c_str());
+      }
+    }
+
+    WADWriter(const WADWriter &) = delete;
+    WADWriter & operator=(const WADWriter &) = delete;
+
+    // Appends a lump to the directory, markers and level labels are lumps without data
+    void add(const std::string & crName, const uint8_t * pData, size_t size)
+    {
+      if (crName.empty() || crName.size() > WAD_ENTRY_NAME_LENGTH)
+        throw std::runtime_error("Failed to add lump " + crName + ", names take 1 to 8 characters!");
+
+      if (size > 0xFFFFFFFFu)
+        throw std::runtime_error("Failed to add lump " + crName + ", it is too large!");
+
+      WADEntry entry_ { (unsigned int)m_end, (unsigned int)size, crName };
+
+      if (size != 0)
+      {
+        uint64_t hash_ = hash64(pData, size);
+        int64_t same_ = find(hash_, pData, size);
+
+        if (same_ >= 0)
+        {
+          entry_.offset = same_;
+          m_deduplicated += size;
+        }
+        else
+        {
+          m_unique.push_back({ m_end, size, pData });
+          m_unique_map.emplace(hash_, m_unique.size() - 1);
+          m_pending.push_back({ (void *)pData, size });
+          m_pending_bytes += size;
+          m_end += size;
+        }
+      }
+
+      if (m_end > 0xFFFFFFFFu)
+        throw std::runtime_error("Failed to add lump " + crName + ", the WAD would be larger than 4 GiB!");
+
+      m_directory.push_back(entry_);
+
+      if (m_pending_bytes >= kMaxPendingBytes || m_pending.size() >= IOV_MAX)
+        flush();
+    }
+
+    void add(const std::string & crName, const std::vector<uint8_t> & crData)
+    {
+      add(crName, crData.data(), crData.size());
+    }
+
+    // The writer owns these bytes until they are flushed, moving the vector keeps its data where it is
+    void add(const std::string & crName, std::vector<uint8_t> && rrData)
+    {
+      m_owned.push_back(std::move(rrData));
+      add(crName, m_owned.back().data(), m_owned.back().size());
+    }
+
+    // Appends the label of a level and its lumps encoded from the parsed structures, the inverse of
+    // WAD::level. An empty REJECT is written as a table where no sector is rejected.
+    void add_level(const WADLevel & crLevel)
+    {
+      add(crLevel.name, nullptr, 0);
+
+      LumpEncoder things_(crLevel.things.size() * 10);
+      for (const WADLevelThing & crThing : crLevel.things)
+      {
+        things_.put(crThing.x);
+        things_.put(crThing.y);
+        things_.put(crThing.angle);
+        things_.put(crThing.type);
+        things_.put(crThing.options);
+      }
+      add("THINGS", std::move(things_.m_data));
+
+      LumpEncoder linedefs_(crLevel.linedefs.size() * 14);
+      for (const WADLevelLinedef & crLinedef : crLevel.linedefs)
+      {
+        linedefs_.put(crLinedef.from);
+        linedefs_.put(crLinedef.to);
+        linedefs_.put(crLinedef.flags);
+        linedefs_.put(crLinedef.types);
+        linedefs_.put(crLinedef.tag);
+        linedefs_.put(crLinedef.right_sidedef);
+        linedefs_.put(crLinedef.left_sidedef);
+      }
+      add("LINEDEFS", std::move(linedefs_.m_data));
+
+      LumpEncoder sidedefs_(crLevel.sidedefs.size() * 30);
+      for (const WADLevelSidedef & crSidedef : crLevel.sidedefs)
+      {
+        sidedefs_.put(crSidedef.x_offset);
+        sidedefs_.put(crSidedef.y_offset);
+        sidedefs_.put_name(crSidedef.upper_texture);
+        sidedefs_.put_name(crSidedef.lower_texture);
+        sidedefs_.put_name(crSidedef.middle_texture);
+        sidedefs_.put(crSidedef.sector);
+      }
+      add("SIDEDEFS", std::move(sidedefs_.m_data));
+
+      LumpEncoder vertices_(crLevel.vertices.size() * 4);
+      for (const WADLevelVertex & crVertex : crLevel.vertices)
+      {
+        vertices_.put(crVertex.x);
+        vertices_.put(crVertex.y);
+      }
+      add("VERTEXES", std::move(vertices_.m_data));
+
+      LumpEncoder segs_(crLevel.segs.size() * 12);
+      for (const WADLevelSeg & crSeg : crLevel.segs)
+      {
+        segs_.put(crSeg.start);
+        segs_.put(crSeg.end);
+        segs_.put(crSeg.angle);
+        segs_.put(crSeg.linedef);
+        segs_.put(crSeg.direction);
+        segs_.put(crSeg.offset);
+      }
+      add("SEGS", std::move(segs_.m_data));
+
+      LumpEncoder ssectors_(crLevel.ssectors.size() * 4);
+      for (const WADLevelSubSector & crSubSector : crLevel.ssectors)
+      {
+        ssectors_.put(crSubSector.num_segs);
+        ssectors_.put(crSubSector.start_seg);
+      }
+      add("SSECTORS", std::move(ssectors_.m_data));
+
+      LumpEncoder nodes_(crLevel.nodes.size() * 28);
+      for (const WADLevelNode & crNode : crLevel.nodes)
+      {
+        for (short value : { crNode.x_start, crNode.y_start, crNode.dx, crNode.dy,
+                             crNode.right_y_upper, crNode.right_y_lower, crNode.right_x_lower, crNode.right_x_upper,
+                             crNode.left_y_upper, crNode.left_y_lower, crNode.left_x_lower, crNode.left_x_upper })
+          nodes_.put(value);
+
+        nodes_.put(crNode.right_child);
+        nodes_.put(crNode.left_child);
+      }
+      add("NODES", std::move(nodes_.m_data));
+
+      LumpEncoder sectors_(crLevel.sectors.size() * 26);
+      for (const WADLevelSector & crSector : crLevel.sectors)
+      {
+        sectors_.put(crSector.floor_height);
+        sectors_.put(crSector.ceiling_height);
+        sectors_.put_name(crSector.floor_texture);
+        sectors_.put_name(crSector.ceiling_texture);
+        sectors_.put(crSector.light_level);
+        sectors_.put(crSector.special);
+        sectors_.put(crSector.tag);
+      }
+      add("SECTORS", std::move(sectors_.m_data));
+
+      // One bit per pair of sectors, the level keeps them packed like the lump so they are written as they
+      // are, padded with zeroes up to the whole table
+      size_t sectors_count_ = crLevel.sectors.size();
+      std::vector<uint8_t> reject_((sectors_count_ * sectors_count_ + 7) / 8, 0);
+
+      if (!crLevel.reject.empty())
+        memcpy(reject_.data(), crLevel.reject.bits.get(), std::min(reject_.size(), crLevel.reject.size));
+
+      add("REJECT", std::move(reject_));
+
+      add("BLOCKMAP", encode_blockmap(crLevel));
+    }
+
+    // Writes the lumps added so far, after this their spans are not used anymore
+    void flush()
+    {
+      write_spans(m_pending);
+
+      m_pending.clear();
+      m_pending_bytes = 0;
+
+      for (size_t i = m_first_pending_unique; i < m_unique.size(); ++i)
+        m_unique[i].m_data = nullptr;
+
+      m_first_pending_unique = m_unique.size();
+      m_owned.clear();
+    }
+
+    // Writes what is left, the directory and the header, and moves the file in place
+    void finish()
+    {
+      flush();
+
+      // The directory has one 16-byte entry for every lump, the offset, the size and the name padded with
+      // zeroes, like read_directory expects
+      std::vector<uint8_t> directory_(m_directory.size() * 16, 0);
+
+      for (size_t i = 0; i < m_directory.size(); ++i)
+      {
+        uint8_t * pEntry = directory_.data() + i * 16;
+        write_uint(pEntry, m_directory[i].offset);
+        write_uint(pEntry + 4, m_directory[i].size);
+        memcpy(pEntry + 8, m_directory[i].name.data(), m_directory[i].name.size());
+      }
+
+      uint64_t directory_offset_ = m_written;
+      std::vector<iovec> spans_ { { directory_.data(), directory_.size() } };
+      write_spans(spans_);
+
+      uint8_t header_[12];
+      memcpy(header_, m_type.data(), 4);
+      write_uint(header_ + 4, m_directory.size());
+      write_uint(header_ + 8, directory_offset_);
+
+      if (::pwrite(m_file, header_, sizeof(header_), 0) != (ssize_t)sizeof(header_))
+        fail();
+
+      if (m_read_file >= 0)
+      {
+        ::close(m_read_file);
+        m_read_file = -1;
+      }
+
+      if (::close(m_file) != 0)
+      {
+        m_file = -1;
+        std::remove(m_temporary_filename.c_str());
+        throw std::runtime_error("Failed to write WAD " + m_filename + "!");
+      }
+
+      m_file = -1;
+
+      if (std::rename(m_temporary_filename.c_str(), m_filename.c_str()) != 0)
+      {
+        std::remove(m_temporary_filename.c_str());
+        throw std::runtime_error("Failed to write WAD " + m_filename + "!");
+      }
+
+      std::cout << "Wrote " << m_directory.size() << " lumps (" << m_written << " bytes, "
+                << m_deduplicated << " deduplicated) to " << m_filename << "\n";
+    }
+
+  private:
+
+    struct UniqueLump
+    {
+      uint64_t m_offset;
+      size_t m_size;
+
+      // Still the caller's span until it is flushed, then only the file has the bytes
+      const uint8_t * m_data;
+    };
+
+    // Little-endian fields one after the other, names padded with zeroes to 8 characters
+    struct LumpEncoder
+    {
+      LumpEncoder(size_t size)
+      {
+        m_data.reserve(size);
+      }
+
+      void put(unsigned short value)
+      {
+        m_data.push_back(value & 0xFF);
+        m_data.push_back(value >> 8);
+      }
+
+      void put(short value)
+      {
+        put((unsigned short)value);
+      }
+
+      void put_name(const std::string & crName)
+      {
+        for (size_t i = 0; i < WAD_ENTRY_NAME_LENGTH; ++i)
+          m_data.push_back((i < crName.size()) ? crName[i] : 0);
+      }
+
+      std::vector<uint8_t> m_data;
+    };
+
+    // Header, one offset per block and the blocklists, blocks with the same lines share one list. Offsets
+    // are 16-bit word offsets, so a map whose lists start past the first 128 KiB cannot be written.
+    static std::vector<uint8_t> encode_blockmap(const WADLevel & crLevel)
+    {
+      const WADLevelBlockmap & crBlockmap = crLevel.blockmap;
+      size_t blocks_ = crBlockmap.blocks();
+
+      std::vector<unsigned short> words_ { (unsigned short)crBlockmap.x, (unsigned short)crBlockmap.y, crBlockmap.num_cols, crBlockmap.num_rows };
+      words_.resize(4 + blocks_);
+
+      std::map<std::vector<unsigned short>, size_t> lists_;
+
+      for (size_t i = 0; i < blocks_; ++i)
+      {
+        std::vector<unsigned short> blocklist_(crBlockmap.lines.begin() + crBlockmap.offsets[i], crBlockmap.lines.begin() + crBlockmap.offsets[i + 1]);
+        auto inserted_ = lists_.emplace(blocklist_, words_.size());
+
+        if (inserted_.first->second > 0xFFFF)
+          throw std::runtime_error("Failed to add the BLOCKMAP of " + crLevel.name + ", its blocklists do not fit in 16-bit offsets!");
+
+        words_[4 + i] = (unsigned short)inserted_.first->second;
+
+        if (inserted_.second)
+        {
+          words_.push_back(0);
+          words_.insert(words_.end(), blocklist_.begin(), blocklist_.end());
+          words_.push_back(0xFFFF);
+        }
+      }
+
+      LumpEncoder blockmap_(words_.size() * 2);
+      for (unsigned short word : words_)
+        blockmap_.put(word);
+
+      return std::move(blockmap_.m_data);
+    }
+
+    static void write_uint(uint8_t * pDst, uint32_t value)
+    {
+      pDst[0] = value & 0xFF;
+      pDst[1] = (value >> 8) & 0xFF;
+      pDst[2] = (value >> 16) & 0xFF;
+      pDst[3] = (value >> 24) & 0xFF;
+    }
+
+    // Offset of an earlier lump with the same bytes, -1 if there is none. Equal hashes are confirmed by
+    // comparing the bytes, from the span while pending or read back from the file once written.
+    int64_t find(uint64_t hash, const uint8_t * pData, size_t size)
+    {
+      auto range_ = m_unique_map.equal_range(hash);
+
+      for (auto it = range_.first; it != range_.second; ++it)
+      {
+        const UniqueLump & crLump = m_unique[it->second];
+
+        if (crLump.m_size != size)
+          continue;
+
+        if (crLump.m_data != nullptr)
+        {
+          if (memcmp(crLump.m_data, pData, size) == 0)
+            return crLump.m_offset;
+
+          continue;
+        }
+
+        m_read_back.resize(size);
+
+        if (::pread(read_descriptor(), m_read_back.data(), size, crLump.m_offset) == (ssize_t)size &&
+            memcmp(m_read_back.data(), pData, size) == 0)
+          return crLump.m_offset;
+      }
+
+      return -1;
+    }
+
+    // The output is write-only, written lumps are compared through a second descriptor
+    int read_descriptor()
+    {
+      if (m_read_file < 0)
+        m_read_file = ::open(m_temporary_filename.c_str(), O_RDONLY);
+
+      return m_read_file;
+    }
+
+    // writev in batches of at most IOV_MAX spans, resuming after partial writes
+    void write_spans(std::vector<iovec> & rSpans)
+    {
+      size_t first_ = 0;
+
+      while (first_ < rSpans.size())
+      {
+        int count_ = (int)std::min<size_t>(rSpans.size() - first_, IOV_MAX);
+        ssize_t written_ = ::writev(m_file, rSpans.data() + first_, count_);
+
+        if (written_ < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          fail();
+        }
+
+        m_written += written_;
+
+        while (first_ < rSpans.size() && (size_t)written_ >= rSpans[first_].iov_len)
+          written_ -= rSpans[first_++].iov_len;
+
+        if (written_ > 0)
+        {
+          rSpans[first_].iov_base = (uint8_t *)rSpans[first_].iov_base + written_;
+          rSpans[first_].iov_len -= written_;
+        }
+      }
+    }
+
+    [[noreturn]] void fail()
+    {
+      ::close(m_file);
+      m_file = -1;
+      std::remove(m_temporary_filename.c_str());
+      throw std::runtime_error("Failed to write WAD " + m_filename + "!");
+    }
+
+    std::string m_filename;
+    std::string m_temporary_filename;
+    std::string m_type;
+    int m_file = -1;
+    int m_read_file = -1;
+
+    std::vector<WADEntry> m_directory;
+
+    // Lumps handed over to the writer, until the next flush
+    std::vector<std::vector<uint8_t>> m_owned;
+
+    // Lumps waiting for the next flush
+    std::vector<iovec> m_pending;
+    size_t m_pending_bytes = 0;
+
+    // Every distinct lump written or pending, by hash
+    std::vector<UniqueLump> m_unique;
+    std::unordered_multimap<uint64_t, size_t> m_unique_map;
+    size_t m_first_pending_unique = 0;
+    std::vector<uint8_t> m_read_back;
+
+    // End of the data written to the file and end including the pending lumps
+    uint64_t m_written;
+    uint64_t m_end;
+    uint64_t m_deduplicated = 0;
+};
+
+// Writes the merged directory of the mounted WADs into a single file. The lumps go straight from the
+// mounted data, in directory order, without the gaps and duplicated bytes the original files may have.
+inline void write_wad(const WAD & crWad, const std::string & crFilename, const std::string & crType = "PWAD")
+{
+  WADWriter writer_(crFilename, crType);
+
+  for (const WADEntry & crEntry : crWad.directory())
+    writer_.add(crEntry.name, crWad.lump_data(crEntry), crEntry.size);
+
+  writer_.finish();
+}
+
+#endif
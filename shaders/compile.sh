@@ -1,2 +1,4 @@
 $VULKAN_SDK/bin/glslangValidator -V shader.vert
 $VULKAN_SDK/bin/glslangValidator -V shader.frag
+$VULKAN_SDK/bin/glslangValidator -V level.vert -o level_vert.spv
+$VULKAN_SDK/bin/glslangValidator -V level.frag -o level_frag.spv
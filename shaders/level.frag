@@ -0,0 +1,21 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 1) uniform sampler2DArray texSampler;
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragLayer;
+layout(location = 3) flat in vec2 fragTextureSize;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+    // Texture coordinates come in texels, wrap them inside the texture and then scale them to the
+    // layer since smaller textures only cover the top-left corner of it
+    vec2 layerSize = vec2(textureSize(texSampler, 0).xy);
+    vec2 uv = fract(fragTexCoord / fragTextureSize) * fragTextureSize / layerSize;
+
+    outColor = vec4(texture(texSampler, vec3(uv, float(fragLayer))).rgb * fragColor, 1.0);
+}
@@ -0,0 +1,38 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+  mat4 model;
+  mat4 view;
+  mat4 proj;
+} ubo;
+
+// Texture of every surface, indexed by the draw (each indirect command uses its index as firstInstance)
+layout(std430, set = 0, binding = 2) readonly buffer SurfaceTextures {
+  uint surfaceTextures[];
+};
+
+// Size in texels (xy) and layer in its texture array (z) of every level texture
+layout(std430, set = 0, binding = 3) readonly buffer TextureInfos {
+  vec4 textureInfos[];
+};
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragLayer;
+layout(location = 3) flat out vec2 fragTextureSize;
+
+void main()
+{
+    uint textureIndex = surfaceTextures[gl_InstanceIndex];
+
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    fragColor = inColor;
+    fragTexCoord = inTexCoord;
+    fragLayer = uint(textureInfos[textureIndex].z);
+    fragTextureSize = textureInfos[textureIndex].xy;
+}
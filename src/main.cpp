@@ -1,17 +1,83 @@
 #include <iostream>
+#include <string>
 
 #include "application.hpp"
 #include "wad.hpp"
 
 #define WAD_FILENAME "doom1.wad"
 
-int main(void)
+int main(int argc, char** argv)
 {
 	//WAD wad_(WAD_FILENAME);
 	//std::cout << wad_;
 
-	Application app_;
+	ApplicationOptions options_;
+	options_.m_wad_filename = WAD_FILENAME;
+
+	// -headless renders offscreen without a window, -frames sets how many frames are rendered and
+	// -capture N writes every Nth frame as a PPM (e.g., for golden image comparisons). -level renders
+	// the given map (e.g., E1M1) of the WAD selected with -wad instead of the test quad (-file mounts
+	// the PWADs that follow it over that IWAD, -levelcache keeps parsed levels in the given directory)
+	// and -software renders that map headless on the CPU instead of with Vulkan (-threads sets how
+	// many threads share the screen, all the hardware threads by default). Only -software runs the game,
+	// at 35 tics per second: -simthread simulates them in a thread of their own and -timedemo runs a tic
+	// per frame as fast as possible. -playdemo plays a demo (a DEMO lump or an .lmp file) on its level,
+	// -norender only simulates it and -benchmark writes the timings as JSON to the given file. These are
+	// software-only, the Vulkan renderer refuses them.
+	// -exportmusic writes the music of the WADs as MIDI files to the given directory and exits, -profile
+	// writes the profiler zones as a Chrome trace to the given file (builds with DOOMFS_PROFILE only) and
+	// -log writes the log events, e.g., the lumps read and how long they took, as JSON lines to the given file
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg_ = argv[i];
+
+		if (arg_ == "-headless")
+			options_.m_headless = true;
+		else if (arg_ == "-frames" && i + 1 < argc)
+			options_.m_frames = std::stoi(argv[++i]);
+		else if (arg_ == "-capture" && i + 1 < argc)
+			options_.m_capture_interval = std::stoi(argv[++i]);
+		else if (arg_ == "-width" && i + 1 < argc)
+			options_.m_width = std::stoi(argv[++i]);
+		else if (arg_ == "-height" && i + 1 < argc)
+			options_.m_height = std::stoi(argv[++i]);
+		else if (arg_ == "-wad" && i + 1 < argc)
+			options_.m_wad_filename = argv[++i];
+		else if (arg_ == "-file")
+		{
+			while (i + 1 < argc && argv[i + 1][0] != '-')
+				options_.m_pwad_filenames.push_back(argv[++i]);
+		}
+		else if (arg_ == "-level" && i + 1 < argc)
+			options_.m_level_name = argv[++i];
+		else if (arg_ == "-levelcache" && i + 1 < argc)
+			options_.m_level_cache_directory = argv[++i];
+		else if (arg_ == "-exportmusic" && i + 1 < argc)
+			options_.m_music_directory = argv[++i];
+		else if (arg_ == "-software")
+			options_.m_software = true;
+		else if (arg_ == "-threads" && i + 1 < argc)
+			options_.m_software_threads = std::stoi(argv[++i]);
+		else if (arg_ == "-simthread")
+			options_.m_simulation_thread = true;
+		else if (arg_ == "-timedemo")
+			options_.m_timedemo = true;
+		else if (arg_ == "-playdemo" && i + 1 < argc)
+			options_.m_demo = argv[++i];
+		else if (arg_ == "-norender")
+			options_.m_render = false;
+		else if (arg_ == "-benchmark" && i + 1 < argc)
+			options_.m_benchmark_filename = argv[++i];
+		else if (arg_ == "-profile" && i + 1 < argc)
+			options_.m_profile_filename = argv[++i];
+		else if (arg_ == "-log" && i + 1 < argc)
+			options_.m_log_filename = argv[++i];
+		else
+			std::cerr << "WARNING: Ignoring unknown argument " << arg_ << "\n";
+	}
+
+	Application app_(options_);
 	app_.run();
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.hpp"
+#include "software_renderer.hpp"
+#include "wad.hpp"
+#include "wad_generator.hpp"
+
+// Headless check of the software renderer: every column kernel, with one thread and with several, has to
+// draw exactly the same frames. The level is the small synthetic one of wad_generator.hpp, generated next
+// to the test so it runs without any WAD, and it is looked at from its start all around and at sizes
+// that do not split evenly into strips. Returns non-zero on the first frame that differs.
+//
+// doomfs_render_test [--preset PRESET] [--threads N]
+
+struct RenderSetup
+{
+	ColumnKernel m_kernel;
+	unsigned int m_threads;
+};
+
+// Frames of the whole turn, back to back
+std::vector<uint8_t> render_turn(const WAD & crWad, const WADLevel & crLevel, const RenderSetup & crSetup, unsigned int width, unsigned int height)
+{
+	const unsigned int kAngles = 32;
+
+	SoftwareRenderer renderer_(crWad, crLevel, crSetup.m_threads);
+	renderer_.set_column_kernel(crSetup.m_kernel);
+
+	SoftwareFramebuffer framebuffer_(width, height);
+	RenderView view_ = renderer_.start_view();
+	std::vector<uint8_t> frames_;
+
+	for (unsigned int i = 0; i < kAngles; ++i)
+	{
+		view_.m_angle = i * 2.0f * kPi / kAngles;
+		renderer_.render(view_, framebuffer_);
+		frames_.insert(frames_.end(), framebuffer_.m_pixels.begin(), framebuffer_.m_pixels.end());
+	}
+
+	return frames_;
+}
+
+int main(int argc, char** argv)
+{
+	std::string preset_ = "small";
+	unsigned int threads_ = std::max(std::thread::hardware_concurrency(), 4u);
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg_ = argv[i];
+
+		if (arg_ == "--preset" && i + 1 < argc)
+			preset_ = argv[++i];
+		else if (arg_ == "--threads" && i + 1 < argc)
+			threads_ = std::stoi(argv[++i]);
+		else
+			std::cerr << "WARNING: Ignoring unknown argument " << arg_ << "\n";
+	}
+
+	Logger::instance().set_level(LogLevel::Warning);
+
+	SyntheticWADOptions options_ = synthetic_preset(preset_);
+	std::string filename_ = "render_test_" + preset_ + ".wad";
+	generate_wad(options_, filename_);
+
+	WAD wad_(filename_, false);
+	WADLevel level_ = wad_.level(options_.m_level_name);
+
+	// Only the kernels this machine runs, the detected one is the widest
+	std::vector<ColumnKernel> kernels_ { ColumnKernel::kScalar };
+	if (detect_column_kernel() != ColumnKernel::kScalar)
+		kernels_.push_back(ColumnKernel::kSSE2);
+	if (detect_column_kernel() == ColumnKernel::kAVX2)
+		kernels_.push_back(ColumnKernel::kAVX2);
+
+	std::vector<RenderSetup> setups_;
+	for (ColumnKernel kernel : kernels_)
+		for (unsigned int threads : { 1u, threads_ })
+			setups_.push_back({ kernel, threads });
+
+	const std::pair<unsigned int, unsigned int> kSizes[] = { { 320, 200 }, { 637, 401 } };
+	bool failed_ = false;
+
+	for (const auto & crSize : kSizes)
+	{
+		// The scalar kernel on a single thread is the reference
+		std::vector<uint8_t> reference_ = render_turn(wad_, level_, setups_[0], crSize.first, crSize.second);
+
+		for (size_t s = 1; s < setups_.size(); ++s)
+		{
+			std::vector<uint8_t> frames_ = render_turn(wad_, level_, setups_[s], crSize.first, crSize.second);
+			auto mismatch_ = std::mismatch(reference_.begin(), reference_.end(), frames_.begin());
+
+			std::cout << crSize.first << "x" << crSize.second << " " << column_kernel_name(setups_[s].m_kernel) << " "
+			          << setups_[s].m_threads << " threads: ";
+
+			if (mismatch_.first == reference_.end())
+			{
+				std::cout << "identical\n";
+				continue;
+			}
+
+			size_t pixel_ = mismatch_.first - reference_.begin();
+			size_t frame_size_ = crSize.first * crSize.second;
+
+			std::cout << "differs\n";
+			std::cerr << "ERROR: Frame " << pixel_ / frame_size_ << " differs from the scalar single thread one at ("
+			          << pixel_ % frame_size_ % crSize.first << ", " << pixel_ % frame_size_ / crSize.first << ")\n";
+			failed_ = true;
+		}
+	}
+
+	return failed_ ? 1 : 0;
+}